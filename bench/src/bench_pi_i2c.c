@@ -0,0 +1,2476 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Benchmark the pi_i2c protocol engine on any Linux machine by running it
+// against the simulated bus backend. Bus delays advance the simulator's
+// virtual clock instead of sleeping, so the CPU time measured here is the
+// cost of the engine itself (bit shifting, line control, bookkeeping).
+//
+// Achieved SCL frequency is modelled as SCL cycles over the time a real bus
+// would take: the delays the engine asked for plus the CPU time spent in
+// between them.
+
+// Include C standard libraries:
+#include <stdlib.h> // C Standard library
+#include <stdio.h>  // C Standard I/O libary
+#include <string.h> // C Standard string manipulation libary
+#include <stdint.h> // C Standard integer types (GPIO registers)
+#include <time.h>   // C Standard date and time manipulation
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <pthread.h>  // POSIX threads (pi_lw_gpio call path)
+#include <sys/mman.h> // Memory management (GPIO register stand-in)
+#include <unistd.h>   // POSIX usleep
+#include <poll.h>     // Wait for presence events
+
+#include <pi_i2c.h> // Pi I2C library!
+
+#define SIM_SDA_PIN 2
+#define SIM_SCL_PIN 3
+
+#define DEVICE_ADDRESS 0x1C
+#define MISSING_ADDRESS 0x2A
+
+// Batch benchmark: reads per batch and the one addressing nobody:
+#define BATCH_READS 24
+#define BATCH_MISSING 5
+
+// Requests kept in flight on the asynchronous bus:
+#define ASYNC_DEPTH 64
+
+// Threads polling the same register at the same time:
+#define COALESCE_THREADS 4
+#define COALESCE_REGISTER 0x40
+
+// Line accesses are counted by wrapping the backend under test. On the
+// gpiochip backend every line access is exactly one ioctl:
+static const struct pi_i2c_gpio_backend *counted_backend;
+static unsigned long long num_line_accesses;
+
+// Error the wrapped backend fails line reads with (0 to pass them on):
+static int line_read_error;
+
+static int counting_open(void **ctx, unsigned int sda, unsigned int scl,
+                         void *arg) {
+    return counted_backend->open(ctx, sda, scl, arg);
+}
+
+static void counting_close(void *ctx) {
+    counted_backend->close(ctx);
+}
+
+static void counting_clear_line(void *ctx, unsigned int gpio) {
+    num_line_accesses++;
+    counted_backend->clear_line(ctx, gpio);
+}
+
+static void counting_release_line(void *ctx, unsigned int gpio) {
+    num_line_accesses++;
+    counted_backend->release_line(ctx, gpio);
+}
+
+static int counting_read_line(void *ctx, unsigned int gpio) {
+    num_line_accesses++;
+    return line_read_error ? line_read_error :
+                             counted_backend->read_line(ctx, gpio);
+}
+
+static void counting_delay_us(void *ctx, unsigned int us) {
+    counted_backend->delay_us(ctx, us);
+}
+
+static void counting_delay_ns(void *ctx, unsigned int ns) {
+    counted_backend->delay_ns(ctx, ns);
+}
+
+static int counting_read_lines(void *ctx) {
+    num_line_accesses++;
+    return line_read_error ? line_read_error :
+                             counted_backend->read_lines(ctx);
+}
+
+// Build a counting wrapper around a backend. Without batching the engine
+// falls back to one access per line:
+static void wrap_backend(struct pi_i2c_gpio_backend *counting,
+                         const struct pi_i2c_gpio_backend *backend,
+                         int batch) {
+    counted_backend = backend;
+
+    counting->open = counting_open;
+    counting->close = counting_close;
+    counting->clear_line = counting_clear_line;
+    counting->release_line = counting_release_line;
+    counting->read_line = counting_read_line;
+    counting->delay_us = counting_delay_us;
+    counting->read_lines = (batch && backend->read_lines) ?
+                           counting_read_lines : NULL;
+    counting->delay_ns = backend->delay_ns ? counting_delay_ns : NULL;
+}
+
+// Seconds of CPU time consumed by this thread:
+static double cpu_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return (double) now.tv_sec + 1.0e-9 * now.tv_nsec;
+}
+
+// Write a pattern, read it back and scan; any mismatch fails the benchmark
+static int check_sim_bus(struct pi_i2c_bus *bus, unsigned char *registers) {
+    int i;
+    int ret;
+
+    int write_data[4] = {0xDE, 0xAD, 0xBE, 0xEF};
+    int read_data[4];
+    int address_book[128] = {0};
+
+    printf("Checking engine against simulated bus\n");
+
+    if ((ret = write_i2c_bus(bus, DEVICE_ADDRESS, 0x10, write_data, 4)) < 0) {
+        printf("Error! write_i2c_bus() returned %d\n", ret);
+        return -1;
+    }
+
+    if ((ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x10, read_data, 4)) < 0) {
+        printf("Error! read_i2c_bus() returned %d\n", ret);
+        return -1;
+    }
+
+    for (i = 0; i < 4; i++) {
+        if ((read_data[i] != write_data[i]) ||
+            (registers[0x10 + i] != write_data[i])) {
+            printf("Error! byte %d wrote 0x%X, read 0x%X\n", i,
+                   write_data[i], read_data[i]);
+            return -1;
+        }
+    }
+
+    if ((ret = read_i2c_bus(bus, DEVICE_ADDRESS + 1, 0x10, read_data, 1)) !=
+        -ENACK) {
+        printf("Error! read from absent device returned %d\n", ret);
+        return -1;
+    }
+
+    if ((ret = scan_i2c_bus(bus, address_book)) < 0) {
+        printf("Error! scan_i2c_bus() returned %d\n", ret);
+        return -1;
+    }
+
+    for (i = 0; i < 128; i++) {
+        if (address_book[i] != (i == DEVICE_ADDRESS)) {
+            printf("Error! scan reported 0x%X as %d\n", i, address_book[i]);
+            return -1;
+        }
+    }
+
+    printf("Check complete\n");
+
+    return 0;
+}
+
+// Read through a backend whose line reads fail and check that the read
+// returns the backend's error rather than a bus error made up from the
+// level taken in its place, that it is counted, and that the bus works
+// again once the backend does
+static int check_line_errors(struct pi_i2c_sim *sim) {
+    struct pi_i2c_gpio_backend counting;
+    struct pi_i2c_statistics statistics;
+    struct pi_i2c_bus *bus;
+
+    int data;
+    int ret;
+
+    wrap_backend(&counting, &pi_i2c_sim_backend, 1);
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &counting,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    line_read_error = -EIO;
+    ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x10, &data, 1);
+    line_read_error = 0;
+
+    statistics = get_statistics_i2c_bus(bus);
+
+    if ((ret != -EIO) || (statistics.num_line_errors == 0) ||
+        (statistics.last_line_error != -EIO)) {
+        printf("Error! read with failing line reads returned %d (%d "
+               "counted)\n", ret, statistics.num_line_errors);
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    if ((ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x10, &data, 1)) < 0) {
+        printf("Error! read after line errors returned %d\n", ret);
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    printf("Failed line reads returned as %d (%d counted)\n", -EIO,
+           statistics.num_line_errors);
+
+    free_i2c_bus(bus);
+
+    return 0;
+}
+
+// Block read by bench_byte_buffers():
+#define BLOCK_BYTES 128
+
+// Write a block through a byte buffer and read it back through byte and
+// int buffers, then compare CPU time per block read into each
+static int bench_byte_buffers(struct pi_i2c_bus *bus,
+                              unsigned char *registers, int iterations) {
+    uint8_t write_bytes[BLOCK_BYTES];
+    uint8_t read_bytes[BLOCK_BYTES];
+    int read_ints[BLOCK_BYTES];
+
+    double cpu_bytes;
+    double cpu_ints;
+    double start;
+
+    int i;
+    int ret;
+
+    for (i = 0; i < BLOCK_BYTES; i++) {
+        write_bytes[i] = 0xFF - i;
+    }
+
+    if ((ret = write_bytes_i2c_bus(bus, DEVICE_ADDRESS, 0x00, write_bytes,
+                                   BLOCK_BYTES)) < 0) {
+        printf("Error! write_bytes_i2c_bus() returned %d\n", ret);
+        return -1;
+    }
+
+    if (((ret = read_bytes_i2c_bus(bus, DEVICE_ADDRESS, 0x00, read_bytes,
+                                   BLOCK_BYTES)) < 0) ||
+        ((ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x00, read_ints,
+                             BLOCK_BYTES)) < 0)) {
+        printf("Error! block read returned %d\n", ret);
+        return -1;
+    }
+
+    for (i = 0; i < BLOCK_BYTES; i++) {
+        if ((registers[i] != write_bytes[i]) ||
+            (read_bytes[i] != write_bytes[i]) ||
+            (read_ints[i] != write_bytes[i])) {
+            printf("Error! byte %d wrote 0x%02X, read 0x%02X and 0x%02X\n",
+                   i, write_bytes[i], read_bytes[i], read_ints[i]);
+            return -1;
+        }
+    }
+
+    start = cpu_time();
+
+    for (i = 0; i < iterations; i++) {
+        read_i2c_bus(bus, DEVICE_ADDRESS, 0x00, read_ints, BLOCK_BYTES);
+    }
+
+    cpu_ints = (cpu_time() - start) / iterations;
+    start = cpu_time();
+
+    for (i = 0; i < iterations; i++) {
+        read_bytes_i2c_bus(bus, DEVICE_ADDRESS, 0x00, read_bytes,
+                           BLOCK_BYTES);
+    }
+
+    cpu_bytes = (cpu_time() - start) / iterations;
+
+    printf("read %d bytes into ints:  %9.1f ns CPU/transaction, %4zu byte "
+           "buffer\n", BLOCK_BYTES, cpu_ints * 1e9, sizeof(read_ints));
+    printf("read %d bytes into bytes: %9.1f ns CPU/transaction, %4zu byte "
+           "buffer\n", BLOCK_BYTES, cpu_bytes * 1e9, sizeof(read_bytes));
+
+    return 0;
+}
+
+// Run read or write transactions and report CPU cost per SCL cycle (bit)
+static int bench_transfer(struct pi_i2c_bus *bus, struct pi_i2c_sim *sim,
+                          int write, int n_bytes, int iterations) {
+    int i;
+    int ret;
+
+    int data[256];
+
+    double start;
+    double run_time;
+
+    struct pi_i2c_sim_statistics before;
+    struct pi_i2c_sim_statistics after;
+
+    struct pi_i2c_statistics bus_before;
+    struct pi_i2c_statistics bus_after;
+
+    unsigned long long cycles;
+
+    double bus_time;
+    float scl_hz = get_configs_i2c_bus(bus).scl_actual_clock_frequency_hz;
+
+    for (i = 0; i < n_bytes; i++) {
+        data[i] = i & 0xFF;
+    }
+
+    bus_before = get_statistics_i2c_bus(bus);
+    before = get_statistics_sim_i2c(sim);
+    start = cpu_time();
+
+    for (i = 0; i < iterations; i++) {
+        if (write) {
+            ret = write_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, n_bytes);
+        } else {
+            ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, n_bytes);
+        }
+
+        if (ret < 0) {
+            printf("Error! transfer returned %d\n", ret);
+            return -1;
+        }
+    }
+
+    run_time = cpu_time() - start;
+    after = get_statistics_sim_i2c(sim);
+    bus_after = get_statistics_i2c_bus(bus);
+
+    cycles = after.num_scl_cycles - before.num_scl_cycles;
+
+    printf("%s %3d bytes x %d: %8.1f ns CPU/transaction, "
+           "%6.1f ns CPU/bit, %5.2f line writes/byte, "
+           "%5.2f line reads/byte\n",
+           write ? "write" : "read ", n_bytes, iterations,
+           run_time * 1e9 / iterations, run_time * 1e9 / cycles,
+           (double) (after.num_line_writes - before.num_line_writes) /
+               ((double) iterations * n_bytes),
+           (double) (after.num_line_reads - before.num_line_reads) /
+               ((double) iterations * n_bytes));
+
+    bus_time = (after.bus_time_ns - before.bus_time_ns) * 1e-9;
+
+    printf("      SCL achieved %6.1f kHz, %5.1f%% of "
+           "scl_actual_clock_frequency_hz (%.1f kHz)\n",
+           cycles / bus_time * 1e-3, 100.0 * cycles / bus_time / scl_hz,
+           scl_hz * 1e-3);
+
+    if (get_configs_i2c_bus(bus).timing_mode == I2C_TIMING_DEADLINE) {
+        printf("      %.2f late edges/transaction, worst %d ns late\n",
+               (double) (bus_after.num_late_edges -
+                         bus_before.num_late_edges) / iterations,
+               bus_after.max_edge_lateness_ns);
+    }
+
+    return 0;
+}
+
+// Count line reads left out thanks to the shadow of the lines for short
+// transfers and a scan, checking every clock pulse for stretching and none
+static int bench_reads_avoided(struct pi_i2c_sim *sim) {
+    int policies[] = {I2C_STRETCH_EVERY_BIT, I2C_STRETCH_NEVER};
+    const char *names[] = {"every bit", "never"};
+    const char *transfers[] = {"read 1 byte", "write 1 byte", "scan"};
+
+    int data[1] = {0x5A};
+    int address_book[128];
+
+    struct pi_i2c_sim_statistics sim_before;
+    struct pi_i2c_sim_statistics sim_after;
+
+    struct pi_i2c_statistics before;
+    struct pi_i2c_statistics after;
+
+    struct pi_i2c_bus *bus;
+
+    unsigned long long reads;
+    int avoided;
+
+    int i;
+    int j;
+    int ret;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < 2; i++) {
+        set_stretch_policy_i2c_bus(bus, policies[i]);
+
+        for (j = 0; j < 3; j++) {
+            before = get_statistics_i2c_bus(bus);
+            sim_before = get_statistics_sim_i2c(sim);
+
+            if (j == 0) {
+                ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, 1);
+            } else if (j == 1) {
+                ret = write_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, 1);
+            } else {
+                ret = scan_i2c_bus(bus, address_book);
+            }
+
+            if (ret < 0) {
+                printf("Error! transfer returned %d\n", ret);
+                free_i2c_bus(bus);
+                return -1;
+            }
+
+            sim_after = get_statistics_sim_i2c(sim);
+            after = get_statistics_i2c_bus(bus);
+
+            reads = sim_after.num_line_reads - sim_before.num_line_reads;
+            avoided = after.num_line_reads_avoided -
+                      before.num_line_reads_avoided;
+
+            printf("%-12s stretch %-9s: %5llu line reads, %3d avoided "
+                   "(%4.1f%% fewer)\n", transfers[j], names[i], reads,
+                   avoided, 100.0 * avoided / (reads + avoided));
+        }
+    }
+
+    free_i2c_bus(bus);
+
+    return 0;
+}
+
+// Devices on the bus scanned by bench_scan():
+#define SCAN_DEVICES 3
+
+static const unsigned int scan_devices[SCAN_DEVICES] = {DEVICE_ADDRESS, 0x50,
+                                                        0x68};
+static unsigned char scan_registers[256];
+
+// Whether an address map holds exactly the scanned devices in a range
+static int check_address_map(const unsigned long long *address_map,
+                             unsigned int first_address,
+                             unsigned int last_address) {
+    unsigned int address;
+    int expected;
+    int i;
+
+    for (address = 0; address < 128; address++) {
+        expected = 0;
+
+        for (i = 0; i < SCAN_DEVICES; i++) {
+            if ((scan_devices[i] == address) && (address >= first_address) &&
+                (address <= last_address)) {
+                expected = 1;
+            }
+        }
+
+        if ((int) I2C_ADDRESS_PRESENT(address_map, address) != expected) {
+            printf("Error! scan reported 0x%02X as %d\n", address,
+                   (int) I2C_ADDRESS_PRESENT(address_map, address));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Scan a bus with a few devices on it with the address book scan, then with
+// every style of range scan, and compare the bus time each took
+static int bench_scan(void) {
+    const char *names[] = {"message per probe", "repeated STARTs",
+                           "read probes"};
+    int flags[] = {I2C_SCAN_STOP, I2C_SCAN_WRITE, I2C_SCAN_READ};
+
+    unsigned long long address_map[I2C_ADDRESS_MAP_WORDS];
+    unsigned long long mask[I2C_ADDRESS_MAP_WORDS] = {0};
+    int address_book[127];
+
+    struct pi_i2c_statistics before;
+    struct pi_i2c_statistics after;
+
+    struct pi_i2c_sim *sim;
+    struct pi_i2c_bus *bus;
+
+    int i;
+    int ret = 0;
+
+    if ((sim = create_sim_i2c()) == NULL) {
+        printf("Error! create_sim_i2c() failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < SCAN_DEVICES; i++) {
+        add_device_sim_i2c(sim, scan_devices[i], scan_registers);
+    }
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        free_sim_i2c(sim);
+        return -1;
+    }
+
+    if (scan_i2c_bus(bus, address_book) < 0) {
+        printf("Error! scan_i2c_bus() failed\n");
+        ret = -1;
+    } else {
+        printf("address book, 0x00-0x7E       : %8.1f us bus time\n",
+               get_statistics_i2c_bus(bus).last_scan_ns * 1e-3);
+    }
+
+    // Every style over the unreserved addresses:
+    for (i = 0; (i < 3) && (ret == 0); i++) {
+        before = get_statistics_i2c_bus(bus);
+
+        if (((ret = scan_range_i2c_bus(bus, 0x00, 0x7F, NULL, flags[i],
+                                       address_map)) != SCAN_DEVICES) ||
+            (check_address_map(address_map, 0x08, 0x77) < 0)) {
+            printf("Error! %s scan returned %d\n", names[i], ret);
+            ret = -1;
+            break;
+        }
+
+        ret = 0;
+        after = get_statistics_i2c_bus(bus);
+
+        printf("0x08-0x77, %-19s: %8.1f us bus time, %3d STARTs, %3d "
+               "repeated\n", names[i], after.last_scan_ns * 1e-3,
+               after.num_start_cond - before.num_start_cond,
+               after.num_repeated_start_cond -
+               before.num_repeated_start_cond);
+    }
+
+    // A range, then a mask of two of the devices and a missing address:
+    if ((ret == 0) &&
+        ((scan_range_i2c_bus(bus, 0x50, 0x5F, NULL, I2C_SCAN_WRITE,
+                             address_map) != 1) ||
+         (check_address_map(address_map, 0x50, 0x5F) < 0))) {
+        printf("Error! scan of 0x50-0x5F did not find 0x50 alone\n");
+        ret = -1;
+    }
+
+    mask[DEVICE_ADDRESS >> 6] |= 1ULL << (DEVICE_ADDRESS & 0x3F);
+    mask[0x68 >> 6] |= 1ULL << (0x68 & 0x3F);
+    mask[MISSING_ADDRESS >> 6] |= 1ULL << (MISSING_ADDRESS & 0x3F);
+
+    if ((ret == 0) &&
+        ((scan_range_i2c_bus(bus, 0x00, 0x7F, mask, I2C_SCAN_WRITE,
+                             address_map) != 2) ||
+         !I2C_ADDRESS_PRESENT(address_map, DEVICE_ADDRESS) ||
+         !I2C_ADDRESS_PRESENT(address_map, 0x68))) {
+        printf("Error! masked scan did not find its two devices\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        printf("3 masked addresses            : %8.1f us bus time\n",
+               get_statistics_i2c_bus(bus).last_scan_ns * 1e-3);
+    }
+
+    free_i2c_bus(bus);
+    free_sim_i2c(sim);
+
+    return ret;
+}
+
+// Background rescans of bench_presence() and how long to wait for an event:
+#define PRESENCE_INTERVAL_US 500
+#define PRESENCE_WAIT_MS 1000
+
+static unsigned char presence_registers[256];
+
+// Watch handed events by count_presence_event() and what unwatching it from
+// the callback returned:
+static struct pi_i2c_presence *callback_presence;
+static int callback_unwatch_ret;
+
+// Count arrivals and departures handed to a callback, trying (and failing)
+// to stop watching from it on the first arrival:
+static void count_presence_event(unsigned int device_address, int present,
+                                 void *arg) {
+    int *num_events = arg;
+
+    if (device_address == MISSING_ADDRESS) {
+        if (present && (num_events[1] == 0)) {
+            callback_unwatch_ret = unwatch_presence_i2c(callback_presence);
+        }
+
+        __atomic_add_fetch(&num_events[present], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Wait for the next event of a watched bus. Returns milliseconds waited,
+// or -1 if no event (or not the expected one) came
+static double wait_presence_event(struct pi_i2c_presence *presence,
+                                  unsigned int device_address, int present) {
+    struct pollfd fd = {.fd = get_fd_presence_i2c(presence),
+                        .events = POLLIN};
+    struct timespec start;
+    struct timespec end;
+
+    unsigned int event_address;
+    int event_present;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (poll_presence_i2c(presence, &event_address,
+                             &event_present) == -EAGAIN) {
+        if (poll(&fd, 1, PRESENCE_WAIT_MS) <= 0) {
+            return -1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if ((event_address != device_address) || (event_present != present)) {
+        return -1;
+    }
+
+    return (end.tv_sec - start.tv_sec) * 1e3 +
+           (end.tv_nsec - start.tv_nsec) * 1e-6;
+}
+
+// Watch a bus with one device on it, check that a transaction to an empty
+// address fails without touching the bus, then plug a device in and out
+// and time how long the background rescan takes to notice, through the
+// eventfd and through a callback
+static int bench_presence(void) {
+    struct pi_i2c_presence_statistics statistics;
+    struct pi_i2c_sim_statistics sim_before;
+    struct pi_i2c_sim_statistics sim_after;
+
+    struct pi_i2c_presence *presence;
+    struct pi_i2c_batch *batch;
+    struct pi_i2c_sim *sim;
+    struct pi_i2c_bus *bus;
+
+    unsigned long long address_map[I2C_ADDRESS_MAP_WORDS];
+    unsigned long long nack_ns;
+    long long num_fail_fast;
+
+    double arrive_ms;
+    double depart_ms;
+
+    int num_events[2] = {0, 0};
+    int data;
+    int batch_data[2];
+    int i;
+    int ret = 0;
+
+    if ((sim = create_sim_i2c()) == NULL) {
+        printf("Error! create_sim_i2c() failed\n");
+        return -1;
+    }
+
+    add_device_sim_i2c(sim, DEVICE_ADDRESS, presence_registers);
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        free_sim_i2c(sim);
+        return -1;
+    }
+
+    // Bus time of a read NACKed by an empty address:
+    sim_before = get_statistics_sim_i2c(sim);
+    read_i2c_bus(bus, MISSING_ADDRESS, 0x00, &data, 1);
+    sim_after = get_statistics_sim_i2c(sim);
+    nack_ns = sim_after.elapsed_ns - sim_before.elapsed_ns;
+
+    if ((presence = watch_presence_i2c_bus(bus, NULL, 4,
+                                           PRESENCE_INTERVAL_US, NULL,
+                                           NULL)) == NULL) {
+        printf("Error! watch_presence_i2c_bus() failed\n");
+        free_i2c_bus(bus);
+        free_sim_i2c(sim);
+        return -1;
+    }
+
+    if ((get_map_presence_i2c(presence, address_map) != 1) ||
+        !I2C_ADDRESS_PRESENT(address_map, DEVICE_ADDRESS) ||
+        (watch_presence_i2c_bus(bus, NULL, 0, 0, NULL, NULL) != NULL)) {
+        printf("Error! presence map does not hold the device alone\n");
+        ret = -1;
+    }
+
+    // Known empty, so no bus time at all:
+    sim_before = get_statistics_sim_i2c(sim);
+
+    if ((ret == 0) &&
+        (read_i2c_bus(bus, MISSING_ADDRESS, 0x00, &data, 1) != -ENACK)) {
+        printf("Error! read of an empty address did not fail fast\n");
+        ret = -1;
+    }
+
+    sim_after = get_statistics_sim_i2c(sim);
+
+    if ((ret == 0) && (sim_after.elapsed_ns != sim_before.elapsed_ns)) {
+        printf("Error! read of an empty address touched the bus\n");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        printf("read of empty 0x%02X: %8.1f us bus time NACKed, %.1f us "
+               "failed fast\n", MISSING_ADDRESS, nack_ns * 1e-3,
+               (sim_after.elapsed_ns - sim_before.elapsed_ns) * 1e-3);
+    }
+
+    // A batch only fails the descriptor of the empty address, and that
+    // without touching the bus:
+    if ((ret == 0) && ((batch = create_batch_i2c()) != NULL)) {
+        add_read_batch_i2c(batch, DEVICE_ADDRESS, 0x00, &batch_data[0], 1);
+        add_read_batch_i2c(batch, MISSING_ADDRESS, 0x00, &batch_data[1],
+                           1);
+
+        num_fail_fast = get_statistics_presence_i2c(presence).num_fail_fast;
+
+        if ((run_batch_i2c_bus(bus, batch) != 1) ||
+            (get_status_batch_i2c(batch, 0) != 0) ||
+            (get_status_batch_i2c(batch, 1) != -ENACK) ||
+            (get_statistics_presence_i2c(presence).num_fail_fast !=
+             num_fail_fast + 1)) {
+            printf("Error! batch read of an empty address did not fail "
+                   "fast\n");
+            ret = -1;
+        }
+
+        free_batch_i2c(batch);
+    }
+
+    // Hot-plug through the eventfd:
+    if (ret == 0) {
+        add_device_sim_i2c(sim, MISSING_ADDRESS, presence_registers);
+        arrive_ms = wait_presence_event(presence, MISSING_ADDRESS, 1);
+
+        remove_device_sim_i2c(sim, MISSING_ADDRESS);
+        depart_ms = wait_presence_event(presence, MISSING_ADDRESS, 0);
+
+        if ((arrive_ms < 0) || (depart_ms < 0)) {
+            printf("Error! plugging 0x%02X in and out went unnoticed\n",
+                   MISSING_ADDRESS);
+            ret = -1;
+        } else {
+            statistics = get_statistics_presence_i2c(presence);
+
+            printf("device plugged in noticed after %6.2f ms, unplugged "
+                   "after %6.2f ms\n", arrive_ms, depart_ms);
+            printf("      %lld refreshes of 4 addresses every %d us, "
+                   "%.1f us bus time each, %lld put off, %lld failed "
+                   "fast\n", statistics.num_refreshes, PRESENCE_INTERVAL_US,
+                   statistics.last_refresh_ns * 1e-3, statistics.num_busy,
+                   statistics.num_fail_fast);
+        }
+    }
+
+    unwatch_presence_i2c(presence);
+
+    // Hot-plug through a callback:
+    if ((ret == 0) &&
+        ((presence = watch_presence_i2c_bus(bus, NULL, 4,
+                                            PRESENCE_INTERVAL_US,
+                                            count_presence_event,
+                                            num_events)) != NULL)) {
+        callback_presence = presence;
+        add_device_sim_i2c(sim, MISSING_ADDRESS, presence_registers);
+
+        for (i = 0; (i < PRESENCE_WAIT_MS) &&
+                    !__atomic_load_n(&num_events[1], __ATOMIC_SEQ_CST); i++) {
+            usleep(1000);
+        }
+
+        remove_device_sim_i2c(sim, MISSING_ADDRESS);
+
+        for (i = 0; (i < PRESENCE_WAIT_MS) &&
+                    !__atomic_load_n(&num_events[0], __ATOMIC_SEQ_CST); i++) {
+            usleep(1000);
+        }
+
+        if ((unwatch_presence_i2c(presence) != 0) ||
+            (callback_unwatch_ret != -EDEADLK)) {
+            printf("Error! unwatching from the callback returned %d\n",
+                   callback_unwatch_ret);
+            ret = -1;
+        } else if ((num_events[1] != 1) || (num_events[0] != 1)) {
+            printf("Error! callback saw %d arrivals, %d departures\n",
+                   num_events[1], num_events[0]);
+            ret = -1;
+        } else {
+            printf("device plugged in and out: 1 arrival, 1 departure "
+                   "through callback\n");
+        }
+    }
+
+    free_i2c_bus(bus);
+    free_sim_i2c(sim);
+
+    return ret;
+}
+
+// Count line accesses per byte for one kind of transfer with and without
+// batched line access. With a gpiochip path the bus has no devices (e.g. a
+// gpio-sim chip) so only address frames are exercised through a bus scan:
+static int bench_line_accesses(const struct pi_i2c_gpio_backend *backend,
+                               void *backend_arg, unsigned int sda,
+                               unsigned int scl, int write, int n_bytes) {
+    int batch;
+    int ret;
+    int i;
+
+    int simulated = (backend == &pi_i2c_sim_backend);
+    int n_frames;
+
+    int data[256];
+    int address_book[128];
+
+    unsigned long long accesses[2];
+
+    struct pi_i2c_gpio_backend counting;
+    struct pi_i2c_bus *bus;
+
+    for (i = 0; i < n_bytes; i++) {
+        data[i] = i & 0xFF;
+    }
+
+    // Every byte on the bus counts, including address and register frames:
+    if (simulated) {
+        n_frames = n_bytes + (write ? 2 : 3);
+    } else {
+        n_frames = 128;
+    }
+
+    for (batch = 0; batch < 2; batch++) {
+        wrap_backend(&counting, backend, batch);
+
+        if ((bus = config_i2c_bus_backend(sda, scl, I2C_FULL_SPEED,
+                                          &counting, backend_arg)) == NULL) {
+            printf("Error! config_i2c_bus_backend() failed\n");
+            return -1;
+        }
+
+        num_line_accesses = 0;
+
+        if (!simulated) {
+            ret = scan_i2c_bus(bus, address_book);
+        } else if (write) {
+            ret = write_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, n_bytes);
+        } else {
+            ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, n_bytes);
+        }
+
+        free_i2c_bus(bus);
+
+        if (ret < 0) {
+            printf("Error! transfer returned %d\n", ret);
+            return -1;
+        }
+
+        accesses[batch] = num_line_accesses;
+    }
+
+    // Only the idle checks before START and STOP read both lines, so the
+    // saving is per transaction (per probe when scanning), not per byte:
+    printf("%-5s %3d bytes: %6.2f line accesses/byte per-line, "
+           "%6.2f batched, %llu fewer in all\n",
+           !simulated ? "scan" : (write ? "write" : "read"), n_frames,
+           (double) accesses[0] / n_frames, (double) accesses[1] / n_frames,
+           accesses[0] - accesses[1]);
+
+    return 0;
+}
+
+// Run the same read at each speed grade on a fresh simulated bus
+static int bench_speed_grades(struct pi_i2c_sim *sim, unsigned char *registers,
+                              int iterations) {
+    unsigned int speed_grades[] = {I2C_STANDARD_MODE, I2C_FULL_SPEED,
+                                   I2C_FAST_MODE_PLUS};
+
+    struct pi_i2c_configs configs;
+    struct pi_i2c_bus *bus;
+
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < sizeof(speed_grades) / sizeof(speed_grades[0]); i++) {
+        if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                          speed_grades[i],
+                                          &pi_i2c_sim_backend,
+                                          sim)) == NULL) {
+            printf("Error! config_i2c_bus_backend() failed\n");
+            return -1;
+        }
+
+        configs = get_configs_i2c_bus(bus);
+
+        printf("%4u kHz: T_LOW %d ns, T_HIGH %d ns (+ %d ns rise)\n",
+               speed_grades[i] / 1000, configs.scl_t_low_sleep_ns,
+               configs.scl_t_high_sleep_ns, configs.scl_response_time_ns);
+
+        if ((ret = check_sim_bus(bus, registers)) == 0) {
+            ret = bench_transfer(bus, sim, 0, 16, iterations);
+        }
+
+        free_i2c_bus(bus);
+
+        if (ret < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Useful bytes per second of 16 byte reads, modelled on the time a real bus
+// would have taken
+static int bench_bytes_per_second(struct pi_i2c_bus *bus,
+                                  struct pi_i2c_sim *sim, int iterations,
+                                  double *bytes_per_s) {
+    int data[16];
+
+    struct pi_i2c_sim_statistics before;
+    struct pi_i2c_sim_statistics after;
+
+    int i;
+    int ret;
+
+    before = get_statistics_sim_i2c(sim);
+
+    for (i = 0; i < iterations; i++) {
+        if ((ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, 16)) < 0) {
+            printf("Error! read_i2c_bus() returned %d\n", ret);
+            return -1;
+        }
+    }
+
+    after = get_statistics_sim_i2c(sim);
+
+    *bytes_per_s = 16.0 * iterations /
+                   ((after.bus_time_ns - before.bus_time_ns) * 1e-9);
+
+    return 0;
+}
+
+// Compare clock stretching policies at each speed grade. A device stretching
+// after every ACK must still be waited out with the ACK only policy
+static int bench_stretch_policies(struct pi_i2c_sim *sim,
+                                  unsigned char *registers, int iterations) {
+    unsigned int speed_grades[] = {I2C_STANDARD_MODE, I2C_FULL_SPEED,
+                                   I2C_FAST_MODE_PLUS};
+    int policies[] = {I2C_STRETCH_EVERY_BIT, I2C_STRETCH_ACK_ONLY,
+                      I2C_STRETCH_NEVER};
+    const char *names[] = {"every bit", "ACK only", "never"};
+
+    double bytes_per_s[3];
+
+    struct pi_i2c_bus *bus;
+
+    unsigned int i;
+    unsigned int j;
+    int ret = 0;
+
+    for (i = 0; i < sizeof(speed_grades) / sizeof(speed_grades[0]); i++) {
+        if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                          speed_grades[i],
+                                          &pi_i2c_sim_backend,
+                                          sim)) == NULL) {
+            printf("Error! config_i2c_bus_backend() failed\n");
+            return -1;
+        }
+
+        for (j = 0; (j < 3) && (ret == 0); j++) {
+            if (((ret = set_device_stretch_policy_i2c_bus(
+                      bus, DEVICE_ADDRESS, policies[j])) == 0) &&
+                ((ret = check_sim_bus(bus, registers)) == 0)) {
+                ret = bench_bytes_per_second(bus, sim, iterations,
+                                             &bytes_per_s[j]);
+            }
+        }
+
+        if (ret == 0) {
+            for (j = 0; j < 3; j++) {
+                printf("%4u kHz, stretch %-9s: %8.0f bytes/s read "
+                       "(%+5.1f%%)\n", speed_grades[i] / 1000, names[j],
+                       bytes_per_s[j],
+                       100.0 * (bytes_per_s[j] / bytes_per_s[0] - 1.0));
+            }
+        }
+
+        // Byte level stretching is still waited out with ACK only:
+        if (ret == 0) {
+            set_device_stretch_policy_i2c_bus(bus, DEVICE_ADDRESS,
+                                              I2C_STRETCH_ACK_ONLY);
+            set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, 20);
+
+            ret = check_sim_bus(bus, registers);
+
+            set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, 0);
+        }
+
+        free_i2c_bus(bus);
+
+        if (ret < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Run the same transfers on a simulated bus calibrated to its lines
+static int bench_calibrated(struct pi_i2c_sim *sim, unsigned char *registers,
+                            int iterations) {
+    struct pi_i2c_configs configs;
+    struct pi_i2c_bus *bus;
+
+    int ret;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    if ((ret = calibrate_i2c_bus(bus, NULL)) < 0) {
+        printf("Error! calibrate_i2c_bus() returned %d\n", ret);
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    configs = get_configs_i2c_bus(bus);
+
+    printf("Rise %d ns, line access %d ns: T_LOW %d ns, T_HIGH %d ns\n",
+           configs.scl_response_time_ns, configs.line_call_ns,
+           configs.scl_t_low_sleep_ns, configs.scl_t_high_sleep_ns);
+
+    if ((ret = check_sim_bus(bus, registers)) == 0) {
+        if ((bench_transfer(bus, sim, 0, 16, iterations) < 0) ||
+            (bench_transfer(bus, sim, 1, 16, iterations) < 0)) {
+            ret = -1;
+        }
+    }
+
+    free_i2c_bus(bus);
+
+    return ret;
+}
+
+// Report how closely waiting out clock stretching tracks the time a device
+// actually stretched for
+static int bench_stretch(struct pi_i2c_bus *bus, struct pi_i2c_sim *sim,
+                         unsigned int stretch_us, int iterations) {
+    int data[4] = {0x01, 0x02, 0x03, 0x04};
+
+    struct pi_i2c_statistics before;
+    struct pi_i2c_statistics after;
+
+    int i;
+    int ret;
+
+    int stretches;
+
+    set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, stretch_us);
+
+    before = get_statistics_i2c_bus(bus);
+
+    for (i = 0; i < iterations; i++) {
+        if ((ret = write_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, 4)) < 0) {
+            printf("Error! write_i2c_bus() returned %d\n", ret);
+            return -1;
+        }
+    }
+
+    after = get_statistics_i2c_bus(bus);
+
+    stretches = after.num_clock_stretch - before.num_clock_stretch;
+
+    // The device starts stretching when SCL falls; the controller only
+    // notices once T_LOW and the rise time are over:
+    printf("stretch %4u us: %5.1f stretches/transaction, "
+           "%9.1f ns waited/stretch, %5.1f%% slept\n",
+           stretch_us, (double) stretches / iterations,
+           (double) (after.total_clock_stretch_ns -
+                     before.total_clock_stretch_ns) / stretches,
+           100.0 * (after.num_clock_stretch_sleeps -
+                    before.num_clock_stretch_sleeps) / stretches);
+
+    return 0;
+}
+
+// Compare polling for a device stretching the clock after every ACK with
+// waiting its learned stretch out up front
+static int bench_learned(struct pi_i2c_sim *sim, unsigned int stretch_us,
+                         int iterations) {
+    int policies[] = {I2C_STRETCH_EVERY_BIT, I2C_STRETCH_LEARNED};
+    const char *names[] = {"polled", "learned"};
+
+    int data[4] = {0x01, 0x02, 0x03, 0x04};
+
+    struct pi_i2c_sim_statistics sim_before;
+    struct pi_i2c_sim_statistics sim_after;
+
+    struct pi_i2c_statistics before;
+    struct pi_i2c_statistics after;
+
+    struct pi_i2c_stretch_profile profile;
+
+    struct pi_i2c_bus *bus;
+
+    double start;
+    double run_time;
+
+    int i;
+    int j;
+    int ret = 0;
+
+    set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, stretch_us);
+
+    for (j = 0; (j < 2) && (ret == 0); j++) {
+        if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                          I2C_FULL_SPEED,
+                                          &pi_i2c_sim_backend,
+                                          sim)) == NULL) {
+            printf("Error! config_i2c_bus_backend() failed\n");
+            ret = -1;
+            break;
+        }
+
+        set_device_stretch_policy_i2c_bus(bus, DEVICE_ADDRESS, policies[j]);
+
+        before = get_statistics_i2c_bus(bus);
+        sim_before = get_statistics_sim_i2c(sim);
+        start = cpu_time();
+
+        for (i = 0; (i < iterations) && (ret == 0); i++) {
+            if ((ret = write_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data,
+                                     4)) < 0) {
+                printf("Error! write_i2c_bus() returned %d\n", ret);
+            }
+        }
+
+        run_time = cpu_time() - start;
+        sim_after = get_statistics_sim_i2c(sim);
+        after = get_statistics_i2c_bus(bus);
+
+        get_stretch_profile_i2c_bus(bus, DEVICE_ADDRESS,
+                                    I2C_PHASE_WRITE_DATA, &profile);
+
+        if (ret == 0) {
+            printf("stretch %4u us %-7s: %8.1f us/transaction, "
+                   "%7.1f ns CPU/transaction, %6.1f line reads/transaction, "
+                   "%5.1f%% predicted\n", stretch_us, names[j],
+                   (sim_after.bus_time_ns - sim_before.bus_time_ns) *
+                       1e-3 / iterations,
+                   run_time * 1e9 / iterations,
+                   (double) (sim_after.num_line_reads -
+                             sim_before.num_line_reads) / iterations,
+                   100.0 * (after.num_predicted_stretches -
+                            before.num_predicted_stretches) /
+                       (after.num_clock_stretch - before.num_clock_stretch));
+            printf("      data byte profile: %lld stretched, min %d ns, "
+                   "max %d ns, predicted %d ns\n", profile.num_stretched,
+                   profile.min_stretch_ns, profile.max_stretch_ns,
+                   profile.predicted_ns);
+        }
+
+        free_i2c_bus(bus);
+    }
+
+    set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, 0);
+
+    return ret;
+}
+
+// Wait out stretches of different lengths, then check that a per-device
+// stretch timeout applies
+static int bench_clock_stretching(struct pi_i2c_sim *sim, int iterations) {
+    int data[4] = {0x01, 0x02, 0x03, 0x04};
+
+    struct pi_i2c_bus *bus;
+
+    int ret;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    if ((bench_stretch(bus, sim, 5, iterations) < 0) ||
+        (bench_stretch(bus, sim, 30, iterations) < 0) ||
+        (bench_stretch(bus, sim, 200, iterations) < 0) ||
+        (bench_stretch(bus, sim, 2000, iterations) < 0)) {
+        ret = -1;
+    } else {
+        // Device stretching for 2 ms with a 1 ms timeout must time out:
+        set_stretch_timeout_i2c_bus(bus, DEVICE_ADDRESS, 1000);
+
+        ret = write_i2c_bus(bus, DEVICE_ADDRESS, 0x00, data, 4);
+
+        if (ret == -ECLKTIMEOUT) {
+            printf("stretch past 1 ms device timeout returned "
+                   "ECLKTIMEOUT\n");
+            ret = 0;
+        } else {
+            printf("Error! stretch past timeout returned %d\n", ret);
+            ret = -1;
+        }
+    }
+
+    // Let the device finish stretching and clock it back to idle:
+    set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, 0);
+    set_stretch_timeout_i2c_bus(bus, DEVICE_ADDRESS, 0);
+
+    if ((ret == 0) && (reset_i2c_bus(bus) < 0)) {
+        printf("Error! reset_i2c_bus() failed\n");
+        ret = -1;
+    }
+
+    free_i2c_bus(bus);
+
+    return ret;
+}
+
+// Check a combined transaction (register write, read back, and a read
+// continuing from the register pointer) then compare reading three
+// unrelated registers one message at a time against one transaction joined
+// by repeated STARTs
+static int bench_combined(struct pi_i2c_sim *sim, unsigned char *registers,
+                          int iterations) {
+    unsigned int register_addresses[3] = {0x10, 0x50, 0x90};
+
+    int write_data[2] = {0x3C, 0xC3};
+    int read_data[2];
+    int next_data[2];
+    int data[3];
+
+    struct pi_i2c_msg msgs[3];
+
+    struct pi_i2c_sim_statistics sim_before;
+    struct pi_i2c_sim_statistics sim_after;
+
+    struct pi_i2c_statistics before;
+    struct pi_i2c_statistics after;
+
+    struct pi_i2c_bus *bus;
+
+    double start;
+    double run_time;
+
+    int combined;
+    int i;
+    int j;
+    int ret;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    registers[0x42] = 0x5A;
+    registers[0x43] = 0xA5;
+
+    msgs[0].device_address = DEVICE_ADDRESS;
+    msgs[0].register_address = 0x40;
+    msgs[0].flags = 0;
+    msgs[0].data = write_data;
+    msgs[0].n_bytes = 2;
+
+    msgs[1] = msgs[0];
+    msgs[1].flags = I2C_MSG_READ;
+    msgs[1].data = read_data;
+
+    msgs[2] = msgs[1];
+    msgs[2].flags = I2C_MSG_READ | I2C_MSG_NO_REGISTER;
+    msgs[2].data = next_data;
+
+    before = get_statistics_i2c_bus(bus);
+
+    if ((ret = transfer_i2c_bus(bus, msgs, 3)) < 0) {
+        printf("Error! transfer_i2c_bus() returned %d\n", ret);
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    after = get_statistics_i2c_bus(bus);
+
+    if ((read_data[0] != 0x3C) || (read_data[1] != 0xC3) ||
+        (next_data[0] != 0x5A) || (next_data[1] != 0xA5) ||
+        (after.num_stop_cond - before.num_stop_cond != 1)) {
+        printf("Error! combined transaction read 0x%02X 0x%02X 0x%02X "
+               "0x%02X with %d STOPs\n", read_data[0], read_data[1],
+               next_data[0], next_data[1],
+               after.num_stop_cond - before.num_stop_cond);
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    printf("write, read back and read on in one transaction: %d repeated "
+           "STARTs, 1 STOP\n", after.num_repeated_start_cond -
+                               before.num_repeated_start_cond);
+
+    for (i = 0; i < 3; i++) {
+        registers[register_addresses[i]] = 0x11 * (i + 1);
+
+        msgs[i].device_address = DEVICE_ADDRESS;
+        msgs[i].register_address = register_addresses[i];
+        msgs[i].flags = I2C_MSG_READ;
+        msgs[i].data = &data[i];
+        msgs[i].n_bytes = 1;
+    }
+
+    for (combined = 0; combined < 2; combined++) {
+        before = get_statistics_i2c_bus(bus);
+        sim_before = get_statistics_sim_i2c(sim);
+        start = cpu_time();
+
+        for (i = 0; i < iterations; i++) {
+            if (combined) {
+                ret = transfer_i2c_bus(bus, msgs, 3);
+            } else {
+                ret = 0;
+
+                for (j = 0; (j < 3) && (ret >= 0); j++) {
+                    ret = read_i2c_bus(bus, DEVICE_ADDRESS,
+                                       register_addresses[j], &data[j], 1);
+                }
+            }
+
+            if ((ret < 0) || (data[0] != 0x11) || (data[1] != 0x22) ||
+                (data[2] != 0x33)) {
+                printf("Error! register reads returned %d\n", ret);
+                free_i2c_bus(bus);
+                return -1;
+            }
+        }
+
+        run_time = cpu_time() - start;
+        sim_after = get_statistics_sim_i2c(sim);
+        after = get_statistics_i2c_bus(bus);
+
+        printf("3 registers %-8s: %6.1f us bus time/set, "
+               "%7.1f ns CPU/set, %.0f STOP/set\n",
+               combined ? "combined" : "separate",
+               (sim_after.bus_time_ns - sim_before.bus_time_ns) * 1e-3 /
+                   iterations,
+               run_time * 1e9 / iterations,
+               (double) (after.num_stop_cond - before.num_stop_cond) /
+                   iterations);
+    }
+
+    free_i2c_bus(bus);
+
+    return 0;
+}
+
+// Run a batch of register reads with one descriptor addressing a missing
+// device (only that one may fail), then compare reading registers with
+// separate calls against the same reads run as a batch
+static int bench_batch(struct pi_i2c_sim *sim, unsigned char *registers,
+                       int iterations) {
+    struct pi_i2c_sim_statistics sim_before;
+    struct pi_i2c_sim_statistics sim_after;
+
+    struct pi_i2c_batch_timing timing;
+
+    struct pi_i2c_batch *batch;
+    struct pi_i2c_bus *bus;
+
+    int data[BATCH_READS];
+
+    double start;
+    double run_time;
+
+    int batched;
+    int status;
+    int i;
+    int j;
+    int ret;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    if ((batch = create_batch_i2c()) == NULL) {
+        printf("Error! create_batch_i2c() failed\n");
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    for (i = 0; i < BATCH_READS; i++) {
+        registers[0x80 + i] = i;
+        data[i] = -1;
+
+        add_read_batch_i2c(batch, (i == BATCH_MISSING) ? MISSING_ADDRESS :
+                                                         DEVICE_ADDRESS,
+                           0x80 + i, &data[i], 1);
+    }
+
+    ret = run_batch_i2c_bus(bus, batch);
+
+    for (i = 0; (i < BATCH_READS) && (ret == 1); i++) {
+        status = get_status_batch_i2c(batch, i);
+
+        if ((i == BATCH_MISSING) ? (status != -ENACK) :
+                                   ((status != 0) || (data[i] != i))) {
+            ret = -1;
+        }
+    }
+
+    if (ret != 1) {
+        printf("Error! batch with a missing device returned %d\n", ret);
+        free_batch_i2c(batch);
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    printf("batch of %d reads with one missing device: 1 failed with "
+           "ENACK, others read back\n", BATCH_READS);
+
+    clear_batch_i2c(batch);
+
+    for (i = 0; i < BATCH_READS; i++) {
+        add_read_batch_i2c(batch, DEVICE_ADDRESS, 0x80 + i, &data[i], 1);
+    }
+
+    for (batched = 0; batched < 2; batched++) {
+        sim_before = get_statistics_sim_i2c(sim);
+        start = cpu_time();
+
+        for (i = 0; i < iterations / 10; i++) {
+            if (batched) {
+                ret = run_batch_i2c_bus(bus, batch);
+            } else {
+                ret = 0;
+
+                for (j = 0; (j < BATCH_READS) && (ret >= 0); j++) {
+                    ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x80 + j,
+                                       &data[j], 1);
+                }
+            }
+
+            if (ret != 0) {
+                printf("Error! reads returned %d\n", ret);
+                free_batch_i2c(batch);
+                free_i2c_bus(bus);
+                return -1;
+            }
+        }
+
+        run_time = cpu_time() - start;
+        sim_after = get_statistics_sim_i2c(sim);
+
+        printf("%d reads %-8s: %6.2f us bus time/read, %6.1f ns CPU/read, "
+               "%6.0f bytes/s\n", BATCH_READS,
+               batched ? "batched" : "separate",
+               (sim_after.bus_time_ns - sim_before.bus_time_ns) * 1e-3 /
+                   ((double) (iterations / 10) * BATCH_READS),
+               run_time * 1e9 / ((double) (iterations / 10) * BATCH_READS),
+               (iterations / 10) * BATCH_READS /
+                   ((sim_after.bus_time_ns - sim_before.bus_time_ns) *
+                    1e-9));
+    }
+
+    timing = get_timing_batch_i2c(batch);
+
+    printf("      last batch: %lld ns, %lld ns compiling, %d reads, "
+           "%d failed, %d bytes\n", timing.elapsed_ns, timing.compile_ns,
+           timing.num_transfers, timing.num_failed, timing.num_bytes);
+
+    free_batch_i2c(batch);
+    free_i2c_bus(bus);
+
+    return 0;
+}
+
+// Simulated bus whose sleeps take real time as well, so that threads get
+// to queue up behind a transaction waiting out clock stretching:
+static struct pi_i2c_gpio_backend sleeping_backend;
+
+static void sleeping_sleep_us(void *ctx, unsigned int us) {
+    struct timespec sleep = {.tv_sec = 0, .tv_nsec = us * 1000L};
+
+    nanosleep(&sleep, NULL);
+
+    pi_i2c_sim_backend.sleep_us(ctx, us);
+}
+
+struct coalesce_thread {
+    struct pi_i2c_bus *bus;
+    int n_reads;
+    int n_wrong; // Reads not returning the register's bytes
+};
+
+// Poll the same two bytes over and over:
+static void *poll_register(void *arg) {
+    struct coalesce_thread *thread = arg;
+
+    int data[2];
+
+    int i;
+
+    for (i = 0; i < thread->n_reads; i++) {
+        if ((read_i2c_bus(thread->bus, DEVICE_ADDRESS, COALESCE_REGISTER,
+                          data, 2) != 0) ||
+            (data[0] != 0x5A) || (data[1] != 0xA5)) {
+            thread->n_wrong++;
+        }
+    }
+
+    return NULL;
+}
+
+// Have several threads poll the same register of a device stretching the
+// clock, with and without coalescing their reads, and compare the
+// transactions it took
+static int bench_coalesced(struct pi_i2c_sim *sim, unsigned char *registers,
+                           int iterations) {
+    struct pi_i2c_statistics before;
+    struct pi_i2c_statistics after;
+
+    struct coalesce_thread threads[COALESCE_THREADS];
+    pthread_t thread_ids[COALESCE_THREADS];
+
+    struct pi_i2c_bus *bus;
+
+    int coalesce;
+    int n_wrong;
+    int i;
+
+    sleeping_backend = pi_i2c_sim_backend;
+    sleeping_backend.sleep_us = sleeping_sleep_us;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_STANDARD_MODE, &sleeping_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    registers[COALESCE_REGISTER] = 0x5A;
+    registers[COALESCE_REGISTER + 1] = 0xA5;
+
+    set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, 200);
+
+    for (coalesce = 0; coalesce < 2; coalesce++) {
+        set_read_coalescing_i2c_bus(bus, coalesce);
+        before = get_statistics_i2c_bus(bus);
+
+        for (i = 0; i < COALESCE_THREADS; i++) {
+            threads[i].bus = bus;
+            threads[i].n_reads = iterations / 100 + 1;
+            threads[i].n_wrong = 0;
+
+            pthread_create(&thread_ids[i], NULL, poll_register, &threads[i]);
+        }
+
+        n_wrong = 0;
+
+        for (i = 0; i < COALESCE_THREADS; i++) {
+            pthread_join(thread_ids[i], NULL);
+            n_wrong += threads[i].n_wrong;
+        }
+
+        after = get_statistics_i2c_bus(bus);
+
+        if (n_wrong != 0) {
+            printf("Error! %d reads did not return the register\n", n_wrong);
+            set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, 0);
+            free_i2c_bus(bus);
+            return -1;
+        }
+
+        printf("%d threads x %d reads %-9s: %4d run on the bus, %4d "
+               "served by another thread's\n", COALESCE_THREADS,
+               threads[0].n_reads, coalesce ? "coalesced" : "separate",
+               (after.num_bytes_read - before.num_bytes_read) / 2,
+               after.num_coalesced_reads - before.num_coalesced_reads);
+    }
+
+    printf("      reads of 0x%02X served by another thread's: %d\n",
+           COALESCE_REGISTER,
+           get_coalesced_reads_i2c_bus(bus, DEVICE_ADDRESS,
+                                       COALESCE_REGISTER, 2));
+
+    set_clock_stretch_sim_i2c(sim, DEVICE_ADDRESS, 0);
+    free_i2c_bus(bus);
+
+    return 0;
+}
+
+// Count requests completed through a callback on the worker thread:
+static void count_completion(struct pi_i2c_request *request, void *arg) {
+    int *num_completed = arg;
+
+    if (request->status == 0) {
+        __atomic_add_fetch(num_completed, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Keep the asynchronous bus's pool in flight with register reads and check
+// every one read back, then compare the submitting thread's CPU time per
+// read against calling read_i2c_bus() directly
+static int bench_async(struct pi_i2c_sim *sim, unsigned char *registers,
+                       int iterations) {
+    struct pi_i2c_async_statistics statistics;
+
+    struct pi_i2c_request *requests[ASYNC_DEPTH];
+    struct pi_i2c_request *request;
+    struct pi_i2c_async *async;
+    struct pi_i2c_bus *bus;
+
+    int data;
+
+    double start;
+    double sync_time;
+    double async_time;
+
+    int num_completed;
+    int num_reads;
+    int i;
+    int ret = 0;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    if ((async = create_async_i2c_bus(bus, ASYNC_DEPTH, -1)) == NULL) {
+        printf("Error! create_async_i2c_bus() failed\n");
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    for (i = 0; i < ASYNC_DEPTH; i++) {
+        registers[0x80 + i] = 0xA0 + i;
+    }
+
+    num_reads = (iterations / ASYNC_DEPTH + 1) * ASYNC_DEPTH;
+
+    // Submitting thread's CPU time only (the worker's is not counted):
+    start = cpu_time();
+
+    for (i = 0; i < ASYNC_DEPTH; i++) {
+        requests[i] = get_request_async_i2c(async);
+    }
+
+    if (get_request_async_i2c(async) != NULL) {
+        printf("Error! request taken from an empty pool\n");
+        ret = -1;
+    }
+
+    for (i = 0; (i < ASYNC_DEPTH) && (ret == 0); i++) {
+        requests[i]->kind = I2C_ASYNC_READ;
+        requests[i]->device_address = DEVICE_ADDRESS;
+        requests[i]->register_address = 0x80 + i;
+        requests[i]->n_bytes = 1;
+
+        ret = submit_async_i2c(async, requests[i]);
+    }
+
+    // Resubmit every completed request until enough reads have been run:
+    for (i = ASYNC_DEPTH; (i < num_reads + ASYNC_DEPTH) && (ret == 0); i++) {
+        if ((request = wait_async_i2c(async, 1000)) == NULL) {
+            printf("Error! no read completed\n");
+            ret = -1;
+        } else if ((request->status != 0) ||
+                   (request->data[0] !=
+                    (int) (0xA0 + request->register_address - 0x80))) {
+            printf("Error! read of 0x%02X returned %d, 0x%02X\n",
+                   request->register_address, request->status,
+                   request->data[0]);
+            ret = -1;
+        } else if (i < num_reads) {
+            ret = submit_async_i2c(async, request);
+        } else {
+            put_request_async_i2c(async, request);
+        }
+    }
+
+    async_time = cpu_time() - start;
+    statistics = get_statistics_async_i2c(async);
+
+    if ((ret != 0) || (statistics.queue_depth != 0) ||
+        (statistics.num_completed != num_reads) ||
+        (statistics.num_pool_empty != 1)) {
+        printf("Error! asynchronous reads did not all complete\n");
+        free_async_i2c(async);
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    // Same reads from the calling thread:
+    start = cpu_time();
+
+    for (i = 0; (i < num_reads) && (ret == 0); i++) {
+        ret = read_i2c_bus(bus, DEVICE_ADDRESS, 0x80 + i % ASYNC_DEPTH,
+                           &data, 1);
+    }
+
+    sync_time = cpu_time() - start;
+
+    printf("%d reads direct      : %6.1f ns CPU/read in calling thread\n",
+           num_reads, sync_time * 1e9 / num_reads);
+    printf("%d reads asynchronous: %6.1f ns CPU/read in calling thread\n",
+           num_reads, async_time * 1e9 / num_reads);
+    printf("      max queue depth %d, latency %.1f us average, %.1f us "
+           "max, worker %.0f%% busy\n", statistics.max_queue_depth,
+           statistics.total_latency_ns * 1e-3 / statistics.num_completed,
+           statistics.max_latency_ns * 1e-3,
+           statistics.busy_ns * 100.0 / statistics.elapsed_ns);
+
+    // Completions handed to a callback on the worker thread instead:
+    num_completed = 0;
+
+    for (i = 0; (i < ASYNC_DEPTH) && (ret == 0); i++) {
+        request = get_request_async_i2c(async);
+        request->kind = I2C_ASYNC_READ;
+        request->device_address = DEVICE_ADDRESS;
+        request->register_address = 0x80 + i;
+        request->n_bytes = 1;
+        request->callback = count_completion;
+        request->callback_arg = &num_completed;
+
+        ret = submit_async_i2c(async, request);
+    }
+
+    // Requests still queued are run before the worker exits:
+    free_async_i2c(async);
+    free_i2c_bus(bus);
+
+    if ((ret != 0) || (num_completed != ASYNC_DEPTH)) {
+        printf("Error! %d of %d callbacks ran\n", num_completed,
+               ASYNC_DEPTH);
+        return -1;
+    }
+
+    printf("%d reads completed through callbacks\n", ASYNC_DEPTH);
+
+    return 0;
+}
+
+// Sampler of bench_sampler(): rate, ring, and how often it is drained:
+#define SAMPLER_RATE_HZ 2000
+#define SAMPLER_CAPACITY 64
+#define SAMPLER_BYTES 6
+#define SAMPLER_REGISTER 0x90
+#define SAMPLER_DRAIN_US 10000
+#define SAMPLER_N_DRAINS 25
+
+// Sample registers into a ring drained every SAMPLER_DRAIN_US, checking
+// every sample taken and the draining thread's CPU time per sample, then
+// leave the ring undrained and count the samples written over
+static int bench_sampler(struct pi_i2c_sim *sim, unsigned char *registers) {
+    struct pi_i2c_sampler_statistics statistics;
+
+    struct pi_i2c_sampler *sampler;
+    struct pi_i2c_bus *bus;
+
+    uint8_t samples[SAMPLER_CAPACITY][SAMPLER_BYTES];
+    long long timestamps_ns[SAMPLER_CAPACITY];
+    long long last_ns = 0;
+
+    unsigned long long index;
+    unsigned long long taken = 0;
+    unsigned long long num_lost = 0;
+    unsigned int slot;
+
+    double start;
+    double drain_time;
+
+    int i;
+    int ret = 0;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < SAMPLER_BYTES; i++) {
+        registers[SAMPLER_REGISTER + i] = 0x30 + i;
+    }
+
+    if ((sampler = start_sampler_i2c_bus(bus, DEVICE_ADDRESS,
+                                         SAMPLER_REGISTER, SAMPLER_BYTES,
+                                         SAMPLER_RATE_HZ, &samples[0][0],
+                                         timestamps_ns, SAMPLER_CAPACITY,
+                                         -1)) == NULL) {
+        printf("Error! start_sampler_i2c_bus() failed\n");
+        free_i2c_bus(bus);
+        return -1;
+    }
+
+    // Draining thread's CPU time only (the sampling thread's is not
+    // counted):
+    start = cpu_time();
+
+    for (i = 0; (i < SAMPLER_N_DRAINS) && (ret == 0); i++) {
+        usleep(SAMPLER_DRAIN_US);
+
+        index = get_index_sampler_i2c(sampler);
+
+        // Samples more than a ring behind are gone:
+        if (index - taken > SAMPLER_CAPACITY) {
+            num_lost += index - taken - SAMPLER_CAPACITY;
+            taken = index - SAMPLER_CAPACITY;
+        }
+
+        for (; (taken < index) && (ret == 0); taken++) {
+            slot = taken % SAMPLER_CAPACITY;
+
+            if ((memcmp(samples[slot], &registers[SAMPLER_REGISTER],
+                        SAMPLER_BYTES) != 0) ||
+                (timestamps_ns[slot] <= last_ns)) {
+                printf("Error! sample %llu is not the registers read\n",
+                       taken);
+                ret = -1;
+            }
+
+            last_ns = timestamps_ns[slot];
+        }
+
+        set_taken_sampler_i2c(sampler, taken);
+    }
+
+    drain_time = cpu_time() - start;
+    statistics = get_statistics_sampler_i2c(sampler);
+
+    if ((ret == 0) && ((taken == 0) || (statistics.num_errors != 0))) {
+        printf("Error! sampler read %lld samples with %lld errors\n",
+               statistics.num_samples, statistics.num_errors);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        printf("%llu samples at %d Hz: %.1f Hz achieved, %lld sample "
+               "times missed, %.1f us late at most\n", taken,
+               SAMPLER_RATE_HZ, statistics.achieved_rate_hz,
+               statistics.num_missed, statistics.max_lateness_ns * 1e-3);
+        printf("      %.1f ns CPU/sample in the draining thread, %lld "
+               "written over (%llu lost)\n", drain_time * 1e9 / taken,
+               statistics.num_overwritten, num_lost);
+
+        // Two rings' worth of sample times without taking any:
+        usleep(2 * SAMPLER_CAPACITY * (1000000 / SAMPLER_RATE_HZ));
+
+        index = get_index_sampler_i2c(sampler);
+        statistics = get_statistics_sampler_i2c(sampler);
+
+        if ((index - taken > SAMPLER_CAPACITY) &&
+            (statistics.num_overwritten < (long long) (index - taken -
+                                                       SAMPLER_CAPACITY))) {
+            printf("Error! %lld samples counted written over of %llu\n",
+                   statistics.num_overwritten,
+                   index - taken - SAMPLER_CAPACITY);
+            ret = -1;
+        } else {
+            printf("Undrained ring: %lld samples written over\n",
+                   statistics.num_overwritten);
+        }
+    }
+
+    stop_sampler_i2c(sampler);
+    free_i2c_bus(bus);
+
+    return ret;
+}
+
+// Simulated buses clocked in lockstep (plus one without a device):
+#define GROUP_BUSES 8
+#define GROUP_BYTES 16
+
+static struct pi_i2c_sim *group_sims[GROUP_BUSES + 1];
+static unsigned char group_registers[GROUP_BUSES][256];
+
+// Line accesses made by the simulated buses so far:
+static unsigned long long sim_line_accesses(struct pi_i2c_sim **sims,
+                                            int n_sims) {
+    struct pi_i2c_sim_statistics statistics;
+
+    unsigned long long n = 0;
+
+    int i;
+
+    for (i = 0; i < n_sims; i++) {
+        statistics = get_statistics_sim_i2c(sims[i]);
+        n += statistics.num_line_writes + statistics.num_line_reads;
+    }
+
+    return n;
+}
+
+// Read the same registers of a device on every bus of a group, with each
+// bus's device holding different contents, and compare the CPU time and
+// register accesses per byte against reading the buses one at a time. Then
+// check that a bus without the device fails on its own
+static int bench_bus_group(int iterations) {
+    struct pi_i2c_bus_group_statistics statistics;
+
+    struct pi_i2c_bus *buses[GROUP_BUSES];
+    struct pi_i2c_sim *separate_sims[GROUP_BUSES];
+    struct pi_i2c_sim_regs *sim_regs;
+    struct pi_i2c_bus_group *group;
+
+    unsigned int sda_pins[GROUP_BUSES + 1];
+    unsigned int scl_pins[GROUP_BUSES + 1];
+
+    int data[(GROUP_BUSES + 1) * GROUP_BYTES];
+    int status[GROUP_BUSES + 1];
+
+    double start;
+    double group_time;
+    double separate_time;
+    unsigned long long accesses;
+
+    int n_reads = iterations / 10 + 1;
+    int n_bytes;
+    int i;
+    int j;
+    int k;
+    int ret = 0;
+
+    if ((sim_regs = create_sim_regs_i2c()) == NULL) {
+        printf("Error! create_sim_regs_i2c() failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < GROUP_BUSES + 1; i++) {
+        sda_pins[i] = 4 + 2 * i;
+        scl_pins[i] = 5 + 2 * i;
+
+        group_sims[i] = create_sim_i2c();
+        attach_sim_regs_i2c(sim_regs, group_sims[i], sda_pins[i],
+                            scl_pins[i]);
+    }
+
+    for (i = 0; i < GROUP_BUSES; i++) {
+        for (j = 0; j < GROUP_BYTES; j++) {
+            group_registers[i][0x10 + j] = 0x10 * i + j;
+        }
+
+        separate_sims[i] = create_sim_i2c();
+        add_device_sim_i2c(group_sims[i], DEVICE_ADDRESS,
+                           group_registers[i]);
+        add_device_sim_i2c(separate_sims[i], DEVICE_ADDRESS,
+                           group_registers[i]);
+
+        buses[i] = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                          I2C_FULL_SPEED,
+                                          &pi_i2c_sim_backend,
+                                          separate_sims[i]);
+    }
+
+    if ((group = create_sim_bus_group_i2c(sda_pins, scl_pins, GROUP_BUSES,
+                                          I2C_FULL_SPEED,
+                                          sim_regs)) == NULL) {
+        printf("Error! create_sim_bus_group_i2c() failed\n");
+        return -1;
+    }
+
+    // Every bus in one transaction:
+    start = cpu_time();
+
+    for (k = 0; (k < n_reads) && (ret == 0); k++) {
+        ret = read_bus_group_i2c(group, DEVICE_ADDRESS, 0x10, data,
+                                 GROUP_BYTES, status);
+    }
+
+    group_time = cpu_time() - start;
+    statistics = get_statistics_bus_group_i2c(group);
+
+    for (i = 0; (i < GROUP_BUSES * GROUP_BYTES) && (ret == 0); i++) {
+        if (data[i] != group_registers[i / GROUP_BYTES][0x10 +
+                                                        i % GROUP_BYTES]) {
+            printf("Error! bus %d byte %d read 0x%02X\n", i / GROUP_BYTES,
+                   i % GROUP_BYTES, data[i]);
+            ret = -1;
+        }
+    }
+
+    // Same reads one bus at a time:
+    accesses = sim_line_accesses(separate_sims, GROUP_BUSES);
+    start = cpu_time();
+
+    for (k = 0; (k < n_reads) && (ret == 0); k++) {
+        for (i = 0; (i < GROUP_BUSES) && (ret == 0); i++) {
+            ret = read_i2c_bus(buses[i], DEVICE_ADDRESS, 0x10,
+                               &data[i * GROUP_BYTES], GROUP_BYTES);
+        }
+    }
+
+    separate_time = cpu_time() - start;
+    accesses = sim_line_accesses(separate_sims, GROUP_BUSES) - accesses;
+
+    if (ret != 0) {
+        printf("Error! reading the group's buses failed (%d)\n", ret);
+    } else {
+        n_bytes = n_reads * GROUP_BUSES * GROUP_BYTES;
+
+        printf("%d buses one at a time: %6.1f ns CPU/byte, %5.2f line "
+               "accesses/byte\n", GROUP_BUSES, separate_time * 1e9 / n_bytes,
+               (double) accesses / n_bytes);
+        printf("%d buses in lockstep  : %6.1f ns CPU/byte, %5.2f register "
+               "accesses/byte\n", GROUP_BUSES, group_time * 1e9 / n_bytes,
+               (double) (statistics.num_register_stores +
+                         statistics.num_level_reads) / n_bytes);
+    }
+
+    // Different bytes written to each bus and read back:
+    for (i = 0; i < GROUP_BUSES; i++) {
+        data[i] = 0xC0 + i;
+    }
+
+    if ((ret == 0) &&
+        ((write_bus_group_i2c(group, DEVICE_ADDRESS, 0x30, data, 1,
+                              status) != 0) ||
+         (read_bus_group_i2c(group, DEVICE_ADDRESS, 0x30, data, 1,
+                             status) != 0))) {
+        printf("Error! write then read back on the group failed\n");
+        ret = -1;
+    }
+
+    for (i = 0; (i < GROUP_BUSES) && (ret == 0); i++) {
+        if ((data[i] != 0xC0 + i) || (group_registers[i][0x30] != 0xC0 + i)) {
+            printf("Error! bus %d wrote 0x%02X\n", i, data[i]);
+            ret = -1;
+        }
+    }
+
+    free_bus_group_i2c(group);
+
+    // The bus without the device fails with the others carrying on:
+    if ((ret == 0) &&
+        ((group = create_sim_bus_group_i2c(sda_pins, scl_pins,
+                                           GROUP_BUSES + 1, I2C_FULL_SPEED,
+                                           sim_regs)) == NULL)) {
+        printf("Error! create_sim_bus_group_i2c() failed\n");
+        ret = -1;
+    } else if (ret == 0) {
+        ret = read_bus_group_i2c(group, DEVICE_ADDRESS, 0x10, data,
+                                 GROUP_BYTES, status);
+
+        if ((ret != 1) || (status[GROUP_BUSES] != -ENACK) ||
+            (status[0] != 0) || (data[GROUP_BYTES] != 0x10)) {
+            printf("Error! missing device returned %d, status %d\n", ret,
+                   status[GROUP_BUSES]);
+            ret = -1;
+        } else {
+            printf("%d buses, one without the device: only it failed "
+                   "(%d)\n", GROUP_BUSES + 1, status[GROUP_BUSES]);
+            ret = 0;
+        }
+
+        free_bus_group_i2c(group);
+    }
+
+    for (i = 0; i < GROUP_BUSES; i++) {
+        free_i2c_bus(buses[i]);
+        free_sim_i2c(separate_sims[i]);
+    }
+
+    for (i = 0; i < GROUP_BUSES + 1; i++) {
+        free_sim_i2c(group_sims[i]);
+    }
+
+    free_sim_regs_i2c(sim_regs);
+
+    return ret;
+}
+
+// GPIO register block stand-in for the gpio_regs backend (32-bit words):
+#define REGS_BLOCK_SIZE 4096
+#define REGS_GPFSEL0 0
+#define REGS_GPFSEL2 2
+#define REGS_GPCLR0 10
+#define REGS_GPLEV0 13
+#define REGS_EDGE_SDA_PIN 20
+#define REGS_EDGE_SCL_PIN 21
+
+// Every pin of GPFSEL0 is an output before the bus is configured:
+#define REGS_FSEL_PATTERN 0x09249249
+
+// Replica of the pi_lw_gpio call path on the same stand-in: the backend takes
+// the GPFSEL register's mutex and calls gpio_set_mode() in the pi_lw_gpio
+// library, which does a read-modify-write of the register. The library call
+// goes through a volatile pointer so it is not inlined, as with the shared
+// library:
+static volatile uint32_t *lw_regs;
+static pthread_mutex_t lw_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lw_gpio_set_mode(int mode, unsigned int gpio) {
+    volatile uint32_t *fsel = &lw_regs[gpio / 10];
+    unsigned int shift = (gpio % 10) * 3;
+
+    *fsel = (*fsel & ~((uint32_t) 0x7 << shift)) | ((uint32_t) mode << shift);
+}
+
+static void (*volatile lw_gpio_set_mode_call)(int, unsigned int) =
+    lw_gpio_set_mode;
+
+static void lw_clear_line(void *ctx, unsigned int gpio) {
+    (void) ctx;
+
+    pthread_mutex_lock(&lw_lock);
+    lw_gpio_set_mode_call(1, gpio);
+    pthread_mutex_unlock(&lw_lock);
+}
+
+static void lw_release_line(void *ctx, unsigned int gpio) {
+    (void) ctx;
+
+    pthread_mutex_lock(&lw_lock);
+    lw_gpio_set_mode_call(0, gpio);
+    pthread_mutex_unlock(&lw_lock);
+}
+
+// Edges per second toggling SCL through a backend's clear_line() and
+// release_line() operations:
+static double edges_per_second(const struct pi_i2c_gpio_backend *backend,
+                               void *ctx, int n_edges) {
+    const struct pi_i2c_gpio_backend *volatile ops = backend;
+
+    struct timespec start;
+    struct timespec end;
+
+    double elapsed;
+
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < n_edges; i += 2) {
+        ops->clear_line(ctx, REGS_EDGE_SCL_PIN);
+        ops->release_line(ctx, REGS_EDGE_SCL_PIN);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (double) (end.tv_sec - start.tv_sec) +
+              1.0e-9 * (end.tv_nsec - start.tv_nsec);
+
+    return n_edges / elapsed;
+}
+
+// Drive a bus through the gpio_regs backend on anonymous memory standing in
+// for the GPIO registers, check what it stores, then compare edges per second
+// against the pi_lw_gpio call path
+static int bench_gpio_regs(int iterations) {
+    struct pi_i2c_gpio_backend lw_backend;
+
+    volatile uint32_t *regs;
+
+    struct pi_i2c_bus *bus;
+
+    int address_book[128];
+
+    uint32_t expected;
+    uint32_t pin_bits;
+
+    double regs_rate;
+    double lw_rate;
+
+    void *ctx;
+
+    int n_edges = iterations * 1000;
+    int ret;
+
+    if ((regs = mmap(NULL, REGS_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        printf("Error! mmap() failed\n");
+        return -1;
+    }
+
+    // Released lines read high through their pull-ups:
+    regs[REGS_GPFSEL0] = REGS_FSEL_PATTERN;
+    regs[REGS_GPLEV0] = 0xFFFFFFFF;
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED,
+                                      &pi_i2c_gpio_regs_backend,
+                                      (void *) regs)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        munmap((void *) regs, REGS_BLOCK_SIZE);
+        return -1;
+    }
+
+    // Both pins released to inputs and cleared once; the other pins of the
+    // register keep their function:
+    pin_bits = ((uint32_t) 0x7 << (SIM_SDA_PIN * 3)) |
+               ((uint32_t) 0x7 << (SIM_SCL_PIN * 3));
+    expected = REGS_FSEL_PATTERN & ~pin_bits;
+
+    ret = 0;
+
+    if ((regs[REGS_GPFSEL0] != expected) ||
+        (regs[REGS_GPCLR0] != ((1u << SIM_SDA_PIN) | (1u << SIM_SCL_PIN)))) {
+        printf("Error! GPFSEL0 0x%08x GPCLR0 0x%08x after config\n",
+               regs[REGS_GPFSEL0], regs[REGS_GPCLR0]);
+        ret = -1;
+    } else if ((ret = scan_i2c_bus(bus, address_book)) != 0) {
+        printf("Error! scan of empty bus returned %d\n", ret);
+        ret = -1;
+    } else if (regs[REGS_GPFSEL0] != expected) {
+        printf("Error! GPFSEL0 0x%08x after scan\n", regs[REGS_GPFSEL0]);
+        ret = -1;
+    } else if (config_i2c_bus_backend(SIM_SDA_PIN + 2, SIM_SCL_PIN + 2,
+                                      I2C_FULL_SPEED,
+                                      &pi_i2c_gpio_regs_backend,
+                                      (void *) regs) != NULL) {
+        printf("Error! second bus in GPFSEL0 was configured\n");
+        ret = -1;
+    } else {
+        printf("scan of empty register bus found no devices, GPFSEL0 "
+               "0x%08x, second bus in GPFSEL0 refused\n",
+               regs[REGS_GPFSEL0]);
+    }
+
+    free_i2c_bus(bus);
+
+    if (ret < 0) {
+        munmap((void *) regs, REGS_BLOCK_SIZE);
+        return -1;
+    }
+
+    // Edges per second on pins of their own GPFSEL register:
+    if ((ret = pi_i2c_gpio_regs_backend.open(&ctx, REGS_EDGE_SDA_PIN,
+                                             REGS_EDGE_SCL_PIN,
+                                             (void *) regs)) < 0) {
+        printf("Error! gpio_regs open() returned %d\n", ret);
+        munmap((void *) regs, REGS_BLOCK_SIZE);
+        return -1;
+    }
+
+    regs_rate = edges_per_second(&pi_i2c_gpio_regs_backend, ctx, n_edges);
+
+    pi_i2c_gpio_regs_backend.close(ctx);
+
+    lw_regs = regs;
+
+    memset(&lw_backend, 0, sizeof(lw_backend));
+    lw_backend.clear_line = lw_clear_line;
+    lw_backend.release_line = lw_release_line;
+
+    lw_rate = edges_per_second(&lw_backend, NULL, n_edges);
+
+    printf("gpio_regs precomputed stores: %6.1f M edges/s\n",
+           regs_rate / 1.0e6);
+    printf("pi_lw_gpio call path:         %6.1f M edges/s (%.1fx fewer)\n",
+           lw_rate / 1.0e6, regs_rate / lw_rate);
+
+    munmap((void *) regs, REGS_BLOCK_SIZE);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int iterations = 2000;
+
+    unsigned char registers[256];
+
+    struct pi_i2c_sim *sim;
+    struct pi_i2c_bus *bus;
+
+    // Usage: bench_pi_i2c [iterations] [gpiochip sda scl]
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+
+    // Optionally count ioctls per byte on a real (or gpio-sim) GPIO chip:
+    if (argc > 4) {
+        printf("Counting ioctls per byte on %s\n", argv[2]);
+
+        if (bench_line_accesses(&pi_i2c_gpiochip_backend, argv[2],
+                                atoi(argv[3]), atoi(argv[4]), 0, 0) < 0) {
+            return 1;
+        }
+
+        printf("Benchmark complete\n");
+
+        return 0;
+    }
+
+    printf("Begin bench_pi_i2c.c\n");
+
+    memset(registers, 0, sizeof(registers));
+
+    if ((sim = create_sim_i2c()) == NULL) {
+        printf("Error! create_sim_i2c() failed\n");
+        return 1;
+    }
+
+    add_device_sim_i2c(sim, DEVICE_ADDRESS, registers);
+
+    if ((bus = config_i2c_bus_backend(SIM_SDA_PIN, SIM_SCL_PIN,
+                                      I2C_FULL_SPEED, &pi_i2c_sim_backend,
+                                      sim)) == NULL) {
+        printf("Error! config_i2c_bus_backend() failed\n");
+        return 1;
+    }
+
+    if ((check_sim_bus(bus, registers) < 0) ||
+        (check_line_errors(sim) < 0)) {
+        return 1;
+    }
+
+    printf("Running engine benchmark (%d iterations)\n", iterations);
+
+    if ((bench_transfer(bus, sim, 0, 1, iterations) < 0) ||
+        (bench_transfer(bus, sim, 0, 16, iterations) < 0) ||
+        (bench_transfer(bus, sim, 1, 1, iterations) < 0) ||
+        (bench_transfer(bus, sim, 1, 16, iterations) < 0)) {
+        return 1;
+    }
+
+    printf("Reading blocks into byte and int buffers\n");
+
+    if (bench_byte_buffers(bus, registers, iterations) < 0) {
+        return 1;
+    }
+
+    printf("Running engine benchmark with deadline timing\n");
+
+    if ((set_timing_mode_i2c_bus(bus, I2C_TIMING_DEADLINE) < 0) ||
+        (bench_transfer(bus, sim, 0, 1, iterations) < 0) ||
+        (bench_transfer(bus, sim, 0, 16, iterations) < 0) ||
+        (bench_transfer(bus, sim, 1, 1, iterations) < 0) ||
+        (bench_transfer(bus, sim, 1, 16, iterations) < 0) ||
+        (check_sim_bus(bus, registers) < 0) ||
+        (set_timing_mode_i2c_bus(bus, I2C_TIMING_RELATIVE) < 0)) {
+        return 1;
+    }
+
+    printf("Comparing speed grades\n");
+
+    if (bench_speed_grades(sim, registers, iterations) < 0) {
+        return 1;
+    }
+
+    printf("Running engine benchmark on calibrated bus\n");
+
+    if (bench_calibrated(sim, registers, iterations) < 0) {
+        return 1;
+    }
+
+    printf("Comparing clock stretching policies\n");
+
+    if (bench_stretch_policies(sim, registers, iterations) < 0) {
+        return 1;
+    }
+
+    printf("Waiting out clock stretching\n");
+
+    if (bench_clock_stretching(sim, iterations / 10) < 0) {
+        return 1;
+    }
+
+    printf("Learning clock stretching\n");
+
+    if ((bench_learned(sim, 30, iterations / 10) < 0) ||
+        (bench_learned(sim, 200, iterations / 10) < 0)) {
+        return 1;
+    }
+
+    printf("Counting line reads avoided\n");
+
+    if (bench_reads_avoided(sim) < 0) {
+        return 1;
+    }
+
+    printf("Scanning address ranges\n");
+
+    if (bench_scan() < 0) {
+        return 1;
+    }
+
+    printf("Watching for devices coming and going\n");
+
+    if (bench_presence() < 0) {
+        return 1;
+    }
+
+    printf("Combining messages with repeated STARTs\n");
+
+    if (bench_combined(sim, registers, iterations) < 0) {
+        return 1;
+    }
+
+    printf("Running reads as a batch\n");
+
+    if (bench_batch(sim, registers, iterations) < 0) {
+        return 1;
+    }
+
+    printf("Running reads asynchronously\n");
+
+    if (bench_async(sim, registers, iterations) < 0) {
+        return 1;
+    }
+
+    printf("Sampling registers at a fixed rate\n");
+
+    if (bench_sampler(sim, registers) < 0) {
+        return 1;
+    }
+
+    printf("Coalescing reads of the same register\n");
+
+    if (bench_coalesced(sim, registers, iterations) < 0) {
+        return 1;
+    }
+
+    printf("Driving lines through GPIO registers\n");
+
+    if (bench_gpio_regs(iterations) < 0) {
+        return 1;
+    }
+
+    printf("Clocking buses in lockstep\n");
+
+    if (bench_bus_group(iterations) < 0) {
+        return 1;
+    }
+
+    printf("Counting line accesses per byte\n");
+
+    if ((bench_line_accesses(&pi_i2c_sim_backend, sim, SIM_SDA_PIN,
+                             SIM_SCL_PIN, 0, 16) < 0) ||
+        (bench_line_accesses(&pi_i2c_sim_backend, sim, SIM_SDA_PIN,
+                             SIM_SCL_PIN, 1, 16) < 0)) {
+        return 1;
+    }
+
+    printf("Benchmark complete\n");
+
+    free_i2c_bus(bus);
+    free_sim_i2c(sim);
+
+    return 0;
+}
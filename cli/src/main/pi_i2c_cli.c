@@ -146,9 +146,12 @@ int main(int argc, char **argv) {
                     speed_grade = I2C_STANDARD_MODE;
                 } else if (strcmp(optarg, "i2c_full_speed") == 0) {
                     speed_grade = I2C_FULL_SPEED;
+                } else if (strcmp(optarg, "i2c_fast_mode_plus") == 0) {
+                    speed_grade = I2C_FAST_MODE_PLUS;
                 } else {
                     printf("pi_i2c: --speed-grade option must " \
-                           "i2c_standard_mode (100) or i2c_full_speed (400)\n");
+                           "i2c_standard_mode (100), i2c_full_speed (400) " \
+                           "or i2c_fast_mode_plus (1000)\n");
                     printf("pi_i2c: error is not recoverable; exiting now\n");
                     return -1;
                 }
@@ -236,9 +239,11 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-    if ((speed_grade != I2C_STANDARD_MODE) && (speed_grade != I2C_FULL_SPEED)) {
+    if ((speed_grade != I2C_STANDARD_MODE) &&
+        (speed_grade != I2C_FULL_SPEED) &&
+        (speed_grade != I2C_FAST_MODE_PLUS)) {
         printf("pi_i2c: -g, --speed-grade option must i2c_standard_mode " \
-               "(100) or i2c_full_speed (400)\n");
+               "(100), i2c_full_speed (400) or i2c_fast_mode_plus (1000)\n");
         printf("pi_i2c: error is not recoverable; exiting now\n");
         return -1;
     }
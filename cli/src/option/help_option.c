@@ -44,7 +44,8 @@ void help_option(void) {
     printf("  -a, --sda          GPIO pin to use for the SDA line (BCM numbering)\n");
     printf("  -c, --scl          GPIO pin to use for the SCL line (BCM numbering)\n");
     printf("  -g, --speed-grade  I2C bus speed grade (bit rate) as defined by pi_i2c.h\n");
-    printf("                     valid speed grades are i2c_standard_mode (100) or i2c_full_speed (400)\n");
+    printf("                     valid speed grades are i2c_standard_mode (100), i2c_full_speed (400)\n");
+    printf("                     or i2c_fast_mode_plus (1000)\n");
     printf("  -e, --device       device I2C address as a hex number (e.g., 0xFF)\n");
     printf("  -i, --register     device's register address read from or written as a hex number (e.g., 0xFF)\n");
     printf("  -s, --scan         scan the bus for any I2C devices\n");
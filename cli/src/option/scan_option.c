@@ -48,7 +48,8 @@ int scan_option(void) {
         printf("%d0 ", i);
 
         for (j = 0; j < 16; j++) {
-            if (address_book[i*16 + j] == 1) {
+            // The address book ends at 0x7E:
+            if ((i*16 + j < 127) && (address_book[i*16 + j] == 1)) {
                 printf(" x ");
             } else {
                 printf(" - ");
@@ -21,9 +21,56 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 // ============================================================================
 
+// Include C standard libraries:
+#include <stdint.h> // C Standard integer types (byte buffers)
+
 // I2C speed grades define in bits/second:
 #define I2C_STANDARD_MODE 100e3
 #define I2C_FULL_SPEED 400e3
+#define I2C_FAST_MODE_PLUS 1000e3
+
+// Scan flags (see scan_range_i2c()):
+#define I2C_SCAN_WRITE 0x0    // Probe with an address frame for writing
+#define I2C_SCAN_READ 0x1     // Probe by reading a byte (NACKed) instead
+#define I2C_SCAN_RESERVED 0x2 // Also probe reserved 0x00-0x07, 0x78-0x7F
+#define I2C_SCAN_STOP 0x4     // STOP after every probe (no repeated START)
+
+// Address maps hold a bit per 7-bit address, address A being bit A % 64 of
+// word A / 64:
+#define I2C_ADDRESS_MAP_WORDS 2
+#define I2C_ADDRESS_PRESENT(map, address) \
+    (((map)[(address) >> 6] >> ((address) & 0x3F)) & 0x1)
+
+// Bus timing modes (see set_timing_mode_i2c()):
+#define I2C_TIMING_RELATIVE 0 // Sleep each delay after changing a line
+#define I2C_TIMING_DEADLINE 1 // Wait for each edge's deadline counted from
+                              // the start of the transaction
+
+// Clock stretching policies (see set_stretch_policy_i2c()):
+#define I2C_STRETCH_DEFAULT 0   // Bus: every bit; device: follow the bus
+#define I2C_STRETCH_EVERY_BIT 1 // Wait out stretching on every clock pulse
+#define I2C_STRETCH_ACK_ONLY 2  // Only around ACKs (byte level stretching)
+#define I2C_STRETCH_NEVER 3     // Device never stretches the clock
+#define I2C_STRETCH_LEARNED 4   // Every bit, waiting profiled stretches out
+                                // up front
+
+// Points of a message clock stretching is profiled at: the release of SCL
+// following the ACK of a byte (see get_stretch_profile_i2c()):
+#define I2C_PHASE_BIT 0          // Any other clock pulse
+#define I2C_PHASE_ADDRESS 1      // Device address
+#define I2C_PHASE_REGISTER 2     // Register address
+#define I2C_PHASE_READ_ADDRESS 3 // Device address after repeated START
+#define I2C_PHASE_WRITE_DATA 4   // Data byte written
+#define I2C_PHASE_READ_DATA 5    // Data byte read
+#define I2C_N_PHASES 6
+
+// Message segment flags (see transfer_i2c()):
+#define I2C_MSG_READ 0x1        // Read into data (write it otherwise)
+#define I2C_MSG_NO_REGISTER 0x2 // No register address; reads continue from
+                                // the device's register pointer
+#define I2C_MSG_NO_ACK_LAST 0x4 // Last byte written may be NACK'd
+
+#define I2C_MAX_MSGS 42 // Most segments in one transaction
 
 // Error numbers:
 #define ENOPIVER 140    // Could not get PI board revision
@@ -63,6 +110,121 @@ struct pi_i2c_statistics {
     int num_device_hung;
     int num_clock_stretching_timeouts;
     int num_clock_stretch;
+
+    // Deadline timing (I2C_TIMING_DEADLINE) only; how far behind its
+    // deadline the host was when it got to an edge:
+    int num_late_edges;        // Edges reached after their deadline
+    int max_edge_lateness_ns;  // Worst lateness seen on the bus
+    int last_edge_lateness_ns; // Worst lateness of the last transaction
+
+    // Time devices held SCL low once the controller released it:
+    int num_clock_stretch_sleeps;     // Stretches long enough to yield CPU
+    int last_clock_stretch_ns;        // Most recent stretch
+    int max_clock_stretch_ns;         // Longest stretch
+    long long total_clock_stretch_ns; // All stretches
+
+    // Stretches waited out up front (I2C_STRETCH_LEARNED):
+    int num_predicted_stretches;    // Over at the confirmation read
+    int num_mispredicted_stretches; // Still going; polled for the rest
+
+    // Line reads left out as the controller had just driven the lines to
+    // the state they would confirm:
+    int num_line_reads_avoided;
+
+    // Reads served by another thread's identical read (see
+    // set_read_coalescing_i2c()):
+    int num_coalesced_reads;
+
+    // Time the last scan took on the bus (see scan_range_i2c()):
+    long long last_scan_ns;
+
+    // Backend failing to read (or change) the lines:
+    int num_line_errors;
+    int last_line_error; // Error number returned by the backend
+};
+
+// Clock stretching seen at one point of the messages to one device:
+struct pi_i2c_stretch_profile {
+    long long num_samples;      // Clock pulses checked
+    long long num_stretched;    // Pulses the device stretched
+    int min_stretch_ns;         // Shortest stretch
+    int max_stretch_ns;         // Longest stretch
+    int last_stretch_ns;        // Most recent check (0 if not stretched)
+    int predicted_ns;           // Wait up front with I2C_STRETCH_LEARNED
+    long long total_stretch_ns; // All stretches
+};
+
+// One segment of a combined transaction (see transfer_i2c()). Segments are
+// joined by repeated STARTs and only the last one ends with a STOP:
+struct pi_i2c_msg {
+    unsigned int device_address;   // 7-bit device address
+    unsigned int register_address; // Unless I2C_MSG_NO_REGISTER
+    unsigned int flags;            // I2C_MSG_* flags
+    int *data;                     // Bytes to write or read into
+    unsigned int n_bytes;          // Writes may be empty
+};
+
+// Batch of register reads and writes run back-to-back (see
+// create_batch_i2c()):
+struct pi_i2c_batch;
+
+// Timing of the last run of a batch:
+struct pi_i2c_batch_timing {
+    long long elapsed_ns; // Whole run, compiling included
+    long long compile_ns; // Compiling the batch before touching the bus
+    int num_transfers;    // Reads and writes run
+    int num_failed;       // Reads and writes ending in an error
+    int num_bytes;        // Data bytes read and written by the others
+};
+
+// Asynchronous requests (see submit_async_i2c()):
+#define I2C_ASYNC_READ 0
+#define I2C_ASYNC_WRITE 1
+#define I2C_ASYNC_SCAN 2 // Addresses first_address to last_address
+#define I2C_ASYNC_MAX_BYTES 32
+
+// Request taken from an asynchronous bus's pool:
+struct pi_i2c_request {
+    int kind;                          // I2C_ASYNC_READ, _WRITE or _SCAN
+    unsigned int device_address;
+    unsigned int register_address;
+    int data[I2C_ASYNC_MAX_BYTES];     // Read into or written from
+    unsigned int n_bytes;
+
+    // Addresses a scan runs over, its I2C_SCAN_* flags and the addresses
+    // it found:
+    unsigned int first_address;
+    unsigned int last_address;
+    int scan_flags;
+    unsigned long long address_map[I2C_ADDRESS_MAP_WORDS];
+
+    // Called from the worker thread on completion instead of queueing the
+    // request for poll_async_i2c() (NULL to queue it):
+    void (*callback)(struct pi_i2c_request *request, void *callback_arg);
+    void *callback_arg;
+
+    int status;                        // Outcome once completed
+    long long submit_ns;               // Time submitted
+    long long complete_ns;             // Time completed
+};
+
+struct pi_i2c_async;
+
+struct pi_i2c_async_statistics {
+    int queue_depth;                // Submitted and not yet completed
+    int max_queue_depth;
+    long long num_submitted;
+    long long num_completed;
+    long long num_pool_empty;       // Requests asked for with none free
+
+    // Submission to completion:
+    long long last_latency_ns;
+    long long max_latency_ns;
+    long long total_latency_ns;
+
+    // Worker utilization is busy_ns / elapsed_ns:
+    long long busy_ns;              // Running requests on the bus
+    long long elapsed_ns;           // Since the worker started
 };
 
 struct pi_i2c_configs {
@@ -73,15 +235,338 @@ struct pi_i2c_configs {
     int min_t_susta_sleep_us;
     int min_t_susto_sleep_us;
     int min_t_buf_sleep_us;
+
+    // Delays actually used, in nano seconds (the micro second values above
+    // are these rounded up). SCL is high for scl_response_time_ns (waiting
+    // for it to rise, see clock stretching) plus scl_t_high_sleep_ns:
+    int scl_t_low_sleep_ns;
+    int scl_t_high_sleep_ns;
+    int scl_response_time_ns;
+    int min_t_hdsta_sleep_ns;
+    int min_t_susta_sleep_ns;
+    int min_t_susto_sleep_ns;
+    int min_t_buf_sleep_ns;
+
+    int timing_mode; // I2C_TIMING_RELATIVE or I2C_TIMING_DEADLINE
+    int stretch_policy; // I2C_STRETCH_* of devices following the bus
+
+    // Measured by calibrate_i2c() (calibrated is 0 until then and the rise
+    // time above is the maximum of the speed mode):
+    int calibrated;
+    int line_call_ns; // Time spent in one line access
+};
+
+// Opaque handle to one SDA/SCL bus (see config_i2c_bus()):
+struct pi_i2c_bus;
+
+// GPIO backend operations used to drive a bus. Lines are open-drain:
+// clear_line() pulls a line low and release_line() lets the pull-up take it
+// high. open() receives the backend argument given at config time and returns
+// a context handed back to every other operation.
+//
+// read_lines() is optional (NULL if not supported) and reads both lines in a
+// single call, returning the SDA level in bit 0 and the SCL level in bit 1.
+// Lines are only ever changed one at a time so that SDA never moves while
+// SCL is high except as a START or STOP. read_line() and read_lines()
+// return a negative error number if the lines cannot be read (or the last
+// change of a line failed). delay_ns() is optional too; without it delays
+// are rounded up to whole micro seconds for delay_us().
+//
+// now_ns() and delay_until_ns() are optional and needed for deadline timing
+// (I2C_TIMING_DEADLINE). now_ns() reads the backend's clock in nano seconds
+// and delay_until_ns() waits until that clock reaches the deadline, returning
+// how far past the deadline the clock already was (0 if on time).
+//
+// sleep_us() is optional and used for long waits (clock stretching); it waits
+// like delay_us() but yields the CPU. Without it delay_us() is used.
+struct pi_i2c_gpio_backend {
+    int (*open)(void **ctx, unsigned int sda, unsigned int scl, void *arg);
+    void (*close)(void *ctx);
+    void (*clear_line)(void *ctx, unsigned int gpio);
+    void (*release_line)(void *ctx, unsigned int gpio);
+    int (*read_line)(void *ctx, unsigned int gpio);
+    void (*delay_us)(void *ctx, unsigned int us);
+    int (*read_lines)(void *ctx);
+    void (*delay_ns)(void *ctx, unsigned int ns);
+    long long (*now_ns)(void *ctx);
+    long long (*delay_until_ns)(void *ctx, long long deadline_ns);
+    void (*sleep_us)(void *ctx, unsigned int us);
+};
+
+// GPIO backends shipped with pi_i2c:
+extern const struct pi_i2c_gpio_backend pi_i2c_pi_lw_gpio_backend; // Default
+extern const struct pi_i2c_gpio_backend pi_i2c_sim_backend;        // In-memory
+extern const struct pi_i2c_gpio_backend pi_i2c_gpiochip_backend;   // Char dev
+extern const struct pi_i2c_gpio_backend pi_i2c_gpio_regs_backend;  // GPFSEL
+
+// Simulated bus (backend argument for pi_i2c_sim_backend):
+struct pi_i2c_sim;
+
+struct pi_i2c_sim_statistics {
+    unsigned long long elapsed_ns;      // Virtual time spent in delays
+    unsigned long long num_line_writes; // clear_line() + release_line()
+    unsigned long long num_line_reads;  // read_line()
+    unsigned long long num_scl_cycles;  // SCL rising edges
+    unsigned long long bus_time_ns;     // Time a real bus would have taken:
+                                        // delays plus host time spent
+                                        // between them
+};
+
+// Devices kept track of in the background (see watch_presence_i2c()):
+struct pi_i2c_presence;
+
+struct pi_i2c_presence_statistics {
+    long long num_refreshes;      // Background refreshes run
+    long long num_probes;         // Addresses probed by them
+    long long num_busy;           // Refreshes put off with the bus in use
+    long long num_fail_fast;      // Transactions failed without the bus
+    long long num_arrivals;       // Devices found on an empty address
+    long long num_departures;     // Devices found gone
+    long long num_events_dropped; // Events lost to a full queue
+    long long last_refresh_ns;    // Bus time of the last refresh
+};
+
+// Registers read at a fixed rate into a caller's ring (see
+// start_sampler_i2c()):
+struct pi_i2c_sampler;
+
+struct pi_i2c_sampler_statistics {
+    long long num_samples;     // Written to the ring
+    long long num_missed;      // Sample times skipped by reads running late
+    long long num_overwritten; // Samples written over before being taken
+    long long num_errors;      // Reads failing (no sample written)
+    int last_error;            // Error number of the last of them
+    long long max_lateness_ns; // Furthest a read started after its time
+    long long elapsed_ns;      // Since sampling started
+    float achieved_rate_hz;    // num_samples over elapsed_ns
+};
+
+// Simulated GPIO register block (see attach_sim_regs_i2c()):
+struct pi_i2c_sim_regs;
+
+// Buses clocked in lockstep (see create_bus_group_i2c()):
+#define I2C_GROUP_MAX_BUSES 16
+
+struct pi_i2c_bus_group;
+
+struct pi_i2c_bus_group_statistics {
+    int num_transactions;          // Run on every bus of the group at once
+    int num_failed;                // Buses failing one
+    int num_bytes_read;            // Summed over the buses
+    int num_bytes_written;
+    int num_clock_stretch;         // Edges held up by a stretching device
+    long long num_register_stores; // GPFSEL stores (each shared by buses)
+    long long num_level_reads;     // GPLEV0 loads (each sampling every bus)
 };
 
 // I2C function prototypes:
 int config_i2c(unsigned int sda, unsigned int scl, unsigned int speed_grade);
+int config_i2c_dev(unsigned int adapter);
 int scan_bus_i2c(int *address_book);
+int scan_range_i2c(unsigned int first_address, unsigned int last_address,
+                   const unsigned long long *mask, int flags,
+                   unsigned long long *address_map);
 int write_i2c(unsigned int device_address, unsigned int register_address,
               int *data, unsigned int n_bytes);
 int read_i2c(unsigned int device_address, unsigned int register_address,
              int *data, unsigned int n_bytes);
+int write_bytes_i2c(unsigned int device_address,
+                    unsigned int register_address, const uint8_t *data,
+                    unsigned int n_bytes);
+int read_bytes_i2c(unsigned int device_address, unsigned int register_address,
+                   uint8_t *data, unsigned int n_bytes);
+int transfer_i2c(struct pi_i2c_msg *msgs, unsigned int n_msgs);
+int run_batch_i2c(struct pi_i2c_batch *batch);
 int reset_i2c(void);
 struct pi_i2c_statistics get_statistics_i2c(void);
-struct pi_i2c_configs get_configs_i2c(void);
\ No newline at end of file
+struct pi_i2c_configs get_configs_i2c(void);
+int set_timing_mode_i2c(int mode);
+int calibrate_i2c(const char *cache_path);
+int set_stretch_timeout_i2c(unsigned int device_address,
+                            unsigned int timeout_us);
+int set_stretch_policy_i2c(int policy);
+int set_device_stretch_policy_i2c(unsigned int device_address, int policy);
+int get_stretch_profile_i2c(unsigned int device_address, unsigned int phase,
+                            struct pi_i2c_stretch_profile *profile);
+int export_stretch_profiles_i2c(const char *path);
+int set_read_coalescing_i2c(int enable);
+int get_coalesced_reads_i2c(unsigned int device_address,
+                            unsigned int register_address,
+                            unsigned int n_bytes);
+
+// I2C bus handle function prototypes. Calls on different buses may run
+// concurrently from different threads; calls on the same bus are serialized:
+struct pi_i2c_bus *config_i2c_bus(unsigned int sda, unsigned int scl,
+                                  unsigned int speed_grade);
+struct pi_i2c_bus *config_i2c_bus_backend(
+    unsigned int sda, unsigned int scl, unsigned int speed_grade,
+    const struct pi_i2c_gpio_backend *backend, void *backend_arg);
+struct pi_i2c_bus *config_i2c_dev_bus(unsigned int adapter);
+void free_i2c_bus(struct pi_i2c_bus *bus);
+int scan_i2c_bus(struct pi_i2c_bus *bus, int *address_book);
+int scan_range_i2c_bus(struct pi_i2c_bus *bus, unsigned int first_address,
+                       unsigned int last_address,
+                       const unsigned long long *mask, int flags,
+                       unsigned long long *address_map);
+int write_i2c_bus(struct pi_i2c_bus *bus, unsigned int device_address,
+                  unsigned int register_address, int *data,
+                  unsigned int n_bytes);
+int read_i2c_bus(struct pi_i2c_bus *bus, unsigned int device_address,
+                 unsigned int register_address, int *data,
+                 unsigned int n_bytes);
+int write_bytes_i2c_bus(struct pi_i2c_bus *bus, unsigned int device_address,
+                        unsigned int register_address, const uint8_t *data,
+                        unsigned int n_bytes);
+int read_bytes_i2c_bus(struct pi_i2c_bus *bus, unsigned int device_address,
+                       unsigned int register_address, uint8_t *data,
+                       unsigned int n_bytes);
+int transfer_i2c_bus(struct pi_i2c_bus *bus, struct pi_i2c_msg *msgs,
+                     unsigned int n_msgs);
+int run_batch_i2c_bus(struct pi_i2c_bus *bus, struct pi_i2c_batch *batch);
+int reset_i2c_bus(struct pi_i2c_bus *bus);
+struct pi_i2c_statistics get_statistics_i2c_bus(struct pi_i2c_bus *bus);
+struct pi_i2c_configs get_configs_i2c_bus(struct pi_i2c_bus *bus);
+int set_timing_mode_i2c_bus(struct pi_i2c_bus *bus, int mode);
+int calibrate_i2c_bus(struct pi_i2c_bus *bus, const char *cache_path);
+int set_stretch_timeout_i2c_bus(struct pi_i2c_bus *bus,
+                                unsigned int device_address,
+                                unsigned int timeout_us);
+int set_stretch_policy_i2c_bus(struct pi_i2c_bus *bus, int policy);
+int set_device_stretch_policy_i2c_bus(struct pi_i2c_bus *bus,
+                                      unsigned int device_address,
+                                      int policy);
+int get_stretch_profile_i2c_bus(struct pi_i2c_bus *bus,
+                                unsigned int device_address,
+                                unsigned int phase,
+                                struct pi_i2c_stretch_profile *profile);
+int export_stretch_profiles_i2c_bus(struct pi_i2c_bus *bus, const char *path);
+int set_read_coalescing_i2c_bus(struct pi_i2c_bus *bus, int enable);
+int get_coalesced_reads_i2c_bus(struct pi_i2c_bus *bus,
+                                unsigned int device_address,
+                                unsigned int register_address,
+                                unsigned int n_bytes);
+
+// Batch function prototypes (a batch is not shared between threads while
+// being filled or run):
+struct pi_i2c_batch *create_batch_i2c(void);
+void free_batch_i2c(struct pi_i2c_batch *batch);
+void clear_batch_i2c(struct pi_i2c_batch *batch);
+int add_read_batch_i2c(struct pi_i2c_batch *batch,
+                       unsigned int device_address,
+                       unsigned int register_address, int *data,
+                       unsigned int n_bytes);
+int add_write_batch_i2c(struct pi_i2c_batch *batch,
+                        unsigned int device_address,
+                        unsigned int register_address, int *data,
+                        unsigned int n_bytes);
+int add_read_bytes_batch_i2c(struct pi_i2c_batch *batch,
+                             unsigned int device_address,
+                             unsigned int register_address, uint8_t *data,
+                             unsigned int n_bytes);
+int add_write_bytes_batch_i2c(struct pi_i2c_batch *batch,
+                              unsigned int device_address,
+                              unsigned int register_address,
+                              const uint8_t *data, unsigned int n_bytes);
+int get_status_batch_i2c(struct pi_i2c_batch *batch, unsigned int index);
+struct pi_i2c_batch_timing get_timing_batch_i2c(struct pi_i2c_batch *batch);
+
+// Asynchronous bus function prototypes. Any thread may take, submit, poll
+// and put back requests; the bus is only driven from the worker thread:
+struct pi_i2c_async *create_async_i2c(unsigned int depth, int cpu);
+struct pi_i2c_async *create_async_i2c_bus(struct pi_i2c_bus *bus,
+                                          unsigned int depth, int cpu);
+void free_async_i2c(struct pi_i2c_async *async);
+struct pi_i2c_request *get_request_async_i2c(struct pi_i2c_async *async);
+void put_request_async_i2c(struct pi_i2c_async *async,
+                           struct pi_i2c_request *request);
+int submit_async_i2c(struct pi_i2c_async *async,
+                     struct pi_i2c_request *request);
+struct pi_i2c_request *poll_async_i2c(struct pi_i2c_async *async);
+struct pi_i2c_request *wait_async_i2c(struct pi_i2c_async *async,
+                                      int timeout_ms);
+int get_fd_async_i2c(struct pi_i2c_async *async);
+struct pi_i2c_async_statistics get_statistics_async_i2c(
+    struct pi_i2c_async *async);
+
+// Presence cache function prototypes. Callbacks run on the worker thread:
+struct pi_i2c_presence *watch_presence_i2c(
+    const unsigned long long *mask, unsigned int n_per_refresh,
+    unsigned int interval_us,
+    void (*callback)(unsigned int device_address, int present, void *arg),
+    void *callback_arg);
+struct pi_i2c_presence *watch_presence_i2c_bus(
+    struct pi_i2c_bus *bus, const unsigned long long *mask,
+    unsigned int n_per_refresh, unsigned int interval_us,
+    void (*callback)(unsigned int device_address, int present, void *arg),
+    void *callback_arg);
+int unwatch_presence_i2c(struct pi_i2c_presence *presence);
+int get_map_presence_i2c(struct pi_i2c_presence *presence,
+                         unsigned long long *address_map);
+int poll_presence_i2c(struct pi_i2c_presence *presence,
+                      unsigned int *device_address, int *present);
+int get_fd_presence_i2c(struct pi_i2c_presence *presence);
+struct pi_i2c_presence_statistics get_statistics_presence_i2c(
+    struct pi_i2c_presence *presence);
+
+// Sampler function prototypes. The ring is written from the sampling
+// thread; sample i is in slot i % capacity and samples index - capacity + 1
+// to index - 1 may be read:
+struct pi_i2c_sampler *start_sampler_i2c(unsigned int device_address,
+                                         unsigned int register_address,
+                                         unsigned int n_bytes, float rate_hz,
+                                         uint8_t *samples,
+                                         long long *timestamps_ns,
+                                         unsigned int capacity, int cpu);
+struct pi_i2c_sampler *start_sampler_i2c_bus(struct pi_i2c_bus *bus,
+                                             unsigned int device_address,
+                                             unsigned int register_address,
+                                             unsigned int n_bytes,
+                                             float rate_hz, uint8_t *samples,
+                                             long long *timestamps_ns,
+                                             unsigned int capacity,
+                                             int cpu);
+unsigned long long stop_sampler_i2c(struct pi_i2c_sampler *sampler);
+unsigned long long get_index_sampler_i2c(struct pi_i2c_sampler *sampler);
+void set_taken_sampler_i2c(struct pi_i2c_sampler *sampler,
+                           unsigned long long index);
+struct pi_i2c_sampler_statistics get_statistics_sampler_i2c(
+    struct pi_i2c_sampler *sampler);
+
+// Simulated bus function prototypes:
+struct pi_i2c_sim *create_sim_i2c(void);
+void free_sim_i2c(struct pi_i2c_sim *sim);
+int add_device_sim_i2c(struct pi_i2c_sim *sim, unsigned int device_address,
+                       unsigned char *registers);
+int remove_device_sim_i2c(struct pi_i2c_sim *sim,
+                          unsigned int device_address);
+int set_clock_stretch_sim_i2c(struct pi_i2c_sim *sim,
+                              unsigned int device_address,
+                              unsigned int stretch_us);
+struct pi_i2c_sim_statistics get_statistics_sim_i2c(struct pi_i2c_sim *sim);
+struct pi_i2c_sim_regs *create_sim_regs_i2c(void);
+void free_sim_regs_i2c(struct pi_i2c_sim_regs *regs);
+int attach_sim_regs_i2c(struct pi_i2c_sim_regs *regs, struct pi_i2c_sim *sim,
+                        unsigned int sda, unsigned int scl);
+
+// Bus group function prototypes. Every bus runs the same transaction; bus
+// N's bytes are data[N * n_bytes] onwards and its outcome status[N]:
+struct pi_i2c_bus_group *create_bus_group_i2c(const unsigned int *sda_pins,
+                                              const unsigned int *scl_pins,
+                                              unsigned int n_buses,
+                                              unsigned int speed_grade,
+                                              void *regs);
+struct pi_i2c_bus_group *create_sim_bus_group_i2c(
+    const unsigned int *sda_pins, const unsigned int *scl_pins,
+    unsigned int n_buses, unsigned int speed_grade,
+    struct pi_i2c_sim_regs *sim_regs);
+void free_bus_group_i2c(struct pi_i2c_bus_group *group);
+int read_bus_group_i2c(struct pi_i2c_bus_group *group,
+                       unsigned int device_address,
+                       unsigned int register_address, int *data,
+                       unsigned int n_bytes, int *status);
+int write_bus_group_i2c(struct pi_i2c_bus_group *group,
+                        unsigned int device_address,
+                        unsigned int register_address, int *data,
+                        unsigned int n_bytes, int *status);
+struct pi_i2c_bus_group_statistics get_statistics_bus_group_i2c(
+    struct pi_i2c_bus_group *group);
\ No newline at end of file
@@ -1,4 +1,11 @@
 '''Comprehensive I2C library for the Raspberry Pi [Now in Python]'''
 
-from .libpii2c import config_i2c, scan_bus_i2c, write_i2c, read_i2c, reset_i2c, get_statistics_i2c, get_configs_i2c
-from .libpii2c_header import I2C_STANDARD_MODE, I2C_FULL_SPEED
+from .libpii2c import config_i2c, config_i2c_dev, scan_bus_i2c, scan_range_i2c, write_i2c, read_i2c, transfer_i2c, reset_i2c, get_statistics_i2c, get_configs_i2c, set_timing_mode_i2c, calibrate_i2c, set_stretch_timeout_i2c, set_stretch_policy_i2c, set_device_stretch_policy_i2c, get_stretch_profile_i2c, export_stretch_profiles_i2c, set_read_coalescing_i2c, get_coalesced_reads_i2c
+from ._pi_i2c import read_into_i2c, write_from_i2c, read_batch_i2c
+from .aio import AsyncI2C
+from .sampler import SamplerI2C
+from .libpii2c_header import I2C_STANDARD_MODE, I2C_FULL_SPEED, I2C_FAST_MODE_PLUS
+from .libpii2c_header import I2C_TIMING_RELATIVE, I2C_TIMING_DEADLINE
+from .libpii2c_header import I2C_SCAN_WRITE, I2C_SCAN_READ, I2C_SCAN_RESERVED, I2C_SCAN_STOP
+from .libpii2c_header import I2C_MSG_READ, I2C_MSG_NO_REGISTER, I2C_MSG_NO_ACK_LAST
+from .libpii2c_header import I2C_ASYNC_MAX_BYTES
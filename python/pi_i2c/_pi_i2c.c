@@ -0,0 +1,904 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Native Python module
+//
+// The parts of the Python package that move data: reads into any writable
+// buffer (bytearray, memoryview, NumPy array) and writes from any buffer,
+// without copying, plus a batch of reads run by one call into one packed
+// buffer. The GIL is released while the bus is driven so that other Python
+// threads keep running through a transaction. An asynchronous bus type
+// hands requests to the native worker thread of async.c and reports their
+// completion through its eventfd, for aio.py to watch from an event loop,
+// and a sampler type runs sampler.c's thread over ring buffers the caller
+// allocated (see sampler.py). Everything else goes through ctypes in
+// libpii2c.py, which loads the libraries this module links to.
+
+// Python.h must come before any standard header:
+#define PY_SSIZE_T_CLEAN
+#include <Python.h> // CPython API
+
+// Include C standard libraries:
+#include <stdint.h> // C Standard integer types (byte buffers)
+#include <string.h> // C Standard strerror
+#include <limits.h> // C Standard integer limits (buffer lengths)
+#include <errno.h>  // C Standard for error conditions
+
+// Include header files:
+#include <pi_i2c.h> // Pi I2C library!
+
+// Exception class and message per pi_i2c error number (see
+// libpii2c_errno.py):
+static PyObject *errno_table;
+
+// Build the exception for a negative error number (OSError for one not
+// of pi_i2c)
+static PyObject *errno_exception(int ret) {
+    PyObject *value;
+    PyObject *entry;
+
+    if ((value = PyLong_FromLong(-ret)) == NULL) {
+        return NULL;
+    }
+
+    entry = PyDict_GetItemWithError(errno_table, value);
+    Py_DECREF(value);
+
+    if (entry != NULL) {
+        return PyObject_CallFunctionObjArgs(PyTuple_GET_ITEM(entry, 0),
+                                            PyTuple_GET_ITEM(entry, 1),
+                                            NULL);
+    }
+
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+
+    // OSError picks the subclass of the error number itself:
+    return PyObject_CallFunction(PyExc_OSError, "is", -ret, strerror(-ret));
+}
+
+// Raise the exception for a negative error number. Returns NULL
+static PyObject *raise_errno(int ret) {
+    PyObject *exception;
+
+    if ((exception = errno_exception(ret)) != NULL) {
+        PyErr_SetObject((PyObject *)Py_TYPE(exception), exception);
+        Py_DECREF(exception);
+    }
+
+    return NULL;
+}
+
+// Read len(buffer) bytes from a device's register address straight into a
+// writable buffer
+static PyObject *read_into_i2c(PyObject *self, PyObject *args) {
+    unsigned int device_address;
+    unsigned int register_address;
+
+    Py_buffer buffer;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "IIw*", &device_address, &register_address,
+                          &buffer)) {
+        return NULL;
+    }
+
+    // The C library counts bytes in an unsigned int:
+    if (buffer.len > UINT_MAX) {
+        PyBuffer_Release(&buffer);
+        PyErr_SetString(PyExc_OverflowError, "buffer too large");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = read_bytes_i2c(device_address, register_address, buffer.buf,
+                         buffer.len);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&buffer);
+
+    if (ret < 0) {
+        return raise_errno(ret);
+    }
+
+    Py_RETURN_NONE;
+}
+
+// Write the bytes of a buffer to a device's register address
+static PyObject *write_from_i2c(PyObject *self, PyObject *args) {
+    unsigned int device_address;
+    unsigned int register_address;
+
+    Py_buffer buffer;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "IIy*", &device_address, &register_address,
+                          &buffer)) {
+        return NULL;
+    }
+
+    // The C library counts bytes in an unsigned int:
+    if (buffer.len > UINT_MAX) {
+        PyBuffer_Release(&buffer);
+        PyErr_SetString(PyExc_OverflowError, "buffer too large");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = write_bytes_i2c(device_address, register_address, buffer.buf,
+                          buffer.len);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&buffer);
+
+    if (ret < 0) {
+        return raise_errno(ret);
+    }
+
+    Py_RETURN_NONE;
+}
+
+// Add a (device address, register address, n_bytes) read to a batch at
+// offset bytes into data. Returns the number of bytes or -1 with an
+// exception set
+static Py_ssize_t add_read(struct pi_i2c_batch *batch, PyObject *read,
+                           uint8_t *data, Py_ssize_t offset,
+                           Py_ssize_t size) {
+    unsigned int device_address;
+    unsigned int register_address;
+    unsigned int n_bytes;
+
+    int ret;
+
+    if (!PyArg_ParseTuple(read, "III", &device_address, &register_address,
+                          &n_bytes)) {
+        return -1;
+    }
+
+    // A NULL buffer only counts the bytes:
+    if (data == NULL) {
+        return n_bytes;
+    }
+
+    if ((Py_ssize_t)n_bytes > size - offset) {
+        PyErr_SetString(PyExc_ValueError, "buffer too small for reads");
+        return -1;
+    }
+
+    if ((ret = add_read_bytes_batch_i2c(batch, device_address,
+                                        register_address, data + offset,
+                                        n_bytes)) < 0) {
+        raise_errno(ret);
+        return -1;
+    }
+
+    return n_bytes;
+}
+
+// Run a sequence of (device address, register address, n_bytes) reads
+// back-to-back in one batch, their bytes packed one after the other into
+// out (a new bytearray if None). Returns the buffer read into
+static PyObject *read_batch_i2c(PyObject *self, PyObject *args) {
+    PyObject *reads;
+    PyObject *out = Py_None;
+    PyObject *items;
+
+    struct pi_i2c_batch *batch = NULL;
+
+    Py_buffer buffer = {0};
+    Py_ssize_t n_reads;
+    Py_ssize_t offset;
+    Py_ssize_t n;
+    Py_ssize_t i;
+
+    int ret = 0;
+
+    if (!PyArg_ParseTuple(args, "O|O", &reads, &out)) {
+        return NULL;
+    }
+
+    if ((items = PySequence_Fast(reads, "reads must be a sequence")) ==
+        NULL) {
+        return NULL;
+    }
+
+    n_reads = PySequence_Fast_GET_SIZE(items);
+
+    // Size a new bytearray to hold every read:
+    if (out == Py_None) {
+        for (i = 0, offset = 0; i < n_reads; i++, offset += n) {
+            if ((n = add_read(NULL, PySequence_Fast_GET_ITEM(items, i),
+                              NULL, 0, 0)) < 0) {
+                Py_DECREF(items);
+                return NULL;
+            }
+        }
+
+        if ((out = PyByteArray_FromStringAndSize(NULL, offset)) == NULL) {
+            Py_DECREF(items);
+            return NULL;
+        }
+    } else {
+        Py_INCREF(out);
+    }
+
+    if (PyObject_GetBuffer(out, &buffer, PyBUF_WRITABLE |
+                                         PyBUF_C_CONTIGUOUS) < 0) {
+        Py_DECREF(items);
+        Py_DECREF(out);
+        return NULL;
+    }
+
+    if ((batch = create_batch_i2c()) == NULL) {
+        PyErr_NoMemory();
+        ret = -1;
+    }
+
+    for (i = 0, offset = 0; (ret == 0) && (i < n_reads); i++, offset += n) {
+        if ((n = add_read(batch, PySequence_Fast_GET_ITEM(items, i),
+                          buffer.buf, offset, buffer.len)) < 0) {
+            ret = -1;
+        }
+    }
+
+    Py_DECREF(items);
+
+    if (ret == 0) {
+        Py_BEGIN_ALLOW_THREADS
+        ret = run_batch_i2c(batch);
+        Py_END_ALLOW_THREADS
+
+        // Report the first read that failed:
+        if (ret > 0) {
+            for (i = 0; (ret = get_status_batch_i2c(batch, i)) == 0; i++) {
+            }
+        }
+
+        if (ret < 0) {
+            raise_errno(ret);
+        }
+    }
+
+    free_batch_i2c(batch);
+    PyBuffer_Release(&buffer);
+
+    if (ret < 0) {
+        Py_DECREF(out);
+        return NULL;
+    }
+
+    return out;
+}
+
+// Asynchronous bus on the default bus. Requests are named by a token (the
+// address of the request) from submission until poll() returns them
+typedef struct {
+    PyObject_HEAD
+    struct pi_i2c_async *async;
+} AsyncBus;
+
+// Start the worker thread
+static int AsyncBus_init(AsyncBus *self, PyObject *args, PyObject *kwds) {
+    static char *keywords[] = {"depth", "cpu", NULL};
+
+    unsigned int depth = 64;
+    int cpu = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Ii", keywords, &depth,
+                                     &cpu)) {
+        return -1;
+    }
+
+    if (self->async != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "asynchronous bus already "
+                                            "started");
+        return -1;
+    }
+
+    if ((self->async = create_async_i2c(depth, cpu)) == NULL) {
+        raise_errno(-errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Run every request still submitted and stop the worker thread. Their
+// completions are dropped along with the pool
+static PyObject *AsyncBus_close(AsyncBus *self, PyObject *unused) {
+    struct pi_i2c_async *async = self->async;
+
+    self->async = NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    free_async_i2c(async);
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+static void AsyncBus_dealloc(AsyncBus *self) {
+    Py_XDECREF(AsyncBus_close(self, NULL));
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// Take a request from the pool. BlockingIOError is raised if every
+// request is in flight
+static struct pi_i2c_request *take_request(AsyncBus *self) {
+    struct pi_i2c_request *request;
+
+    if (self->async == NULL) {
+        PyErr_SetString(PyExc_ValueError, "asynchronous bus is closed");
+        return NULL;
+    }
+
+    if ((request = get_request_async_i2c(self->async)) == NULL) {
+        raise_errno(-errno);
+        return NULL;
+    }
+
+    // Completions are queued for poll():
+    request->callback = NULL;
+    request->callback_arg = NULL;
+
+    return request;
+}
+
+// Submit a request filled in and return its token
+static PyObject *submit_request(AsyncBus *self,
+                                struct pi_i2c_request *request) {
+    int ret;
+
+    if ((ret = submit_async_i2c(self->async, request)) < 0) {
+        put_request_async_i2c(self->async, request);
+        return raise_errno(ret);
+    }
+
+    return PyLong_FromVoidPtr(request);
+}
+
+static PyObject *AsyncBus_submit_read(AsyncBus *self, PyObject *args) {
+    struct pi_i2c_request *request;
+
+    unsigned int device_address;
+    unsigned int register_address;
+    unsigned int n_bytes;
+
+    if (!PyArg_ParseTuple(args, "III", &device_address, &register_address,
+                          &n_bytes)) {
+        return NULL;
+    }
+
+    if ((request = take_request(self)) == NULL) {
+        return NULL;
+    }
+
+    request->kind = I2C_ASYNC_READ;
+    request->device_address = device_address;
+    request->register_address = register_address;
+    request->n_bytes = n_bytes;
+
+    return submit_request(self, request);
+}
+
+static PyObject *AsyncBus_submit_write(AsyncBus *self, PyObject *args) {
+    struct pi_i2c_request *request;
+
+    unsigned int device_address;
+    unsigned int register_address;
+
+    Py_buffer buffer;
+    Py_ssize_t i;
+
+    if (!PyArg_ParseTuple(args, "IIy*", &device_address, &register_address,
+                          &buffer)) {
+        return NULL;
+    }
+
+    // Requests hold at most I2C_ASYNC_MAX_BYTES bytes:
+    if ((buffer.len == 0) || (buffer.len > I2C_ASYNC_MAX_BYTES)) {
+        PyBuffer_Release(&buffer);
+        return raise_errno(-EINVAL);
+    }
+
+    if ((request = take_request(self)) == NULL) {
+        PyBuffer_Release(&buffer);
+        return NULL;
+    }
+
+    request->kind = I2C_ASYNC_WRITE;
+    request->device_address = device_address;
+    request->register_address = register_address;
+    request->n_bytes = buffer.len;
+
+    for (i = 0; i < buffer.len; i++) {
+        request->data[i] = ((uint8_t *)buffer.buf)[i];
+    }
+
+    PyBuffer_Release(&buffer);
+
+    return submit_request(self, request);
+}
+
+static PyObject *AsyncBus_submit_scan(AsyncBus *self, PyObject *args) {
+    struct pi_i2c_request *request;
+
+    unsigned int first_address;
+    unsigned int last_address;
+    int flags;
+
+    if (!PyArg_ParseTuple(args, "IIi", &first_address, &last_address,
+                          &flags)) {
+        return NULL;
+    }
+
+    if ((request = take_request(self)) == NULL) {
+        return NULL;
+    }
+
+    request->kind = I2C_ASYNC_SCAN;
+    request->first_address = first_address;
+    request->last_address = last_address;
+    request->scan_flags = flags;
+
+    return submit_request(self, request);
+}
+
+// Result of a completed request: the bytes read, the bitmap of addresses
+// found (bit N for address N), or None for a write
+static PyObject *request_result(struct pi_i2c_request *request) {
+    PyObject *result;
+    PyObject *high;
+    PyObject *low;
+    PyObject *shift;
+    PyObject *shifted;
+
+    char *bytes;
+    unsigned int i;
+
+    if (request->kind == I2C_ASYNC_READ) {
+        if ((result = PyBytes_FromStringAndSize(NULL, request->n_bytes)) ==
+            NULL) {
+            return NULL;
+        }
+
+        bytes = PyBytes_AS_STRING(result);
+
+        for (i = 0; i < request->n_bytes; i++) {
+            bytes[i] = request->data[i];
+        }
+
+        return result;
+    }
+
+    if (request->kind == I2C_ASYNC_WRITE) {
+        Py_RETURN_NONE;
+    }
+
+    // Address maps are two 64-bit words:
+    low = PyLong_FromUnsignedLongLong(request->address_map[0]);
+    high = PyLong_FromUnsignedLongLong(request->address_map[1]);
+    shift = PyLong_FromLong(64);
+    result = NULL;
+
+    if ((low != NULL) && (high != NULL) && (shift != NULL) &&
+        ((shifted = PyNumber_Lshift(high, shift)) != NULL)) {
+        result = PyNumber_Or(shifted, low);
+        Py_DECREF(shifted);
+    }
+
+    Py_XDECREF(low);
+    Py_XDECREF(high);
+    Py_XDECREF(shift);
+
+    return result;
+}
+
+// Take every completed request and return them as a list of (token,
+// exception or None, result) tuples, putting the requests back. The file
+// descriptor is readable again once another one completes
+static PyObject *AsyncBus_poll(AsyncBus *self, PyObject *unused) {
+    struct pi_i2c_request *request;
+
+    PyObject *completions;
+    PyObject *completion;
+    PyObject *exception;
+    PyObject *result;
+
+    if (self->async == NULL) {
+        PyErr_SetString(PyExc_ValueError, "asynchronous bus is closed");
+        return NULL;
+    }
+
+    if ((completions = PyList_New(0)) == NULL) {
+        return NULL;
+    }
+
+    while ((request = poll_async_i2c(self->async)) != NULL) {
+        if (request->status < 0) {
+            exception = errno_exception(request->status);
+        } else {
+            Py_INCREF(Py_None);
+            exception = Py_None;
+        }
+
+        result = request_result(request);
+        completion = NULL;
+
+        if ((exception != NULL) && (result != NULL)) {
+            completion = Py_BuildValue("(NOO)", PyLong_FromVoidPtr(request),
+                                       exception, result);
+        }
+
+        Py_XDECREF(exception);
+        Py_XDECREF(result);
+
+        put_request_async_i2c(self->async, request);
+
+        if ((completion == NULL) ||
+            (PyList_Append(completions, completion) < 0)) {
+            Py_XDECREF(completion);
+            Py_DECREF(completions);
+            return NULL;
+        }
+
+        Py_DECREF(completion);
+    }
+
+    return completions;
+}
+
+static PyObject *AsyncBus_fileno(AsyncBus *self, PyObject *unused) {
+    if (self->async == NULL) {
+        PyErr_SetString(PyExc_ValueError, "asynchronous bus is closed");
+        return NULL;
+    }
+
+    return PyLong_FromLong(get_fd_async_i2c(self->async));
+}
+
+static PyMethodDef AsyncBus_methods[] = {
+    {"submit_read", (PyCFunction)AsyncBus_submit_read, METH_VARARGS,
+     "submit_read(device_address, register_address, n_bytes)\n\n"
+     "Submit a read of at most I2C_ASYNC_MAX_BYTES bytes and return its "
+     "token."},
+    {"submit_write", (PyCFunction)AsyncBus_submit_write, METH_VARARGS,
+     "submit_write(device_address, register_address, buffer)\n\n"
+     "Submit a write of the bytes of a buffer (at most I2C_ASYNC_MAX_BYTES)"
+     "\nand return its token."},
+    {"submit_scan", (PyCFunction)AsyncBus_submit_scan, METH_VARARGS,
+     "submit_scan(first_address, last_address, flags)\n\n"
+     "Submit a scan of a range of addresses and return its token."},
+    {"poll", (PyCFunction)AsyncBus_poll, METH_NOARGS,
+     "poll()\n\n"
+     "Return every completed request as a (token, exception or None, "
+     "result)\ntuple."},
+    {"fileno", (PyCFunction)AsyncBus_fileno, METH_NOARGS,
+     "fileno()\n\n"
+     "Return the eventfd readable once a request completes after poll()."},
+    {"close", (PyCFunction)AsyncBus_close, METH_NOARGS,
+     "close()\n\n"
+     "Run every request still submitted and stop the worker thread."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject AsyncBus_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pi_i2c._pi_i2c.AsyncBus",
+    .tp_doc = "AsyncBus(depth=64, cpu=-1)\n\n"
+              "Worker thread running requests against the default bus "
+              "(see\ncreate_async_i2c()).",
+    .tp_basicsize = sizeof(AsyncBus),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)AsyncBus_init,
+    .tp_dealloc = (destructor)AsyncBus_dealloc,
+    .tp_methods = AsyncBus_methods,
+};
+
+// Sampler writing into buffers it holds on to until stopped
+typedef struct {
+    PyObject_HEAD
+    struct pi_i2c_sampler *sampler;
+    Py_buffer samples;
+    Py_buffer timestamps;
+    unsigned long long index; // Samples written once stopped
+} Sampler;
+
+// Start the sampling thread over a samples buffer of capacity * n_bytes
+// bytes and a timestamps buffer of capacity 64-bit integers
+static int Sampler_init(Sampler *self, PyObject *args, PyObject *kwds) {
+    static char *keywords[] = {"device_address", "register_address",
+                               "n_bytes", "rate_hz", "samples",
+                               "timestamps", "cpu", NULL};
+
+    unsigned int device_address;
+    unsigned int register_address;
+    unsigned int n_bytes;
+    float rate_hz;
+    int cpu = -1;
+
+    PyObject *samples;
+    PyObject *timestamps;
+
+    Py_ssize_t capacity;
+    char format;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "IIIfOO|i", keywords,
+                                     &device_address, &register_address,
+                                     &n_bytes, &rate_hz, &samples,
+                                     &timestamps, &cpu)) {
+        return -1;
+    }
+
+    if (self->sampler != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "sampler already started");
+        return -1;
+    }
+
+    if (PyObject_GetBuffer(samples, &self->samples, PyBUF_WRITABLE |
+                                                    PyBUF_C_CONTIGUOUS) < 0) {
+        return -1;
+    }
+
+    if (PyObject_GetBuffer(timestamps, &self->timestamps,
+                           PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS |
+                           PyBUF_FORMAT) < 0) {
+        PyBuffer_Release(&self->samples);
+        return -1;
+    }
+
+    // Times are nano seconds as signed 64-bit integers (numpy.int64):
+    format = self->timestamps.format[strlen(self->timestamps.format) - 1];
+    capacity = self->timestamps.len / sizeof(long long);
+
+    if ((self->timestamps.itemsize != sizeof(long long)) ||
+        ((format != 'q') && (format != 'l'))) {
+        PyErr_SetString(PyExc_TypeError, "timestamps must hold 64-bit "
+                                         "integers");
+    } else if ((capacity == 0) || (capacity > UINT_MAX) ||
+               (self->samples.len != capacity * (Py_ssize_t) n_bytes)) {
+        PyErr_SetString(PyExc_ValueError, "samples must hold n_bytes for "
+                                          "each timestamp");
+    } else if ((self->sampler = start_sampler_i2c(
+                    device_address, register_address, n_bytes, rate_hz,
+                    self->samples.buf, self->timestamps.buf, capacity,
+                    cpu)) == NULL) {
+        raise_errno(-errno);
+    }
+
+    if (self->sampler == NULL) {
+        PyBuffer_Release(&self->samples);
+        PyBuffer_Release(&self->timestamps);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Stop the sampling thread and let go of the buffers
+static PyObject *Sampler_stop(Sampler *self, PyObject *unused) {
+    struct pi_i2c_sampler *sampler = self->sampler;
+
+    if (sampler == NULL) {
+        Py_RETURN_NONE;
+    }
+
+    self->sampler = NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    self->index = stop_sampler_i2c(sampler);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&self->samples);
+    PyBuffer_Release(&self->timestamps);
+
+    Py_RETURN_NONE;
+}
+
+static void Sampler_dealloc(Sampler *self) {
+    Py_XDECREF(Sampler_stop(self, NULL));
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int check_sampler(Sampler *self) {
+    if (self->sampler == NULL) {
+        PyErr_SetString(PyExc_ValueError, "sampler is stopped");
+        return -1;
+    }
+
+    return 0;
+}
+
+// The index stays readable once stopped so the last samples can be taken
+static PyObject *Sampler_get_index(Sampler *self, void *closure) {
+    if (self->sampler == NULL) {
+        return PyLong_FromUnsignedLongLong(self->index);
+    }
+
+    return PyLong_FromUnsignedLongLong(get_index_sampler_i2c(self->sampler));
+}
+
+static PyObject *Sampler_set_taken(Sampler *self, PyObject *args) {
+    unsigned long long index;
+
+    if (!PyArg_ParseTuple(args, "K", &index)) {
+        return NULL;
+    }
+
+    if (self->sampler != NULL) {
+        set_taken_sampler_i2c(self->sampler, index);
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *Sampler_statistics(Sampler *self, PyObject *unused) {
+    struct pi_i2c_sampler_statistics statistics;
+
+    if (check_sampler(self) < 0) {
+        return NULL;
+    }
+
+    statistics = get_statistics_sampler_i2c(self->sampler);
+
+    return Py_BuildValue("{sLsLsLsLsisLsLsf}",
+                         "num_samples", statistics.num_samples,
+                         "num_missed", statistics.num_missed,
+                         "num_overwritten", statistics.num_overwritten,
+                         "num_errors", statistics.num_errors,
+                         "last_error", statistics.last_error,
+                         "max_lateness_ns", statistics.max_lateness_ns,
+                         "elapsed_ns", statistics.elapsed_ns,
+                         "achieved_rate_hz", statistics.achieved_rate_hz);
+}
+
+static PyMethodDef Sampler_methods[] = {
+    {"set_taken", (PyCFunction)Sampler_set_taken, METH_VARARGS,
+     "set_taken(index)\n\n"
+     "Tell the sampler that samples before index have been taken."},
+    {"statistics", (PyCFunction)Sampler_statistics, METH_NOARGS,
+     "statistics()\n\n"
+     "Return the sampler's statistics as a dict."},
+    {"stop", (PyCFunction)Sampler_stop, METH_NOARGS,
+     "stop()\n\n"
+     "Stop the sampling thread and let go of the buffers."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Sampler_getset[] = {
+    {"index", (getter)Sampler_get_index, NULL,
+     "Samples written so far (sample i is in slot i % capacity)", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject Sampler_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pi_i2c._pi_i2c.Sampler",
+    .tp_doc = "Sampler(device_address, register_address, n_bytes, rate_hz, "
+              "samples,\n        timestamps, cpu=-1)\n\n"
+              "Thread reading registers of the default bus at a fixed rate "
+              "into\nring buffers (see start_sampler_i2c()).",
+    .tp_basicsize = sizeof(Sampler),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)Sampler_init,
+    .tp_dealloc = (destructor)Sampler_dealloc,
+    .tp_methods = Sampler_methods,
+    .tp_getset = Sampler_getset,
+};
+
+static PyMethodDef methods[] = {
+    {"read_into_i2c", read_into_i2c, METH_VARARGS,
+     "read_into_i2c(device_address, register_address, buffer)\n\n"
+     "Read len(buffer) bytes from a device's register address straight "
+     "into a\nwritable buffer. The GIL is released during the transfer."},
+    {"write_from_i2c", write_from_i2c, METH_VARARGS,
+     "write_from_i2c(device_address, register_address, buffer)\n\n"
+     "Write the bytes of a buffer to a device's register address. The GIL "
+     "is\nreleased during the transfer."},
+    {"read_batch_i2c", read_batch_i2c, METH_VARARGS,
+     "read_batch_i2c(reads, out=None)\n\n"
+     "Run a sequence of (device_address, register_address, n_bytes) reads "
+     "as\none batch, packing their bytes one after the other into out (a "
+     "new\nbytearray if None). Returns the buffer read into. The GIL is "
+     "released\nwhile the batch runs."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT, "_pi_i2c",
+    "Zero-copy reads and writes of pi_i2c with the GIL released", -1,
+    methods
+};
+
+// Build the error table from libpii2c_errno.py once
+static int load_errno_table(void) {
+    PyObject *errno_module;
+    PyObject *errno_list;
+    PyObject *entry;
+    PyObject *value;
+
+    Py_ssize_t i;
+
+    if ((errno_module = PyImport_ImportModule("pi_i2c.libpii2c_errno")) ==
+        NULL) {
+        return -1;
+    }
+
+    errno_list = PyObject_GetAttrString(errno_module, "libpii2c_errno_list");
+    Py_DECREF(errno_module);
+
+    if ((errno_list == NULL) || ((errno_table = PyDict_New()) == NULL)) {
+        Py_XDECREF(errno_list);
+        return -1;
+    }
+
+    for (i = 0; i < PyList_Size(errno_list); i++) {
+        value = PyList_GET_ITEM(errno_list, i);
+        entry = Py_BuildValue("(OO)", PyDict_GetItemString(value, "raise"),
+                              PyDict_GetItemString(value, "message"));
+
+        if ((entry == NULL) ||
+            (PyDict_SetItem(errno_table, PyDict_GetItemString(value, "value"),
+                            entry) < 0)) {
+            Py_XDECREF(entry);
+            Py_DECREF(errno_list);
+            return -1;
+        }
+
+        Py_DECREF(entry);
+    }
+
+    Py_DECREF(errno_list);
+
+    return 0;
+}
+
+PyMODINIT_FUNC PyInit__pi_i2c(void) {
+    PyObject *m;
+
+    if ((errno_table == NULL) && (load_errno_table() < 0)) {
+        return NULL;
+    }
+
+    if ((PyType_Ready(&AsyncBus_type) < 0) ||
+        (PyType_Ready(&Sampler_type) < 0) ||
+        ((m = PyModule_Create(&module)) == NULL)) {
+        return NULL;
+    }
+
+    Py_INCREF(&AsyncBus_type);
+    Py_INCREF(&Sampler_type);
+
+    if ((PyModule_AddObject(m, "AsyncBus", (PyObject *)&AsyncBus_type) < 0) ||
+        (PyModule_AddObject(m, "Sampler", (PyObject *)&Sampler_type) < 0)) {
+        Py_DECREF(&AsyncBus_type);
+        Py_DECREF(&Sampler_type);
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    return m;
+}
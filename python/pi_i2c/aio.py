@@ -0,0 +1,126 @@
+# Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+#
+# Copyright (c) 2021 Benjamin Spencer
+# =============================================================================
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+# ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+# =============================================================================
+
+import asyncio
+import collections
+
+from . import libpii2c_libraries  # Loads the libraries the native module links to
+from ._pi_i2c import AsyncBus
+from .libpii2c_header import I2C_SCAN_WRITE
+
+
+class AsyncI2C:
+    ''' Awaitable reads, writes and scans run by a native worker thread'''
+
+    def __init__(self, depth=64, cpu=-1, loop=None):
+        self._loop = asyncio.get_running_loop() if loop is None else loop
+        self._bus = AsyncBus(depth, cpu)
+
+        # Futures by the token of their request, and requests waiting for
+        # one of the pool to be put back:
+        self._futures = {}
+        self._waiting = collections.deque()
+
+        # The worker's eventfd wakes the loop; no Python thread is involved:
+        self._loop.add_reader(self._bus.fileno(), self._complete)
+
+    def _submit(self, submit, *args):
+        future = self._loop.create_future()
+
+        if self._waiting:
+            self._waiting.append((future, submit, args))
+        else:
+            try:
+                self._futures[submit(*args)] = future
+            except BlockingIOError:
+                self._waiting.append((future, submit, args))
+
+        return future
+
+    def _complete(self):
+        for token, exception, result in self._bus.poll():
+            future = self._futures.pop(token)
+
+            if future.cancelled():
+                continue
+
+            if exception is not None:
+                future.set_exception(exception)
+            else:
+                future.set_result(result)
+
+        # Submit waiting requests in order while the pool has room:
+        while self._waiting:
+            future, submit, args = self._waiting[0]
+
+            if future.cancelled():
+                self._waiting.popleft()
+                continue
+
+            try:
+                token = submit(*args)
+            except BlockingIOError:
+                break
+            except Exception as exception:
+                future.set_exception(exception)
+                token = None
+
+            self._waiting.popleft()
+
+            if token is not None:
+                self._futures[token] = future
+
+    async def read(self, device_address, register_address, n_bytes):
+        ''' Read n_bytes (at most I2C_ASYNC_MAX_BYTES) from an I2C device's register address and return them as bytes'''
+
+        return await self._submit(self._bus.submit_read, device_address, register_address, n_bytes)
+
+    async def write(self, device_address, register_address, data):
+        ''' Write the bytes of a buffer (at most I2C_ASYNC_MAX_BYTES) to an I2C device's register address'''
+
+        await self._submit(self._bus.submit_write, device_address, register_address, data)
+
+    async def scan(self, first_address=0x00, last_address=0x7F, flags=I2C_SCAN_WRITE):
+        ''' Scan a range of addresses and return a bitmap of present devices (bit N for address N)'''
+
+        return await self._submit(self._bus.submit_scan, first_address, last_address, flags)
+
+    def close(self):
+        ''' Run every request still submitted and stop the worker thread'''
+
+        self._loop.remove_reader(self._bus.fileno())
+        self._bus.close()
+
+        # Completions are dropped with the worker:
+        for future in list(self._futures.values()) + [waiting[0] for waiting in self._waiting]:
+            if not future.done():
+                future.cancel()
+
+        self._futures.clear()
+        self._waiting.clear()
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc_info):
+        self.close()
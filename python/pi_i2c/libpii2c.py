@@ -24,24 +24,35 @@
 import numpy as np
 
 import ctypes
-from ctypes import RTLD_GLOBAL
 
+from .libpii2c_libraries import libpii2c  # Loaded before the native module
+from ._pi_i2c import read_into_i2c, write_from_i2c
 from .libpii2c_errno import libpii2c_errno_list
-from .libpii2c_header import pi_i2c_statistics, pi_i2c_configs
+from .libpii2c_header import pi_i2c_statistics, pi_i2c_configs, pi_i2c_stretch_profile, pi_i2c_msg
+from .libpii2c_header import I2C_MSG_READ, I2C_MSG_NO_REGISTER
+from .libpii2c_header import I2C_SCAN_WRITE
 
-# Required dependencies:
-libpimicrosleephard = ctypes.CDLL("libpimicrosleephard.so", mode=RTLD_GLOBAL)
-libpilwgpio = ctypes.CDLL("libpilwgpio.so", mode=RTLD_GLOBAL)
-
-libpii2c = ctypes.CDLL("libpii2c.so", mode=RTLD_GLOBAL)
+# Error numbers as returned by C (negative) to their entry:
+libpii2c_errno_table = {-err["value"]: err for err in libpii2c_errno_list}
 
 # Define argument types for automatic type checking:
 libpii2c.config_i2c.argtypes = (ctypes.c_uint, ctypes.c_uint, ctypes.c_uint)
+libpii2c.config_i2c_dev.argtypes = (ctypes.c_uint,)
+libpii2c.set_timing_mode_i2c.argtypes = (ctypes.c_int,)
+libpii2c.calibrate_i2c.argtypes = (ctypes.c_char_p,)
+libpii2c.set_stretch_timeout_i2c.argtypes = (ctypes.c_uint, ctypes.c_uint)
+libpii2c.set_stretch_policy_i2c.argtypes = (ctypes.c_int,)
+libpii2c.set_device_stretch_policy_i2c.argtypes = (ctypes.c_uint, ctypes.c_int)
+libpii2c.get_stretch_profile_i2c.argtypes = (ctypes.c_uint, ctypes.c_uint,
+                                             ctypes.POINTER(pi_i2c_stretch_profile))
+libpii2c.export_stretch_profiles_i2c.argtypes = (ctypes.c_char_p,)
+libpii2c.set_read_coalescing_i2c.argtypes = (ctypes.c_int,)
+libpii2c.get_coalesced_reads_i2c.argtypes = (ctypes.c_uint, ctypes.c_uint, ctypes.c_uint)
 libpii2c.scan_bus_i2c.argtypes = (ctypes.POINTER(ctypes.c_int),)
-libpii2c.write.argtypes = (ctypes.c_uint, ctypes.c_uint,
-                           ctypes.POINTER(ctypes.c_int), ctypes.c_uint)
-libpii2c.read.argtypes = (ctypes.c_uint, ctypes.c_uint,
-                          ctypes.POINTER(ctypes.c_int), ctypes.c_uint)
+libpii2c.scan_range_i2c.argtypes = (ctypes.c_uint, ctypes.c_uint,
+                                    ctypes.POINTER(ctypes.c_ulonglong), ctypes.c_int,
+                                    ctypes.POINTER(ctypes.c_ulonglong))
+libpii2c.transfer_i2c.argtypes = (ctypes.POINTER(pi_i2c_msg), ctypes.c_uint)
 
 # Return the structure from C by value (and not reference/pointer)
 libpii2c.get_statistics_i2c.restype = pi_i2c_statistics
@@ -50,9 +61,9 @@ libpii2c.get_configs_i2c.restype = pi_i2c_configs
 
 def check_errno(result):
     # Check returned errno value and raise exception if required:
-    for err in libpii2c_errno_list:
-        if -err["value"] == result:
-            raise err["raise"](err["message"])
+    if result < 0 and result in libpii2c_errno_table:
+        err = libpii2c_errno_table[result]
+        raise err["raise"](err["message"])
 
 
 # Wrapper for config_i2c() function
@@ -65,6 +76,14 @@ def config_i2c(sda, scl, speed_grade):
     check_errno(errno)
 
 
+# Wrapper for config_i2c_dev() function
+def config_i2c_dev(adapter):
+    ''' Configure Pi I2C onto kernel I2C adapter /dev/i2c-N'''
+
+    errno = libpii2c.config_i2c_dev(ctypes.c_uint(int(adapter)))
+    check_errno(errno)
+
+
 # Wrapper for scan_bus_i2c()
 def scan_bus_i2c():
     ''' Scan I2C bus for present devices and return an address book '''
@@ -80,6 +99,24 @@ def scan_bus_i2c():
     return address_book
 
 
+# Wrapper for scan_range_i2c()
+def scan_range_i2c(first_address=0x00, last_address=0x7F, mask=None, flags=I2C_SCAN_WRITE):
+    ''' Scan a range of addresses and return a bitmap of present devices (bit N for address N)'''
+
+    # Address maps are two 64-bit words:
+    address_map = (ctypes.c_ulonglong * 2)()
+
+    if mask is not None:
+        mask = (ctypes.c_ulonglong * 2)(mask & 0xFFFFFFFFFFFFFFFF, (mask >> 64) & 0xFFFFFFFFFFFFFFFF)
+
+    ret = libpii2c.scan_range_i2c(ctypes.c_uint(int(first_address)),
+                                  ctypes.c_uint(int(last_address)), mask,
+                                  ctypes.c_int(int(flags)), address_map)
+    check_errno(ret)
+
+    return address_map[0] | (address_map[1] << 64)
+
+
 # Wrapper for write_i2c()
 def write_i2c(device_address, register_address, data, n_bytes):
     ''' Write variable number of bytes to an I2C device's register address'''
@@ -95,30 +132,27 @@ def write_i2c(device_address, register_address, data, n_bytes):
 
     # Constrain input:
     # - Int if n_bytes == 1 else array
-    # - Type numpy array (results in easy conversion to pointer to int array)
+    # - Type numpy array or bytes (passed to C as a buffer)
     # - Size equal to n_bytes
     if n_bytes == 1:
         if not isinstance(data, int):
             raise TypeError("Data input must be an int if number of bytes equals 1")
 
-        # C is expecting a pointer so cast integer to pointer to integer:
-        data = np.array([data], dtype=int)
-        data_pointer = data.ctypes.data_as(ctypes.POINTER(ctypes.c_int))
+        # C is expecting a buffer so cast integer to a byte array:
+        data = np.array([data & 0xFF], dtype=np.uint8)
     else:
-        if not isinstance(data, (np.ndarray, np.generic)):
-            raise TypeError("Input array must be of NumPy array type")
+        if isinstance(data, (bytes, bytearray)):
+            data = np.frombuffer(data, dtype=np.uint8)
+        elif not isinstance(data, (np.ndarray, np.generic)):
+            raise TypeError("Input array must be of NumPy array or bytes type")
 
         if data.shape != (n_bytes,):
             raise TypeError("Input array must be of shape (n_bytes,0)")
 
-        # C is expecting a pointer to an integer array:
-        data = data.astype(int)
-        data_pointer = data.ctypes.data_as(ctypes.POINTER(ctypes.c_int))
+        # C is expecting a byte array (no copy if it already is one):
+        data = np.ascontiguousarray(data, dtype=np.uint8)
 
-    errno = libpii2c.write_i2c(ctypes.c_uint(int(device_address)),
-                               ctypes.c_uint(int(register_address)), data_pointer,
-                               ctypes.c_uint(int(n_bytes)))
-    check_errno(errno)
+    write_from_i2c(device_address, register_address, data)
 
 
 # Wrapper for scan_bus_i2c()
@@ -134,20 +168,63 @@ def read_i2c(device_address, register_address, n_bytes):
     if not isinstance(n_bytes, int):
         raise TypeError("Number of bytes must be an int")
 
-    # C is expecting a pointer to an integer array:
-    data = np.zeros((n_bytes,), dtype=int)
-    data_pointer = data.ctypes.data_as(ctypes.POINTER(ctypes.c_int))
+    # Bytes are read straight into the array:
+    data = np.empty((n_bytes,), dtype=np.uint8)
 
-    errno = libpii2c.read_i2c(ctypes.c_uint(int(device_address)),
-                              ctypes.c_uint(int(register_address)), data_pointer,
-                              ctypes.c_uint(int(n_bytes)))
-    check_errno(errno)
+    read_into_i2c(device_address, register_address, data)
 
     if n_bytes == 1:
         return int(data[0])
     else:
         return data
 
+def transfer_i2c(segments):
+    '''Run message segments as one I2C transaction joined by repeated STARTs
+
+    Each segment is a (device_address, register_address, flags, data) tuple.
+    register_address is None for segments without one. data is the number of
+    bytes to read for I2C_MSG_READ segments and a NumPy array of bytes to
+    write otherwise. Returns a list of the bytes read by each read segment'''
+
+    msgs = (pi_i2c_msg * len(segments))()
+    buffers = []
+
+    for i, (device_address, register_address, flags, data) in enumerate(segments):
+        if not isinstance(device_address, int):
+            raise TypeError("Device address must be an int")
+
+        if register_address is None:
+            register_address = 0
+            flags |= I2C_MSG_NO_REGISTER
+        elif not isinstance(register_address, int):
+            raise TypeError("Register address must be an int or None")
+
+        # C is expecting a pointer to an integer array (kept alive until
+        # the transfer is done):
+        if flags & I2C_MSG_READ:
+            if not isinstance(data, int):
+                raise TypeError("Read segments take the number of bytes to read")
+
+            buffer = np.zeros((data,), dtype=np.intc)
+        else:
+            if not isinstance(data, (np.ndarray, np.generic)):
+                raise TypeError("Write segments take a NumPy array of bytes")
+
+            buffer = np.ascontiguousarray(data, dtype=np.intc)
+
+        buffers.append(buffer)
+
+        msgs[i].device_address = device_address
+        msgs[i].register_address = register_address
+        msgs[i].flags = flags
+        msgs[i].data = buffer.ctypes.data_as(ctypes.POINTER(ctypes.c_int))
+        msgs[i].n_bytes = buffer.shape[0]
+
+    errno = libpii2c.transfer_i2c(msgs, ctypes.c_uint(len(segments)))
+    check_errno(errno)
+
+    return [buffer for buffer, msg in zip(buffers, msgs) if msg.flags & I2C_MSG_READ]
+
 def reset_i2c():
     '''Reset the I2C bus by issuing 9 clock pulses'''
 
@@ -163,6 +240,77 @@ def get_statistics_i2c():
 
     return statistics_dict
 
+def set_timing_mode_i2c(mode):
+    '''Choose relative or deadline timing of clock edges'''
+
+    errno = libpii2c.set_timing_mode_i2c(ctypes.c_int(int(mode)))
+    check_errno(errno)
+
+def calibrate_i2c(cache_path=None):
+    '''Measure the I2C lines (or look them up in a cache file) and derive timings from them'''
+
+    if cache_path is not None:
+        cache_path = cache_path.encode()
+
+    errno = libpii2c.calibrate_i2c(cache_path)
+    check_errno(errno)
+
+def set_stretch_timeout_i2c(device_address, timeout_us):
+    '''Set how long a device may stretch the clock for (0 for the default)'''
+
+    errno = libpii2c.set_stretch_timeout_i2c(ctypes.c_uint(int(device_address)),
+                                             ctypes.c_uint(int(timeout_us)))
+    check_errno(errno)
+
+def set_stretch_policy_i2c(policy):
+    '''Choose which clock pulses are checked for clock stretching'''
+
+    errno = libpii2c.set_stretch_policy_i2c(ctypes.c_int(int(policy)))
+    check_errno(errno)
+
+def set_device_stretch_policy_i2c(device_address, policy):
+    '''Choose which clock pulses are checked for clock stretching by a device'''
+
+    errno = libpii2c.set_device_stretch_policy_i2c(ctypes.c_uint(int(device_address)),
+                                                   ctypes.c_int(int(policy)))
+    check_errno(errno)
+
+def get_stretch_profile_i2c(device_address, phase):
+    '''Return a dictionary of clock stretching seen at one point of the messages to a device'''
+
+    profile_struct = pi_i2c_stretch_profile()
+
+    errno = libpii2c.get_stretch_profile_i2c(ctypes.c_uint(int(device_address)),
+                                             ctypes.c_uint(int(phase)),
+                                             ctypes.byref(profile_struct))
+    check_errno(errno)
+
+    profile_dict = dict((field, getattr(profile_struct, field)) for field, _ in profile_struct._fields_)
+
+    return profile_dict
+
+def export_stretch_profiles_i2c(path):
+    '''Write the clock stretching profiles of every device to a text file'''
+
+    errno = libpii2c.export_stretch_profiles_i2c(path.encode())
+    check_errno(errno)
+
+def set_read_coalescing_i2c(enable):
+    '''Let identical reads from different threads share one transaction'''
+
+    errno = libpii2c.set_read_coalescing_i2c(ctypes.c_int(1 if enable else 0))
+    check_errno(errno)
+
+def get_coalesced_reads_i2c(device_address, register_address, n_bytes):
+    '''Return how many reads of a register were served by another thread's transaction'''
+
+    ret = libpii2c.get_coalesced_reads_i2c(ctypes.c_uint(int(device_address)),
+                                           ctypes.c_uint(int(register_address)),
+                                           ctypes.c_uint(int(n_bytes)))
+    check_errno(ret)
+
+    return ret
+
 def get_configs_i2c():
     '''Return a dictionary of internal configurations of Pi I2C'''
 
@@ -73,6 +73,10 @@ class EINVALError(Exception):
     pass
 
 
+class ENOTSUPError(Exception):
+    pass
+
+
 class MAP_FAILEDError(Exception):
     pass
 
@@ -98,5 +102,6 @@ libpii2c_errno_list = [
      "error occurring during STOP condition."},
     {"errno": "EdeviceHUNG", "value": 150, "raise": EdeviceHUNGError, "message": "Device forcing SDA line low"},
     {"errno": "EINVAL", "value": 22, "raise": EINVALError, "message": "Invalid argument"},
+    {"errno": "ENOTSUP", "value": 95, "raise": ENOTSUPError, "message": "Operation not supported"},
     {"errno": "MAP_FAILED", "value": 1, "raise": MAP_FAILEDError,
      "message": "Memory map failed (most likely due to permissions)"}]
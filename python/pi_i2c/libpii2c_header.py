@@ -26,6 +26,40 @@ import ctypes
 # I2C speed grades define in bits/second:
 I2C_STANDARD_MODE = 100e3
 I2C_FULL_SPEED = 400e3
+I2C_FAST_MODE_PLUS = 1000e3
+
+# Scan flags:
+I2C_SCAN_WRITE = 0x0
+I2C_SCAN_READ = 0x1
+I2C_SCAN_RESERVED = 0x2
+I2C_SCAN_STOP = 0x4
+
+# Bus timing modes:
+I2C_TIMING_RELATIVE = 0
+I2C_TIMING_DEADLINE = 1
+
+# Clock stretching policies:
+I2C_STRETCH_DEFAULT = 0
+I2C_STRETCH_EVERY_BIT = 1
+I2C_STRETCH_ACK_ONLY = 2
+I2C_STRETCH_NEVER = 3
+I2C_STRETCH_LEARNED = 4
+
+# Points of a message clock stretching is profiled at:
+I2C_PHASE_BIT = 0
+I2C_PHASE_ADDRESS = 1
+I2C_PHASE_REGISTER = 2
+I2C_PHASE_READ_ADDRESS = 3
+I2C_PHASE_WRITE_DATA = 4
+I2C_PHASE_READ_DATA = 5
+
+# Message segment flags:
+I2C_MSG_READ = 0x1
+I2C_MSG_NO_REGISTER = 0x2
+I2C_MSG_NO_ACK_LAST = 0x4
+
+# Most bytes an asynchronous read or write carries:
+I2C_ASYNC_MAX_BYTES = 32
 
 
 # Structure definitions
@@ -38,11 +72,38 @@ class pi_i2c_statistics(ctypes.Structure):
                 ('num_unknown_bus_errors', ctypes.c_int), ('num_bus_lockups', ctypes.c_int),
                 ('num_failed_start_cond', ctypes.c_int), ('num_failed_stop_cond', ctypes.c_int),
                 ('num_device_hung', ctypes.c_int), ('num_clock_stretching_timeouts', ctypes.c_int),
-                ('num_clock_stretch', ctypes.c_int)]
+                ('num_clock_stretch', ctypes.c_int),
+                ('num_late_edges', ctypes.c_int), ('max_edge_lateness_ns', ctypes.c_int),
+                ('last_edge_lateness_ns', ctypes.c_int),
+                ('num_clock_stretch_sleeps', ctypes.c_int), ('last_clock_stretch_ns', ctypes.c_int),
+                ('max_clock_stretch_ns', ctypes.c_int), ('total_clock_stretch_ns', ctypes.c_longlong),
+                ('num_predicted_stretches', ctypes.c_int), ('num_mispredicted_stretches', ctypes.c_int),
+                ('num_line_reads_avoided', ctypes.c_int), ('num_coalesced_reads', ctypes.c_int),
+                ('last_scan_ns', ctypes.c_longlong),
+                ('num_line_errors', ctypes.c_int), ('last_line_error', ctypes.c_int)]
+
+
+class pi_i2c_stretch_profile(ctypes.Structure):
+    _fields_ = [('num_samples', ctypes.c_longlong), ('num_stretched', ctypes.c_longlong),
+                ('min_stretch_ns', ctypes.c_int), ('max_stretch_ns', ctypes.c_int),
+                ('last_stretch_ns', ctypes.c_int), ('predicted_ns', ctypes.c_int),
+                ('total_stretch_ns', ctypes.c_longlong)]
+
+
+class pi_i2c_msg(ctypes.Structure):
+    _fields_ = [('device_address', ctypes.c_uint), ('register_address', ctypes.c_uint),
+                ('flags', ctypes.c_uint), ('data', ctypes.POINTER(ctypes.c_int)),
+                ('n_bytes', ctypes.c_uint)]
 
 
 class pi_i2c_configs(ctypes.Structure):
     _fields_ = [('scl_t_low_sleep_us', ctypes.c_int), ('scl_t_high_sleep_us', ctypes.c_int),
                 ('scl_actual_clock_frequency_hz', ctypes.c_float),
                 ('min_t_hdsta_sleep_us', ctypes.c_int), ('min_t_susta_sleep_us', ctypes.c_int),
-                ('min_t_susto_sleep_us', ctypes.c_int), ('min_t_buf_sleep_us', ctypes.c_int)]
+                ('min_t_susto_sleep_us', ctypes.c_int), ('min_t_buf_sleep_us', ctypes.c_int),
+                ('scl_t_low_sleep_ns', ctypes.c_int), ('scl_t_high_sleep_ns', ctypes.c_int),
+                ('scl_response_time_ns', ctypes.c_int),
+                ('min_t_hdsta_sleep_ns', ctypes.c_int), ('min_t_susta_sleep_ns', ctypes.c_int),
+                ('min_t_susto_sleep_ns', ctypes.c_int), ('min_t_buf_sleep_ns', ctypes.c_int),
+                ('timing_mode', ctypes.c_int), ('stretch_policy', ctypes.c_int),
+                ('calibrated', ctypes.c_int), ('line_call_ns', ctypes.c_int)]
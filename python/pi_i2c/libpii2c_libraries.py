@@ -0,0 +1,33 @@
+# Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+#
+# Copyright (c) 2021 Benjamin Spencer
+# =============================================================================
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+# ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+# =============================================================================
+
+import ctypes
+from ctypes import RTLD_GLOBAL
+
+# Loaded globally ahead of libpii2c.so, which leaves its dependencies for
+# the process to resolve; the native module links to libpii2c.so and is
+# imported once this module has been:
+libpimicrosleephard = ctypes.CDLL("libpimicrosleephard.so", mode=RTLD_GLOBAL)
+libpilwgpio = ctypes.CDLL("libpilwgpio.so", mode=RTLD_GLOBAL)
+
+libpii2c = ctypes.CDLL("libpii2c.so", mode=RTLD_GLOBAL)
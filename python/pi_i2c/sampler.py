@@ -0,0 +1,98 @@
+# Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+#
+# Copyright (c) 2021 Benjamin Spencer
+# =============================================================================
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+# ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+# =============================================================================
+
+import numpy as np
+
+from . import libpii2c_libraries  # Loads the libraries the native module links to
+from ._pi_i2c import Sampler
+
+
+class SamplerI2C:
+    ''' Registers read at a fixed rate by a native thread into NumPy ring buffers'''
+
+    def __init__(self, device_address, register_address, n_bytes, rate_hz, capacity=1024,
+                 samples=None, timestamps=None, cpu=-1):
+        # Ring buffers of capacity samples and their times (nano seconds):
+        if samples is None:
+            samples = np.zeros((capacity, n_bytes), dtype=np.uint8)
+
+        if timestamps is None:
+            timestamps = np.zeros(len(samples), dtype=np.int64)
+
+        self.samples = samples
+        self.timestamps = timestamps
+        self.capacity = len(timestamps)
+
+        # Samples taken by drain() and those written over before it could:
+        self.taken = 0
+        self.num_lost = 0
+
+        self._sampler = Sampler(device_address, register_address, n_bytes, rate_hz,
+                                samples, timestamps, cpu)
+
+    @property
+    def index(self):
+        ''' Samples written so far (sample i is in slot i % capacity)'''
+
+        return self._sampler.index
+
+    def drain(self):
+        ''' Take the samples written since the last drain and return copies of their (timestamps, samples)'''
+
+        index = self._sampler.index
+        first = max(self.taken, index - self.capacity)
+
+        slots = np.arange(first, index) % self.capacity
+        timestamps = self.timestamps[slots]
+        samples = self.samples[slots]
+
+        # Drop the samples written over while they were copied (the slot of
+        # the sample being read is written before the index moves on):
+        overwritten = min(self._sampler.index - self.capacity + 1 - first, len(slots))
+
+        if overwritten > 0:
+            timestamps = timestamps[overwritten:]
+            samples = samples[overwritten:]
+            first += overwritten
+
+        self.num_lost += first - self.taken
+        self.taken = index
+        self._sampler.set_taken(index)
+
+        return timestamps, samples
+
+    def get_statistics(self):
+        ''' Return samples written, sample times missed, samples written over, read errors, lateness and achieved rate'''
+
+        return self._sampler.statistics()
+
+    def stop(self):
+        ''' Stop the sampling thread. Samples not yet drained stay in the ring buffers'''
+
+        self._sampler.stop()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.stop()
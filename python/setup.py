@@ -21,7 +21,13 @@
 # OTHER DEALINGS IN THE SOFTWARE.
 # =============================================================================
 
-from setuptools import setup
+from setuptools import setup, Extension
+
+# Native module moving data to and from the bus (links the installed
+# libpii2c.so):
+pi_i2c_module = Extension('pi_i2c._pi_i2c',
+                          sources=['pi_i2c/_pi_i2c.c'],
+                          libraries=['pii2c'])
 
 setup(
     name='pi_i2c',
@@ -29,6 +35,7 @@ setup(
     author='Benjamin Spencer',
     author_email='spencerbl77@yahoo.com',
     packages=['pi_i2c'],
+    ext_modules=[pi_i2c_module],
     url='https://github.com/besp9510/pi_i2c',
     description='Comprehensive I2C library for the Raspberry Pi [Now in Python]',
     install_requires=[
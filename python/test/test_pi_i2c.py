@@ -24,6 +24,8 @@
 # This is the I2C library
 import pi_i2c
 
+import asyncio
+import time
 import numpy as np
 
 
@@ -104,6 +106,72 @@ def test_read_i2c_multiple_bytes(device_address, register_address, n_bytes):
     print("Test complete")
 
 
+def test_read_batch_i2c(device_address, register_address, n_bytes):
+    print("Testing read_into_i2c() and read_batch_i2c()")
+
+    print("device_address = 0x%X" % device_address)
+    print("register_address = 0x%X" % register_address)
+    print("n_bytes = %d" % n_bytes)
+
+    read_data = bytearray(n_bytes)
+    pi_i2c.read_into_i2c(device_address, register_address, read_data)
+
+    print("read_into_i2c() has returned %s" % read_data.hex())
+
+    # The same read twice in one batch:
+    read_data = pi_i2c.read_batch_i2c([(device_address, register_address, n_bytes),
+                                       (device_address, register_address, n_bytes)])
+
+    print("read_batch_i2c() has returned %s" % read_data.hex())
+    print("Test complete")
+
+
+def test_async_i2c(device_address, register_address, n_bytes):
+    print("Testing AsyncI2C")
+
+    print("device_address = 0x%X" % device_address)
+    print("register_address = 0x%X" % register_address)
+    print("n_bytes = %d" % n_bytes)
+
+    async def run():
+        async with pi_i2c.AsyncI2C() as bus:
+            # Every read in flight at once, then a scan behind them:
+            read_data = await asyncio.gather(*[bus.read(device_address, register_address + i, n_bytes)
+                                               for i in range(0, 8)])
+            address_map = await bus.scan()
+
+        return read_data, address_map
+
+    read_data, address_map = asyncio.run(run())
+
+    for i in range(0, len(read_data)):
+        print("read %d has returned %s" % (i, read_data[i].hex()))
+
+    print("scan() has returned 0x%X" % address_map)
+    print("Test complete")
+
+
+def test_sampler_i2c(device_address, register_address, n_bytes):
+    print("Testing SamplerI2C")
+
+    print("device_address = 0x%X" % device_address)
+    print("register_address = 0x%X" % register_address)
+    print("n_bytes = %d" % n_bytes)
+
+    # A tenth of a second at 100 Hz:
+    with pi_i2c.SamplerI2C(device_address, register_address, n_bytes, 100, capacity=16) as sampler:
+        time.sleep(0.1)
+        statistics = sampler.get_statistics()
+
+    timestamps, samples = sampler.drain()
+
+    for i in range(0, len(samples)):
+        print("sample at %d ns = %s" % (timestamps[i], samples[i].tobytes().hex()))
+
+    print(statistics)
+    print("Test complete")
+
+
 def test_get_configs_i2c():
     print("Testing get_configs_i2c()")
 
@@ -170,5 +238,14 @@ test_read_i2c_one_byte(read_device_address, read_register_address, read_bytes_in
 # Test I2C read with multiple bytes:
 test_read_i2c_multiple_bytes(read_device_address, read_register_address, read_bytes_array)
 
+# Test I2C reads into a buffer and as a batch:
+test_read_batch_i2c(read_device_address, read_register_address, read_bytes_array)
+
+# Test I2C reads and a scan from an event loop:
+test_async_i2c(read_device_address, read_register_address, read_bytes_array)
+
+# Test sampling a register at a fixed rate:
+test_sampler_i2c(read_device_address, read_register_address, read_bytes_array)
+
 # Test get statistics following all of the test calls:
 test_get_statistics_i2c()
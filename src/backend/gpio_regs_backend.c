@@ -0,0 +1,430 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Direct GPIO register backend
+//
+// Maps the GPIO register block once (/dev/gpiomem, no root required) and
+// drives SDA and SCL by storing to the GPFSEL registers directly. Open-drain
+// is emulated like with pi_lw_gpio, switching a pin between output (cleared)
+// and input (released to the pull-up), but the function select words for
+// every state of the two lines (both released, SDA low, SCL low, both low)
+// are worked out at open. Each edge is then a single store of a precomputed
+// word rather than a read-modify-write of the register through
+// gpio_set_mode(), and the clear registers are written once at open.
+//
+// Precomputed words also hold the function select bits of the other pins of
+// the register as they were at open, so those pins must not change mode
+// while the bus is open. A register is only handed to one bus at a time, and
+// not to a bus on the pi_lw_gpio backend either: its read-modify-writes
+// would be undone by the next precomputed word stored.
+
+// Include C standard libraries:
+#include <stdlib.h> // C Standard library (context allocation)
+#include <stdint.h> // C Standard integer types (32-bit registers)
+#include <time.h>   // C Standard get and manipulate time library
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <fcntl.h>    // File control (open)
+#include <unistd.h>   // Symbolic constants and types library (close)
+#include <sys/mman.h> // Memory management (mmap)
+#include <pthread.h>  // POSIX threads (GPFSEL register claims)
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "spin_delay.h"               // Calibrated nano second delays
+#include "gpio_regs_backend.h"        // GPIO register layout and claims
+
+// Line states indexing the precomputed words (bit set for a released line):
+#define GPIO_REGS_SDA_BIT 0x1
+#define GPIO_REGS_SCL_BIT 0x2
+#define GPIO_REGS_IDLE (GPIO_REGS_SDA_BIT | GPIO_REGS_SCL_BIT)
+
+struct gpio_regs_ctx {
+    volatile uint32_t *regs; // GPIO register block
+    int mapped;              // Block mapped by open (unmapped at close)
+
+    unsigned int sda_gpio_pin;
+    unsigned int scl_gpio_pin;
+
+    // GPFSEL registers of each line and the word to store into them for
+    // every line state:
+    volatile uint32_t *sda_fsel;
+    volatile uint32_t *scl_fsel;
+    uint32_t sda_words[4];
+    uint32_t scl_words[4];
+
+    // GPLEV registers and bits of each line:
+    volatile uint32_t *sda_lev;
+    volatile uint32_t *scl_lev;
+    uint32_t sda_mask;
+    uint32_t scl_mask;
+
+    unsigned int state; // GPIO_REGS_* bits of the released lines
+};
+
+// GPFSEL registers claimed by open buses and bus groups, and how many open
+// pi_lw_gpio buses switch pin modes within each register:
+static pthread_mutex_t claim_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int fsel_claimed;
+static unsigned int fsel_users[GPFSEL_REGISTERS];
+
+// GPFSEL registers with a pi_lw_gpio bus in them (caller holds claim_lock)
+static unsigned int fsel_used(void) {
+    unsigned int used = 0;
+    unsigned int i;
+
+    for (i = 0; i < GPFSEL_REGISTERS; i++) {
+        if (fsel_users[i] > 0) {
+            used |= 1U << i;
+        }
+    }
+
+    return used;
+}
+
+// Claim a set of GPFSEL registers (bit N for GPFSEL N). Returns -EBUSY if a
+// register is already used by another bus
+int claim_gpio_regs(unsigned int fsel_registers) {
+    int ret = 0;
+
+    pthread_mutex_lock(&claim_lock);
+
+    if ((fsel_claimed | fsel_used()) & fsel_registers) {
+        ret = -EBUSY;
+    } else {
+        fsel_claimed |= fsel_registers;
+    }
+
+    pthread_mutex_unlock(&claim_lock);
+
+    return ret;
+}
+
+void unclaim_gpio_regs(unsigned int fsel_registers) {
+    pthread_mutex_lock(&claim_lock);
+    fsel_claimed &= ~fsel_registers;
+    pthread_mutex_unlock(&claim_lock);
+}
+
+// Use a set of GPFSEL registers through read-modify-writes (pi_lw_gpio).
+// Such buses may share a register with each other but not with a claim.
+// Returns -EBUSY if a register is claimed
+int use_gpio_regs(unsigned int fsel_registers) {
+    unsigned int i;
+    int ret = 0;
+
+    pthread_mutex_lock(&claim_lock);
+
+    if (fsel_claimed & fsel_registers) {
+        ret = -EBUSY;
+    } else {
+        for (i = 0; i < GPFSEL_REGISTERS; i++) {
+            if (fsel_registers & (1U << i)) {
+                fsel_users[i]++;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&claim_lock);
+
+    return ret;
+}
+
+void unuse_gpio_regs(unsigned int fsel_registers) {
+    unsigned int i;
+
+    pthread_mutex_lock(&claim_lock);
+
+    for (i = 0; i < GPFSEL_REGISTERS; i++) {
+        if (fsel_registers & (1U << i)) {
+            fsel_users[i]--;
+        }
+    }
+
+    pthread_mutex_unlock(&claim_lock);
+}
+
+// Map the GPIO register block through /dev/gpiomem
+int map_gpio_regs(volatile uint32_t **regs) {
+    void *block;
+
+    int fd;
+    int ret;
+
+    if ((fd = open(GPIO_REGS_PATH, O_RDWR | O_SYNC | O_CLOEXEC)) < 0) {
+        return -errno;
+    }
+
+    block = mmap(NULL, GPIO_REGS_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+
+    ret = (block == MAP_FAILED) ? -errno : 0;
+
+    // Mapping stays valid once the file is closed:
+    close(fd);
+
+    if (ret == 0) {
+        *regs = block;
+    }
+
+    return ret;
+}
+
+void unmap_gpio_regs(volatile uint32_t *regs) {
+    munmap((void *) regs, GPIO_REGS_BLOCK_SIZE);
+}
+
+// Function select bits of a pin set to output when its line is cleared
+static inline uint32_t fsel_bits(unsigned int gpio, unsigned int state,
+                                 unsigned int released_bit) {
+    if (state & released_bit) {
+        return GPFSEL_INPUT << ((gpio % GPFSEL_PINS_PER_REGISTER) *
+                                GPFSEL_BITS);
+    }
+
+    return GPFSEL_OUTPUT << ((gpio % GPFSEL_PINS_PER_REGISTER) * GPFSEL_BITS);
+}
+
+// Work out the words to store into the GPFSEL registers for every state of
+// the lines. SDA and SCL sharing a register get words setting both pins
+static void precompute_words(struct gpio_regs_ctx *gpio) {
+    unsigned int sda = gpio->sda_gpio_pin;
+    unsigned int scl = gpio->scl_gpio_pin;
+    unsigned int state;
+
+    uint32_t sda_mask = GPFSEL_MASK << ((sda % GPFSEL_PINS_PER_REGISTER) *
+                                        GPFSEL_BITS);
+    uint32_t scl_mask = GPFSEL_MASK << ((scl % GPFSEL_PINS_PER_REGISTER) *
+                                        GPFSEL_BITS);
+
+    // Other pins of the registers keep their function:
+    uint32_t sda_base = *gpio->sda_fsel & ~sda_mask;
+    uint32_t scl_base = *gpio->scl_fsel & ~scl_mask;
+
+    if (gpio->sda_fsel == gpio->scl_fsel) {
+        sda_base &= ~scl_mask;
+        scl_base = sda_base;
+    }
+
+    for (state = 0; state < 4; state++) {
+        gpio->sda_words[state] = sda_base |
+                                 fsel_bits(sda, state, GPIO_REGS_SDA_BIT);
+        gpio->scl_words[state] = scl_base |
+                                 fsel_bits(scl, state, GPIO_REGS_SCL_BIT);
+
+        if (gpio->sda_fsel == gpio->scl_fsel) {
+            gpio->sda_words[state] |= fsel_bits(scl, state,
+                                                GPIO_REGS_SCL_BIT);
+            gpio->scl_words[state] = gpio->sda_words[state];
+        }
+    }
+}
+
+// Backend argument is the register block to use (e.g. memory standing in
+// for it), or NULL to map /dev/gpiomem. SDA and SCL are BCM pin numbers
+static int gpio_regs_open(void **ctx, unsigned int sda, unsigned int scl,
+                          void *arg) {
+    struct gpio_regs_ctx *gpio;
+
+    int ret;
+
+    if ((sda > GPIO_REGS_MAX_PIN) || (scl > GPIO_REGS_MAX_PIN) ||
+        (sda == scl)) {
+        return -EINVAL;
+    }
+
+    if ((ret = claim_gpio_regs(fsel_registers(sda, scl))) < 0) {
+        return ret;
+    }
+
+    if ((gpio = calloc(1, sizeof(*gpio))) == NULL) {
+        unclaim_gpio_regs(fsel_registers(sda, scl));
+        return -ENOMEM;
+    }
+
+    if (arg != NULL) {
+        gpio->regs = arg;
+    } else {
+        if ((ret = map_gpio_regs(&gpio->regs)) < 0) {
+            unclaim_gpio_regs(fsel_registers(sda, scl));
+            free(gpio);
+            return ret;
+        }
+
+        gpio->mapped = 1;
+    }
+
+    gpio->sda_gpio_pin = sda;
+    gpio->scl_gpio_pin = scl;
+
+    gpio->sda_fsel = &gpio->regs[GPIO_REGS_GPFSEL +
+                                 sda / GPFSEL_PINS_PER_REGISTER];
+    gpio->scl_fsel = &gpio->regs[GPIO_REGS_GPFSEL +
+                                 scl / GPFSEL_PINS_PER_REGISTER];
+    gpio->sda_lev = &gpio->regs[GPIO_REGS_GPLEV + sda / 32];
+    gpio->scl_lev = &gpio->regs[GPIO_REGS_GPLEV + scl / 32];
+    gpio->sda_mask = (uint32_t) 1 << (sda % 32);
+    gpio->scl_mask = (uint32_t) 1 << (scl % 32);
+
+    precompute_words(gpio);
+
+    // Release both lines (bus IDLE) then ensure that output mode means that
+    // the GPIO is cleared. The output latch holds its value while the pin is
+    // an input so this only needs doing once rather than on every edge:
+    gpio->state = GPIO_REGS_IDLE;
+    *gpio->sda_fsel = gpio->sda_words[GPIO_REGS_IDLE];
+    *gpio->scl_fsel = gpio->scl_words[GPIO_REGS_IDLE];
+
+    if (gpio->sda_lev == gpio->scl_lev) {
+        gpio->regs[GPIO_REGS_GPCLR + sda / 32] = gpio->sda_mask |
+                                                 gpio->scl_mask;
+    } else {
+        gpio->regs[GPIO_REGS_GPCLR + sda / 32] = gpio->sda_mask;
+        gpio->regs[GPIO_REGS_GPCLR + scl / 32] = gpio->scl_mask;
+    }
+
+    calibrate_spin_delay();
+
+    *ctx = gpio;
+
+    return 0;
+}
+
+static void gpio_regs_close(void *ctx) {
+    struct gpio_regs_ctx *gpio = ctx;
+
+    // Hand the lines back released:
+    *gpio->sda_fsel = gpio->sda_words[GPIO_REGS_IDLE];
+    *gpio->scl_fsel = gpio->scl_words[GPIO_REGS_IDLE];
+
+    unclaim_gpio_regs(fsel_registers(gpio->sda_gpio_pin,
+                                     gpio->scl_gpio_pin));
+
+    if (gpio->mapped) {
+        unmap_gpio_regs(gpio->regs);
+    }
+
+    free(gpio);
+}
+
+// Each edge stores the precomputed word for the new state of the lines:
+static void gpio_regs_clear_line(void *ctx, unsigned int gpio_pin) {
+    struct gpio_regs_ctx *gpio = ctx;
+
+    if (gpio_pin == gpio->sda_gpio_pin) {
+        gpio->state &= ~GPIO_REGS_SDA_BIT;
+        *gpio->sda_fsel = gpio->sda_words[gpio->state];
+    } else {
+        gpio->state &= ~GPIO_REGS_SCL_BIT;
+        *gpio->scl_fsel = gpio->scl_words[gpio->state];
+    }
+}
+
+static void gpio_regs_release_line(void *ctx, unsigned int gpio_pin) {
+    struct gpio_regs_ctx *gpio = ctx;
+
+    if (gpio_pin == gpio->sda_gpio_pin) {
+        gpio->state |= GPIO_REGS_SDA_BIT;
+        *gpio->sda_fsel = gpio->sda_words[gpio->state];
+    } else {
+        gpio->state |= GPIO_REGS_SCL_BIT;
+        *gpio->scl_fsel = gpio->scl_words[gpio->state];
+    }
+}
+
+static int gpio_regs_read_line(void *ctx, unsigned int gpio_pin) {
+    struct gpio_regs_ctx *gpio = ctx;
+
+    if (gpio_pin == gpio->sda_gpio_pin) {
+        return (*gpio->sda_lev & gpio->sda_mask) ? 1 : 0;
+    }
+
+    return (*gpio->scl_lev & gpio->scl_mask) ? 1 : 0;
+}
+
+// Both lines with one load where they share a GPLEV register (SDA bit 0,
+// SCL bit 1):
+static int gpio_regs_read_lines(void *ctx) {
+    struct gpio_regs_ctx *gpio = ctx;
+
+    uint32_t sda_lev = *gpio->sda_lev;
+    uint32_t scl_lev = (gpio->scl_lev == gpio->sda_lev) ? sda_lev :
+                                                          *gpio->scl_lev;
+
+    return ((sda_lev & gpio->sda_mask) ? GPIO_REGS_SDA_BIT : 0) |
+           ((scl_lev & gpio->scl_mask) ? GPIO_REGS_SCL_BIT : 0);
+}
+
+// Delays are calibrated spins on the monotonic clock so the backend does not
+// depend on pi_microsleep_hard:
+static void gpio_regs_delay_us(void *ctx, unsigned int us) {
+    (void) ctx;
+
+    spin_delay_ns(us * 1000);
+}
+
+static void gpio_regs_delay_ns(void *ctx, unsigned int ns) {
+    (void) ctx;
+
+    spin_delay_ns(ns);
+}
+
+static long long gpio_regs_now_ns(void *ctx) {
+    (void) ctx;
+
+    return spin_clock_ns();
+}
+
+static long long gpio_regs_delay_until_ns(void *ctx, long long deadline_ns) {
+    (void) ctx;
+
+    return spin_until_ns(deadline_ns);
+}
+
+// Long waits give the CPU up rather than spinning:
+static void gpio_regs_sleep_us(void *ctx, unsigned int us) {
+    struct timespec sleep_time;
+
+    (void) ctx;
+
+    sleep_time.tv_sec = us / 1000000;
+    sleep_time.tv_nsec = (us % 1000000) * 1000L;
+
+    nanosleep(&sleep_time, NULL);
+}
+
+const struct pi_i2c_gpio_backend pi_i2c_gpio_regs_backend = {
+    .open = gpio_regs_open,
+    .close = gpio_regs_close,
+    .clear_line = gpio_regs_clear_line,
+    .release_line = gpio_regs_release_line,
+    .read_line = gpio_regs_read_line,
+    .delay_us = gpio_regs_delay_us,
+    .read_lines = gpio_regs_read_lines,
+    .delay_ns = gpio_regs_delay_ns,
+    .now_ns = gpio_regs_now_ns,
+    .delay_until_ns = gpio_regs_delay_until_ns,
+    .sleep_us = gpio_regs_sleep_us
+};
@@ -0,0 +1,53 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+
+// GPIO register block layout shared by everything driving the registers
+// directly (gpio_regs_backend.c, bus groups and the simulated block):
+#define GPIO_REGS_PATH "/dev/gpiomem"
+#define GPIO_REGS_BLOCK_SIZE 4096
+
+// Register offsets (32-bit words into the block) and layout:
+#define GPIO_REGS_GPFSEL 0  // Function select, 10 pins per register
+#define GPIO_REGS_GPCLR 10  // Output clear, 32 pins per register
+#define GPIO_REGS_GPLEV 13  // Pin level, 32 pins per register
+#define GPIO_REGS_MAX_PIN 53
+#define GPFSEL_PINS_PER_REGISTER 10
+#define GPFSEL_REGISTERS 6
+#define GPFSEL_BITS 3
+#define GPFSEL_MASK 0x7
+#define GPFSEL_INPUT 0x0
+#define GPFSEL_OUTPUT 0x1
+
+// GPIO register function prototypes (requires stdint.h):
+int map_gpio_regs(volatile uint32_t **regs);
+void unmap_gpio_regs(volatile uint32_t *regs);
+int claim_gpio_regs(unsigned int fsel_registers);
+void unclaim_gpio_regs(unsigned int fsel_registers);
+int use_gpio_regs(unsigned int fsel_registers);
+void unuse_gpio_regs(unsigned int fsel_registers);
+
+// GPFSEL registers of both lines of a bus (bit N for GPFSEL N):
+static inline unsigned int fsel_registers(unsigned int sda, unsigned int scl) {
+    return (1U << (sda / GPFSEL_PINS_PER_REGISTER)) |
+           (1U << (scl / GPFSEL_PINS_PER_REGISTER));
+}
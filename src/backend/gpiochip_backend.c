@@ -0,0 +1,250 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Linux GPIO character device backend
+//
+// Drives SDA and SCL through the /dev/gpiochipN v2 line-request ioctls so no
+// register access (and no root) is required. Both lines are requested as
+// open-drain outputs in a single line request: writing 1 releases a line to
+// its pull-up and writing 0 pulls it low, replacing the input/output mode
+// switching used with pi_lw_gpio. A single GPIO_V2_LINE_GET_VALUES_IOCTL
+// reads both lines at once.
+
+// Include C standard libraries:
+#include <stdlib.h> // C Standard library (context allocation)
+#include <string.h> // C Standard string manipulation libary
+#include <time.h>   // C Standard get and manipulate time library
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <fcntl.h>     // File control (open)
+#include <unistd.h>    // Symbolic constants and types library (close)
+#include <sys/ioctl.h> // Device control
+
+// Include Linux kernel headers:
+#include <linux/gpio.h> // GPIO character device v2 ABI
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "spin_delay.h"               // Calibrated nano second delays
+
+#define GPIOCHIP_DEFAULT_PATH "/dev/gpiochip0"
+#define GPIOCHIP_CONSUMER "pi_i2c"
+
+// Line request indices (bit positions in the values bitmaps):
+#define GPIOCHIP_SDA_BIT 0x1
+#define GPIOCHIP_SCL_BIT 0x2
+
+struct gpiochip_ctx {
+    int line_fd; // Line request holding both SDA and SCL
+    unsigned int sda_gpio_pin;
+    int set_error; // Failed change of a line, reported by the next read
+};
+
+static inline unsigned long long gpiochip_line_bit(struct gpiochip_ctx *gpio,
+                                                   unsigned int offset) {
+    return (offset == gpio->sda_gpio_pin) ? GPIOCHIP_SDA_BIT :
+                                            GPIOCHIP_SCL_BIT;
+}
+
+// Line changes cannot return an error to the engine; the first failure is
+// kept for the next read to return instead
+static inline void gpiochip_set_values(struct gpiochip_ctx *gpio,
+                                       unsigned long long mask,
+                                       unsigned long long bits) {
+    struct gpio_v2_line_values values = {
+        .bits = bits,
+        .mask = mask
+    };
+
+    if ((ioctl(gpio->line_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) &&
+        (gpio->set_error == 0)) {
+        gpio->set_error = -errno;
+    }
+}
+
+// Return the bits of the lines in mask, or a negative error number
+static inline int gpiochip_get_values(struct gpiochip_ctx *gpio,
+                                      unsigned long long mask) {
+    struct gpio_v2_line_values values = {
+        .bits = 0,
+        .mask = mask
+    };
+
+    int ret;
+
+    if (gpio->set_error != 0) {
+        ret = gpio->set_error;
+        gpio->set_error = 0;
+
+        return ret;
+    }
+
+    if (ioctl(gpio->line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        return -errno;
+    }
+
+    return values.bits & mask;
+}
+
+// Backend argument is the chip path (e.g. "/dev/gpiochip0") and the SDA and
+// SCL pins are line offsets on that chip
+static int gpiochip_open(void **ctx, unsigned int sda, unsigned int scl,
+                         void *arg) {
+    const char *path = (arg != NULL) ? arg : GPIOCHIP_DEFAULT_PATH;
+
+    struct gpiochip_ctx *gpio;
+    struct gpio_v2_line_request request;
+
+    int chip_fd;
+    int ret;
+
+    if ((gpio = calloc(1, sizeof(*gpio))) == NULL) {
+        return -ENOMEM;
+    }
+
+    if ((chip_fd = open(path, O_RDWR | O_CLOEXEC)) < 0) {
+        ret = -errno;
+        free(gpio);
+        return ret;
+    }
+
+    memset(&request, 0, sizeof(request));
+
+    request.offsets[0] = sda;
+    request.offsets[1] = scl;
+    request.num_lines = 2;
+    strncpy(request.consumer, GPIOCHIP_CONSUMER,
+            sizeof(request.consumer) - 1);
+
+    // Open-drain outputs starting released (bus IDLE):
+    request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT |
+                           GPIO_V2_LINE_FLAG_OPEN_DRAIN;
+    request.config.num_attrs = 1;
+    request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    request.config.attrs[0].attr.values = GPIOCHIP_SDA_BIT | GPIOCHIP_SCL_BIT;
+    request.config.attrs[0].mask = GPIOCHIP_SDA_BIT | GPIOCHIP_SCL_BIT;
+
+    ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request);
+
+    // Line request stays valid once the chip is closed:
+    close(chip_fd);
+
+    if (ret < 0) {
+        ret = -errno;
+        free(gpio);
+        return ret;
+    }
+
+    gpio->line_fd = request.fd;
+    gpio->sda_gpio_pin = sda;
+
+    calibrate_spin_delay();
+
+    *ctx = gpio;
+
+    return 0;
+}
+
+static void gpiochip_close(void *ctx) {
+    struct gpiochip_ctx *gpio = ctx;
+
+    close(gpio->line_fd);
+    free(gpio);
+}
+
+static void gpiochip_clear_line(void *ctx, unsigned int gpio) {
+    gpiochip_set_values(ctx, gpiochip_line_bit(ctx, gpio), 0);
+}
+
+static void gpiochip_release_line(void *ctx, unsigned int gpio) {
+    unsigned long long bit = gpiochip_line_bit(ctx, gpio);
+
+    gpiochip_set_values(ctx, bit, bit);
+}
+
+static int gpiochip_read_line(void *ctx, unsigned int gpio) {
+    unsigned long long bit = gpiochip_line_bit(ctx, gpio);
+
+    int bits = gpiochip_get_values(ctx, bit);
+
+    return (bits < 0) ? bits : ((bits & bit) ? 1 : 0);
+}
+
+// Both lines in one GPIO_V2_LINE_GET_VALUES_IOCTL (SDA bit 0, SCL bit 1):
+static int gpiochip_read_lines(void *ctx) {
+    return gpiochip_get_values(ctx, GPIOCHIP_SDA_BIT | GPIOCHIP_SCL_BIT);
+}
+
+// No system timer access without /dev/mem so delays are calibrated spins on
+// the monotonic clock instead of pi_microsleep_hard:
+static void gpiochip_delay_us(void *ctx, unsigned int us) {
+    (void) ctx;
+
+    spin_delay_ns(us * 1000);
+}
+
+static void gpiochip_delay_ns(void *ctx, unsigned int ns) {
+    (void) ctx;
+
+    spin_delay_ns(ns);
+}
+
+static long long gpiochip_now_ns(void *ctx) {
+    (void) ctx;
+
+    return spin_clock_ns();
+}
+
+static long long gpiochip_delay_until_ns(void *ctx, long long deadline_ns) {
+    (void) ctx;
+
+    return spin_until_ns(deadline_ns);
+}
+
+// Long waits give the CPU up rather than spinning:
+static void gpiochip_sleep_us(void *ctx, unsigned int us) {
+    struct timespec sleep_time;
+
+    (void) ctx;
+
+    sleep_time.tv_sec = us / 1000000;
+    sleep_time.tv_nsec = (us % 1000000) * 1000L;
+
+    nanosleep(&sleep_time, NULL);
+}
+
+const struct pi_i2c_gpio_backend pi_i2c_gpiochip_backend = {
+    .open = gpiochip_open,
+    .close = gpiochip_close,
+    .clear_line = gpiochip_clear_line,
+    .release_line = gpiochip_release_line,
+    .read_line = gpiochip_read_line,
+    .delay_us = gpiochip_delay_us,
+    .read_lines = gpiochip_read_lines,
+    .delay_ns = gpiochip_delay_ns,
+    .now_ns = gpiochip_now_ns,
+    .delay_until_ns = gpiochip_delay_until_ns,
+    .sleep_us = gpiochip_sleep_us
+};
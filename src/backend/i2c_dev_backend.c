@@ -0,0 +1,517 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Kernel i2c-dev backend
+//
+// Hands whole messages to a hardware I2C controller through /dev/i2c-N
+// instead of bit-banging SDA and SCL. Adapters capable of plain I2C
+// transfers (I2C_FUNC_I2C) receive I2C_RDWR ioctls so that a register read
+// is a single combined transfer: register address write, repeated START and
+// data read. SMBus-only adapters, such as the i2c-stub test module, fall back
+// to I2C block SMBus transfers which the kernel issues as the same combined
+// message in chunks of up to 32 bytes.
+
+// Include C standard libraries:
+#include <stdio.h>  // C Standard I/O library (device path)
+#include <stdlib.h> // C Standard library (message buffers)
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <fcntl.h>     // File control (open)
+#include <unistd.h>    // Symbolic constants and types library (close)
+#include <sys/ioctl.h> // Device control
+
+// Include Linux kernel headers:
+#include <linux/i2c.h>     // I2C message and functionality definitions
+#include <linux/i2c-dev.h> // i2c-dev ioctls
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "config.h"                   // I2C timing and variable defs
+#include "i2c_dev_backend.h"          // Kernel i2c-dev function protos
+
+#define I2C_DEV_PATH_LEN 32
+#define I2C_DEV_MAX_MSG_LEN 8192 // Kernel limit on one i2c-dev message
+
+// Adapter can run the combined messages itself:
+#define I2C_DEV_RDWR_FUNCS (I2C_FUNC_I2C)
+
+// Adapter can at least run register reads and writes as SMBus transfers:
+#define I2C_DEV_SMBUS_FUNCS (I2C_FUNC_SMBUS_READ_I2C_BLOCK | \
+                             I2C_FUNC_SMBUS_WRITE_I2C_BLOCK)
+
+// Translate a failed transfer into a pi_i2c error. Adapters report a missing
+// ACK as ENXIO or EREMOTEIO without saying which byte was refused so it is
+// treated as the device not acknowledging its address:
+static int i2c_dev_transfer_error(struct pi_i2c_bus *bus, int error) {
+    switch (error) {
+    case ENXIO:
+    case EREMOTEIO:
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        bus->statistics.num_nack++;
+
+        return -ENACK;
+    case ETIMEDOUT:
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        bus->statistics.num_clock_stretching_timeouts++;
+
+        return -ECLKTIMEOUT;
+    default:
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        bus->statistics.num_unknown_bus_errors++;
+
+        return -error;
+    }
+}
+
+// Run one SMBus transfer on the currently selected device
+static int i2c_dev_smbus(struct pi_i2c_bus *bus, char read_write,
+                         unsigned char command, int size,
+                         union i2c_smbus_data *smbus_data) {
+    struct i2c_smbus_ioctl_data args = {
+        .read_write = read_write,
+        .command = command,
+        .size = size,
+        .data = smbus_data
+    };
+
+    return ioctl(bus->i2c_dev_fd, I2C_SMBUS, &args);
+}
+
+// Point SMBus transfers at a device. A kernel driver bound to the address
+// makes this fail with EBUSY
+static int i2c_dev_select(struct pi_i2c_bus *bus,
+                          unsigned int device_address) {
+    if (ioctl(bus->i2c_dev_fd, I2C_SLAVE,
+              (unsigned long) device_address) < 0) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+// Open /dev/i2c-N and check what the adapter is able to do
+int open_i2c_dev(struct pi_i2c_bus *bus, unsigned int adapter) {
+    char path[I2C_DEV_PATH_LEN];
+
+    unsigned long funcs;
+
+    int fd;
+    int ret;
+
+    snprintf(path, sizeof(path), "/dev/i2c-%u", adapter);
+
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0) {
+        return -errno;
+    }
+
+    if (ioctl(fd, I2C_FUNCS, &funcs) < 0) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+
+    // Register reads and writes need either plain I2C or I2C block SMBus
+    // transfers:
+    if (!(funcs & I2C_DEV_RDWR_FUNCS) &&
+        ((funcs & I2C_DEV_SMBUS_FUNCS) != I2C_DEV_SMBUS_FUNCS)) {
+        close(fd);
+        return -EOPNOTSUPP;
+    }
+
+    bus->i2c_dev_fd = fd;
+    bus->i2c_dev_funcs = funcs;
+
+    return 0;
+}
+
+void close_i2c_dev(struct pi_i2c_bus *bus) {
+    close(bus->i2c_dev_fd);
+
+    bus->i2c_dev_fd = -1;
+    bus->i2c_dev_funcs = 0;
+}
+
+// Read N number of bytes from the specified register address of a device
+int read_message_i2c_dev(struct pi_i2c_bus *bus, unsigned int device_address,
+                         unsigned int register_address, uint8_t *data,
+                         unsigned int n_bytes) {
+    // Definitions:
+    unsigned char register_byte = register_address;
+
+    struct i2c_msg msgs[2];
+    struct i2c_rdwr_ioctl_data transfer;
+
+    union i2c_smbus_data smbus_data;
+    unsigned int chunk;
+    unsigned int i;
+    unsigned int j;
+    int ret;
+
+    if (n_bytes > I2C_DEV_MAX_MSG_LEN) {
+        return -EINVAL;
+    }
+
+    if (bus->i2c_dev_funcs & I2C_DEV_RDWR_FUNCS) {
+        // Register address write and data read in one transfer; the adapter
+        // puts a repeated START between the two messages. The data is read
+        // straight into the caller's bytes:
+        msgs[0].addr = device_address;
+        msgs[0].flags = 0;
+        msgs[0].len = 1;
+        msgs[0].buf = &register_byte;
+
+        msgs[1].addr = device_address;
+        msgs[1].flags = I2C_M_RD;
+        msgs[1].len = n_bytes;
+        msgs[1].buf = data;
+
+        transfer.msgs = msgs;
+        transfer.nmsgs = 2;
+
+        if (ioctl(bus->i2c_dev_fd, I2C_RDWR, &transfer) < 0) {
+            return i2c_dev_transfer_error(bus, errno);
+        }
+
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        bus->statistics.num_start_cond++;
+        bus->statistics.num_repeated_start_cond++;
+        bus->statistics.num_stop_cond++;
+        bus->statistics.num_bytes_read += n_bytes;
+
+        return 0;
+    }
+
+    if ((ret = i2c_dev_select(bus, device_address)) < 0) {
+        return ret;
+    }
+
+    // SMBus block reads are limited to 32 bytes. Continue each chunk from
+    // the register the previous chunk left off at, relying on the same
+    // register auto-increment a multi-byte read does:
+    for (i = 0; i < n_bytes; i += chunk) {
+        chunk = n_bytes - i;
+
+        if (chunk > I2C_SMBUS_BLOCK_MAX) {
+            chunk = I2C_SMBUS_BLOCK_MAX;
+        }
+
+        smbus_data.block[0] = chunk;
+
+        if (i2c_dev_smbus(bus, I2C_SMBUS_READ, register_address + i,
+                          I2C_SMBUS_I2C_BLOCK_DATA, &smbus_data) < 0) {
+            return i2c_dev_transfer_error(bus, errno);
+        }
+
+        for (j = 0; j < chunk; j++) {
+            data[i + j] = smbus_data.block[j + 1];
+        }
+
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        bus->statistics.num_start_cond++;
+        bus->statistics.num_repeated_start_cond++;
+        bus->statistics.num_stop_cond++;
+        bus->statistics.num_bytes_read += chunk;
+    }
+
+    return 0;
+}
+
+// Write N number of bytes to the specified register address of a device
+int write_message_i2c_dev(struct pi_i2c_bus *bus, unsigned int device_address,
+                          unsigned int register_address,
+                          const uint8_t *data,
+                          unsigned int n_bytes) {
+    // Definitions:
+    unsigned char *buffer;
+
+    struct i2c_msg msg;
+    struct i2c_rdwr_ioctl_data transfer;
+
+    union i2c_smbus_data smbus_data;
+    unsigned int chunk;
+    unsigned int i;
+    unsigned int j;
+    int ret;
+
+    // Register address shares the message with the data:
+    if (n_bytes + 1 > I2C_DEV_MAX_MSG_LEN) {
+        return -EINVAL;
+    }
+
+    if (bus->i2c_dev_funcs & I2C_DEV_RDWR_FUNCS) {
+        if ((buffer = malloc(n_bytes + 1)) == NULL) {
+            return -ENOMEM;
+        }
+
+        buffer[0] = register_address;
+
+        for (i = 0; i < n_bytes; i++) {
+            buffer[i + 1] = data[i];
+        }
+
+        msg.addr = device_address;
+        msg.flags = 0;
+        msg.len = n_bytes + 1;
+        msg.buf = buffer;
+
+        transfer.msgs = &msg;
+        transfer.nmsgs = 1;
+
+        ret = ioctl(bus->i2c_dev_fd, I2C_RDWR, &transfer);
+
+        free(buffer);
+
+        if (ret < 0) {
+            return i2c_dev_transfer_error(bus, errno);
+        }
+
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        bus->statistics.num_start_cond++;
+        bus->statistics.num_stop_cond++;
+        bus->statistics.num_bytes_written += n_bytes;
+
+        return 0;
+    }
+
+    if ((ret = i2c_dev_select(bus, device_address)) < 0) {
+        return ret;
+    }
+
+    // SMBus block writes are limited to 32 bytes (see
+    // read_message_i2c_dev()):
+    for (i = 0; i < n_bytes; i += chunk) {
+        chunk = n_bytes - i;
+
+        if (chunk > I2C_SMBUS_BLOCK_MAX) {
+            chunk = I2C_SMBUS_BLOCK_MAX;
+        }
+
+        smbus_data.block[0] = chunk;
+
+        for (j = 0; j < chunk; j++) {
+            smbus_data.block[j + 1] = data[i + j];
+        }
+
+        if (i2c_dev_smbus(bus, I2C_SMBUS_WRITE, register_address + i,
+                          I2C_SMBUS_I2C_BLOCK_DATA, &smbus_data) < 0) {
+            return i2c_dev_transfer_error(bus, errno);
+        }
+
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        bus->statistics.num_start_cond++;
+        bus->statistics.num_stop_cond++;
+        bus->statistics.num_bytes_written += chunk;
+    }
+
+    return 0;
+}
+
+// Run message segments as one I2C_RDWR transfer. A segment with a register
+// address becomes a register write message of its own when reading, or gets
+// the register put in front of its data when writing. SMBus-only adapters
+// cannot combine messages, and the kernel takes at most
+// I2C_RDWR_IOCTL_MAX_MSGS messages in one transfer
+int transfer_messages_i2c_dev(struct pi_i2c_bus *bus, struct pi_i2c_msg *msgs,
+                              unsigned int n_msgs) {
+    // Definitions:
+    unsigned char registers[I2C_MAX_MSGS];
+    unsigned char *buffer;
+    unsigned char *next;
+
+    struct i2c_msg i2c_msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+    struct i2c_rdwr_ioctl_data transfer;
+
+    unsigned int n_i2c_msgs = 0;
+    unsigned int n_buffer = 0;
+    unsigned int n_written = 0;
+    unsigned int n_read = 0;
+    unsigned int i;
+    unsigned int j;
+    int ret;
+
+    if (!(bus->i2c_dev_funcs & I2C_DEV_RDWR_FUNCS)) {
+        return -EOPNOTSUPP;
+    }
+
+    for (i = 0; i < n_msgs; i++) {
+        if (msgs[i].n_bytes + 1 > I2C_DEV_MAX_MSG_LEN) {
+            return -EINVAL;
+        }
+
+        // Ignoring a NACK needs the adapter to mangle the protocol:
+        if (!(msgs[i].flags & I2C_MSG_READ) &&
+            (msgs[i].flags & I2C_MSG_NO_ACK_LAST) &&
+            !(bus->i2c_dev_funcs & I2C_FUNC_PROTOCOL_MANGLING)) {
+            return -EOPNOTSUPP;
+        }
+
+        // Register reads take a register write message too:
+        if ((msgs[i].flags & I2C_MSG_READ) &&
+            !(msgs[i].flags & I2C_MSG_NO_REGISTER)) {
+            n_i2c_msgs++;
+        }
+
+        n_i2c_msgs++;
+        n_buffer += msgs[i].n_bytes + 1;
+    }
+
+    if (n_i2c_msgs > I2C_RDWR_IOCTL_MAX_MSGS) {
+        return -E2BIG;
+    }
+
+    n_i2c_msgs = 0;
+
+    if ((buffer = malloc(n_buffer)) == NULL) {
+        return -ENOMEM;
+    }
+
+    next = buffer;
+
+    for (i = 0; i < n_msgs; i++) {
+        registers[i] = msgs[i].register_address;
+
+        // Register address write then data read; the adapter puts a
+        // repeated START between every message:
+        if ((msgs[i].flags & I2C_MSG_READ) &&
+            !(msgs[i].flags & I2C_MSG_NO_REGISTER)) {
+            i2c_msgs[n_i2c_msgs].addr = msgs[i].device_address;
+            i2c_msgs[n_i2c_msgs].flags = 0;
+            i2c_msgs[n_i2c_msgs].len = 1;
+            i2c_msgs[n_i2c_msgs].buf = &registers[i];
+            n_i2c_msgs++;
+        }
+
+        i2c_msgs[n_i2c_msgs].addr = msgs[i].device_address;
+        i2c_msgs[n_i2c_msgs].flags = 0;
+        i2c_msgs[n_i2c_msgs].len = msgs[i].n_bytes;
+        i2c_msgs[n_i2c_msgs].buf = next;
+
+        if (msgs[i].flags & I2C_MSG_READ) {
+            i2c_msgs[n_i2c_msgs].flags = I2C_M_RD;
+            n_read += msgs[i].n_bytes;
+        } else {
+            if (!(msgs[i].flags & I2C_MSG_NO_REGISTER)) {
+                next[i2c_msgs[n_i2c_msgs].len++] = registers[i];
+            }
+
+            for (j = 0; j < msgs[i].n_bytes; j++) {
+                next[i2c_msgs[n_i2c_msgs].len++] = msgs[i].data[j];
+            }
+
+            // Adapters only support ignoring NACKs for a whole message:
+            if (msgs[i].flags & I2C_MSG_NO_ACK_LAST) {
+                i2c_msgs[n_i2c_msgs].flags = I2C_M_IGNORE_NAK;
+            }
+
+            n_written += msgs[i].n_bytes;
+        }
+
+        next += msgs[i].n_bytes + 1;
+        n_i2c_msgs++;
+    }
+
+    transfer.msgs = i2c_msgs;
+    transfer.nmsgs = n_i2c_msgs;
+
+    if (ioctl(bus->i2c_dev_fd, I2C_RDWR, &transfer) < 0) {
+        ret = i2c_dev_transfer_error(bus, errno);
+        free(buffer);
+        return ret;
+    }
+
+    // Every segment has its own stretch of the buffer:
+    next = buffer;
+
+    for (i = 0; i < n_msgs; i++) {
+        if (msgs[i].flags & I2C_MSG_READ) {
+            for (j = 0; j < msgs[i].n_bytes; j++) {
+                msgs[i].data[j] = next[j];
+            }
+        }
+
+        next += msgs[i].n_bytes + 1;
+    }
+
+    free(buffer);
+
+    // Keep track of statistics for any caller interested in those
+    // kind of numbers:
+    bus->statistics.num_start_cond++;
+    bus->statistics.num_repeated_start_cond += n_i2c_msgs - 1;
+    bus->statistics.num_stop_cond++;
+    bus->statistics.num_bytes_written += n_written;
+    bus->statistics.num_bytes_read += n_read;
+
+    return 0;
+}
+
+// Probe one address for a device: an SMBus quick write (address frame then
+// STOP) like the bit-banged scan, or a one byte read when read_flag is set
+// or the adapter cannot send a message without data. Returns 1 if present,
+// 0 if not, or a negative error number
+int probe_i2c_dev(struct pi_i2c_bus *bus, unsigned int device_address,
+                  int read_flag) {
+    // Definitions:
+    union i2c_smbus_data smbus_data;
+    int ret;
+
+    // A kernel driver already claimed the device so it must be present:
+    if ((ret = i2c_dev_select(bus, device_address)) == -EBUSY) {
+        return 1;
+    } else if (ret < 0) {
+        return ret;
+    }
+
+    if (!read_flag && (bus->i2c_dev_funcs & I2C_FUNC_SMBUS_QUICK)) {
+        ret = i2c_dev_smbus(bus, I2C_SMBUS_WRITE, 0, I2C_SMBUS_QUICK, NULL);
+    } else {
+        ret = i2c_dev_smbus(bus, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE,
+                            &smbus_data);
+    }
+
+    // Keep track of statistics for any caller interested in those
+    // kind of numbers:
+    bus->statistics.num_start_cond++;
+    bus->statistics.num_stop_cond++;
+
+    if (ret == 0) {
+        return 1;
+    }
+
+    // Only a missing ACK means nobody is there; anything else is the
+    // adapter failing and is reported like a failed transfer:
+    if ((errno == ENXIO) || (errno == EREMOTEIO)) {
+        return 0;
+    }
+
+    return i2c_dev_transfer_error(bus, errno);
+}
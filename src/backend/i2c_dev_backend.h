@@ -0,0 +1,37 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+
+// Kernel i2c-dev function prototypes (caller holds bus->lock):
+int open_i2c_dev(struct pi_i2c_bus *bus, unsigned int adapter);
+void close_i2c_dev(struct pi_i2c_bus *bus);
+int read_message_i2c_dev(struct pi_i2c_bus *bus, unsigned int device_address,
+                         unsigned int register_address, uint8_t *data,
+                         unsigned int n_bytes);
+int write_message_i2c_dev(struct pi_i2c_bus *bus, unsigned int device_address,
+                          unsigned int register_address,
+                          const uint8_t *data,
+                          unsigned int n_bytes);
+int transfer_messages_i2c_dev(struct pi_i2c_bus *bus, struct pi_i2c_msg *msgs,
+                              unsigned int n_msgs);
+int probe_i2c_dev(struct pi_i2c_bus *bus, unsigned int device_address,
+                  int read_flag);
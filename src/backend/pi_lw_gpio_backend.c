@@ -0,0 +1,268 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+
+// Include C standard libraries:
+#include <stdlib.h> // C Standard library (context allocation)
+#include <stdint.h> // C Standard integer types (register layout)
+#include <time.h>   // C Standard get and manipulate time library
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <pthread.h> // POSIX threads (GPFSEL register locks)
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "spin_delay.h"               // Calibrated nano second delays
+#include "gpio_regs_backend.h"        // GPIO register layout and claims
+
+#ifndef PI_I2C_NO_PI_LW_GPIO
+#include <pi_lw_gpio.h>               // GPIO library for the Pi
+#include <pi_microsleep_hard.h>       // Hard microsleep function for the Pi
+
+// Open-drain is emulated by switching a pin between output (cleared) and
+// input (released to the pull-up). gpio_set_mode() is a read-modify-write of
+// the GPFSEL register shared by ten pins, so buses driven from different
+// threads must not switch modes within the same register at the same time.
+// The registers are also marked as in use so that the register backend,
+// which stores whole precomputed words, keeps out of them:
+struct pi_lw_gpio_ctx {
+    unsigned int fsel_registers; // GPFSEL registers of the lines
+};
+
+static pthread_mutex_t gpfsel_lock[GPFSEL_REGISTERS] = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER
+};
+
+// setup_microsleep_hard() only needs to succeed once per process:
+static pthread_mutex_t microsleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static int microsleep_setup_flag = 0;
+
+static void set_line_mode(int mode, unsigned int gpio) {
+    pthread_mutex_t *lock = &gpfsel_lock[gpio / GPFSEL_PINS_PER_REGISTER];
+
+    pthread_mutex_lock(lock);
+    gpio_set_mode(mode, gpio);
+    pthread_mutex_unlock(lock);
+}
+
+static int pi_lw_gpio_open(void **ctx, unsigned int sda, unsigned int scl,
+                           void *arg) {
+    struct pi_lw_gpio_ctx *gpio;
+
+    int ret = 0;
+
+    (void) arg;
+
+    if ((sda > GPIO_REGS_MAX_PIN) || (scl > GPIO_REGS_MAX_PIN)) {
+        return -EINVAL;
+    }
+
+    if ((gpio = calloc(1, sizeof(*gpio))) == NULL) {
+        return -ENOMEM;
+    }
+
+    gpio->fsel_registers = fsel_registers(sda, scl);
+
+    if ((ret = use_gpio_regs(gpio->fsel_registers)) < 0) {
+        free(gpio);
+        return ret;
+    }
+
+    // Setup microsleep function to eliminate additional over head at first
+    // sleep function call:
+    pthread_mutex_lock(&microsleep_lock);
+
+    if (!microsleep_setup_flag) {
+        if ((ret = setup_microsleep_hard()) == 0) {
+            microsleep_setup_flag = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&microsleep_lock);
+
+    if (ret < 0) {
+        unuse_gpio_regs(gpio->fsel_registers);
+        free(gpio);
+        return ret;
+    }
+
+    // Sub-micro second bus timings are spun out instead:
+    calibrate_spin_delay();
+
+    // Ensure that output mode means that the GPIO is cleared. The output
+    // latch holds its value while the pin is an input so this only needs
+    // doing once rather than on every edge:
+    gpio_clear(sda);
+    gpio_clear(scl);
+
+    *ctx = gpio;
+
+    return 0;
+}
+
+static void pi_lw_gpio_close(void *ctx) {
+    struct pi_lw_gpio_ctx *gpio = ctx;
+
+    unuse_gpio_regs(gpio->fsel_registers);
+
+    free(gpio);
+}
+
+// Pull line low by claiming it as an output
+static void pi_lw_gpio_clear_line(void *ctx, unsigned int gpio) {
+    (void) ctx;
+
+    set_line_mode(GPIO_OUTPUT, gpio);
+}
+
+// Let line float high by releasing it to an input
+static void pi_lw_gpio_release_line(void *ctx, unsigned int gpio) {
+    (void) ctx;
+
+    set_line_mode(GPIO_INPUT, gpio);
+}
+
+static int pi_lw_gpio_read_line(void *ctx, unsigned int gpio) {
+    (void) ctx;
+
+    return gpio_read_level(gpio);
+}
+
+static void pi_lw_gpio_delay_us(void *ctx, unsigned int us) {
+    (void) ctx;
+
+    microsleep_hard(us);
+}
+
+static void pi_lw_gpio_delay_ns(void *ctx, unsigned int ns) {
+    (void) ctx;
+
+    spin_delay_ns(ns);
+}
+
+static long long pi_lw_gpio_now_ns(void *ctx) {
+    (void) ctx;
+
+    return spin_clock_ns();
+}
+
+static long long pi_lw_gpio_delay_until_ns(void *ctx, long long deadline_ns) {
+    (void) ctx;
+
+    return spin_until_ns(deadline_ns);
+}
+
+// Long waits give the CPU up rather than holding it in a hard microsleep:
+static void pi_lw_gpio_sleep_us(void *ctx, unsigned int us) {
+    struct timespec sleep_time;
+
+    (void) ctx;
+
+    sleep_time.tv_sec = us / 1000000;
+    sleep_time.tv_nsec = (us % 1000000) * 1000L;
+
+    nanosleep(&sleep_time, NULL);
+}
+
+#else
+
+// Library was configured without pi_lw_gpio (e.g. building off a Pi); the
+// backend still exists so callers link but it cannot be opened:
+static int pi_lw_gpio_open(void **ctx, unsigned int sda, unsigned int scl,
+                           void *arg) {
+    (void) ctx;
+    (void) sda;
+    (void) scl;
+    (void) arg;
+
+    return -ENOSYS;
+}
+
+static void pi_lw_gpio_close(void *ctx) {
+    (void) ctx;
+}
+
+static void pi_lw_gpio_clear_line(void *ctx, unsigned int gpio) {
+    (void) ctx;
+    (void) gpio;
+}
+
+static void pi_lw_gpio_release_line(void *ctx, unsigned int gpio) {
+    (void) ctx;
+    (void) gpio;
+}
+
+static int pi_lw_gpio_read_line(void *ctx, unsigned int gpio) {
+    (void) ctx;
+    (void) gpio;
+
+    return 1;
+}
+
+static void pi_lw_gpio_delay_us(void *ctx, unsigned int us) {
+    (void) ctx;
+    (void) us;
+}
+
+static void pi_lw_gpio_delay_ns(void *ctx, unsigned int ns) {
+    (void) ctx;
+    (void) ns;
+}
+
+static long long pi_lw_gpio_now_ns(void *ctx) {
+    (void) ctx;
+
+    return 0;
+}
+
+static long long pi_lw_gpio_delay_until_ns(void *ctx, long long deadline_ns) {
+    (void) ctx;
+    (void) deadline_ns;
+
+    return 0;
+}
+
+static void pi_lw_gpio_sleep_us(void *ctx, unsigned int us) {
+    (void) ctx;
+    (void) us;
+}
+
+#endif
+
+// Default backend: GPIO registers through pi_lw_gpio, hard microsleeps
+// through pi_microsleep_hard and calibrated spins for shorter delays:
+const struct pi_i2c_gpio_backend pi_i2c_pi_lw_gpio_backend = {
+    .open = pi_lw_gpio_open,
+    .close = pi_lw_gpio_close,
+    .clear_line = pi_lw_gpio_clear_line,
+    .release_line = pi_lw_gpio_release_line,
+    .read_line = pi_lw_gpio_read_line,
+    .delay_us = pi_lw_gpio_delay_us,
+    .delay_ns = pi_lw_gpio_delay_ns,
+    .now_ns = pi_lw_gpio_now_ns,
+    .delay_until_ns = pi_lw_gpio_delay_until_ns,
+    .sleep_us = pi_lw_gpio_sleep_us
+};
@@ -0,0 +1,613 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Simulated I2C bus
+//
+// An in-memory wired-AND bus: each line is low if either the controller or a
+// simulated device pulls it low. Devices are 256-byte register files with an
+// auto-incrementing register pointer (the common sensor/EEPROM layout) and are
+// driven by the controller's SCL and SDA edges. Time is virtual; the delay
+// operation advances a nanosecond clock instead of sleeping so the protocol
+// engine can be exercised and benchmarked on any machine. The simulator's
+// clock (used for deadline timing) is that virtual time plus the host time
+// spent outside of delays, which is how long a real bus would have taken.
+//
+// Simulated buses can also be attached to pins of a simulated GPIO register
+// block instead, for code storing to the registers directly (bus groups):
+// a pin switched to output pulls its line low and the level register reads
+// back the lines of every attached bus.
+
+// Include C standard libraries:
+#include <stdlib.h> // C Standard library (simulator allocation)
+#include <stdint.h> // C Standard integer types (simulated registers)
+#include <time.h>   // C Standard get and manipulate time library
+#include <errno.h>  // C Standard for error conditions
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "gpio_regs_backend.h"        // GPIO register layout
+#include "sim_backend.h"              // Simulated register block protos
+
+#define SIM_DEVICES 128 // 7-bit address space
+#define SIM_REGS_BUSES 16 // Buses attached to a simulated register block
+
+// Device protocol states:
+#define SIM_IDLE 0   // Not addressed; waiting for START
+#define SIM_RX 1     // Receiving a byte from the controller
+#define SIM_RX_ACK 2 // Driving ACK for a received byte
+#define SIM_TX 3     // Transmitting a byte to the controller
+#define SIM_TX_ACK 4 // Waiting on the controller's ACK/NACK
+
+struct sim_device {
+    int present;
+    unsigned char *registers;       // 256 registers owned by the caller
+    unsigned int register_pointer;  // Auto-incremented on every access
+    unsigned int stretch_us;        // SCL held low after each ACK
+};
+
+struct pi_i2c_sim {
+    unsigned int sda_gpio_pin;
+    unsigned int scl_gpio_pin;
+
+    // Line drivers (1 = released) and resolved wired-AND levels:
+    int controller_sda;
+    int controller_scl;
+    int device_sda;
+    int device_scl;
+    int sda;
+    int scl;
+
+    unsigned long long stretch_until_ns;
+
+    long long host_start_ns; // Host clock when the simulator was created
+
+    // Protocol state of the addressed device:
+    int state;
+    int device_address;
+    int read_flag;
+    int byte_index;
+    int bit;
+    unsigned int shift;
+    int ack_level;
+
+    struct sim_device devices[SIM_DEVICES];
+
+    struct pi_i2c_sim_statistics statistics;
+};
+
+// Simulated GPIO register block (pins 0 to 31):
+struct pi_i2c_sim_regs {
+    uint32_t fsel[GPFSEL_REGISTERS];
+
+    struct pi_i2c_sim *buses[SIM_REGS_BUSES];
+    unsigned int n_buses;
+};
+
+// START or repeated START: every device listens for an address frame
+static void sim_start(struct pi_i2c_sim *sim) {
+    sim->state = SIM_RX;
+    sim->device_address = -1;
+    sim->byte_index = 0;
+    sim->bit = 0;
+    sim->shift = 0;
+    sim->device_sda = 1;
+}
+
+// STOP: bus returns to IDLE
+static void sim_stop(struct pi_i2c_sim *sim) {
+    sim->state = SIM_IDLE;
+    sim->device_address = -1;
+    sim->device_sda = 1;
+}
+
+// Load the next register and drive its MSB
+static void sim_begin_tx(struct pi_i2c_sim *sim) {
+    struct sim_device *device = &sim->devices[sim->device_address];
+
+    sim->shift = device->registers[device->register_pointer & 0xFF];
+    device->register_pointer = (device->register_pointer + 1) & 0xFF;
+
+    sim->bit = 7;
+    sim->device_sda = (sim->shift >> 7) & 0x1;
+    sim->state = SIM_TX;
+}
+
+// A full byte has been clocked in from the controller
+static void sim_byte_received(struct pi_i2c_sim *sim) {
+    unsigned int byte = sim->shift & 0xFF;
+
+    struct sim_device *device;
+
+    if (sim->byte_index == 0) {
+        // Address frame; devices not addressed stay quiet until next START:
+        if (!sim->devices[byte >> 1].present) {
+            sim->state = SIM_IDLE;
+            return;
+        }
+
+        sim->device_address = byte >> 1;
+        sim->read_flag = byte & 0x1;
+    } else {
+        device = &sim->devices[sim->device_address];
+
+        if (sim->byte_index == 1) {
+            // First byte of a write sets the register pointer:
+            device->register_pointer = byte;
+        } else {
+            device->registers[device->register_pointer & 0xFF] = byte;
+            device->register_pointer = (device->register_pointer + 1) & 0xFF;
+        }
+    }
+
+    sim->byte_index++;
+
+    // ACK by pulling SDA low for the ninth clock:
+    sim->device_sda = 0;
+    sim->state = SIM_RX_ACK;
+}
+
+static void sim_scl_rising(struct pi_i2c_sim *sim) {
+    sim->statistics.num_scl_cycles++;
+
+    switch (sim->state) {
+        case SIM_RX:
+            sim->shift = (sim->shift << 1) | sim->sda;
+            sim->bit++;
+            break;
+
+        case SIM_TX_ACK:
+            sim->ack_level = sim->sda;
+            break;
+    }
+}
+
+static void sim_scl_falling(struct pi_i2c_sim *sim) {
+    struct sim_device *device;
+
+    switch (sim->state) {
+        case SIM_RX:
+            if (sim->bit == 8) {
+                sim_byte_received(sim);
+            }
+            break;
+
+        case SIM_RX_ACK:
+            // ACK clock complete; release SDA and optionally stretch:
+            sim->device_sda = 1;
+
+            device = &sim->devices[sim->device_address];
+
+            if (device->stretch_us) {
+                sim->device_scl = 0;
+                sim->stretch_until_ns = sim->statistics.elapsed_ns +
+                    device->stretch_us * 1000ULL;
+            }
+
+            if (sim->read_flag) {
+                sim_begin_tx(sim);
+            } else {
+                sim->state = SIM_RX;
+                sim->bit = 0;
+                sim->shift = 0;
+            }
+            break;
+
+        case SIM_TX:
+            if (--sim->bit < 0) {
+                // Release SDA so the controller can ACK or NACK:
+                sim->device_sda = 1;
+                sim->state = SIM_TX_ACK;
+            } else {
+                sim->device_sda = (sim->shift >> sim->bit) & 0x1;
+            }
+            break;
+
+        case SIM_TX_ACK:
+            if (sim->ack_level == 0) {
+                sim_begin_tx(sim);
+            } else {
+                // NACK: controller is done reading; wait for STOP:
+                sim->state = SIM_IDLE;
+            }
+            break;
+    }
+}
+
+// Resolve the wired-AND lines and feed any edges to the device
+static void sim_update(struct pi_i2c_sim *sim) {
+    int sda;
+    int scl;
+
+    // A stretching device lets go of SCL once its time is up:
+    if (!sim->device_scl &&
+        (sim->statistics.elapsed_ns >= sim->stretch_until_ns)) {
+        sim->device_scl = 1;
+    }
+
+    sda = sim->controller_sda & sim->device_sda;
+    scl = sim->controller_scl & sim->device_scl;
+
+    // SDA changing while SCL is held high is a START or STOP condition:
+    if (scl && sim->scl && (sda != sim->sda)) {
+        sim->sda = sda;
+
+        if (!sda) {
+            sim_start(sim);
+        } else {
+            sim_stop(sim);
+        }
+    }
+
+    sim->sda = sda;
+
+    if (scl != sim->scl) {
+        sim->scl = scl;
+
+        if (scl) {
+            sim_scl_rising(sim);
+        } else {
+            sim_scl_falling(sim);
+        }
+    }
+
+    // The device may have changed its drivers in response:
+    sim->sda = sim->controller_sda & sim->device_sda;
+    sim->scl = sim->controller_scl & sim->device_scl;
+}
+
+static long long sim_host_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Virtual delays plus host time spent between them:
+static long long sim_clock_ns(struct pi_i2c_sim *sim) {
+    return (sim_host_ns() - sim->host_start_ns) +
+           (long long) sim->statistics.elapsed_ns;
+}
+
+static void sim_drive_line(struct pi_i2c_sim *sim, unsigned int gpio,
+                           int level) {
+    sim->statistics.num_line_writes++;
+
+    if (gpio == sim->sda_gpio_pin) {
+        sim->controller_sda = level;
+    } else if (gpio == sim->scl_gpio_pin) {
+        sim->controller_scl = level;
+    }
+
+    sim_update(sim);
+}
+
+static int sim_open(void **ctx, unsigned int sda, unsigned int scl,
+                    void *arg) {
+    struct pi_i2c_sim *sim = arg;
+
+    // Backend argument is the simulator created by create_sim_i2c():
+    if (sim == NULL) {
+        return -EINVAL;
+    }
+
+    sim->sda_gpio_pin = sda;
+    sim->scl_gpio_pin = scl;
+
+    *ctx = sim;
+
+    return 0;
+}
+
+static void sim_close(void *ctx) {
+    // Simulator is owned by the caller (see free_sim_i2c()):
+    (void) ctx;
+}
+
+static void sim_clear_line(void *ctx, unsigned int gpio) {
+    sim_drive_line(ctx, gpio, 0);
+}
+
+static void sim_release_line(void *ctx, unsigned int gpio) {
+    sim_drive_line(ctx, gpio, 1);
+}
+
+static int sim_read_line(void *ctx, unsigned int gpio) {
+    struct pi_i2c_sim *sim = ctx;
+
+    sim->statistics.num_line_reads++;
+
+    sim_update(sim);
+
+    return (gpio == sim->scl_gpio_pin) ? sim->scl : sim->sda;
+}
+
+static int sim_read_lines(void *ctx) {
+    struct pi_i2c_sim *sim = ctx;
+
+    sim->statistics.num_line_reads++;
+
+    sim_update(sim);
+
+    return sim->sda | (sim->scl << 1);
+}
+
+static void sim_delay_us(void *ctx, unsigned int us) {
+    struct pi_i2c_sim *sim = ctx;
+
+    sim->statistics.elapsed_ns += us * 1000ULL;
+
+    sim_update(sim);
+}
+
+static void sim_delay_ns(void *ctx, unsigned int ns) {
+    struct pi_i2c_sim *sim = ctx;
+
+    sim->statistics.elapsed_ns += ns;
+
+    sim_update(sim);
+}
+
+static long long sim_now_ns(void *ctx) {
+    return sim_clock_ns(ctx);
+}
+
+static long long sim_delay_until_ns(void *ctx, long long deadline_ns) {
+    struct pi_i2c_sim *sim = ctx;
+
+    long long now = sim_clock_ns(sim);
+
+    if (now >= deadline_ns) {
+        return now - deadline_ns;
+    }
+
+    sim->statistics.elapsed_ns += deadline_ns - now;
+
+    sim_update(sim);
+
+    return 0;
+}
+
+const struct pi_i2c_gpio_backend pi_i2c_sim_backend = {
+    .open = sim_open,
+    .close = sim_close,
+    .clear_line = sim_clear_line,
+    .release_line = sim_release_line,
+    .read_line = sim_read_line,
+    .delay_us = sim_delay_us,
+    .read_lines = sim_read_lines,
+    .delay_ns = sim_delay_ns,
+    .now_ns = sim_now_ns,
+    .delay_until_ns = sim_delay_until_ns,
+    .sleep_us = sim_delay_us
+};
+
+// Create an idle simulated bus with no devices. Returns NULL and sets errno
+// on error
+struct pi_i2c_sim *create_sim_i2c(void) {
+    struct pi_i2c_sim *sim;
+
+    if ((sim = calloc(1, sizeof(*sim))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // All drivers released; pull-ups hold the bus IDLE:
+    sim->controller_sda = 1;
+    sim->controller_scl = 1;
+    sim->device_sda = 1;
+    sim->device_scl = 1;
+    sim->sda = 1;
+    sim->scl = 1;
+
+    sim->state = SIM_IDLE;
+    sim->device_address = -1;
+
+    sim->host_start_ns = sim_host_ns();
+
+    return sim;
+}
+
+void free_sim_i2c(struct pi_i2c_sim *sim) {
+    free(sim);
+}
+
+// Attach a device at an address backed by a caller-owned 256-byte register
+// file
+int add_device_sim_i2c(struct pi_i2c_sim *sim, unsigned int device_address,
+                       unsigned char *registers) {
+    if ((sim == NULL) || (registers == NULL)) {
+        return -EINVAL;
+    }
+
+    // Only 7-bit addressing is supported:
+    if (device_address > 0x7F) {
+        return -EINVAL;
+    }
+
+    sim->devices[device_address].present = 1;
+    sim->devices[device_address].registers = registers;
+    sim->devices[device_address].register_pointer = 0;
+    sim->devices[device_address].stretch_us = 0;
+
+    return 0;
+}
+
+// Unplug a device; its address goes unanswered until it is added again
+int remove_device_sim_i2c(struct pi_i2c_sim *sim,
+                          unsigned int device_address) {
+    if ((sim == NULL) || (device_address > 0x7F)) {
+        return -EINVAL;
+    }
+
+    sim->devices[device_address].present = 0;
+
+    return 0;
+}
+
+// Have a device hold SCL low for stretch_us after each byte it ACKs
+int set_clock_stretch_sim_i2c(struct pi_i2c_sim *sim,
+                              unsigned int device_address,
+                              unsigned int stretch_us) {
+    if ((sim == NULL) || (device_address > 0x7F) ||
+        !sim->devices[device_address].present) {
+        return -EINVAL;
+    }
+
+    sim->devices[device_address].stretch_us = stretch_us;
+
+    return 0;
+}
+
+// Return line access counts and virtual time recorded by the simulator
+struct pi_i2c_sim_statistics get_statistics_sim_i2c(struct pi_i2c_sim *sim) {
+    sim->statistics.bus_time_ns = sim_clock_ns(sim);
+
+    return sim->statistics;
+}
+
+// Create a simulated GPIO register block with every pin an input. Returns
+// NULL and sets errno on error
+struct pi_i2c_sim_regs *create_sim_regs_i2c(void) {
+    struct pi_i2c_sim_regs *regs;
+
+    if ((regs = calloc(1, sizeof(*regs))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return regs;
+}
+
+void free_sim_regs_i2c(struct pi_i2c_sim_regs *regs) {
+    free(regs);
+}
+
+// Wire a simulated bus to two pins of the register block. The bus must not
+// also be used through pi_i2c_sim_backend
+int attach_sim_regs_i2c(struct pi_i2c_sim_regs *regs, struct pi_i2c_sim *sim,
+                        unsigned int sda, unsigned int scl) {
+    if ((regs == NULL) || (sim == NULL) || (sda > 31) || (scl > 31) ||
+        (sda == scl)) {
+        return -EINVAL;
+    }
+
+    if (regs->n_buses == SIM_REGS_BUSES) {
+        return -ENOSPC;
+    }
+
+    sim->sda_gpio_pin = sda;
+    sim->scl_gpio_pin = scl;
+
+    regs->buses[regs->n_buses++] = sim;
+
+    return 0;
+}
+
+// Whether a pin of the block is set to output (driving its line low)
+static inline int sim_regs_output(struct pi_i2c_sim_regs *regs,
+                                  unsigned int gpio) {
+    return ((regs->fsel[gpio / GPFSEL_PINS_PER_REGISTER] >>
+             ((gpio % GPFSEL_PINS_PER_REGISTER) * GPFSEL_BITS)) &
+            GPFSEL_MASK) == GPFSEL_OUTPUT;
+}
+
+// Store to a register of the block. Function select changes drive the
+// lines of the attached buses; other registers are ignored
+void store_sim_regs(struct pi_i2c_sim_regs *regs, unsigned int offset,
+                    uint32_t value) {
+    struct pi_i2c_sim *sim;
+
+    unsigned int i;
+    int sda;
+    int scl;
+
+    if (offset >= GPIO_REGS_GPFSEL + GPFSEL_REGISTERS) {
+        return;
+    }
+
+    regs->fsel[offset - GPIO_REGS_GPFSEL] = value;
+
+    for (i = 0; i < regs->n_buses; i++) {
+        sim = regs->buses[i];
+
+        sda = !sim_regs_output(regs, sim->sda_gpio_pin);
+        scl = !sim_regs_output(regs, sim->scl_gpio_pin);
+
+        if ((sda != sim->controller_sda) || (scl != sim->controller_scl)) {
+            sim->statistics.num_line_writes++;
+
+            sim->controller_sda = sda;
+            sim->controller_scl = scl;
+
+            sim_update(sim);
+        }
+    }
+}
+
+// Load a register of the block. The level register holds the lines of the
+// attached buses (other pins read high as if pulled up)
+uint32_t load_sim_regs(struct pi_i2c_sim_regs *regs, unsigned int offset) {
+    struct pi_i2c_sim *sim;
+
+    uint32_t levels = 0xFFFFFFFF;
+
+    unsigned int i;
+
+    if (offset < GPIO_REGS_GPFSEL + GPFSEL_REGISTERS) {
+        return regs->fsel[offset - GPIO_REGS_GPFSEL];
+    }
+
+    if (offset != GPIO_REGS_GPLEV) {
+        return 0;
+    }
+
+    for (i = 0; i < regs->n_buses; i++) {
+        sim = regs->buses[i];
+        sim->statistics.num_line_reads++;
+
+        sim_update(sim);
+
+        if (!sim->sda) {
+            levels &= ~((uint32_t) 1 << sim->sda_gpio_pin);
+        }
+
+        if (!sim->scl) {
+            levels &= ~((uint32_t) 1 << sim->scl_gpio_pin);
+        }
+    }
+
+    return levels;
+}
+
+// Advance the virtual clock of every attached bus
+void delay_sim_regs(struct pi_i2c_sim_regs *regs, unsigned int ns) {
+    unsigned int i;
+
+    for (i = 0; i < regs->n_buses; i++) {
+        regs->buses[i]->statistics.elapsed_ns += ns;
+
+        sim_update(regs->buses[i]);
+    }
+}
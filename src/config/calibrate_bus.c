@@ -0,0 +1,326 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Bus calibration
+//
+// Timings derived from the speed mode alone assume lines take the maximum
+// rise time of the mode to go high and that line accesses take no time. Both
+// can be measured on the configured pins instead: the time from releasing a
+// line until it reads back high, and the time spent in one line access. The
+// delays are then derived again from those numbers (see derive_bus_timings())
+// so that nothing is padded beyond what the pins need.
+//
+// Measurements are kept in a cache file, one line per board revision,
+// backend, speed mode and pair of pins, so that later processes using the
+// same pins the same way skip measuring. The speed mode is part of the key
+// as lines are measured between waits of its clock periods.
+
+// Include C standard libraries:
+#include <stdio.h>  // C Standard I/O library (cache file)
+#include <stdlib.h> // C Standard library (qsort)
+#include <string.h> // C Standard string library
+#include <errno.h>  // C Standard for error conditions
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "config.h"                   // I2C timing and variable defs
+#include "detect_recover_bus.h"       // Detect and recover I2C bus
+#include "gpio_line.h"                // Open-drain line control
+#include "calibrate_bus.h"            // Bus calibration function protos
+
+#define CALIBRATION_SAMPLES 128        // Rise time samples per line
+#define CALIBRATION_LINE_CALLS 256     // Line accesses timed per run
+#define CALIBRATION_RUNS 5             // Keep the best run (least preempted)
+#define CALIBRATION_TIMEOUT_NS 1000000 // Released line must rise by then
+
+#define CACHE_LINE_LEN 128
+#define REVISION_LEN 32
+#define BACKEND_NAME_LEN 32
+
+// Board revision from /proc/cpuinfo ("unknown" off the Pi)
+static void get_board_revision(char *revision) {
+    FILE *cpuinfo;
+
+    char line[CACHE_LINE_LEN];
+
+    strcpy(revision, "unknown");
+
+    if ((cpuinfo = fopen("/proc/cpuinfo", "r")) == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), cpuinfo) != NULL) {
+        if (strncmp(line, "Revision", strlen("Revision")) == 0) {
+            sscanf(line, "Revision : %31s", revision);
+            break;
+        }
+    }
+
+    fclose(cpuinfo);
+}
+
+// Name of the bus's backend in the cache ("custom" for a caller's own)
+static const char *get_backend_name(const struct pi_i2c_bus *bus) {
+    if (bus->backend == &pi_i2c_pi_lw_gpio_backend) {
+        return "pi_lw_gpio";
+    } else if (bus->backend == &pi_i2c_gpiochip_backend) {
+        return "gpiochip";
+    } else if (bus->backend == &pi_i2c_gpio_regs_backend) {
+        return "gpio_regs";
+    } else if (bus->backend == &pi_i2c_sim_backend) {
+        return "sim";
+    }
+
+    return "custom";
+}
+
+// Look up the measurements of this board's pins. Returns 1 if found
+static int load_cache(const char *cache_path, const char *revision,
+                      const char *backend, unsigned int speed_hz,
+                      unsigned int sda, unsigned int scl, int *rise_ns,
+                      int *line_call_ns) {
+    FILE *cache;
+
+    char line[CACHE_LINE_LEN];
+    char line_revision[REVISION_LEN];
+    char line_backend[BACKEND_NAME_LEN];
+
+    unsigned int line_speed_hz;
+    unsigned int line_sda;
+    unsigned int line_scl;
+    int line_rise_ns;
+    int line_line_call_ns;
+
+    int found = 0;
+
+    if ((cache = fopen(cache_path, "r")) == NULL) {
+        return 0;
+    }
+
+    // Later lines win should the same pins have been measured again. Lines
+    // without a backend and speed mode are from older versions and are
+    // skipped:
+    while (fgets(line, sizeof(line), cache) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+
+        if (sscanf(line, "%31s %31s %u %u %u %d %d", line_revision,
+                   line_backend, &line_speed_hz, &line_sda, &line_scl,
+                   &line_rise_ns, &line_line_call_ns) != 7) {
+            continue;
+        }
+
+        if ((strcmp(line_revision, revision) == 0) &&
+            (strcmp(line_backend, backend) == 0) &&
+            (line_speed_hz == speed_hz) && (line_sda == sda) &&
+            (line_scl == scl) && (line_rise_ns >= 0) &&
+            (line_line_call_ns >= 0)) {
+            *rise_ns = line_rise_ns;
+            *line_call_ns = line_line_call_ns;
+            found = 1;
+        }
+    }
+
+    fclose(cache);
+
+    return found;
+}
+
+// Add this board's pins to the cache. A cache that cannot be written only
+// means the next process measures again
+static void store_cache(const char *cache_path, const char *revision,
+                        const char *backend, unsigned int speed_hz,
+                        unsigned int sda, unsigned int scl, int rise_ns,
+                        int line_call_ns) {
+    FILE *cache;
+
+    if ((cache = fopen(cache_path, "a")) == NULL) {
+        return;
+    }
+
+    if (ftell(cache) == 0) {
+        fprintf(cache, "# pi_i2c calibration: revision backend speed_hz "
+                       "sda scl rise_ns line_call_ns\n");
+    }
+
+    fprintf(cache, "%s %s %u %u %u %d %d\n", revision, backend, speed_hz,
+            sda, scl, rise_ns, line_call_ns);
+
+    fclose(cache);
+}
+
+static int compare_ns(const void *a, const void *b) {
+    long long x = *(const long long *) a;
+    long long y = *(const long long *) b;
+
+    return (x > y) - (x < y);
+}
+
+// Time from releasing a line until it reads back high. The line is held low
+// for T_LOW and left high for T_HIGH between samples so that the clock never
+// runs faster than the speed grade
+static int measure_rise(struct pi_i2c_bus *bus, unsigned int gpio,
+                        int *rise_ns) {
+    const struct pi_i2c_gpio_backend *backend = bus->backend;
+
+    long long samples[CALIBRATION_SAMPLES];
+    long long start;
+
+    int level;
+    int i;
+
+    for (i = 0; i < CALIBRATION_SAMPLES; i++) {
+        backend->clear_line(bus->backend_ctx, gpio);
+        wait_ns(bus, bus->mode_timing->min_t_low);
+
+        start = now_ns(bus);
+        backend->release_line(bus->backend_ctx, gpio);
+
+        while ((level = backend->read_line(bus->backend_ctx, gpio)) == 0) {
+            if (now_ns(bus) - start > CALIBRATION_TIMEOUT_NS) {
+                return -EBUSLOCKUP;
+            }
+        }
+
+        if (level < 0) {
+            return level;
+        }
+
+        samples[i] = now_ns(bus) - start;
+
+        wait_ns(bus, bus->mode_timing->min_t_high);
+    }
+
+    // The slowest samples are most likely the process being preempted rather
+    // than the line; take the time seven in eight rises make it within:
+    qsort(samples, CALIBRATION_SAMPLES, sizeof(samples[0]), compare_ns);
+
+    *rise_ns = (int) samples[CALIBRATION_SAMPLES * 7 / 8];
+
+    return 0;
+}
+
+// Time spent in one line access (writes leave SDA where it is)
+static int measure_line_call(struct pi_i2c_bus *bus) {
+    long long start;
+    long long elapsed;
+    long long best = -1;
+
+    int run;
+    int i;
+
+    for (run = 0; run < CALIBRATION_RUNS; run++) {
+        start = now_ns(bus);
+
+        for (i = 0; i < CALIBRATION_LINE_CALLS; i++) {
+            release_sda(bus);
+        }
+
+        elapsed = now_ns(bus) - start;
+
+        if ((best < 0) || (elapsed < best)) {
+            best = elapsed;
+        }
+    }
+
+    return (int) (best / CALIBRATION_LINE_CALLS);
+}
+
+// Measure (or look up in the cache at cache_path, if not NULL) how long the
+// bus's lines take to rise and how long a line access takes, then derive its
+// timings from those (caller holds bus->lock)
+int calibrate_bus(struct pi_i2c_bus *bus, const char *cache_path) {
+    char revision[REVISION_LEN];
+
+    int sda_rise_ns;
+    int scl_rise_ns;
+    int line_call_ns;
+
+    int ret;
+
+    // Check if I2C has been configured for use; otherwise bail as there are
+    // no lines to measure:
+    if (!bus->config_i2c_flag) {
+        return -EI2CNOTCFG;
+    }
+
+    // Measuring needs the backend's clock; kernel adapters time their own
+    // bus:
+    if ((bus->backend == NULL) || (bus->backend->now_ns == NULL)) {
+        return -ENOTSUP;
+    }
+
+    get_board_revision(revision);
+
+    if ((cache_path == NULL) ||
+        !load_cache(cache_path, revision, get_backend_name(bus),
+                    bus->mode_timing->max_frequency_hz, bus->sda_gpio_pin,
+                    bus->scl_gpio_pin, &scl_rise_ns, &line_call_ns)) {
+        // Lines can only be measured from an IDLE bus:
+        if ((ret = detect_recover_bus(bus)) < 0) {
+            return ret;
+        }
+
+        // SCL pulses while SDA is released are no START or STOP condition:
+        if ((ret = measure_rise(bus, bus->scl_gpio_pin, &scl_rise_ns)) < 0) {
+            return ret;
+        }
+
+        // Neither are SDA pulses while SCL is held low:
+        clear_scl(bus);
+        wait_ns(bus, bus->mode_timing->min_t_low);
+
+        ret = measure_rise(bus, bus->sda_gpio_pin, &sda_rise_ns);
+
+        release_scl(bus);
+        wait_ns(bus, bus->mode_timing->min_t_buf);
+
+        if (ret < 0) {
+            return ret;
+        }
+
+        // Both lines are given the slower of the two rise times:
+        if (sda_rise_ns > scl_rise_ns) {
+            scl_rise_ns = sda_rise_ns;
+        }
+
+        line_call_ns = measure_line_call(bus);
+
+        if (cache_path != NULL) {
+            store_cache(cache_path, revision, get_backend_name(bus),
+                        bus->mode_timing->max_frequency_hz,
+                        bus->sda_gpio_pin, bus->scl_gpio_pin, scl_rise_ns,
+                        line_call_ns);
+        }
+    }
+
+    bus->scl_rise_time_ns = scl_rise_ns;
+    bus->line_call_ns = line_call_ns;
+    bus->calibrated_flag = 1;
+
+    derive_bus_timings(bus);
+
+    return 0;
+}
\ No newline at end of file
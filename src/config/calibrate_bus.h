@@ -21,5 +21,5 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 // ============================================================================
 
-// Read function prototypes:
-int read_byte_from_bus(int ack_flag);
\ No newline at end of file
+// Bus calibration function prototype (caller holds bus->lock):
+int calibrate_bus(struct pi_i2c_bus *bus, const char *cache_path);
@@ -22,61 +22,204 @@
 // ============================================================================
 
 // Include C standard libraries:
-#include <time.h>  // C Standard get and manipulate time library
-#include <errno.h> // C Standard for error conditions
+#include <stdlib.h> // C Standard library (bus allocation)
+#include <time.h>   // C Standard get and manipulate time library
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <pthread.h> // POSIX threads (per-bus transaction lock)
 
 // Include header files:
 #include "pi_i2c.h"                   // Speed grade, macros, and outward
                                       // function prototypes.
 #include "write_conditions_to_bus.h"  // I2C START and STOP function protos
 #include "config.h"                   // I2C timing and variable defs
-#include <pi_lw_gpio.h>               // GPIO library for the Pi
-#include <pi_microsleep_hard.h>       // Hard microsleep function for the Pi
-
-// I2C timing compliance nanosleep timespec definitions
-int min_t_hdsta_sleep_us = CEILING(MIN_T_HDSTA * 1e6);
-int min_t_susta_sleep_us = CEILING(MIN_T_SUSTA * 1e6);
-int min_t_susto_sleep_us = CEILING(MIN_T_SUSTO * 1e6);
-int min_t_buf_sleep_us = CEILING(MIN_T_BUF * 1e6);
-
-int scl_t_low_sleep_us = 0;
-int scl_t_high_sleep_us = 0;
-
-int scl_response_time_us = CEILING(SCL_RESPONSE_TIME);
-
-// Config global variables defined and initialized to 0:
-int config_i2c_flag = 0;
-
-int sda_gpio_pin = 0;
-int scl_gpio_pin = 0;
-
-int scl_clock_frequency_hz = 0;
-float scl_actual_clock_frequency_hz = 0;
-
-struct pi_i2c_statistics statistics = {
-    .num_start_cond = 0,
-    .num_repeated_start_cond = 0,
-    .num_stop_cond = 0,
-    .num_bytes_written = 0,
-    .num_bytes_read = 0,
-    .num_nack = 0,
-    .num_nack_rst = 0,
-    .num_bad_reg = 0,
-    .num_badxfr = 0,
-    .num_bus_resets = 0,
-    .num_unknown_bus_errors = 0,
-    .num_bus_lockups = 0,
-    .num_failed_start_cond = 0,
-    .num_failed_stop_cond = 0,
-    .num_device_hung = 0,
-    .num_clock_stretch = 0
+#include "i2c_dev_backend.h"          // Kernel i2c-dev function protos
+#include "gpio_line.h"                // Open-drain line control
+
+// Default bus used by the original global API. Everything is zero until
+// configured:
+struct pi_i2c_bus default_bus = {
+    .i2c_dev_fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .coalesce_lock = PTHREAD_MUTEX_INITIALIZER,
+    .coalesce_cond = PTHREAD_COND_INITIALIZER
 };
 
-// Configure pi_i2c
-int config_i2c(unsigned int sda, unsigned int scl, unsigned int speed_grade) {
+// I2C timing minimums for each speed mode according to UM10204 table 10 (in
+// nano seconds). Modes are in order of speed; a bus uses the slowest mode
+// fast enough for its speed grade:
+static const struct i2c_mode_timing i2c_mode_timings[] = {
+    // Standard-mode:
+    {.max_frequency_hz = I2C_STANDARD_MODE,
+     .min_t_low = 4700, .min_t_high = 4000,
+     .min_t_susta = 4700, .min_t_hdsta = 4000,
+     .min_t_susto = 4000, .min_t_buf = 4700,
+     .min_t_sudat = 250, .max_t_r = 1000},
+
+    // Fast-mode (full-speed):
+    {.max_frequency_hz = I2C_FULL_SPEED,
+     .min_t_low = 1300, .min_t_high = 600,
+     .min_t_susta = 600, .min_t_hdsta = 600,
+     .min_t_susto = 600, .min_t_buf = 1300,
+     .min_t_sudat = 100, .max_t_r = 300},
+
+    // Fast-mode Plus:
+    {.max_frequency_hz = I2C_FAST_MODE_PLUS,
+     .min_t_low = 500, .min_t_high = 260,
+     .min_t_susta = 260, .min_t_hdsta = 260,
+     .min_t_susto = 260, .min_t_buf = 500,
+     .min_t_sudat = 50, .max_t_r = 120}
+};
+
+#define N_I2C_MODES (sizeof(i2c_mode_timings) / sizeof(i2c_mode_timings[0]))
+
+// Hand a bus's lines back to whichever backend has been driving them
+static void release_bus(struct pi_i2c_bus *bus) {
+    bus->config_i2c_flag = 0;
+
+    if (bus->backend != NULL) {
+        bus->backend->close(bus->backend_ctx);
+        bus->backend = NULL;
+    }
+
+    if (bus->i2c_dev_fd >= 0) {
+        close_i2c_dev(bus);
+    }
+}
+
+// Delay needed after a line access for a phase to last at least min_ns
+static inline int sleep_after_line_call(int min_ns, int line_call_ns) {
+    return (min_ns > line_call_ns) ? (min_ns - line_call_ns) : 0;
+}
+
+// Derive a bus's delays from the minimums of its speed mode, the time its
+// lines take to rise and the time spent in each line access (caller holds
+// bus->lock). Called again whenever calibration or the timing mode changes
+void derive_bus_timings(struct pi_i2c_bus *bus) {
     // Definitions:
-    int scl_clock_period_us;
+    const struct i2c_mode_timing *mode = bus->mode_timing;
+
+    int scl_clock_period_ns;
+    int min_scl_t_low_ns;
+    int min_scl_t_high_ns;
+    int scl_t_low_ns;
+    int scl_t_high_ns;
+    int slack_ns;
+    int line_call_ns;
+
+    // With relative timing every phase of the clock also spends at least one
+    // line access before the edge ending it, which counts towards the
+    // minimums. Deadline timing already absorbs that time:
+    if (bus->timing_mode == I2C_TIMING_RELATIVE) {
+        line_call_ns = bus->line_call_ns;
+    } else {
+        line_call_ns = 0;
+    }
+
+    // Timings not dependent on the clock period. Delays have nano second
+    // resolution so no rounding up to whole micro seconds is needed:
+    bus->min_t_hdsta_sleep_ns = sleep_after_line_call(mode->min_t_hdsta,
+                                                      line_call_ns);
+    bus->min_t_susta_sleep_ns = sleep_after_line_call(mode->min_t_susta,
+                                                      line_call_ns);
+    bus->min_t_susto_sleep_ns = sleep_after_line_call(mode->min_t_susto,
+                                                      line_call_ns);
+    bus->min_t_buf_sleep_ns = sleep_after_line_call(mode->min_t_buf,
+                                                    line_call_ns);
+
+    // Lines are given their rise time to go high; the maximum rise time of
+    // the mode unless calibration measured the lines:
+    bus->scl_response_time_ns = bus->scl_rise_time_ns;
+
+    scl_clock_period_ns = CEILING(1e9 / bus->scl_clock_frequency_hz);
+
+    // Split the clock period between SCL low and high using the minimums of
+    // the mode. T_HIGH is counted from SCL being released so it must also
+    // cover the time SCL takes to rise (waited out when checking for clock
+    // stretching); the time it takes to fall is ignored. SDA changes at the
+    // start of T_LOW so T_LOW must also let SDA rise and be set up before
+    // SCL is released:
+    //
+    // +-----------+--------------------+---------+---------+---------+
+    // |           |        Clock       |  T_LOW  | T_HIGH  |   T_r   |
+    // |   Mode    +===========+========+=========+=========+=========+
+    // |           | Frequency | Period |   Min   |   Min   |   Max   |
+    // +-----------+-----------+--------+---------+---------+---------+
+    // | Standard  |  100 KHz  |  10 us |  4.7 us |  4.0 us |  1.0 us |
+    // +-----------+-----------+--------+---------+---------+---------+
+    // | Full      |  400 KHz  | 2.5 us |  1.3 us |  0.6 us |  0.3 us |
+    // +-----------+-----------+--------+---------+---------+---------+
+    // | Fast Plus | 1000 KHz  | 1.0 us |  0.5 us | 0.26 us | 0.12 us |
+    // +-----------+-----------+--------+---------+---------+---------+
+    //
+    // Whatever is left of the period once both minimums are met is shared
+    // out in proportion to the minimums so that neither half is closer to
+    // its limit than the other (e.g. at 400 kHz: T_LOW 1.477 us and T_HIGH
+    // 1.023 us including 0.3 us to rise). The actual frequency is within
+    // rounding of a nano second of the input:
+    min_scl_t_low_ns = mode->min_t_low;
+
+    if (min_scl_t_low_ns < mode->min_t_sudat + bus->scl_rise_time_ns) {
+        min_scl_t_low_ns = mode->min_t_sudat + bus->scl_rise_time_ns;
+    }
+
+    min_scl_t_high_ns = mode->min_t_high + bus->scl_rise_time_ns;
+
+    slack_ns = scl_clock_period_ns - min_scl_t_low_ns - min_scl_t_high_ns;
+
+    if (slack_ns < 0) {
+        slack_ns = 0;
+    }
+
+    scl_t_low_ns = min_scl_t_low_ns + (int) (((long long) slack_ns *
+        min_scl_t_low_ns) / (min_scl_t_low_ns + min_scl_t_high_ns));
+
+    scl_t_high_ns = min_scl_t_high_ns + slack_ns -
+        (scl_t_low_ns - min_scl_t_low_ns);
 
+    // Line accesses within each phase come out of its delay:
+    bus->scl_t_low_sleep_ns = sleep_after_line_call(scl_t_low_ns,
+                                                    line_call_ns);
+    bus->scl_t_high_sleep_ns = sleep_after_line_call(
+        scl_t_high_ns - bus->scl_response_time_ns, line_call_ns);
+
+    bus->scl_actual_clock_frequency_hz = (1.0 / \
+        ((bus->scl_t_low_sleep_ns + bus->scl_t_high_sleep_ns +
+          bus->scl_response_time_ns + 2 * line_call_ns) * 1e-9));
+}
+
+// Derive the timings of a speed grade for lines not yet calibrated (caller
+// holds bus->lock)
+void set_bus_speed_grade(struct pi_i2c_bus *bus, unsigned int speed_grade) {
+    unsigned int i;
+
+    // Slowest mode that can run at the speed grade:
+    for (i = 0; i < N_I2C_MODES - 1; i++) {
+        if (speed_grade <= i2c_mode_timings[i].max_frequency_hz) {
+            break;
+        }
+    }
+
+    bus->mode_timing = &i2c_mode_timings[i];
+
+    // Set clock frequency given input speed grade:
+    bus->scl_clock_frequency_hz = speed_grade; // (clock frequency in Hz = bps)
+
+    // Until the lines are calibrated (see calibrate_bus()) assume they take
+    // the maximum rise time of the mode and line accesses take no time:
+    bus->scl_rise_time_ns = bus->mode_timing->max_t_r;
+    bus->line_call_ns = 0;
+    bus->calibrated_flag = 0;
+
+    derive_bus_timings(bus);
+}
+
+// Configure the backend, lines and timings of a bus (caller holds bus->lock)
+int init_bus(struct pi_i2c_bus *bus, unsigned int sda, unsigned int scl,
+             unsigned int speed_grade,
+             const struct pi_i2c_gpio_backend *backend, void *backend_arg) {
+    // Definitions:
     int ret;
 
     // There are no more than 31 physical GPIO pins:
@@ -84,75 +227,236 @@ int config_i2c(unsigned int sda, unsigned int scl, unsigned int speed_grade) {
         return -EINVAL;
     }
 
-    // Don't allow speed grade to be set to more than full-speed as
-    // microsleep_hard will not allow anything faster:
-    if (speed_grade > I2C_FULL_SPEED) {
+    // A bus needs two distinct lines:
+    if (sda == scl) {
+        return -EINVAL;
+    }
+
+    // Don't allow speed grade to be set to more than Fast-mode Plus as
+    // there are no timings defined for anything faster:
+    if ((speed_grade == 0) || (speed_grade > I2C_FAST_MODE_PLUS)) {
         return -EINVAL;
     }
 
-    // Setup microsleep function to eliminate additional over head at first
-    // sleep function call:
-    if ((ret = setup_microsleep_hard()) < 0) {
+    if (backend == NULL) {
+        return -EINVAL;
+    }
+
+    // Reconfiguring a bus hands its lines back to the previous backend:
+    release_bus(bus);
+
+    if ((ret = backend->open(&bus->backend_ctx, sda, scl, backend_arg)) < 0) {
         return ret;
     }
 
+    bus->backend = backend;
+
+    // Deadline timing needs the backend's clock:
+    if ((backend->now_ns == NULL) || (backend->delay_until_ns == NULL)) {
+        bus->timing_mode = I2C_TIMING_RELATIVE;
+    }
+
     // Set data and clock GPIO pin mappings:
-    sda_gpio_pin = sda;
-    scl_gpio_pin = scl;
+    bus->sda_gpio_pin = sda;
+    bus->scl_gpio_pin = scl;
+
+    set_bus_speed_grade(bus, speed_grade);
+
+    // Backends open with both lines released:
+    bus->driven_lines = BUS_IDLE;
+    bus->idle_verified = 0;
 
     // Get bus into known state by using STOP condition:
-    write_stop_condition_to_bus();
+    write_stop_condition_to_bus(bus);
 
-    // Set clock frequency given input speed grade:
-    scl_clock_frequency_hz = speed_grade; // (clock frequency in Hz = bps)
-    scl_clock_period_us = CEILING((1.0 / scl_clock_frequency_hz) * 1e6);
+    // Set configuration flag to allow functionality:
+    bus->config_i2c_flag = 1;
 
-    // Assign SCL low and high period sleep times unevenly. The time it takes
-    // for a GPIO pin to change state is ignored until that time can be
-    // measured or researched accurately.
-    //
-    // Uneven allocation of period reflects I2C timing mimimums for T_LOW and
-    // T_HIGH. T_LOW minimum is larger than T_HIGH but the ratio between the
-    // two periods changes with speed grades. See the table below.
-    //
-    // +-----------+--------------------+-----------------+------------------+
-    // |           |        Clock       |      T_LOW      |      T_HIGH      |
-    // |   Mode    +===========+========+========+========+=========+========+
-    // |           | Frequency | Period |   Min  |  % of  |   Min   |  % of  |
-    // |           |           |        |        | Period |         | Period |
-    // +-----------+-----------+--------+--------+--------+---------+--------+
-    // | Standard  |  100 KHz  |  10 us | 4.7 us |   47%  |  4.0 us |   40%  |
-    // +-----------+-----------+--------+--------+--------+---------+--------+
-    // | Full      |  400 KHz  | 2.5 us | 1.3 us |   52%  |  0.6 us |   24%  |
-    // +-----------+-----------+--------+--------+--------+---------+--------+
-    // | Fast      |  1000 KHz | 1.0 us | 0.5 us |   50%  | 0.26 us |   26%  |
-    // +-----------+-----------+--------+--------+--------+---------+--------+
-    //
-    // +-----------+--------------------+
-    // |           |  Pin Response Time |
-    // |   Mode    | (Falling & Rising) |
-    // |           +===========+========+
-    // |           |  Reserved |  % of  |
-    // |           |           | Period |
-    // +-----------+-----------+--------+
-    // | Standard  |   1.3 us  |   13%  |
-    // +-----------+-----------+--------+
-    // | Fast      |   0.6 us  |   24%  |
-    // +-----------+-----------+--------+
-    // | Fast Plus |  0.24 us  |   24%  |
-    // +-----------+-----------+--------+
-    //
-    // Choosing 66.6% of period for T_LOW and 33.3% of period for T_HIGH as
-    // these ratios will work for all speed grades. Rounding required so actual
-    // frequency achieved is not guaranteed to equal input:
-    scl_t_low_sleep_us = CEILING((2.0 / 3.0) * scl_clock_period_us);
-    scl_t_high_sleep_us = CEILING((1.0 / 3.0) * scl_clock_period_us);
+    return 0;
+}
 
-    scl_actual_clock_frequency_hz = (1.0 / \
-        ((scl_t_low_sleep_us + scl_t_high_sleep_us) * 1e-6));
+// Configure a bus onto kernel I2C adapter /dev/i2c-N (caller holds
+// bus->lock). The adapter driver owns the clock so there are no timings to
+// compute
+int init_i2c_dev_bus(struct pi_i2c_bus *bus, unsigned int adapter) {
+    int ret;
+
+    release_bus(bus);
+
+    if ((ret = open_i2c_dev(bus, adapter)) < 0) {
+        return ret;
+    }
 
     // Set configuration flag to allow functionality:
-    config_i2c_flag = 1;
+    bus->config_i2c_flag = 1;
+
+    return 0;
+}
+
+// Make room for n bytes in bus->transfer_data (caller holds bus->lock)
+int reserve_transfer_data(struct pi_i2c_bus *bus, unsigned int n) {
+    uint8_t *transfer_data;
+
+    if (n <= bus->transfer_capacity) {
+        return 0;
+    }
+
+    if ((transfer_data = realloc(bus->transfer_data, n)) == NULL) {
+        return -ENOMEM;
+    }
+
+    bus->transfer_data = transfer_data;
+    bus->transfer_capacity = n;
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Narrow n ints to a byte each in bus->transfer_data, for int buffers to be
+// written by the byte engine (caller holds bus->lock)
+int stage_int_data(struct pi_i2c_bus *bus, const int *data, unsigned int n) {
+    unsigned int i;
+    int ret;
+
+    if ((ret = reserve_transfer_data(bus, n)) < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < n; i++) {
+        bus->transfer_data[i] = data[i];
+    }
+
+    return 0;
+}
+
+// Widen n bytes read into the start of an int buffer to an int each. Going
+// from the last byte down never overwrites a byte yet to be widened
+void widen_int_data(int *data, unsigned int n) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    unsigned int i;
+
+    for (i = n; i > 0; i--) {
+        data[i - 1] = bytes[i - 1];
+    }
+}
+
+// Configure the default bus used by the global API
+int config_i2c(unsigned int sda, unsigned int scl, unsigned int speed_grade) {
+    int ret;
+
+    pthread_mutex_lock(&default_bus.lock);
+    ret = init_bus(&default_bus, sda, scl, speed_grade,
+                   &pi_i2c_pi_lw_gpio_backend, NULL);
+    pthread_mutex_unlock(&default_bus.lock);
+
+    return ret;
+}
+
+// Configure the default bus used by the global API onto kernel I2C adapter
+// /dev/i2c-N
+int config_i2c_dev(unsigned int adapter) {
+    int ret;
+
+    pthread_mutex_lock(&default_bus.lock);
+    ret = init_i2c_dev_bus(&default_bus, adapter);
+    pthread_mutex_unlock(&default_bus.lock);
+
+    return ret;
+}
+
+// Allocate and configure a new bus driven by the given GPIO backend. Returns
+// NULL and sets errno on error
+struct pi_i2c_bus *config_i2c_bus_backend(
+    unsigned int sda, unsigned int scl, unsigned int speed_grade,
+    const struct pi_i2c_gpio_backend *backend, void *backend_arg) {
+    struct pi_i2c_bus *bus;
+
+    int ret;
+
+    // Statistics and flags start zeroed:
+    if ((bus = calloc(1, sizeof(*bus))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bus->i2c_dev_fd = -1;
+
+    pthread_mutex_init(&bus->lock, NULL);
+    pthread_mutex_init(&bus->coalesce_lock, NULL);
+    pthread_cond_init(&bus->coalesce_cond, NULL);
+
+    // Nobody else can see the bus yet so no need to take the lock:
+    if ((ret = init_bus(bus, sda, scl, speed_grade, backend,
+                        backend_arg)) < 0) {
+        pthread_mutex_destroy(&bus->lock);
+        pthread_mutex_destroy(&bus->coalesce_lock);
+        pthread_cond_destroy(&bus->coalesce_cond);
+        free(bus);
+
+        errno = -ret;
+        return NULL;
+    }
+
+    return bus;
+}
+
+// Allocate and configure a new bus on the Pi's GPIO. Returns NULL and sets
+// errno on error
+struct pi_i2c_bus *config_i2c_bus(unsigned int sda, unsigned int scl,
+                                  unsigned int speed_grade) {
+    return config_i2c_bus_backend(sda, scl, speed_grade,
+                                  &pi_i2c_pi_lw_gpio_backend, NULL);
+}
+
+// Allocate a new bus on kernel I2C adapter /dev/i2c-N. Returns NULL and sets
+// errno on error
+struct pi_i2c_bus *config_i2c_dev_bus(unsigned int adapter) {
+    struct pi_i2c_bus *bus;
+
+    int ret;
+
+    // Statistics and flags start zeroed:
+    if ((bus = calloc(1, sizeof(*bus))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bus->i2c_dev_fd = -1;
+
+    pthread_mutex_init(&bus->lock, NULL);
+    pthread_mutex_init(&bus->coalesce_lock, NULL);
+    pthread_cond_init(&bus->coalesce_cond, NULL);
+
+    // Nobody else can see the bus yet so no need to take the lock:
+    if ((ret = init_i2c_dev_bus(bus, adapter)) < 0) {
+        pthread_mutex_destroy(&bus->lock);
+        pthread_mutex_destroy(&bus->coalesce_lock);
+        pthread_cond_destroy(&bus->coalesce_cond);
+        free(bus);
+
+        errno = -ret;
+        return NULL;
+    }
+
+    return bus;
+}
+
+// Release a bus allocated by config_i2c_bus() or config_i2c_dev_bus()
+void free_i2c_bus(struct pi_i2c_bus *bus) {
+    // The default bus is statically allocated:
+    if ((bus == NULL) || (bus == &default_bus)) {
+        return;
+    }
+
+    // Stop the background rescan before the bus goes:
+    unwatch_presence_i2c(bus->presence);
+
+    release_bus(bus);
+
+    pthread_mutex_destroy(&bus->lock);
+    pthread_mutex_destroy(&bus->coalesce_lock);
+    pthread_cond_destroy(&bus->coalesce_cond);
+    free(bus->waveform.steps);
+    free(bus->transfer_data);
+    free(bus->coalesced_counts);
+    free(bus);
+}
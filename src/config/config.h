@@ -21,20 +21,46 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 // ============================================================================
 
-// I2C timings
-#define MIN_T_LOW 1.3e-6   // SCL Low Period [seconds]
-#define MIN_T_HIGH 0.6e-6  // SCL High Period [seconds]
-#define MIN_T_SUDAT 0.1e-6 // SDA Setup Time [seconds]
-#define MIN_T_HDDAT 0      // SDA Hold Time [seconds]
-#define MIN_T_SUSTA 0.6e-6 // Setup Time for a repeated Start condition [seconds]
-#define MIN_T_HDSTA 0.6e-6 // Hold Time for a Start condition [seconds]
-#define MIN_T_SUSTO 0.6e-6 // Setup time for a Stop condition [seconds]
-#define MIN_T_BUF 1.3e-6   // Time before a new transmission can start [seconds]
-
-#define SCL_RESPONSE_TIME 1e-6 // Time for SCL to change after set/clear
+// Include C POSIX libraries:
+#include <pthread.h> // POSIX threads (per-bus transaction lock)
+
+// I2C timing minimums of one speed mode (UM10204 table 10) in nano seconds.
+// See i2c_mode_timings[] in config.c:
+struct i2c_mode_timing {
+    unsigned int max_frequency_hz; // Fastest SCL clock of the mode
+
+    int min_t_low;   // SCL Low Period
+    int min_t_high;  // SCL High Period
+    int min_t_susta; // Setup Time for a repeated Start condition
+    int min_t_hdsta; // Hold Time for a Start condition
+    int min_t_susto; // Setup time for a Stop condition
+    int min_t_buf;   // Time before a new transmission can start
+    int min_t_sudat; // SDA Setup Time
+    int max_t_r;     // Rise time of SDA and SCL (time for SCL to change)
+};
 
 #define CLOCK_STRETCHING_TIMEOUT_US 500e3 // Clock stretching timeout [micro seconds]
 
+// Waiting out clock stretching (see clock_stretching.c) [nano seconds]:
+#define CLOCK_STRETCHING_SPIN_NS 10000       // Poll finely for this long
+#define CLOCK_STRETCHING_POLL_NS 250         // Polling interval while spinning
+#define CLOCK_STRETCHING_MAX_STEP_NS 1000000 // Longest interval backed off to
+#define CLOCK_STRETCHING_SLEEP_NS 50000      // Intervals this long sleep
+
+// Learned clock stretching (I2C_STRETCH_LEARNED):
+#define CLOCK_STRETCHING_LEARN_SAMPLES 8 // Checks before predicting a wait
+#define CLOCK_STRETCHING_REFRESH 16      // Predicted waits between polls
+
+// Coalescing of identical reads from different threads (see
+// set_read_coalescing_i2c()):
+#define COALESCE_MAX_BYTES 32 // Longer reads always run on their own
+#define COALESCE_N_KEYS 32    // Different reads tracked at a time
+
+// Devices kept track of in the background (see watch_presence_i2c()):
+#define PRESENCE_EVENTS 64         // Arrive and depart events queued
+#define PRESENCE_N_PER_REFRESH 4   // Addresses probed per refresh
+#define PRESENCE_INTERVAL_US 10000 // Time between refreshes
+
 #define ACK 0  // device ACK
 #define NACK 1 // device NACK
 
@@ -46,23 +72,185 @@
 
 // Some useful functions
 #define CEILING(n) (((n - (int)(n)) != 0) ? ((int)(n) + 1) : ((int)(n)))
+#define SECONDS_TO_NS(t) ((int) ((t) * 1e9 + 0.5))
+
+// One step of a compiled transaction (see waveform.c):
+struct waveform_step {
+    unsigned int op;       // WAVEFORM_* operation
+    unsigned int arg;      // Byte index or ACK kind depending on op
+    unsigned int delay_ns; // Wait once the operation is done
+};
+
+// Clock stretching profile of a device at one point of a message:
+struct stretch_profile {
+    struct pi_i2c_stretch_profile stats; // What gets reported
+    int n_predicted; // Waits predicted since the device was last polled
+};
+
+// Read shared by every thread asking for it while it is queued for the bus
+// or on it:
+struct coalesced_read {
+    unsigned int device_address;
+    unsigned int register_address;
+    unsigned int n_bytes;          // 0 while the entry is unused
+
+    int in_flight;                 // Leader has yet to publish the result
+    unsigned int n_waiters;        // Threads yet to copy the result
+    unsigned long long generation; // Results published so far
+
+    int status;                    // Result of the last read
+    uint8_t data[COALESCE_MAX_BYTES];
+
+    int num_coalesced;             // Reads served since taken over
+    int count_index;               // Key's entry of the bus's counts (-1
+                                   // until a read of it is served)
+};
+
+// Reads of one key served by another thread's read. Kept for as long as the
+// bus so that the count outlives the key's entry in coalesced_reads[]:
+struct coalesced_count {
+    unsigned int device_address;
+    unsigned int register_address;
+    unsigned int n_bytes;
+
+    int num_coalesced;
+};
+
+// Transaction compiled into a flat program of line changes, delays and
+// sample points:
+struct waveform {
+    struct waveform_step *steps;
+    unsigned int n_steps;
+    unsigned int capacity;
+
+    unsigned int stop_step;    // Where a NACK jumps to end the message
+    unsigned int message_step; // First step of the message being compiled
+    unsigned int run_step;     // Where run_waveform() starts (batches)
+    int sda_level;             // Controller's SDA output once the steps so far
+    int scl_level;             // have run (used to drop redundant writes)
+    int stretch_policy;        // I2C_STRETCH_* of the device addressed
+    int stretch_phase;         // I2C_PHASE_* of the next release after an ACK
+    int error;                 // Compiling ran out of memory?
+};
+
+// Per-bus state. Every SDA/SCL pair driven by pi_i2c owns one of these so
+// that several buses can be used from the same process at the same time:
+struct pi_i2c_bus {
+    int sda_gpio_pin; // Data line
+    int scl_gpio_pin; // Clock line
+
+    int scl_clock_frequency_hz;          // Desired clock frequency
+    float scl_actual_clock_frequency_hz; // Actual clock frequency
+
+    int config_i2c_flag; // I2C lines and timings defined?
+
+    // GPIO backend driving the lines:
+    const struct pi_i2c_gpio_backend *backend;
+    void *backend_ctx;
+
+    // Kernel I2C adapter running whole messages instead (see
+    // config_i2c_dev_bus()):
+    int i2c_dev_fd;              // /dev/i2c-N (-1 when bit-banged)
+    unsigned long i2c_dev_funcs; // Adapter functionality (I2C_FUNCS)
+
+    struct pi_i2c_statistics statistics;
+
+    // Program for the transaction in progress (reused between messages):
+    struct waveform waveform;
+
+    // Bytes staged for a transaction: read by a combined transaction before
+    // they are handed out to its segments (see transfer_i2c_bus()), or
+    // narrowed from an int buffer before they are written:
+    uint8_t *transfer_data;
+    unsigned int transfer_capacity;
+
+    // I2C timing compliance (nano seconds):
+    int min_t_hdsta_sleep_ns;      // Hold time for START condition
+    int min_t_susto_sleep_ns;      // Setup time for STOP condition
+    int min_t_susta_sleep_ns;      // Setup time for repeated START condition
+    int min_t_buf_sleep_ns;        // Time before new transmission
+    int scl_t_low_sleep_ns;        // SCL Low Period
+    int scl_t_high_sleep_ns;       // SCL High Period (after SCL has risen)
+    int scl_response_time_ns;      // Time for SCL to change
+
+    // What timings are derived from (see derive_bus_timings()):
+    const struct i2c_mode_timing *mode_timing; // Minimums of the speed mode
+    int scl_rise_time_ns; // Time for SDA or SCL to rise
+    int line_call_ns;     // Time spent in one line access
+    int calibrated_flag;  // Rise and line access times measured?
+
+    // Device addressed by the transaction in progress and how long each
+    // device may stretch the clock (0 for CLOCK_STRETCHING_TIMEOUT_US):
+    unsigned int device_address;
+    unsigned int stretch_timeout_us[128];
+
+    // Which clock pulses are checked for clock stretching (I2C_STRETCH_*);
+    // devices left at I2C_STRETCH_DEFAULT follow the bus:
+    int stretch_policy;
+    int device_stretch_policy[128];
+
+    // Clock stretching seen per device and point of a message (see
+    // clock_stretching.c):
+    struct stretch_profile stretch_profiles[128][I2C_N_PHASES];
+
+    int timing_mode; // I2C_TIMING_RELATIVE or I2C_TIMING_DEADLINE
+
+    // Shadow of the lines (see gpio_line.h): levels the controller last
+    // drove them to (SDA_LEVEL | SCL_LEVEL when both are released) and
+    // whether the bus has been read back IDLE since a line was last pulled
+    // low:
+    int driven_lines;
+    int idle_verified;
+
+    // Error of a line the backend failed to read, kept until the
+    // transaction reports it (0 if none):
+    int line_error;
+
+    // Serializes transactions on this bus:
+    pthread_mutex_t lock;
+
+    // Identical reads from different threads sharing one transaction (see
+    // read_coalesced()), guarded by coalesce_lock rather than lock so that
+    // threads can join a read while it is on the bus:
+    int coalesce_flag;
+    struct coalesced_read coalesced_reads[COALESCE_N_KEYS];
+    struct coalesced_count *coalesced_counts;
+    unsigned int n_coalesced_counts;
+    unsigned int coalesced_counts_capacity;
+    int num_coalesced_reads;
+    pthread_mutex_t coalesce_lock;
+    pthread_cond_t coalesce_cond; // Result published or copied
+
+    // Devices kept track of in the background (NULL unless watched; see
+    // presence.c):
+    struct pi_i2c_presence *presence;
+};
+
+// Bus used by the original global API (config_i2c(), read_i2c(), ...):
+extern struct pi_i2c_bus default_bus;
+
+// Configure a bus's backend, lines and timings (caller holds bus->lock):
+int init_bus(struct pi_i2c_bus *bus, unsigned int sda, unsigned int scl,
+             unsigned int speed_grade,
+             const struct pi_i2c_gpio_backend *backend, void *backend_arg);
 
-// Global variables:
-extern int sda_gpio_pin; // Data line
-extern int scl_gpio_pin; // Clock line
+// Derive a bus's delays from its speed mode and calibration (caller holds
+// bus->lock):
+void derive_bus_timings(struct pi_i2c_bus *bus);
 
-extern int scl_clock_frequency_hz;          // Desired clock frequency
-extern float scl_actual_clock_frequency_hz; // Actual clock frequency
+// Derive the timings of a speed grade for lines not yet calibrated (caller
+// holds bus->lock):
+void set_bus_speed_grade(struct pi_i2c_bus *bus, unsigned int speed_grade);
 
-extern int config_i2c_flag; // I2C lines and timings defined?
+// Configure a bus onto kernel I2C adapter /dev/i2c-N (caller holds
+// bus->lock):
+int init_i2c_dev_bus(struct pi_i2c_bus *bus, unsigned int adapter);
 
-extern struct pi_i2c_statistics statistics;
+// Make room for n bytes in bus->transfer_data (caller holds bus->lock):
+int reserve_transfer_data(struct pi_i2c_bus *bus, unsigned int n);
 
-// I2C timing compliance:
-extern int min_t_hdsta_sleep_us;      // Hold time for START condition
-extern int min_t_susto_sleep_us;      // Setup time for STOP condition
-extern int min_t_susta_sleep_us;      // Setup time for repeated START condition
-extern int min_t_buf_sleep_us;        // Time before new transmission
-extern int scl_t_low_sleep_us;        // SCL Low Period
-extern int scl_t_high_sleep_us;       // SCL High Period
-extern int scl_response_time_us;      // Time for SCL to change
\ No newline at end of file
+// Int buffers of the original API on the byte engine: narrow ints to be
+// written into bus->transfer_data (caller holds bus->lock) and widen bytes
+// read into an int buffer in place:
+int stage_int_data(struct pi_i2c_bus *bus, const int *data, unsigned int n);
+void widen_int_data(int *data, unsigned int n);
@@ -30,50 +30,63 @@
 #include "write_conditions_to_bus.h"  // I2C START and STOP function protos
 #include "config.h"                   // I2C timing and variable defs
 #include "clock_stretching.h"         // Support clock stretching
-#include <pi_lw_gpio.h>               // GPIO library for the Pi
-#include <pi_microsleep_hard.h>       // Hard microsleep function for the Pi
+#include "gpio_line.h"                // Open-drain line control
 
 // Detect if bus is locked up **assuming the expected condition is IDLE**
 // and attempt to recover depending on the error
-int detect_recover_bus(void) {
+int detect_recover_bus(struct pi_i2c_bus *bus) {
     int i;
     int ret;
 
+    int lines;
+
+    // Sample both lines once so every check below sees the same bus state:
+    lines = read_lines(bus);
+
+    // Lines the backend cannot read say nothing about the bus:
+    if (bus->line_error != 0) {
+        return take_line_error(bus);
+    }
+
     // Exit if in IDLE as that is the expected condition:
-    if (gpio_read_level(sda_gpio_pin) && gpio_read_level(scl_gpio_pin)) {
+    if (lines == BUS_IDLE) {
         return 0;
     }
 
     // Detect if only SDA line is held low which indicates controller and device
     // are out of sync for some reason. Resolution is to issue 9 clock cycles
     // and check if SDA line is released.
-    if (!(gpio_read_level(sda_gpio_pin)) && gpio_read_level(scl_gpio_pin)) {
+    if (lines == SCL_LEVEL) {
         for (i = 0; i < 9; i++) {
             // End clock pulse by clearing SCL:
-            gpio_set_mode(GPIO_OUTPUT, scl_gpio_pin);
+            clear_scl(bus);
 
             // Previously ended a clock cycle so we must elapse SCL low period:
-            microsleep_hard(scl_t_low_sleep_us);
+            wait_ns(bus, bus->scl_t_low_sleep_ns);
 
             // Transmit bit by setting SCL line:
-            gpio_set_mode(GPIO_INPUT, scl_gpio_pin);
+            release_scl(bus);
 
             // Keep SCL set while SCL high period time elapses. Not waiting may
             // violate I2C timing requirements.
-            microsleep_hard(scl_t_high_sleep_us);
+            wait_ns(bus, bus->scl_t_high_sleep_ns);
 
             // Adhere to UM10204 I2C-bus specification 3.1.9:
-            if ((ret = support_clock_stretching()) < 0) {
+            if ((ret = support_clock_stretching(bus)) < 0) {
                 // In the case clock stretching ends in a time out, immeadiately
                 // exit as device needs to be power cycled:
                 return ret;
             }
 
             // Check that SDA lines has been released by the device:
-            if (gpio_read_level(sda_gpio_pin)) {
+            if (read_sda(bus)) {
+                if (bus->line_error != 0) {
+                    return take_line_error(bus);
+                }
+
                 // Keep track of statistics for any caller interested in those
                 // kind of numbers:
-                statistics.num_bus_resets++;
+                bus->statistics.num_bus_resets++;
 
                 return 0;
             }
@@ -83,7 +96,7 @@ int detect_recover_bus(void) {
 
         // Keep track of statistics for any caller interested in those
         // kind of numbers:
-        statistics.num_device_hung++;
+        bus->statistics.num_device_hung++;
 
         return -EDEVICEHUNG;
     }
@@ -91,10 +104,10 @@ int detect_recover_bus(void) {
     // Detect if only SCL line is held low which indicates the device has most
     // likely become unresponsive. Resolution is to power cycle device if
     // possible!
-    if (gpio_read_level(sda_gpio_pin) && !(gpio_read_level(scl_gpio_pin))) {
+    if (lines == SDA_LEVEL) {
         // Keep track of statistics for any caller interested in those
         // kind of numbers:
-        statistics.num_clock_stretching_timeouts++;
+        bus->statistics.num_clock_stretching_timeouts++;
 
         return -ECLKTIMEOUT;
     }
@@ -102,10 +115,10 @@ int detect_recover_bus(void) {
     // Detect if SDA and SCL lines are held low by the device which indicates
     // that the bus is completely locked up. Resolution is power cycle the
     // device if possible!
-    if (!(gpio_read_level(sda_gpio_pin)) && !(gpio_read_level(scl_gpio_pin))) {
+    if (lines == 0) {
         // Keep track of statistics for any caller interested in those
         // kind of numbers:
-        statistics.num_bus_lockups++;
+        bus->statistics.num_bus_lockups++;
 
         return -EBUSLOCKUP;
     }
@@ -114,7 +127,7 @@ int detect_recover_bus(void) {
 
     // Keep track of statistics for any caller interested in those
     // kind of numbers:
-    statistics.num_unknown_bus_errors++;
+    bus->statistics.num_unknown_bus_errors++;
 
     return -EBUSUNKERR;
 }
\ No newline at end of file
@@ -22,4 +22,4 @@
 // ============================================================================
 
 // Detect and recover the bus if necessary function prototype:
-int detect_recover_bus(void);
\ No newline at end of file
+int detect_recover_bus(struct pi_i2c_bus *bus);
\ No newline at end of file
@@ -0,0 +1,528 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Asynchronous requests
+//
+// An asynchronous bus hands register reads and writes to a worker thread
+// that owns the bus, so that the threads submitting them never wait on a
+// transaction. Requests come out of a pool allocated up front and travel
+// between the threads through lock-free rings of pool indices: free
+// requests, submitted requests, and completed requests. Nothing is
+// allocated and no lock is taken on the way in and out once the bus is
+// created; the worker may be pinned to a CPU of its own.
+//
+// Completed requests are either queued for poll_async_i2c() and
+// wait_async_i2c(), with an eventfd becoming readable for anyone watching
+// get_fd_async_i2c() from an event loop, or handed to the request's
+// callback on the worker thread.
+
+// GNU extensions (CPU affinity):
+#define _GNU_SOURCE
+
+// Include C standard libraries:
+#include <stdlib.h>    // C Standard library (request pool allocation)
+#include <stdint.h>    // C Standard integer types (eventfd counter)
+#include <time.h>      // C Standard get and manipulate time library
+#include <errno.h>     // C Standard for error conditions
+#include <stdatomic.h> // C Standard atomic operations
+
+// Include C POSIX libraries:
+#include <pthread.h>     // POSIX threads (worker thread)
+#include <sched.h>       // CPU sets (worker thread pinning)
+#include <unistd.h>      // POSIX read, write, and close
+#include <poll.h>        // Wait for the completion eventfd
+#include <sys/eventfd.h> // Worker and completion wakeups
+
+// Include header files:
+#include "pi_i2c.h"  // Speed grade, macros, and outward function prototypes
+#include "config.h"  // I2C timing and variable defs
+#include "ring.h"    // Lock-free rings of request indices
+
+struct pi_i2c_async {
+    struct pi_i2c_bus *bus;
+
+    struct pi_i2c_request *requests; // Pool
+    unsigned int depth;              // Requests in the pool
+
+    struct ring free_requests;
+    struct ring submitted_requests;
+    struct ring completed_requests;
+
+    int submit_fd;   // Wakes the worker when it is sleeping
+    int complete_fd; // Readable once a request completes while armed
+
+    pthread_t worker;
+    atomic_int sleeping;  // Worker is (about to be) blocked on submit_fd
+    atomic_int stop;      // Worker to exit once the submissions run out
+    atomic_int armed;     // Completed requests ran out; signal complete_fd
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    atomic_int queue_depth;
+    atomic_int max_queue_depth;
+    atomic_llong num_submitted;
+    atomic_llong num_completed;
+    atomic_llong num_pool_empty;
+    atomic_llong last_latency_ns;
+    atomic_llong max_latency_ns;
+    atomic_llong total_latency_ns;
+    atomic_llong busy_ns;
+    long long start_ns;
+};
+
+static long long async_clock_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Raise a maximum kept by several threads
+static void raise_max(atomic_llong *max, long long value) {
+    long long current = atomic_load(max);
+
+    while ((value > current) &&
+           !atomic_compare_exchange_weak(max, &current, value)) {
+    }
+}
+
+// Position of a request in the pool. Returns -EINVAL if it is not one
+static int request_index(struct pi_i2c_async *async,
+                         struct pi_i2c_request *request) {
+    if ((request < async->requests) ||
+        (request >= async->requests + async->depth)) {
+        return -EINVAL;
+    }
+
+    return request - async->requests;
+}
+
+// Run a request on the bus and hand it back to its submitter
+static void complete_request(struct pi_i2c_async *async,
+                             struct pi_i2c_request *request) {
+    uint64_t count = 1;
+
+    long long start_ns;
+    long long latency_ns;
+
+    start_ns = async_clock_ns();
+
+    if (request->kind == I2C_ASYNC_READ) {
+        request->status = read_i2c_bus(async->bus, request->device_address,
+                                       request->register_address,
+                                       request->data, request->n_bytes);
+    } else if (request->kind == I2C_ASYNC_WRITE) {
+        request->status = write_i2c_bus(async->bus, request->device_address,
+                                        request->register_address,
+                                        request->data, request->n_bytes);
+    } else {
+        request->status = scan_range_i2c_bus(async->bus,
+                                             request->first_address,
+                                             request->last_address,
+                                             NULL, request->scan_flags,
+                                             request->address_map);
+    }
+
+    request->complete_ns = async_clock_ns();
+    latency_ns = request->complete_ns - request->submit_ns;
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    atomic_fetch_add(&async->busy_ns, request->complete_ns - start_ns);
+    atomic_store(&async->last_latency_ns, latency_ns);
+    atomic_fetch_add(&async->total_latency_ns, latency_ns);
+    raise_max(&async->max_latency_ns, latency_ns);
+    atomic_fetch_add(&async->num_completed, 1);
+    atomic_fetch_sub(&async->queue_depth, 1);
+
+    // The request belongs to the callback from here on:
+    if (request->callback != NULL) {
+        request->callback(request, request->callback_arg);
+        return;
+    }
+
+    // Room for every request of the pool; this cannot fail:
+    push_ring(&async->completed_requests, request_index(async, request));
+
+    // Only signal when the completed requests had run out, so that a
+    // consumer keeping up costs a write per wait rather than per request:
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_exchange(&async->armed, 0)) {
+        if (write(async->complete_fd, &count, sizeof(count)) < 0) {
+            // Counter cannot overflow; nothing to do
+        }
+    }
+}
+
+// Worker thread: run submitted requests in order, sleeping on the submit
+// eventfd when there are none. Submissions still queued when asked to stop
+// are run before exiting
+static void *run_worker(void *arg) {
+    struct pi_i2c_async *async = arg;
+
+    unsigned int index;
+    uint64_t count;
+
+    while (1) {
+        if (pop_ring(&async->submitted_requests, &index) == 0) {
+            complete_request(async, &async->requests[index]);
+            continue;
+        }
+
+        if (atomic_load(&async->stop)) {
+            break;
+        }
+
+        // Announce going to sleep before checking one last time so that a
+        // submission racing with it either is seen here or wakes us:
+        atomic_store(&async->sleeping, 1);
+
+        if (!ring_empty(&async->submitted_requests) ||
+            atomic_load(&async->stop)) {
+            atomic_store(&async->sleeping, 0);
+            continue;
+        }
+
+        if ((read(async->submit_fd, &count, sizeof(count)) < 0) &&
+            (errno != EINTR)) {
+            break;
+        }
+
+        atomic_store(&async->sleeping, 0);
+    }
+
+    return NULL;
+}
+
+// Wake the worker if it is sleeping (or about to)
+static void wake_worker(struct pi_i2c_async *async) {
+    uint64_t count = 1;
+
+    if (atomic_exchange(&async->sleeping, 0)) {
+        if (write(async->submit_fd, &count, sizeof(count)) < 0) {
+            // Counter cannot overflow; nothing to do
+        }
+    }
+}
+
+// Start a worker thread owning a bus, with a pool of depth requests. The
+// worker is pinned to a CPU unless cpu is negative. Returns NULL and sets
+// errno on error
+struct pi_i2c_async *create_async_i2c_bus(struct pi_i2c_bus *bus,
+                                          unsigned int depth, int cpu) {
+    struct pi_i2c_async *async;
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+
+    unsigned int i;
+    int ret;
+
+    if ((bus == NULL) || (depth == 0) || (cpu >= CPU_SETSIZE)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((async = calloc(1, sizeof(*async))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    async->bus = bus;
+    async->depth = depth;
+    async->submit_fd = -1;
+    async->complete_fd = -1;
+    atomic_init(&async->armed, 1);
+
+    if (((async->requests = calloc(depth,
+                                   sizeof(*async->requests))) == NULL) ||
+        (init_ring(&async->free_requests, depth) < 0) ||
+        (init_ring(&async->submitted_requests, depth) < 0) ||
+        (init_ring(&async->completed_requests, depth) < 0)) {
+        free_ring(&async->free_requests);
+        free_ring(&async->submitted_requests);
+        free_ring(&async->completed_requests);
+        free(async->requests);
+        free(async);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (i = 0; i < depth; i++) {
+        push_ring(&async->free_requests, i);
+    }
+
+    async->submit_fd = eventfd(0, EFD_CLOEXEC);
+    async->complete_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    pthread_attr_init(&attr);
+
+    if (cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    async->start_ns = async_clock_ns();
+
+    if ((async->submit_fd < 0) || (async->complete_fd < 0)) {
+        ret = errno;
+    } else {
+        ret = pthread_create(&async->worker, &attr, run_worker, async);
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if (ret != 0) {
+        if (async->submit_fd >= 0) {
+            close(async->submit_fd);
+        }
+
+        if (async->complete_fd >= 0) {
+            close(async->complete_fd);
+        }
+
+        free_ring(&async->free_requests);
+        free_ring(&async->submitted_requests);
+        free_ring(&async->completed_requests);
+        free(async->requests);
+        free(async);
+        errno = ret;
+        return NULL;
+    }
+
+    return async;
+}
+
+// Start a worker thread owning the default bus
+struct pi_i2c_async *create_async_i2c(unsigned int depth, int cpu) {
+    return create_async_i2c_bus(&default_bus, depth, cpu);
+}
+
+// Stop the worker once it has run every submitted request, and free the
+// pool. Requests not put back are freed along with it
+void free_async_i2c(struct pi_i2c_async *async) {
+    uint64_t count = 1;
+
+    if (async == NULL) {
+        return;
+    }
+
+    atomic_store(&async->stop, 1);
+
+    if (write(async->submit_fd, &count, sizeof(count)) < 0) {
+        // Counter cannot overflow; nothing to do
+    }
+
+    pthread_join(async->worker, NULL);
+
+    close(async->submit_fd);
+    close(async->complete_fd);
+
+    free_ring(&async->free_requests);
+    free_ring(&async->submitted_requests);
+    free_ring(&async->completed_requests);
+    free(async->requests);
+    free(async);
+}
+
+// Take a request from the pool. Returns NULL and sets errno to EAGAIN if
+// every request is in use
+struct pi_i2c_request *get_request_async_i2c(struct pi_i2c_async *async) {
+    struct pi_i2c_request *request;
+
+    unsigned int index;
+
+    if (pop_ring(&async->free_requests, &index) < 0) {
+        // Keep track of statistics for any caller interested in those kind
+        // of numbers:
+        atomic_fetch_add(&async->num_pool_empty, 1);
+
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    request = &async->requests[index];
+    request->callback = NULL;
+    request->callback_arg = NULL;
+    request->status = 0;
+
+    return request;
+}
+
+// Give a request back to the pool
+void put_request_async_i2c(struct pi_i2c_async *async,
+                           struct pi_i2c_request *request) {
+    int index;
+
+    if ((index = request_index(async, request)) >= 0) {
+        push_ring(&async->free_requests, index);
+    }
+}
+
+// Queue a request taken from the pool for the worker. Returns without
+// waiting for the bus
+int submit_async_i2c(struct pi_i2c_async *async,
+                     struct pi_i2c_request *request) {
+    int index;
+    int depth;
+    int max_depth;
+
+    if ((async == NULL) || ((index = request_index(async, request)) < 0)) {
+        return -EINVAL;
+    }
+
+    // Only 7-bit addressing and 8-bit register addresses are supported.
+    // Zero bytes makes no sense caller. Scans run over a range of 7-bit
+    // addresses instead:
+    if (request->kind == I2C_ASYNC_SCAN) {
+        if ((request->first_address > request->last_address) ||
+            (request->last_address > 0x7F) ||
+            (request->scan_flags & ~(I2C_SCAN_READ | I2C_SCAN_RESERVED |
+                                     I2C_SCAN_STOP))) {
+            return -EINVAL;
+        }
+    } else if (((request->kind != I2C_ASYNC_READ) &&
+                (request->kind != I2C_ASYNC_WRITE)) ||
+               (request->device_address > 0x7F) ||
+               (request->register_address > 0xFF) ||
+               (request->n_bytes == 0) ||
+               (request->n_bytes > I2C_ASYNC_MAX_BYTES)) {
+        return -EINVAL;
+    }
+
+    request->submit_ns = async_clock_ns();
+    request->complete_ns = 0;
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    atomic_fetch_add(&async->num_submitted, 1);
+    depth = atomic_fetch_add(&async->queue_depth, 1) + 1;
+    max_depth = atomic_load(&async->max_queue_depth);
+
+    while ((depth > max_depth) &&
+           !atomic_compare_exchange_weak(&async->max_queue_depth,
+                                         &max_depth, depth)) {
+    }
+
+    // Room for every request of the pool; this cannot fail:
+    push_ring(&async->submitted_requests, index);
+
+    // Order the push before checking whether the worker is sleeping:
+    atomic_thread_fence(memory_order_seq_cst);
+    wake_worker(async);
+
+    return 0;
+}
+
+// Take a completed request if there is one. Returns NULL and sets errno to
+// EAGAIN otherwise
+struct pi_i2c_request *poll_async_i2c(struct pi_i2c_async *async) {
+    unsigned int index;
+    uint64_t count;
+
+    if (pop_ring(&async->completed_requests, &index) == 0) {
+        return &async->requests[index];
+    }
+
+    // Nothing queued; reset the eventfd and arm it before looking again so
+    // that a completion racing with this makes it readable:
+    if (read(async->complete_fd, &count, sizeof(count)) < 0) {
+        // Already reset
+    }
+
+    atomic_store(&async->armed, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (pop_ring(&async->completed_requests, &index) == 0) {
+        return &async->requests[index];
+    }
+
+    errno = EAGAIN;
+    return NULL;
+}
+
+// Wait up to timeout_ms milliseconds (forever if negative) for a completed
+// request. Returns NULL and sets errno to ETIMEDOUT if none completed
+struct pi_i2c_request *wait_async_i2c(struct pi_i2c_async *async,
+                                      int timeout_ms) {
+    struct pi_i2c_request *request;
+    struct pollfd fd;
+
+    long long deadline_ns;
+    long long remaining_ns;
+    int wait_ms = -1;
+
+    deadline_ns = async_clock_ns() + timeout_ms * 1000000LL;
+
+    fd.fd = async->complete_fd;
+    fd.events = POLLIN;
+
+    while ((request = poll_async_i2c(async)) == NULL) {
+        if (timeout_ms >= 0) {
+            remaining_ns = deadline_ns - async_clock_ns();
+
+            if (remaining_ns <= 0) {
+                errno = ETIMEDOUT;
+                return NULL;
+            }
+
+            // Round up so as not to spin through the last millisecond:
+            wait_ms = (remaining_ns + 999999) / 1000000;
+        }
+
+        if ((poll(&fd, 1, wait_ms) < 0) && (errno != EINTR)) {
+            return NULL;
+        }
+    }
+
+    return request;
+}
+
+// File descriptor for event loops. It becomes readable when a request
+// completes after poll_async_i2c() has returned NULL, and stays so until
+// poll_async_i2c() returns NULL again; take every completed request each
+// time it is readable
+int get_fd_async_i2c(struct pi_i2c_async *async) {
+    return async->complete_fd;
+}
+
+// Return the statistics of an asynchronous bus
+struct pi_i2c_async_statistics get_statistics_async_i2c(
+    struct pi_i2c_async *async) {
+    struct pi_i2c_async_statistics statistics;
+
+    statistics.queue_depth = atomic_load(&async->queue_depth);
+    statistics.max_queue_depth = atomic_load(&async->max_queue_depth);
+    statistics.num_submitted = atomic_load(&async->num_submitted);
+    statistics.num_completed = atomic_load(&async->num_completed);
+    statistics.num_pool_empty = atomic_load(&async->num_pool_empty);
+    statistics.last_latency_ns = atomic_load(&async->last_latency_ns);
+    statistics.max_latency_ns = atomic_load(&async->max_latency_ns);
+    statistics.total_latency_ns = atomic_load(&async->total_latency_ns);
+    statistics.busy_ns = atomic_load(&async->busy_ns);
+    statistics.elapsed_ns = async_clock_ns() - async->start_ns;
+
+    return statistics;
+}
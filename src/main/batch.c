@@ -0,0 +1,411 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Batched register reads and writes
+//
+// A batch collects read and write descriptors ahead of time and runs them
+// back-to-back in one call. Everything a single read_i2c() or write_i2c()
+// pays on every call is paid once per batch instead: arguments are checked
+// as descriptors are added, every message is compiled into one program
+// before the bus is touched, and the defensive STOP condition is only
+// written before the first message (and after a message that failed). Each
+// message still ends with a STOP condition checked for bus errors, whose
+// bus free time (t_BUF) is then all that separates it from the next START.
+//
+// Every descriptor gets its own status; a NACK fails that descriptor only.
+// Bus errors that cannot be recovered end the run and leave the remaining
+// descriptors cancelled.
+
+// Include C standard libraries:
+#include <stdlib.h> // C Standard library (descriptor allocation)
+#include <time.h>   // C Standard get and manipulate time library
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <pthread.h> // POSIX threads (per-bus transaction lock)
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "write_conditions_to_bus.h"  // I2C START and STOP function protos
+#include "config.h"                   // I2C timing and variable defs
+#include "gpio_line.h"                // Open-drain line control
+#include "i2c_dev_backend.h"          // Kernel i2c-dev function protos
+#include "waveform.h"                 // Compiled message waveforms
+#include "presence.h"                 // Presence cache function protos
+
+// One register read or write of a batch:
+struct batch_transfer {
+    unsigned int device_address;
+    unsigned int register_address;
+    int read;                // Read into data (write it otherwise)
+    uint8_t *data;
+    int *int_data;           // Int buffer data is widened to or narrowed
+                             // from (NULL for byte buffers)
+    unsigned int n_bytes;
+
+    int status;              // Outcome of the last run
+    unsigned int first_step; // Where its message starts in the program
+};
+
+struct pi_i2c_batch {
+    struct batch_transfer *transfers;
+    unsigned int n_transfers;
+    unsigned int capacity;
+
+    struct pi_i2c_batch_timing timing; // Last run
+};
+
+// Time on the bus's clock: the backend's where it has one (the simulated
+// bus keeps its own), the monotonic clock otherwise
+static long long batch_clock_ns(struct pi_i2c_bus *bus) {
+    struct timespec now;
+
+    if ((bus->i2c_dev_fd < 0) && (bus->backend->now_ns != NULL)) {
+        return now_ns(bus);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Check and append a descriptor of a byte buffer (data) or an int buffer
+// (int_data). Returns its index
+static int add_transfer(struct pi_i2c_batch *batch, int read,
+                        unsigned int device_address,
+                        unsigned int register_address, uint8_t *data,
+                        int *int_data, unsigned int n_bytes) {
+    struct batch_transfer *transfers;
+    struct batch_transfer *transfer;
+
+    unsigned int capacity;
+
+    // Only 7-bit addressing and 8-bit register addresses are supported.
+    // Zero bytes makes no sense caller:
+    if ((batch == NULL) || ((data == NULL) && (int_data == NULL)) ||
+        (device_address > 0x7F) || (register_address > 0xFF) ||
+        (n_bytes == 0)) {
+        return -EINVAL;
+    }
+
+    if (batch->n_transfers == batch->capacity) {
+        capacity = (batch->capacity != 0) ? batch->capacity * 2 : 16;
+
+        if ((transfers = realloc(batch->transfers,
+                                 capacity * sizeof(*transfers))) == NULL) {
+            return -ENOMEM;
+        }
+
+        batch->transfers = transfers;
+        batch->capacity = capacity;
+    }
+
+    transfer = &batch->transfers[batch->n_transfers];
+
+    transfer->device_address = device_address;
+    transfer->register_address = register_address;
+    transfer->read = read;
+    transfer->data = (int_data != NULL) ? (uint8_t *)int_data : data;
+    transfer->int_data = int_data;
+    transfer->n_bytes = n_bytes;
+    transfer->status = -ECANCELED;
+    transfer->first_step = 0;
+
+    return batch->n_transfers++;
+}
+
+// Bytes a write descriptor sends: its byte buffer, or its int buffer
+// narrowed into bus->transfer_data. Returns NULL if that runs out of memory
+static const uint8_t *write_data(struct pi_i2c_bus *bus,
+                                 struct batch_transfer *transfer) {
+    if (transfer->int_data == NULL) {
+        return transfer->data;
+    }
+
+    if (stage_int_data(bus, transfer->int_data, transfer->n_bytes) < 0) {
+        return NULL;
+    }
+
+    return bus->transfer_data;
+}
+
+// Run one descriptor through a kernel I2C adapter. Bytes read into an int
+// buffer are left at its start for run_batch() to widen
+static int run_transfer_i2c_dev(struct pi_i2c_bus *bus,
+                                struct batch_transfer *transfer) {
+    const uint8_t *data;
+
+    if (transfer->read) {
+        return read_message_i2c_dev(bus, transfer->device_address,
+                                    transfer->register_address,
+                                    transfer->data, transfer->n_bytes);
+    }
+
+    if ((data = write_data(bus, transfer)) == NULL) {
+        return -ENOMEM;
+    }
+
+    return write_message_i2c_dev(bus, transfer->device_address,
+                                 transfer->register_address, data,
+                                 transfer->n_bytes);
+}
+
+// Compile every descriptor into one program, each message ending the run of
+// run_waveform() so that its status can be collected
+static int compile_batch(struct pi_i2c_bus *bus, struct pi_i2c_batch *batch) {
+    struct batch_transfer *transfer;
+
+    const uint8_t *data;
+
+    unsigned int i;
+
+    bus->device_address = batch->transfers[0].device_address;
+
+    begin_waveform(bus);
+
+    for (i = 0; i < batch->n_transfers; i++) {
+        transfer = &batch->transfers[i];
+        transfer->first_step = bus->waveform.n_steps;
+
+        // Clock stretching is handled per device:
+        add_device_to_waveform(bus, transfer->device_address);
+
+        if (transfer->read) {
+            add_read_message_to_waveform(bus, transfer->device_address,
+                                         transfer->register_address,
+                                         transfer->n_bytes);
+        } else {
+            // The bytes are compiled into the program right away, so the
+            // staging buffer is free again for the next descriptor:
+            if ((data = write_data(bus, transfer)) == NULL) {
+                return -ENOMEM;
+            }
+
+            add_write_message_to_waveform(bus, transfer->device_address,
+                                          transfer->register_address, data,
+                                          transfer->n_bytes);
+        }
+
+        add_end_message_to_waveform(bus);
+    }
+
+    return bus->waveform.error ? -ENOMEM : 0;
+}
+
+// Run every descriptor of a batch back-to-back. Returns the number of
+// descriptors that failed (0 if none did) or a negative error number if the
+// run could not be completed
+static int run_batch(struct pi_i2c_bus *bus, struct pi_i2c_batch *batch) {
+    // Definitions:
+    struct pi_i2c_batch_timing *timing = &batch->timing;
+    struct batch_transfer *transfer;
+
+    long long start_ns;
+
+    unsigned int i;
+    int ret = 0;
+
+    // Check if I2C has been configured for use; otherwise bail as important
+    // timings are not yet defined:
+    if (!bus->config_i2c_flag) {
+        return -EI2CNOTCFG;
+    }
+
+    timing->elapsed_ns = 0;
+    timing->compile_ns = 0;
+    timing->num_transfers = 0;
+    timing->num_failed = 0;
+    timing->num_bytes = 0;
+
+    for (i = 0; i < batch->n_transfers; i++) {
+        batch->transfers[i].status = -ECANCELED;
+    }
+
+    if (batch->n_transfers == 0) {
+        return 0;
+    }
+
+    start_ns = batch_clock_ns(bus);
+
+    if (bus->i2c_dev_fd < 0) {
+        if ((ret = compile_batch(bus, batch)) < 0) {
+            return ret;
+        }
+
+        timing->compile_ns = batch_clock_ns(bus) - start_ns;
+
+        // Get bus into known state by using STOP condition:
+        ret = write_stop_condition_to_bus(bus);
+    }
+
+    for (i = 0; (i < batch->n_transfers) && (ret >= 0); i++) {
+        transfer = &batch->transfers[i];
+
+        // Devices known to be absent fail without touching the bus:
+        transfer->status = check_presence(bus, transfer->device_address);
+
+        if (transfer->status < 0) {
+            timing->num_failed++;
+            continue;
+        }
+
+        // Kernel adapters run each message themselves:
+        if (bus->i2c_dev_fd >= 0) {
+            transfer->status = run_transfer_i2c_dev(bus, transfer);
+        } else {
+            bus->waveform.run_step = transfer->first_step;
+            transfer->status = run_waveform(bus, transfer->data);
+        }
+
+        note_presence(bus, transfer->device_address, transfer->status);
+
+        timing->num_transfers++;
+
+        if (transfer->status >= 0) {
+            if (transfer->read && (transfer->int_data != NULL)) {
+                widen_int_data(transfer->int_data, transfer->n_bytes);
+            }
+
+            timing->num_bytes += transfer->n_bytes;
+            continue;
+        }
+
+        timing->num_failed++;
+
+        // A message may have been given up on part way through; return the
+        // bus to IDLE before the next one. If that fails the rest of the
+        // batch is cancelled:
+        if (bus->i2c_dev_fd < 0) {
+            ret = write_stop_condition_to_bus(bus);
+        }
+    }
+
+    timing->elapsed_ns = batch_clock_ns(bus) - start_ns;
+
+    return (ret < 0) ? ret : timing->num_failed;
+}
+
+// Create an empty batch. Returns NULL and sets errno on error
+struct pi_i2c_batch *create_batch_i2c(void) {
+    struct pi_i2c_batch *batch;
+
+    if ((batch = calloc(1, sizeof(*batch))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return batch;
+}
+
+void free_batch_i2c(struct pi_i2c_batch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+
+    free(batch->transfers);
+    free(batch);
+}
+
+// Remove every descriptor so that the batch can be filled again
+void clear_batch_i2c(struct pi_i2c_batch *batch) {
+    if (batch != NULL) {
+        batch->n_transfers = 0;
+    }
+}
+
+// Add a read of N bytes from a device's register address. Returns the
+// descriptor's index
+int add_read_batch_i2c(struct pi_i2c_batch *batch,
+                       unsigned int device_address,
+                       unsigned int register_address, int *data,
+                       unsigned int n_bytes) {
+    return add_transfer(batch, 1, device_address, register_address, NULL,
+                        data, n_bytes);
+}
+
+// Add a write of N bytes to a device's register address. Returns the
+// descriptor's index
+int add_write_batch_i2c(struct pi_i2c_batch *batch,
+                        unsigned int device_address,
+                        unsigned int register_address, int *data,
+                        unsigned int n_bytes) {
+    return add_transfer(batch, 0, device_address, register_address, NULL,
+                        data, n_bytes);
+}
+
+// Add a read of N bytes from a device's register address straight into a
+// byte buffer. Returns the descriptor's index
+int add_read_bytes_batch_i2c(struct pi_i2c_batch *batch,
+                             unsigned int device_address,
+                             unsigned int register_address, uint8_t *data,
+                             unsigned int n_bytes) {
+    return add_transfer(batch, 1, device_address, register_address, data,
+                        NULL, n_bytes);
+}
+
+// Add a write of N bytes to a device's register address straight from a
+// byte buffer. Returns the descriptor's index
+int add_write_bytes_batch_i2c(struct pi_i2c_batch *batch,
+                              unsigned int device_address,
+                              unsigned int register_address,
+                              const uint8_t *data, unsigned int n_bytes) {
+    // Write descriptors only ever read their bytes:
+    return add_transfer(batch, 0, device_address, register_address,
+                        (uint8_t *)data, NULL, n_bytes);
+}
+
+// Outcome of a descriptor in the last run: 0, an error number, or
+// -ECANCELED if it was not run
+int get_status_batch_i2c(struct pi_i2c_batch *batch, unsigned int index) {
+    if ((batch == NULL) || (index >= batch->n_transfers)) {
+        return -EINVAL;
+    }
+
+    return batch->transfers[index].status;
+}
+
+// Return the timing of the last run of a batch
+struct pi_i2c_batch_timing get_timing_batch_i2c(struct pi_i2c_batch *batch) {
+    return batch->timing;
+}
+
+// Run every descriptor of a batch back-to-back on a bus
+int run_batch_i2c_bus(struct pi_i2c_bus *bus, struct pi_i2c_batch *batch) {
+    int ret;
+
+    if ((bus == NULL) || (batch == NULL)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = run_batch(bus, batch);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Run every descriptor of a batch back-to-back on the default bus
+int run_batch_i2c(struct pi_i2c_batch *batch) {
+    return run_batch_i2c_bus(&default_bus, batch);
+}
@@ -0,0 +1,735 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Lockstep bus groups
+//
+// A bus group runs the same transaction (device address, register address
+// and number of bytes) on several buses at once, storing to the GPIO
+// registers directly like gpio_regs_backend.c does for a single bus. Each
+// edge of the group is one store per GPFSEL register holding lines that
+// change, however many buses it clocks, and each sample point reads the
+// lines of every bus with one load of GPLEV0. Identical devices at the same
+// address on separate buses are then read for about the cost of one.
+//
+// Every bus keeps its own data and outcome. A bus whose device does not
+// acknowledge stops being clocked (its SCL held low) until the STOP
+// condition ending the transaction on every bus, and a device stretching
+// the clock holds up the whole group. Lines are limited to GPIO 0 to 31 so
+// that one level register covers them all.
+
+// Include C standard libraries:
+#include <stdlib.h> // C Standard library (group allocation)
+#include <stdint.h> // C Standard integer types (32-bit registers)
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <pthread.h> // POSIX threads (per-group transaction lock)
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "config.h"                   // I2C timing and variable defs
+#include "spin_delay.h"               // Calibrated nano second delays
+#include "gpio_regs_backend.h"        // GPIO register layout and claims
+#include "sim_backend.h"              // Simulated register block protos
+
+#define GROUP_FSEL_REGISTERS 4 // GPFSEL0 to GPFSEL3 hold GPIO 0 to 31
+#define GROUP_FSEL_WORDS 1024  // Pins of a GPFSEL register driven low
+
+struct pi_i2c_bus_group {
+    volatile uint32_t *regs;     // Register block (or memory standing in)
+    int mapped;                  // Block mapped at create (unmapped at free)
+    struct pi_i2c_sim_regs *sim; // Simulated block instead (NULL otherwise)
+
+    unsigned int n_buses;
+    uint32_t sda_bits[I2C_GROUP_MAX_BUSES]; // Lines of each bus in GPLEV0
+    uint32_t scl_bits[I2C_GROUP_MAX_BUSES];
+    unsigned int fsel_registers;            // Bit N set for GPFSEL N used
+
+    // Word to store into each GPFSEL register for every combination of its
+    // pins driven low (NULL for registers without lines of the group):
+    uint32_t *fsel_words[GROUP_FSEL_REGISTERS];
+    uint32_t driven_low; // Lines driven low (GPLEV0 bits)
+
+    // Buses in the transaction in progress (bit N for bus N), those still
+    // being clocked, and the lines of those still being clocked:
+    unsigned int in_transaction;
+    unsigned int clocked;
+    uint32_t clocked_sda;
+    uint32_t clocked_scl;
+
+    int status[I2C_GROUP_MAX_BUSES]; // Outcome of each bus
+
+    // Timings of the speed grade, derived as for a single bus:
+    struct pi_i2c_bus *timing;
+
+    struct pi_i2c_bus_group_statistics statistics;
+
+    // Serializes transactions on this group:
+    pthread_mutex_t lock;
+};
+
+static inline void store_reg(struct pi_i2c_bus_group *group,
+                             unsigned int offset, uint32_t value) {
+    if (group->sim != NULL) {
+        store_sim_regs(group->sim, offset, value);
+    } else {
+        group->regs[offset] = value;
+    }
+}
+
+static inline uint32_t load_reg(struct pi_i2c_bus_group *group,
+                                unsigned int offset) {
+    if (group->sim != NULL) {
+        return load_sim_regs(group->sim, offset);
+    }
+
+    return group->regs[offset];
+}
+
+static inline void delay_group(struct pi_i2c_bus_group *group,
+                               unsigned int ns) {
+    if (group->sim != NULL) {
+        delay_sim_regs(group->sim, ns);
+    } else {
+        spin_delay_ns(ns);
+    }
+}
+
+// Drive the given lines low and release the others, storing only to the
+// GPFSEL registers whose pins change
+static inline void drive_lines(struct pi_i2c_bus_group *group, uint32_t low) {
+    uint32_t changed = low ^ group->driven_low;
+
+    unsigned int shift;
+    unsigned int r;
+
+    for (r = 0; r < GROUP_FSEL_REGISTERS; r++) {
+        shift = r * GPFSEL_PINS_PER_REGISTER;
+
+        if ((group->fsel_words[r] != NULL) &&
+            ((changed >> shift) & (GROUP_FSEL_WORDS - 1))) {
+            store_reg(group, GPIO_REGS_GPFSEL + r,
+                      group->fsel_words[r][(low >> shift) &
+                                           (GROUP_FSEL_WORDS - 1)]);
+
+            // Keep track of statistics for any caller interested in those
+            // kind of numbers:
+            group->statistics.num_register_stores++;
+        }
+    }
+
+    group->driven_low = low;
+}
+
+// Levels of every line of the group
+static inline uint32_t read_lines(struct pi_i2c_bus_group *group) {
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    group->statistics.num_level_reads++;
+
+    return load_reg(group, GPIO_REGS_GPLEV);
+}
+
+// Work out the lines of the buses still being clocked
+static void update_clocked(struct pi_i2c_bus_group *group) {
+    unsigned int bus;
+
+    group->clocked_sda = 0;
+    group->clocked_scl = 0;
+
+    for (bus = 0; bus < group->n_buses; bus++) {
+        if (group->clocked & (1U << bus)) {
+            group->clocked_sda |= group->sda_bits[bus];
+            group->clocked_scl |= group->scl_bits[bus];
+        }
+    }
+}
+
+// Fail a bus and stop clocking it. Left in the transaction it still gets
+// the STOP condition ending it
+static void fail_bus(struct pi_i2c_bus_group *group, unsigned int bus,
+                     int error, int leave_transaction) {
+    group->status[bus] = error;
+    group->clocked &= ~(1U << bus);
+
+    if (leave_transaction) {
+        group->in_transaction &= ~(1U << bus);
+    }
+
+    update_clocked(group);
+}
+
+// Release SCL of the buses being clocked and wait for every one of them to
+// go high, polling at growing intervals while a device stretches the clock.
+// Buses still held low after CLOCK_STRETCHING_TIMEOUT_US are failed.
+// Returns the levels of the lines once SCL is high
+static uint32_t release_scl(struct pi_i2c_bus_group *group) {
+    uint32_t levels;
+
+    unsigned int waited_ns = 0;
+    unsigned int step_ns = CLOCK_STRETCHING_POLL_NS;
+    unsigned int bus;
+
+    drive_lines(group, group->driven_low & ~group->clocked_scl);
+    delay_group(group, group->timing->scl_response_time_ns);
+
+    levels = read_lines(group);
+
+    if ((levels & group->clocked_scl) == group->clocked_scl) {
+        return levels;
+    }
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    group->statistics.num_clock_stretch++;
+
+    while (((levels & group->clocked_scl) != group->clocked_scl) &&
+           (waited_ns < CLOCK_STRETCHING_TIMEOUT_US * 1000)) {
+        delay_group(group, step_ns);
+        waited_ns += step_ns;
+
+        if ((waited_ns >= CLOCK_STRETCHING_SPIN_NS) &&
+            (step_ns < CLOCK_STRETCHING_MAX_STEP_NS)) {
+            step_ns *= 2;
+        }
+
+        levels = read_lines(group);
+    }
+
+    // Give up on the devices still stretching; their lines are left
+    // released:
+    for (bus = 0; bus < group->n_buses; bus++) {
+        if ((group->clocked & (1U << bus)) &&
+            !(levels & group->scl_bits[bus])) {
+            fail_bus(group, bus, -ECLKTIMEOUT, 1);
+            drive_lines(group, group->driven_low & ~group->sda_bits[bus]);
+        }
+    }
+
+    return levels;
+}
+
+// One clock pulse of the buses being clocked (SCL low on return). Returns
+// the levels sampled while SCL was high
+static uint32_t clock_pulse(struct pi_i2c_bus_group *group) {
+    uint32_t levels;
+
+    delay_group(group, group->timing->scl_t_low_sleep_ns);
+    levels = release_scl(group);
+    delay_group(group, group->timing->scl_t_high_sleep_ns);
+    drive_lines(group, group->driven_low | group->clocked_scl);
+
+    return levels;
+}
+
+// START condition on every bus found IDLE. Buses that are not stay out of
+// the transaction
+static void start_group(struct pi_i2c_bus_group *group) {
+    uint32_t levels = read_lines(group);
+
+    unsigned int bus;
+
+    for (bus = 0; bus < group->n_buses; bus++) {
+        if (!(levels & group->scl_bits[bus])) {
+            fail_bus(group, bus, -EBUSLOCKUP, 1);
+        } else if (!(levels & group->sda_bits[bus])) {
+            fail_bus(group, bus, -EDEVICEHUNG, 1);
+        }
+    }
+
+    // SDA falls while SCL is high:
+    drive_lines(group, group->driven_low | group->clocked_sda);
+    delay_group(group, group->timing->min_t_hdsta_sleep_ns);
+    drive_lines(group, group->driven_low | group->clocked_scl);
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    group->statistics.num_transactions++;
+}
+
+// Repeated START condition on the buses being clocked (SCL is low)
+static void repeated_start_group(struct pi_i2c_bus_group *group) {
+    drive_lines(group, group->driven_low & ~group->clocked_sda);
+    delay_group(group, group->timing->scl_t_low_sleep_ns);
+    release_scl(group);
+    delay_group(group, group->timing->min_t_susta_sleep_ns);
+    drive_lines(group, group->driven_low | group->clocked_sda);
+    delay_group(group, group->timing->min_t_hdsta_sleep_ns);
+    drive_lines(group, group->driven_low | group->clocked_scl);
+}
+
+// STOP condition on every bus of the transaction, including those no
+// longer clocked. Buses not back to IDLE afterwards are failed
+static void stop_group(struct pi_i2c_bus_group *group) {
+    uint32_t levels;
+
+    unsigned int bus;
+
+    group->clocked = group->in_transaction;
+    update_clocked(group);
+
+    // SDA low while SCL is low, then SDA rises while SCL is high:
+    drive_lines(group, group->driven_low | group->clocked_sda |
+                       group->clocked_scl);
+    delay_group(group, group->timing->scl_t_low_sleep_ns);
+    release_scl(group);
+    delay_group(group, group->timing->min_t_susto_sleep_ns);
+    drive_lines(group, group->driven_low & ~group->clocked_sda);
+    delay_group(group, group->timing->min_t_buf_sleep_ns);
+
+    levels = read_lines(group);
+
+    for (bus = 0; bus < group->n_buses; bus++) {
+        if ((group->in_transaction & (1U << bus)) &&
+            (group->status[bus] == 0) &&
+            ((levels & (group->sda_bits[bus] | group->scl_bits[bus])) !=
+             (group->sda_bits[bus] | group->scl_bits[bus]))) {
+            group->status[bus] = -EBUSUNKERR;
+        }
+    }
+}
+
+// Write a byte to every bus being clocked (byte of bus N at bytes[N *
+// stride]) and fail the buses whose device does not acknowledge it
+static void write_byte_group(struct pi_i2c_bus_group *group,
+                             const int *bytes, unsigned int stride,
+                             int nack_error) {
+    uint32_t levels;
+    uint32_t low;
+
+    unsigned int bus;
+    int bit;
+
+    for (bit = 7; bit >= 0; bit--) {
+        // SDA changes while SCL is low:
+        low = group->driven_low & ~group->clocked_sda;
+
+        for (bus = 0; bus < group->n_buses; bus++) {
+            if ((group->clocked & (1U << bus)) &&
+                !((bytes[bus * stride] >> bit) & 0x1)) {
+                low |= group->sda_bits[bus];
+            }
+        }
+
+        drive_lines(group, low);
+        clock_pulse(group);
+    }
+
+    // Let go of SDA for the devices to ACK:
+    drive_lines(group, group->driven_low & ~group->clocked_sda);
+    levels = clock_pulse(group);
+
+    for (bus = 0; bus < group->n_buses; bus++) {
+        if (!(group->clocked & (1U << bus))) {
+            continue;
+        }
+
+        if (levels & group->sda_bits[bus]) {
+            fail_bus(group, bus, nack_error, 0);
+        } else if (stride != 0) {
+            // Keep track of statistics for any caller interested in those
+            // kind of numbers:
+            group->statistics.num_bytes_written++;
+        }
+    }
+}
+
+// Read a byte from every bus being clocked into bytes[N * stride] and ACK
+// it (or NACK it as the last byte)
+static void read_byte_group(struct pi_i2c_bus_group *group, int *bytes,
+                            unsigned int stride, int ack) {
+    uint32_t levels;
+
+    unsigned int bus;
+    int bit;
+
+    for (bus = 0; bus < group->n_buses; bus++) {
+        bytes[bus * stride] = 0;
+    }
+
+    // Let go of SDA for the devices to drive:
+    drive_lines(group, group->driven_low & ~group->clocked_sda);
+
+    for (bit = 7; bit >= 0; bit--) {
+        levels = clock_pulse(group);
+
+        for (bus = 0; bus < group->n_buses; bus++) {
+            if ((group->clocked & (1U << bus)) &&
+                (levels & group->sda_bits[bus])) {
+                bytes[bus * stride] |= 1 << bit;
+            }
+        }
+    }
+
+    if (ack) {
+        drive_lines(group, group->driven_low | group->clocked_sda);
+    }
+
+    clock_pulse(group);
+    drive_lines(group, group->driven_low & ~group->clocked_sda);
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    for (bus = 0; bus < group->n_buses; bus++) {
+        if (group->clocked & (1U << bus)) {
+            group->statistics.num_bytes_read++;
+        }
+    }
+}
+
+// Run a register read or write on every bus of a group. Bus N's bytes are
+// data[N * n_bytes] onwards. Returns the number of buses that failed
+static int run_group(struct pi_i2c_bus_group *group, int read,
+                     unsigned int device_address,
+                     unsigned int register_address, int *data,
+                     unsigned int n_bytes, int *status) {
+    int address_byte;
+    int register_byte = register_address;
+
+    unsigned int bus;
+    unsigned int i;
+    int n_failed = 0;
+
+    group->in_transaction = (1U << group->n_buses) - 1;
+    group->clocked = group->in_transaction;
+    update_clocked(group);
+
+    for (bus = 0; bus < group->n_buses; bus++) {
+        group->status[bus] = 0;
+    }
+
+    start_group(group);
+
+    address_byte = (device_address << 1) | WRITE_FLAG;
+    write_byte_group(group, &address_byte, 0, -ENACK);
+    write_byte_group(group, &register_byte, 0, -EBADREGADDR);
+
+    if (read) {
+        repeated_start_group(group);
+
+        address_byte = (device_address << 1) | READ_FLAG;
+        write_byte_group(group, &address_byte, 0, -ENACKRST);
+
+        for (i = 0; (i < n_bytes) && group->clocked; i++) {
+            read_byte_group(group, &data[i], n_bytes, i < n_bytes - 1);
+        }
+    } else {
+        for (i = 0; (i < n_bytes) && group->clocked; i++) {
+            write_byte_group(group, &data[i], n_bytes, -EBADXFR);
+        }
+    }
+
+    stop_group(group);
+
+    for (bus = 0; bus < group->n_buses; bus++) {
+        if (group->status[bus] < 0) {
+            n_failed++;
+        }
+
+        if (status != NULL) {
+            status[bus] = group->status[bus];
+        }
+    }
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    group->statistics.num_failed += n_failed;
+
+    return n_failed;
+}
+
+// Work out the GPFSEL words of every combination of the group's pins driven
+// low, keeping the function of the other pins of the registers
+static int precompute_group_words(struct pi_i2c_bus_group *group,
+                                  uint32_t lines) {
+    uint32_t base;
+    uint32_t word;
+
+    unsigned int gpio;
+    unsigned int r;
+    unsigned int w;
+    unsigned int j;
+
+    for (r = 0; r < GROUP_FSEL_REGISTERS; r++) {
+        if (!(group->fsel_registers & (1U << r))) {
+            continue;
+        }
+
+        if ((group->fsel_words[r] = malloc(GROUP_FSEL_WORDS *
+                                           sizeof(uint32_t))) == NULL) {
+            return -ENOMEM;
+        }
+
+        base = load_reg(group, GPIO_REGS_GPFSEL + r);
+
+        for (j = 0; j < GPFSEL_PINS_PER_REGISTER; j++) {
+            gpio = r * GPFSEL_PINS_PER_REGISTER + j;
+
+            if ((gpio < 32) && (lines & ((uint32_t) 1 << gpio))) {
+                base &= ~(GPFSEL_MASK << (j * GPFSEL_BITS));
+            }
+        }
+
+        for (w = 0; w < GROUP_FSEL_WORDS; w++) {
+            word = base;
+
+            for (j = 0; j < GPFSEL_PINS_PER_REGISTER; j++) {
+                gpio = r * GPFSEL_PINS_PER_REGISTER + j;
+
+                if ((w & (1U << j)) && (gpio < 32) &&
+                    (lines & ((uint32_t) 1 << gpio))) {
+                    word |= GPFSEL_OUTPUT << (j * GPFSEL_BITS);
+                }
+            }
+
+            group->fsel_words[r][w] = word;
+        }
+    }
+
+    return 0;
+}
+
+static void free_group(struct pi_i2c_bus_group *group) {
+    unsigned int r;
+
+    for (r = 0; r < GROUP_FSEL_REGISTERS; r++) {
+        free(group->fsel_words[r]);
+    }
+
+    if (group->sim == NULL) {
+        unclaim_gpio_regs(group->fsel_registers);
+    }
+
+    if (group->mapped) {
+        unmap_gpio_regs(group->regs);
+    }
+
+    free(group->timing);
+    free(group);
+}
+
+// Set up a group on a register block (regs or sim). Returns NULL and sets
+// errno on error
+static struct pi_i2c_bus_group *create_group(const unsigned int *sda_pins,
+                                             const unsigned int *scl_pins,
+                                             unsigned int n_buses,
+                                             unsigned int speed_grade,
+                                             void *regs,
+                                             struct pi_i2c_sim_regs *sim) {
+    struct pi_i2c_bus_group *group;
+
+    uint32_t lines = 0;
+
+    unsigned int bus;
+    unsigned int r;
+    int ret;
+
+    if ((sda_pins == NULL) || (scl_pins == NULL) || (n_buses == 0) ||
+        (n_buses > I2C_GROUP_MAX_BUSES) || (speed_grade == 0) ||
+        (speed_grade > I2C_FAST_MODE_PLUS)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Every line its own pin, all in GPLEV0:
+    for (bus = 0; bus < n_buses; bus++) {
+        if ((sda_pins[bus] > 31) || (scl_pins[bus] > 31) ||
+            (sda_pins[bus] == scl_pins[bus]) ||
+            (lines & (((uint32_t) 1 << sda_pins[bus]) |
+                      ((uint32_t) 1 << scl_pins[bus])))) {
+            errno = EINVAL;
+            return NULL;
+        }
+
+        lines |= ((uint32_t) 1 << sda_pins[bus]) |
+                 ((uint32_t) 1 << scl_pins[bus]);
+    }
+
+    if ((group = calloc(1, sizeof(*group))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    group->n_buses = n_buses;
+    group->sim = sim;
+
+    for (bus = 0; bus < n_buses; bus++) {
+        group->sda_bits[bus] = (uint32_t) 1 << sda_pins[bus];
+        group->scl_bits[bus] = (uint32_t) 1 << scl_pins[bus];
+        group->fsel_registers |= (1U << (sda_pins[bus] /
+                                         GPFSEL_PINS_PER_REGISTER)) |
+                                 (1U << (scl_pins[bus] /
+                                         GPFSEL_PINS_PER_REGISTER));
+    }
+
+    if (sim == NULL) {
+        if ((ret = claim_gpio_regs(group->fsel_registers)) < 0) {
+            free(group);
+            errno = -ret;
+            return NULL;
+        }
+
+        if (regs != NULL) {
+            group->regs = regs;
+        } else if ((ret = map_gpio_regs(&group->regs)) == 0) {
+            group->mapped = 1;
+        } else {
+            unclaim_gpio_regs(group->fsel_registers);
+            free(group);
+            errno = -ret;
+            return NULL;
+        }
+    }
+
+    if (((group->timing = calloc(1, sizeof(*group->timing))) == NULL) ||
+        (precompute_group_words(group, lines) < 0)) {
+        free_group(group);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    set_bus_speed_grade(group->timing, speed_grade);
+
+    // Release every line (buses IDLE) then ensure that output mode means
+    // that the GPIO is cleared:
+    for (r = 0; r < GROUP_FSEL_REGISTERS; r++) {
+        if (group->fsel_words[r] != NULL) {
+            store_reg(group, GPIO_REGS_GPFSEL + r, group->fsel_words[r][0]);
+        }
+    }
+
+    store_reg(group, GPIO_REGS_GPCLR, lines);
+
+    if (sim == NULL) {
+        calibrate_spin_delay();
+    }
+
+    pthread_mutex_init(&group->lock, NULL);
+
+    return group;
+}
+
+// Run the same transactions on buses at GPIO sda_pins[N] and scl_pins[N] in
+// lockstep. regs is the GPIO register block to use (e.g. memory standing in
+// for it), or NULL to map /dev/gpiomem. Returns NULL and sets errno on error
+struct pi_i2c_bus_group *create_bus_group_i2c(const unsigned int *sda_pins,
+                                              const unsigned int *scl_pins,
+                                              unsigned int n_buses,
+                                              unsigned int speed_grade,
+                                              void *regs) {
+    return create_group(sda_pins, scl_pins, n_buses, speed_grade, regs,
+                        NULL);
+}
+
+// Same on a simulated register block (see attach_sim_regs_i2c())
+struct pi_i2c_bus_group *create_sim_bus_group_i2c(
+    const unsigned int *sda_pins, const unsigned int *scl_pins,
+    unsigned int n_buses, unsigned int speed_grade,
+    struct pi_i2c_sim_regs *sim_regs) {
+    if (sim_regs == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return create_group(sda_pins, scl_pins, n_buses, speed_grade, NULL,
+                        sim_regs);
+}
+
+// Hand the lines back released and free the group
+void free_bus_group_i2c(struct pi_i2c_bus_group *group) {
+    unsigned int r;
+
+    if (group == NULL) {
+        return;
+    }
+
+    for (r = 0; r < GROUP_FSEL_REGISTERS; r++) {
+        if (group->fsel_words[r] != NULL) {
+            store_reg(group, GPIO_REGS_GPFSEL + r, group->fsel_words[r][0]);
+        }
+    }
+
+    pthread_mutex_destroy(&group->lock);
+    free_group(group);
+}
+
+// Read N bytes from the same register address of the same device on every
+// bus. Bus N's bytes go to data[N * n_bytes] onwards and its outcome to
+// status[N] (status may be NULL). Returns the number of buses that failed
+int read_bus_group_i2c(struct pi_i2c_bus_group *group,
+                       unsigned int device_address,
+                       unsigned int register_address, int *data,
+                       unsigned int n_bytes, int *status) {
+    int ret;
+
+    // Only 7-bit addressing and 8-bit register addresses are supported.
+    // Zero bytes makes no sense caller:
+    if ((group == NULL) || (data == NULL) || (device_address > 0x7F) ||
+        (register_address > 0xFF) || (n_bytes == 0)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&group->lock);
+    ret = run_group(group, 1, device_address, register_address, data,
+                    n_bytes, status);
+    pthread_mutex_unlock(&group->lock);
+
+    return ret;
+}
+
+// Write N bytes to the same register address of the same device on every
+// bus. Bus N's bytes are data[N * n_bytes] onwards and its outcome goes to
+// status[N] (status may be NULL). Returns the number of buses that failed
+int write_bus_group_i2c(struct pi_i2c_bus_group *group,
+                        unsigned int device_address,
+                        unsigned int register_address, int *data,
+                        unsigned int n_bytes, int *status) {
+    int ret;
+
+    // Only 7-bit addressing and 8-bit register addresses are supported.
+    // Zero bytes makes no sense caller:
+    if ((group == NULL) || (data == NULL) || (device_address > 0x7F) ||
+        (register_address > 0xFF) || (n_bytes == 0)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&group->lock);
+    ret = run_group(group, 0, device_address, register_address, data,
+                    n_bytes, status);
+    pthread_mutex_unlock(&group->lock);
+
+    return ret;
+}
+
+// Return the statistics of a group
+struct pi_i2c_bus_group_statistics get_statistics_bus_group_i2c(
+    struct pi_i2c_bus_group *group) {
+    struct pi_i2c_bus_group_statistics statistics;
+
+    pthread_mutex_lock(&group->lock);
+    statistics = group->statistics;
+    pthread_mutex_unlock(&group->lock);
+
+    return statistics;
+}
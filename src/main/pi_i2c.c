@@ -73,36 +73,38 @@
 // +-------+--------+------+------+---------+------+---------+------+-------+
 
 // Include C standard libraries:
-#include <time.h>  // C Standard get and manipulate time library
-#include <errno.h> // C Standard for error conditions
+#include <stdlib.h> // C Standard library (transfer buffers)
+#include <limits.h> // C Standard sizes of integer types
+#include <time.h>   // C Standard get and manipulate time library
+#include <errno.h>  // C Standard for error conditions
+
+// Include C POSIX libraries:
+#include <pthread.h> // POSIX threads (per-bus transaction lock)
 
 // Include header files:
 #include "pi_i2c.h"                   // Speed grade, macros, and outward
                                       // function prototypes.
 #include "write_conditions_to_bus.h"  // I2C START and STOP function protos
-#include "write_bus.h"                // I2C write to bus functions
-#include "read_bus.h"                 // I2C read to bus functions
 #include "config.h"                   // I2C timing and variable defs
 #include "detect_recover_bus.h"       // Detect and recover I2C bus
 #include "clock_stretching.h"         // Support clock stretching
-#include <pi_lw_gpio.h>               // GPIO library for the Pi
-#include <pi_microsleep_hard.h>       // Hard microsleep function for the Pi
+#include "gpio_line.h"                // Open-drain line control
+#include "i2c_dev_backend.h"          // Kernel i2c-dev function protos
+#include "waveform.h"                 // Compiled message waveforms
+#include "calibrate_bus.h"            // Bus calibration function protos
+#include "scan.h"                     // Bus scan function protos
+#include "presence.h"                 // Presence cache function protos
 
 // Read N number of bytes from the specified register address of a device
-int read_i2c(unsigned int device_address, unsigned int register_address,
-             int *data, unsigned int n_bytes) {
+static int read_message(struct pi_i2c_bus *bus, unsigned int device_address,
+                        unsigned int register_address, uint8_t *data,
+                        unsigned int n_bytes) {
     // Definitions:
-    int byte;
-    int i;
     int ret;
 
-    int write_status;
-
-    int ack_flag = 1;
-
     // Check if I2C has been configured for use; otherwise bail as important
     // timings are not yet defined:
-    if (!config_i2c_flag) {
+    if (!bus->config_i2c_flag) {
         return -EI2CNOTCFG;
     }
 
@@ -122,111 +124,38 @@ int read_i2c(unsigned int device_address, unsigned int register_address,
         return -EINVAL;
     }
 
-    // Get bus into known state by using STOP condition:
-    if ((ret = write_stop_condition_to_bus()) < 0) {
-        return ret;
-    }
-
-    // Make bus busy with START condition so devices know to expect message:
-    if ((ret = write_start_condition_to_bus()) < 0) {
-        return ret;
-    }
-
-    // Write address frame to bus and begin message with device:
-    write_status = write_address_frame_to_bus(device_address, WRITE_FLAG);
-
-    if (write_status == NACK) {
-        // In case a STOP condition cannot be written and bus
-        // encounters an error
-        if ((ret = write_stop_condition_to_bus()) < 0) {
-            return ret;
-        }
-        // Keep track of statistics for any caller interested in those
-        // kind of numbers:
-        statistics.num_nack++;
-
-        return -ENACK;
+    // Kernel adapters run the whole message themselves:
+    if (bus->i2c_dev_fd >= 0) {
+        return read_message_i2c_dev(bus, device_address, register_address,
+                                    data, n_bytes);
     }
 
-    // Write register address to device:
-    write_status = write_data_frame_to_bus(register_address);
-
-    if (write_status == NACK) {
-        // In case a STOP condition cannot be written and bus
-        // encounters an error
-        if ((ret = write_stop_condition_to_bus()) < 0) {
-            return ret;
-        }
-        // Keep track of statistics for any caller interested in those
-        // kind of numbers:
-        statistics.num_bad_reg++;
-
-        return -EBADREGADDR;
-    }
+    // Clock stretching is handled per device:
+    bus->device_address = device_address;
 
-    // A repeated start condition is required prior to reading off data:
-    if ((ret = write_repeated_start_condition_to_bus() < 0)) {
+    // Get bus into known state by using STOP condition:
+    if ((ret = write_stop_condition_to_bus(bus)) < 0) {
         return ret;
     }
 
-    // Write address frame to bus and begin message with the device:
-    write_status = write_address_frame_to_bus(device_address, READ_FLAG);
+    // Compile the whole message before touching the bus:
+    begin_waveform(bus);
+    add_read_message_to_waveform(bus, device_address, register_address,
+                                 n_bytes);
 
-    if (write_status == NACK) {
-        // In case a STOP condition cannot be written and bus
-        // encounters an error
-        if ((ret = write_stop_condition_to_bus()) < 0) {
-            return ret;
-        }
-        // Keep track of statistics for any caller interested in those
-        // kind of numbers:
-        statistics.num_nack_rst++;
-
-        return -ENACKRST;
-    }
-
-    // Read data from the specified register:
-    for (i = 0; i < n_bytes; i++) {
-        // Only NACK if it is the last byte to be read:
-        if (i == (n_bytes - 1)) {
-            ack_flag = 0;
-        }
-
-        // Read one byte from the device. ACK or NACK depending on if
-        // more bytes will be subsequently read:
-        byte = read_byte_from_bus(ack_flag);
-
-        // Consider a NACK during data transfer to be a bad transfer; device
-        // stopped responding to write for some reason:
-        if (byte == NACK) {
-            return -EBADXFR;
-        }
-        // Keep track of statistics for any caller interested in those
-        // kind of numbers:
-        statistics.num_bytes_read++;
-
-        data[i] = byte;
-    }
-
-    // Complete message by transition the bus to IDLE:
-    if ((ret = write_stop_condition_to_bus()) < 0) {
-        return ret;
-    }
-
-    return 0;
+    return run_waveform(bus, data);
 }
 
 // Write N number of bytes to the specified register address of a device
-int write_i2c(unsigned int device_address, unsigned int register_address,
-              int *data, unsigned int n_bytes) {
+static int write_message(struct pi_i2c_bus *bus, unsigned int device_address,
+                         unsigned int register_address, const uint8_t *data,
+                         unsigned int n_bytes) {
     // Definitions:
-    int write_status;
-    int i;
     int ret;
 
     // Check if I2C has been configured for use; otherwise bail as important
     // timings are not yet defined:
-    if (!config_i2c_flag) {
+    if (!bus->config_i2c_flag) {
         return -EI2CNOTCFG;
     }
 
@@ -246,155 +175,257 @@ int write_i2c(unsigned int device_address, unsigned int register_address,
         return -EINVAL;
     }
 
-    // Get bus into known state by using STOP condition:
-    if ((ret = write_stop_condition_to_bus()) < 0) {
-        return ret;
+    // Kernel adapters run the whole message themselves:
+    if (bus->i2c_dev_fd >= 0) {
+        return write_message_i2c_dev(bus, device_address, register_address,
+                                     data, n_bytes);
     }
 
-    // Make bus busy with START condition so devices know to expect message:
-    if ((ret = write_start_condition_to_bus()) < 0) {
+    // Clock stretching is handled per device:
+    bus->device_address = device_address;
+
+    // Get bus into known state by using STOP condition:
+    if ((ret = write_stop_condition_to_bus(bus)) < 0) {
         return ret;
     }
 
-    // Write address frame to bus and begin message with the device:
-    write_status = write_address_frame_to_bus(device_address, WRITE_FLAG);
+    // Compile the whole message before touching the bus:
+    begin_waveform(bus);
+    add_write_message_to_waveform(bus, device_address, register_address,
+                                  data, n_bytes);
 
-    if (write_status == NACK) {
-        // In case a STOP condition cannot be written and bus
-        // encounters an error
-        if ((ret = write_stop_condition_to_bus()) < 0) {
-            return ret;
-        }
-        // Keep track of statistics for any caller interested in those
-        // kind of numbers:
-        statistics.num_nack++;
+    return run_waveform(bus, NULL);
+}
+
+// Check the segments of a combined transaction and count the bytes they
+// read
+static int check_messages(struct pi_i2c_msg *msgs, unsigned int n_msgs,
+                          unsigned int *n_read) {
+    unsigned int i;
 
-        return -ENACK;
+    if ((msgs == NULL) || (n_msgs == 0) || (n_msgs > I2C_MAX_MSGS)) {
+        return -EINVAL;
     }
 
-    // Write register address to the device:
-    write_status = write_data_frame_to_bus(register_address);
+    *n_read = 0;
 
-    if (write_status == NACK) {
-        // In case a STOP condition cannot be written and bus
-        // encounters an error
-        if ((ret = write_stop_condition_to_bus()) < 0) {
-            return ret;
+    for (i = 0; i < n_msgs; i++) {
+        // Only 7-bit addressing and 8-bit register addresses are supported:
+        if ((msgs[i].device_address > 0x7F) ||
+            (msgs[i].flags & ~(I2C_MSG_READ | I2C_MSG_NO_REGISTER |
+                               I2C_MSG_NO_ACK_LAST))) {
+            return -EINVAL;
         }
-        // Keep track of statistics for any caller interested in those
-        // kind of numbers:
-        statistics.num_bad_reg++;
 
-        return -EBADREGADDR;
-    }
+        if (!(msgs[i].flags & I2C_MSG_NO_REGISTER) &&
+            (msgs[i].register_address > 0xFF)) {
+            return -EINVAL;
+        }
 
-    // Write data to specified register:
-    for (i = 0; i < n_bytes; i++) {
-        write_status = write_data_frame_to_bus(data[i]);
-
-        // Consider a NACK during data transfer to be a bad transfer; device
-        // stopped responding to write for some reason:
-        if (write_status == NACK) {
-            // In case a STOP condition cannot be written and bus
-            // encounters an error
-            if ((ret = write_stop_condition_to_bus()) < 0) {
-                return ret;
+        if ((msgs[i].n_bytes != 0) && (msgs[i].data == NULL)) {
+            return -EINVAL;
+        }
+
+        // Reading nothing makes no sense caller:
+        if (msgs[i].flags & I2C_MSG_READ) {
+            if ((msgs[i].n_bytes == 0) ||
+                (msgs[i].n_bytes > UINT_MAX - *n_read)) {
+                return -EINVAL;
             }
-            // Keep track of statistics for any caller interested in those
-            // kind of numbers:
-            statistics.num_badxfr++;
 
-            return -EBADXFR;
+            *n_read += msgs[i].n_bytes;
         }
-        // Keep track of statistics for any caller interested in those
-        // kind of numbers:
-        statistics.num_bytes_written++;
     }
 
-    // Complete message by transition the bus to IDLE:
-    if ((ret = write_stop_condition_to_bus()) < 0) {
-        return ret;
+    return 0;
+}
+
+// Compile one segment of a combined transaction. Bytes read go to
+// bus->transfer_data starting at index
+static void add_message_to_waveform(struct pi_i2c_bus *bus,
+                                    struct pi_i2c_msg *msg,
+                                    unsigned int address_ack,
+                                    unsigned int index) {
+    unsigned int read = (msg->flags & I2C_MSG_READ) ? 1 : 0;
+    unsigned int i;
+
+    if (msg->flags & I2C_MSG_NO_REGISTER) {
+        add_write_byte_to_waveform(bus, (msg->device_address << 1) |
+                                   (read ? READ_FLAG : WRITE_FLAG),
+                                   address_ack);
+    } else {
+        add_write_byte_to_waveform(bus, (msg->device_address << 1) |
+                                   WRITE_FLAG, address_ack);
+        add_write_byte_to_waveform(bus, msg->register_address,
+                                   WAVEFORM_ACK_REGISTER);
+
+        // Repeated START required prior to reading off data:
+        if (read) {
+            add_repeated_start_to_waveform(bus);
+            add_write_byte_to_waveform(bus, (msg->device_address << 1) |
+                                       READ_FLAG, WAVEFORM_ACK_READ_ADDRESS);
+        }
     }
 
-    return write_status;
+    // Only NACK the last byte read. Devices allowed to NACK the last byte
+    // written do not end the transaction:
+    for (i = 0; i < msg->n_bytes; i++) {
+        if (read) {
+            add_read_byte_to_waveform(bus, index + i,
+                                      i != (msg->n_bytes - 1));
+        } else if ((msg->flags & I2C_MSG_NO_ACK_LAST) &&
+                   (i == (msg->n_bytes - 1))) {
+            add_write_byte_to_waveform(bus, msg->data[i],
+                                       WAVEFORM_ACK_DATA_LAST);
+        } else {
+            add_write_byte_to_waveform(bus, msg->data[i], WAVEFORM_ACK_DATA);
+        }
+    }
 }
 
-// Scan bus for devices (only supporting 7-bit addressing)
-int scan_bus_i2c(int *address_book) {
+// Run message segments as one transaction: START, every segment joined to
+// the one before it by a repeated START, and a single STOP at the end
+static int transfer_messages(struct pi_i2c_bus *bus, struct pi_i2c_msg *msgs,
+                             unsigned int n_msgs) {
     // Definitions:
-    int i;
+    unsigned int n_read;
+    unsigned int index;
+    unsigned int i;
+    unsigned int j;
     int ret;
 
-    int write_status;
-
     // Check if I2C has been configured for use; otherwise bail as important
     // timings are not yet defined:
-    if (!config_i2c_flag) {
+    if (!bus->config_i2c_flag) {
         return -EI2CNOTCFG;
     }
 
-    // Initialize array to zero to prevent any confusion for caller:
-    for (i = 0; i < 127; i++) {
-        address_book[i] = 0x0;
+    if ((ret = check_messages(msgs, n_msgs, &n_read)) < 0) {
+        return ret;
     }
 
+    // Kernel adapters run the whole transaction themselves:
+    if (bus->i2c_dev_fd >= 0) {
+        return transfer_messages_i2c_dev(bus, msgs, n_msgs);
+    }
+
+    if ((ret = reserve_transfer_data(bus, n_read)) < 0) {
+        return ret;
+    }
+
+    // Clock stretching is handled per device:
+    bus->device_address = msgs[0].device_address;
+
     // Get bus into known state by using STOP condition:
-    if ((ret = write_stop_condition_to_bus()) < 0) {
+    if ((ret = write_stop_condition_to_bus(bus)) < 0) {
         return ret;
     }
 
-    for (i = 0; i < 128; i++) {
-        // Make bus busy with START condition so devices know to expect message:
-        if ((ret = write_start_condition_to_bus()) < 0) {
-            return ret;
+    // Compile the whole transaction before touching the bus. A NACK
+    // anywhere ends it early with the STOP condition:
+    begin_waveform(bus);
+    add_start_to_waveform(bus);
+    add_message_to_waveform(bus, &msgs[0], WAVEFORM_ACK_ADDRESS, 0);
+
+    index = (msgs[0].flags & I2C_MSG_READ) ? msgs[0].n_bytes : 0;
+
+    for (i = 1; i < n_msgs; i++) {
+        add_repeated_start_to_waveform(bus);
+
+        if (msgs[i].device_address != msgs[i - 1].device_address) {
+            add_device_to_waveform(bus, msgs[i].device_address);
         }
 
-        // Index will be I2C address to scan:
-        write_status = write_address_frame_to_bus(i, WRITE_FLAG);
+        add_message_to_waveform(bus, &msgs[i], WAVEFORM_ACK_READ_ADDRESS,
+                                index);
 
-        // Transition bus back to IDLE in case the device has ACK'd during scan:
-        if ((ret = write_stop_condition_to_bus()) < 0) {
-            return ret;
+        if (msgs[i].flags & I2C_MSG_READ) {
+            index += msgs[i].n_bytes;
+        }
+    }
+
+    add_stop_to_waveform(bus);
+
+    if ((ret = run_waveform(bus, bus->transfer_data)) < 0) {
+        return ret;
+    }
+
+    // Hand the bytes read out to their segments:
+    index = 0;
+
+    for (i = 0; i < n_msgs; i++) {
+        if (!(msgs[i].flags & I2C_MSG_READ)) {
+            continue;
         }
 
-        // If device responded, update i2c address book to say if a
-        // device was detected:
-        if (write_status == ACK) {
-            address_book[i] = 0x1;
+        for (j = 0; j < msgs[i].n_bytes; j++) {
+            msgs[i].data[j] = bus->transfer_data[index++];
         }
     }
 
     return 0;
 }
 
+// Scan bus for devices (only supporting 7-bit addressing). Every address
+// the address book holds is probed with a message of its own
+static int scan_bus(struct pi_i2c_bus *bus, int *address_book) {
+    // Definitions:
+    unsigned long long address_map[I2C_ADDRESS_MAP_WORDS];
+    int i;
+    int ret;
+
+    // Initialize array to zero to prevent any confusion for caller. The
+    // address book holds addresses 0x00 through 0x7E:
+    for (i = 0; i < 127; i++) {
+        address_book[i] = 0x0;
+    }
+
+    if ((ret = scan_addresses(bus, 0x00, 0x7E, NULL,
+                              I2C_SCAN_RESERVED | I2C_SCAN_STOP,
+                              address_map)) < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < 127; i++) {
+        address_book[i] = I2C_ADDRESS_PRESENT(address_map, i);
+    }
+
+    return 0;
+}
+
 // Reset bus by issuing 9 clock pulses. Typically used to un-stuck the SDA line
 // after a device is forcing it low
-int reset_i2c(void) {
+static int reset_bus(struct pi_i2c_bus *bus) {
     int i;
     int ret;
 
     // Check if I2C has been configured for use; otherwise bail as important
     // timings are not yet defined:
-    if (!config_i2c_flag) {
+    if (!bus->config_i2c_flag) {
         return -EI2CNOTCFG;
     }
 
+    // Kernel adapter drivers recover their own bus:
+    if (bus->i2c_dev_fd >= 0) {
+        return 0;
+    }
+
     for (i = 0; i < 9; i++) {
         // End clock pulse by clearing SCL:
-        gpio_set_mode(GPIO_OUTPUT, scl_gpio_pin);
+        clear_scl(bus);
 
         // Previously ended a clock cycle so we must elapse SCL low period:
-        microsleep_hard(scl_t_low_sleep_us);
+        wait_ns(bus, bus->scl_t_low_sleep_ns);
 
         // Transmit bit by setting SCL line:
-        gpio_set_mode(GPIO_INPUT, scl_gpio_pin);
+        release_scl(bus);
 
         // Keep SCL set while SCL high period time elapses. Not waiting may
         // violate I2C timing requirements.
-        microsleep_hard(scl_t_high_sleep_us);
+        wait_ns(bus, bus->scl_t_high_sleep_ns);
 
         // Adhere to UM10204 I2C-bus specification 3.1.9:
-        if ((ret = support_clock_stretching()) < 0) {
+        if ((ret = support_clock_stretching(bus)) < 0) {
             // In the case clock stretching ends in a time out, immeadiately
             // exit as device needs to be power cycled:
             return ret;
@@ -403,27 +434,820 @@ int reset_i2c(void) {
 
     // Keep track of statistics for any caller interested in those
     // kind of numbers:
-    statistics.num_bus_resets++;
+    bus->statistics.num_bus_resets++;
+
+    return 0;
+}
+
+// Return a structure of statistics recorded on a bus
+static struct pi_i2c_statistics get_statistics(struct pi_i2c_bus *bus) {
+    return bus->statistics;
+}
+
+// Return internal configuration values of a bus
+static struct pi_i2c_configs get_configs(struct pi_i2c_bus *bus) {
+    struct pi_i2c_configs configs = {
+        .scl_t_low_sleep_us = CEILING(bus->scl_t_low_sleep_ns / 1e3),
+        .scl_t_high_sleep_us = CEILING(bus->scl_t_high_sleep_ns / 1e3),
+        .scl_actual_clock_frequency_hz = bus->scl_actual_clock_frequency_hz,
+        .min_t_hdsta_sleep_us = CEILING(bus->min_t_hdsta_sleep_ns / 1e3),
+        .min_t_susta_sleep_us = CEILING(bus->min_t_susta_sleep_ns / 1e3),
+        .min_t_susto_sleep_us = CEILING(bus->min_t_susto_sleep_ns / 1e3),
+        .min_t_buf_sleep_us = CEILING(bus->min_t_buf_sleep_ns / 1e3),
+        .scl_t_low_sleep_ns = bus->scl_t_low_sleep_ns,
+        .scl_t_high_sleep_ns = bus->scl_t_high_sleep_ns,
+        .scl_response_time_ns = bus->scl_response_time_ns,
+        .min_t_hdsta_sleep_ns = bus->min_t_hdsta_sleep_ns,
+        .min_t_susta_sleep_ns = bus->min_t_susta_sleep_ns,
+        .min_t_susto_sleep_ns = bus->min_t_susto_sleep_ns,
+        .min_t_buf_sleep_ns = bus->min_t_buf_sleep_ns,
+        .timing_mode = bus->timing_mode,
+        .stretch_policy = bus->stretch_policy,
+        .calibrated = bus->calibrated_flag,
+        .line_call_ns = bus->line_call_ns
+    };
+
+    return configs;
+}
+
+// Choose between relative and deadline timing of a bus's clock edges
+static int set_timing_mode(struct pi_i2c_bus *bus, int mode) {
+    if ((mode != I2C_TIMING_RELATIVE) && (mode != I2C_TIMING_DEADLINE)) {
+        return -EINVAL;
+    }
+
+    // Check if I2C has been configured for use; otherwise bail as there is
+    // no backend yet:
+    if (!bus->config_i2c_flag) {
+        return -EI2CNOTCFG;
+    }
+
+    // Deadline timing needs the backend's clock; kernel adapters time their
+    // own bus:
+    if ((mode == I2C_TIMING_DEADLINE) &&
+        ((bus->backend == NULL) || (bus->backend->now_ns == NULL) ||
+         (bus->backend->delay_until_ns == NULL))) {
+        return -ENOTSUP;
+    }
+
+    bus->timing_mode = mode;
+
+    // Line accesses only come out of the delays with relative timing:
+    if (bus->backend != NULL) {
+        derive_bus_timings(bus);
+    }
+
+    return 0;
+}
+
+// Set how long a device may stretch the clock (0 for the default)
+static int set_stretch_timeout(struct pi_i2c_bus *bus,
+                               unsigned int device_address,
+                               unsigned int timeout_us) {
+    // Only 7-bit addressing is supported:
+    if (device_address > 0x7F) {
+        return -EINVAL;
+    }
+
+    bus->stretch_timeout_us[device_address] = timeout_us;
+
+    return 0;
+}
+
+// Check a clock stretching policy is one of I2C_STRETCH_*
+static int check_stretch_policy(int policy) {
+    if ((policy < I2C_STRETCH_DEFAULT) || (policy > I2C_STRETCH_LEARNED)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+// Choose which clock pulses are checked for clock stretching on a bus
+static int set_stretch_policy(struct pi_i2c_bus *bus, int policy) {
+    int ret;
+
+    if ((ret = check_stretch_policy(policy)) < 0) {
+        return ret;
+    }
+
+    bus->stretch_policy = policy;
+
+    return 0;
+}
+
+// Choose which clock pulses are checked for clock stretching by a device
+// (I2C_STRETCH_DEFAULT to follow the bus)
+static int set_device_stretch_policy(struct pi_i2c_bus *bus,
+                                     unsigned int device_address,
+                                     int policy) {
+    int ret;
+
+    // Only 7-bit addressing is supported:
+    if (device_address > 0x7F) {
+        return -EINVAL;
+    }
+
+    if ((ret = check_stretch_policy(policy)) < 0) {
+        return ret;
+    }
+
+    bus->device_stretch_policy[device_address] = policy;
+
+    return 0;
+}
+
+// Return the clock stretching profile of a device at a point of a message
+static int get_stretch_profile(struct pi_i2c_bus *bus,
+                               unsigned int device_address,
+                               unsigned int phase,
+                               struct pi_i2c_stretch_profile *profile) {
+    // Only 7-bit addressing is supported; phase is one of I2C_PHASE_*:
+    if ((device_address > 0x7F) || (phase >= I2C_N_PHASES) ||
+        (profile == NULL)) {
+        return -EINVAL;
+    }
+
+    *profile = bus->stretch_profiles[device_address][phase].stats;
+
+    return 0;
+}
+
+// Read through the bus lock
+static int read_locked(struct pi_i2c_bus *bus, unsigned int device_address,
+                       unsigned int register_address, uint8_t *data,
+                       unsigned int n_bytes) {
+    int ret;
+
+    pthread_mutex_lock(&bus->lock);
+
+    if ((ret = check_presence(bus, device_address)) == 0) {
+        ret = read_message(bus, device_address, register_address, data,
+                           n_bytes);
+        note_presence(bus, device_address, ret);
+    }
+
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Find the entry of a read, or take over an idle entry for it (the one
+// that served the fewest reads). Returns NULL if every entry is busy
+// (caller holds bus->coalesce_lock)
+static struct coalesced_read *find_coalesced_read(
+    struct pi_i2c_bus *bus, unsigned int device_address,
+    unsigned int register_address, unsigned int n_bytes) {
+    struct coalesced_read *entry;
+    struct coalesced_read *spare = NULL;
+
+    unsigned int i;
+
+    for (i = 0; i < COALESCE_N_KEYS; i++) {
+        entry = &bus->coalesced_reads[i];
+
+        if ((entry->n_bytes == n_bytes) &&
+            (entry->device_address == device_address) &&
+            (entry->register_address == register_address)) {
+            return entry;
+        }
+
+        if (!entry->in_flight && (entry->n_waiters == 0) &&
+            ((spare == NULL) ||
+             (entry->num_coalesced < spare->num_coalesced))) {
+            spare = entry;
+        }
+    }
+
+    if (spare != NULL) {
+        spare->device_address = device_address;
+        spare->register_address = register_address;
+        spare->n_bytes = n_bytes;
+        spare->num_coalesced = 0;
+        spare->count_index = -1;
+    }
+
+    return spare;
+}
+
+// Count a read served by another thread's read against its key, adding the
+// key to the bus's counts the first time (caller holds bus->coalesce_lock).
+// Should there be no memory for a new key only the bus total counts it
+static void count_coalesced_read(struct pi_i2c_bus *bus,
+                                 struct coalesced_read *entry) {
+    struct coalesced_count *counts;
+
+    unsigned int capacity;
+    unsigned int i;
+
+    entry->num_coalesced++;
+    bus->num_coalesced_reads++;
+
+    if (entry->count_index < 0) {
+        for (i = 0; i < bus->n_coalesced_counts; i++) {
+            if ((bus->coalesced_counts[i].n_bytes == entry->n_bytes) &&
+                (bus->coalesced_counts[i].device_address ==
+                 entry->device_address) &&
+                (bus->coalesced_counts[i].register_address ==
+                 entry->register_address)) {
+                break;
+            }
+        }
+
+        if (i == bus->coalesced_counts_capacity) {
+            capacity = (i == 0) ? COALESCE_N_KEYS : 2 * i;
+
+            if ((counts = realloc(bus->coalesced_counts,
+                                  capacity * sizeof(*counts))) == NULL) {
+                return;
+            }
+
+            bus->coalesced_counts = counts;
+            bus->coalesced_counts_capacity = capacity;
+        }
+
+        if (i == bus->n_coalesced_counts) {
+            bus->coalesced_counts[i].device_address = entry->device_address;
+            bus->coalesced_counts[i].register_address =
+                entry->register_address;
+            bus->coalesced_counts[i].n_bytes = entry->n_bytes;
+            bus->coalesced_counts[i].num_coalesced = 0;
+            bus->n_coalesced_counts++;
+        }
+
+        entry->count_index = i;
+    }
+
+    bus->coalesced_counts[entry->count_index].num_coalesced++;
+}
+
+// Read N bytes, sharing the transaction with every other thread reading the
+// same bytes of the same device while it is queued for the bus or on it.
+// The first thread (the leader) runs the read; the others wait for it and
+// copy its bytes and status
+static int read_coalesced(struct pi_i2c_bus *bus, unsigned int device_address,
+                          unsigned int register_address, uint8_t *data,
+                          unsigned int n_bytes) {
+    struct coalesced_read *entry;
+
+    unsigned long long generation;
+
+    unsigned int i;
+    int ret;
+
+    // Arguments read_message() would refuse are left for it to refuse:
+    if ((data == NULL) || (device_address > 0x7F) ||
+        (register_address > 0xFF) || (n_bytes == 0) ||
+        (n_bytes > COALESCE_MAX_BYTES)) {
+        return read_locked(bus, device_address, register_address, data,
+                           n_bytes);
+    }
+
+    pthread_mutex_lock(&bus->coalesce_lock);
+
+    while (1) {
+        if (!bus->coalesce_flag ||
+            ((entry = find_coalesced_read(bus, device_address,
+                                          register_address,
+                                          n_bytes)) == NULL)) {
+            pthread_mutex_unlock(&bus->coalesce_lock);
+
+            return read_locked(bus, device_address, register_address, data,
+                               n_bytes);
+        }
+
+        if (entry->in_flight) {
+            // Same read queued or on the bus already; wait for its bytes:
+            generation = entry->generation;
+            entry->n_waiters++;
+
+            while (entry->generation == generation) {
+                pthread_cond_wait(&bus->coalesce_cond, &bus->coalesce_lock);
+            }
+
+            ret = entry->status;
+
+            for (i = 0; i < n_bytes; i++) {
+                data[i] = entry->data[i];
+            }
+
+            // Keep track of statistics for any caller interested in those
+            // kind of numbers:
+            count_coalesced_read(bus, entry);
+
+            // The next leader of this read waits for the last copy:
+            if (--entry->n_waiters == 0) {
+                pthread_cond_broadcast(&bus->coalesce_cond);
+            }
+
+            pthread_mutex_unlock(&bus->coalesce_lock);
+
+            return ret;
+        }
+
+        // Lead a new read once the result of the last one has been copied
+        // by all of its waiters (the entry may be taken over meanwhile):
+        if (entry->n_waiters == 0) {
+            break;
+        }
+
+        pthread_cond_wait(&bus->coalesce_cond, &bus->coalesce_lock);
+    }
+
+    entry->in_flight = 1;
+
+    pthread_mutex_unlock(&bus->coalesce_lock);
+
+    ret = read_locked(bus, device_address, register_address, data, n_bytes);
+
+    pthread_mutex_lock(&bus->coalesce_lock);
+
+    entry->status = ret;
+
+    for (i = 0; i < n_bytes; i++) {
+        entry->data[i] = data[i];
+    }
+
+    entry->generation++;
+    entry->in_flight = 0;
+
+    pthread_cond_broadcast(&bus->coalesce_cond);
+    pthread_mutex_unlock(&bus->coalesce_lock);
+
+    return ret;
+}
+
+// Bus handle API. Each call holds the bus lock for the whole transaction so
+// that threads sharing a bus are serialized while different buses run
+// concurrently:
+
+// Read N number of bytes from the specified register address of a device
+// straight into a byte buffer
+int read_bytes_i2c_bus(struct pi_i2c_bus *bus, unsigned int device_address,
+                       unsigned int register_address, uint8_t *data,
+                       unsigned int n_bytes) {
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    return read_coalesced(bus, device_address, register_address, data,
+                          n_bytes);
+}
+
+// Write N number of bytes to the specified register address of a device
+// straight from a byte buffer
+int write_bytes_i2c_bus(struct pi_i2c_bus *bus, unsigned int device_address,
+                        unsigned int register_address, const uint8_t *data,
+                        unsigned int n_bytes) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+
+    if ((ret = check_presence(bus, device_address)) == 0) {
+        ret = write_message(bus, device_address, register_address, data,
+                            n_bytes);
+        note_presence(bus, device_address, ret);
+    }
+
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Read N number of bytes from the specified register address of a device.
+// The bytes are read into the start of data and widened to an int each
+int read_i2c_bus(struct pi_i2c_bus *bus, unsigned int device_address,
+                 unsigned int register_address, int *data,
+                 unsigned int n_bytes) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    if ((ret = read_coalesced(bus, device_address, register_address,
+                              (uint8_t *)data, n_bytes)) >= 0) {
+        widen_int_data(data, n_bytes);
+    }
+
+    return ret;
+}
+
+// Write N number of bytes to the specified register address of a device.
+// Each int is narrowed to the byte written
+int write_i2c_bus(struct pi_i2c_bus *bus, unsigned int device_address,
+                  unsigned int register_address, int *data,
+                  unsigned int n_bytes) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+
+    if (((ret = check_presence(bus, device_address)) == 0) &&
+        ((ret = stage_int_data(bus, data, n_bytes)) == 0)) {
+        ret = write_message(bus, device_address, register_address,
+                            bus->transfer_data, n_bytes);
+        note_presence(bus, device_address, ret);
+    }
+
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Run message segments as one transaction joined by repeated STARTs
+int transfer_i2c_bus(struct pi_i2c_bus *bus, struct pi_i2c_msg *msgs,
+                     unsigned int n_msgs) {
+    unsigned int i;
+    int ret = 0;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+
+    // Any segment to a device known to be gone fails the transaction:
+    for (i = 0; (msgs != NULL) && (i < n_msgs) && (ret == 0); i++) {
+        ret = check_presence(bus, msgs[i].device_address);
+    }
+
+    if (ret == 0) {
+        ret = transfer_messages(bus, msgs, n_msgs);
+    }
+
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Scan bus for devices (only supporting 7-bit addressing)
+int scan_i2c_bus(struct pi_i2c_bus *bus, int *address_book) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = scan_bus(bus, address_book);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Scan a range of addresses for devices into a 128-bit address map
+int scan_range_i2c_bus(struct pi_i2c_bus *bus, unsigned int first_address,
+                       unsigned int last_address,
+                       const unsigned long long *mask, int flags,
+                       unsigned long long *address_map) {
+    int ret;
+
+    if ((bus == NULL) || (address_map == NULL) ||
+        (first_address > last_address) || (last_address > 0x7F) ||
+        (flags & ~(I2C_SCAN_READ | I2C_SCAN_RESERVED | I2C_SCAN_STOP))) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = scan_addresses(bus, first_address, last_address, mask, flags,
+                         address_map);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Reset bus by issuing 9 clock pulses
+int reset_i2c_bus(struct pi_i2c_bus *bus) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = reset_bus(bus);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Return a structure of statistics recorded on a bus
+struct pi_i2c_statistics get_statistics_i2c_bus(struct pi_i2c_bus *bus) {
+    struct pi_i2c_statistics statistics;
+
+    pthread_mutex_lock(&bus->lock);
+    statistics = get_statistics(bus);
+    pthread_mutex_unlock(&bus->lock);
+
+    pthread_mutex_lock(&bus->coalesce_lock);
+    statistics.num_coalesced_reads = bus->num_coalesced_reads;
+    pthread_mutex_unlock(&bus->coalesce_lock);
+
+    return statistics;
+}
+
+// Return internal configuration values of a bus
+struct pi_i2c_configs get_configs_i2c_bus(struct pi_i2c_bus *bus) {
+    struct pi_i2c_configs configs;
+
+    pthread_mutex_lock(&bus->lock);
+    configs = get_configs(bus);
+    pthread_mutex_unlock(&bus->lock);
+
+    return configs;
+}
+
+// Choose between relative and deadline timing of a bus's clock edges
+int set_timing_mode_i2c_bus(struct pi_i2c_bus *bus, int mode) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = set_timing_mode(bus, mode);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Measure how long a bus's lines take to rise and how long a line access
+// takes (or look those up in a cache file) and derive its timings from them
+int calibrate_i2c_bus(struct pi_i2c_bus *bus, const char *cache_path) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = calibrate_bus(bus, cache_path);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Set how long a device may stretch the clock (0 for the default)
+int set_stretch_timeout_i2c_bus(struct pi_i2c_bus *bus,
+                                unsigned int device_address,
+                                unsigned int timeout_us) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = set_stretch_timeout(bus, device_address, timeout_us);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Choose which clock pulses are checked for clock stretching on a bus
+int set_stretch_policy_i2c_bus(struct pi_i2c_bus *bus, int policy) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = set_stretch_policy(bus, policy);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Choose which clock pulses are checked for clock stretching by a device
+int set_device_stretch_policy_i2c_bus(struct pi_i2c_bus *bus,
+                                      unsigned int device_address,
+                                      int policy) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = set_device_stretch_policy(bus, device_address, policy);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Return the clock stretching profile of a device at a point of a message
+int get_stretch_profile_i2c_bus(struct pi_i2c_bus *bus,
+                                unsigned int device_address,
+                                unsigned int phase,
+                                struct pi_i2c_stretch_profile *profile) {
+    int ret;
+
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = get_stretch_profile(bus, device_address, phase, profile);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Write the clock stretching profiles of a bus to a text file
+int export_stretch_profiles_i2c_bus(struct pi_i2c_bus *bus,
+                                    const char *path) {
+    int ret;
+
+    if ((bus == NULL) || (path == NULL)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    ret = export_stretch_profiles(bus, path);
+    pthread_mutex_unlock(&bus->lock);
+
+    return ret;
+}
+
+// Let identical reads from different threads share one transaction (or
+// stop them from doing so)
+int set_read_coalescing_i2c_bus(struct pi_i2c_bus *bus, int enable) {
+    if (bus == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->coalesce_lock);
+    bus->coalesce_flag = (enable != 0);
+    pthread_mutex_unlock(&bus->coalesce_lock);
 
     return 0;
 }
 
+// Return how many reads of N bytes from a device's register address were
+// served by another thread's transaction
+int get_coalesced_reads_i2c_bus(struct pi_i2c_bus *bus,
+                                unsigned int device_address,
+                                unsigned int register_address,
+                                unsigned int n_bytes) {
+    struct coalesced_count *count;
+
+    unsigned int i;
+    int ret = 0;
+
+    // Only 7-bit addressing and 8-bit register addresses are supported:
+    if ((bus == NULL) || (device_address > 0x7F) ||
+        (register_address > 0xFF) || (n_bytes == 0)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bus->coalesce_lock);
+
+    for (i = 0; i < bus->n_coalesced_counts; i++) {
+        count = &bus->coalesced_counts[i];
+
+        if ((count->n_bytes == n_bytes) &&
+            (count->device_address == device_address) &&
+            (count->register_address == register_address)) {
+            ret = count->num_coalesced;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&bus->coalesce_lock);
+
+    return ret;
+}
+
+// Global API. Thin shims operating on the default bus set up by
+// config_i2c():
+
+// Read N number of bytes from the specified register address of a device
+int read_i2c(unsigned int device_address, unsigned int register_address,
+             int *data, unsigned int n_bytes) {
+    return read_i2c_bus(&default_bus, device_address, register_address,
+                        data, n_bytes);
+}
+
+// Write N number of bytes to the specified register address of a device
+int write_i2c(unsigned int device_address, unsigned int register_address,
+              int *data, unsigned int n_bytes) {
+    return write_i2c_bus(&default_bus, device_address, register_address,
+                         data, n_bytes);
+}
+
+// Read N number of bytes from the specified register address of a device
+// straight into a byte buffer
+int read_bytes_i2c(unsigned int device_address, unsigned int register_address,
+                   uint8_t *data, unsigned int n_bytes) {
+    return read_bytes_i2c_bus(&default_bus, device_address, register_address,
+                              data, n_bytes);
+}
+
+// Write N number of bytes to the specified register address of a device
+// straight from a byte buffer
+int write_bytes_i2c(unsigned int device_address,
+                    unsigned int register_address, const uint8_t *data,
+                    unsigned int n_bytes) {
+    return write_bytes_i2c_bus(&default_bus, device_address,
+                               register_address, data, n_bytes);
+}
+
+// Run message segments as one transaction joined by repeated STARTs
+int transfer_i2c(struct pi_i2c_msg *msgs, unsigned int n_msgs) {
+    return transfer_i2c_bus(&default_bus, msgs, n_msgs);
+}
+
+// Scan bus for devices (only supporting 7-bit addressing)
+int scan_bus_i2c(int *address_book) {
+    return scan_i2c_bus(&default_bus, address_book);
+}
+
+// Scan a range of addresses for devices into a 128-bit address map
+int scan_range_i2c(unsigned int first_address, unsigned int last_address,
+                   const unsigned long long *mask, int flags,
+                   unsigned long long *address_map) {
+    return scan_range_i2c_bus(&default_bus, first_address, last_address,
+                              mask, flags, address_map);
+}
+
+// Reset bus by issuing 9 clock pulses. Typically used to un-stuck the SDA line
+// after a device is forcing it low
+int reset_i2c(void) {
+    return reset_i2c_bus(&default_bus);
+}
+
 // Return a structure of statistics recorded by Pi I2C
 struct pi_i2c_statistics get_statistics_i2c(void) {
-    return statistics;
+    return get_statistics_i2c_bus(&default_bus);
 }
 
 // Return internal configuration values
 struct pi_i2c_configs get_configs_i2c(void) {
-    struct pi_i2c_configs configs = {
-        .scl_t_low_sleep_us = scl_t_low_sleep_us,
-        .scl_t_high_sleep_us = scl_t_high_sleep_us,
-        .scl_actual_clock_frequency_hz = scl_actual_clock_frequency_hz,
-        .min_t_hdsta_sleep_us = min_t_hdsta_sleep_us,
-        .min_t_susta_sleep_us = min_t_susta_sleep_us,
-        .min_t_susto_sleep_us = min_t_susto_sleep_us,
-        .min_t_buf_sleep_us = min_t_buf_sleep_us
-    };
+    return get_configs_i2c_bus(&default_bus);
+}
 
-    return configs;
+// Choose between relative and deadline timing of clock edges
+int set_timing_mode_i2c(int mode) {
+    return set_timing_mode_i2c_bus(&default_bus, mode);
 }
+
+// Measure the default bus's lines (or look them up in a cache file) and
+// derive its timings from them
+int calibrate_i2c(const char *cache_path) {
+    return calibrate_i2c_bus(&default_bus, cache_path);
+}
+
+// Set how long a device may stretch the clock (0 for the default)
+int set_stretch_timeout_i2c(unsigned int device_address,
+                            unsigned int timeout_us) {
+    return set_stretch_timeout_i2c_bus(&default_bus, device_address,
+                                       timeout_us);
+}
+
+// Choose which clock pulses are checked for clock stretching
+int set_stretch_policy_i2c(int policy) {
+    return set_stretch_policy_i2c_bus(&default_bus, policy);
+}
+
+// Choose which clock pulses are checked for clock stretching by a device
+int set_device_stretch_policy_i2c(unsigned int device_address, int policy) {
+    return set_device_stretch_policy_i2c_bus(&default_bus, device_address,
+                                             policy);
+}
+
+// Return the clock stretching profile of a device at a point of a message
+int get_stretch_profile_i2c(unsigned int device_address, unsigned int phase,
+                            struct pi_i2c_stretch_profile *profile) {
+    return get_stretch_profile_i2c_bus(&default_bus, device_address, phase,
+                                       profile);
+}
+
+// Write the clock stretching profiles to a text file
+int export_stretch_profiles_i2c(const char *path) {
+    return export_stretch_profiles_i2c_bus(&default_bus, path);
+}
+
+// Let identical reads from different threads share one transaction (or
+// stop them from doing so)
+int set_read_coalescing_i2c(int enable) {
+    return set_read_coalescing_i2c_bus(&default_bus, enable);
+}
+
+// Return how many reads of N bytes from a device's register address were
+// served by another thread's transaction
+int get_coalesced_reads_i2c(unsigned int device_address,
+                            unsigned int register_address,
+                            unsigned int n_bytes) {
+    return get_coalesced_reads_i2c_bus(&default_bus, device_address,
+                                       register_address, n_bytes);
+}
\ No newline at end of file
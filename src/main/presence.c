@@ -0,0 +1,515 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Device presence cache
+//
+// A watched bus keeps a map of which of the watched addresses have a device
+// on them. The map is filled by a scan when watching starts and then kept
+// up to date two ways: every transaction to a watched address tells whether
+// its device answered, and a worker thread probes a few addresses at a time
+// in the background, round robin over the watched addresses. The worker
+// only probes when it finds the bus free; a bus in use puts the refresh off
+// to the next interval rather than making the application wait behind it.
+//
+// Transactions to a watched address known to be empty fail with -ENACK
+// without touching the bus. Devices arriving or departing are queued as
+// events, handed to the callback from the worker thread or else polled for
+// with an eventfd signalling their arrival.
+
+// Include C standard libraries:
+#include <stdlib.h>    // C Standard library (watch allocation)
+#include <stdint.h>    // C Standard integer types (eventfd counter)
+#include <time.h>      // C Standard get and manipulate time library
+#include <errno.h>     // C Standard for error conditions
+#include <stdatomic.h> // C Standard atomic operations
+
+// Include C POSIX libraries:
+#include <pthread.h>     // POSIX threads (worker thread)
+#include <unistd.h>      // POSIX read, write, and close
+#include <sys/eventfd.h> // Event wakeups
+
+// Include header files:
+#include "pi_i2c.h"   // Speed grade, macros, and outward function prototypes
+#include "config.h"   // I2C timing and variable defs
+#include "ring.h"     // Lock-free ring of events
+#include "scan.h"     // Bus scan function protos
+#include "presence.h" // Presence cache function protos
+
+// Events are queued as the address with this bit set for arrivals:
+#define PRESENCE_ARRIVED 0x80
+
+struct pi_i2c_presence {
+    struct pi_i2c_bus *bus;
+
+    // Addresses kept track of and those with a device on them. Written
+    // holding both bus->lock and lock so either is enough to read them:
+    unsigned long long watched[I2C_ADDRESS_MAP_WORDS];
+    unsigned long long present[I2C_ADDRESS_MAP_WORDS];
+
+    unsigned int n_per_refresh; // Addresses probed per refresh
+    unsigned int interval_us;   // Time between refreshes
+    unsigned int next_address;  // Where the next refresh carries on from
+
+    void (*callback)(unsigned int device_address, int present, void *arg);
+    void *callback_arg;
+
+    struct ring events; // Queued arrive and depart events
+    int event_fd;       // Readable once an event is queued (no callback)
+
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // Stop asked for or events to hand to callback
+    int stop;
+    int pending;
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers (guarded by lock, bar num_busy):
+    struct pi_i2c_presence_statistics statistics;
+    atomic_llong num_busy;
+};
+
+static inline int watched_address(struct pi_i2c_presence *presence,
+                                  unsigned int device_address) {
+    return (device_address < 128) &&
+           I2C_ADDRESS_PRESENT(presence->watched, device_address);
+}
+
+// Record whether a device is on a watched address and queue an event if
+// that changed (caller holds bus->lock)
+static void set_presence(struct pi_i2c_presence *presence,
+                         unsigned int device_address, int present) {
+    unsigned long long bit = 1ULL << (device_address & 0x3F);
+    uint64_t count = 1;
+
+    int notify = 0;
+
+    pthread_mutex_lock(&presence->lock);
+
+    if ((int) I2C_ADDRESS_PRESENT(presence->present, device_address) !=
+        present) {
+        presence->present[device_address >> 6] ^= bit;
+
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        if (present) {
+            presence->statistics.num_arrivals++;
+        } else {
+            presence->statistics.num_departures++;
+        }
+
+        if (push_ring(&presence->events, device_address |
+                      (present ? PRESENCE_ARRIVED : 0)) < 0) {
+            presence->statistics.num_events_dropped++;
+        } else if (presence->callback != NULL) {
+            presence->pending = 1;
+            pthread_cond_signal(&presence->wake);
+        } else {
+            notify = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&presence->lock);
+
+    if (notify && (write(presence->event_fd, &count, sizeof(count)) < 0)) {
+        // Counter cannot overflow; nothing to do
+    }
+}
+
+// Fail a transaction to a watched address known to be empty (caller holds
+// bus->lock). Returns 0 otherwise
+int check_presence(struct pi_i2c_bus *bus, unsigned int device_address) {
+    struct pi_i2c_presence *presence = bus->presence;
+
+    if ((presence == NULL) || !watched_address(presence, device_address) ||
+        I2C_ADDRESS_PRESENT(presence->present, device_address)) {
+        return 0;
+    }
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    pthread_mutex_lock(&presence->lock);
+    presence->statistics.num_fail_fast++;
+    pthread_mutex_unlock(&presence->lock);
+
+    return -ENACK;
+}
+
+// Learn from how a transaction to a device went (caller holds bus->lock).
+// Success means the device is there and a NACK of its address that it is
+// not; other errors say nothing about it
+void note_presence(struct pi_i2c_bus *bus, unsigned int device_address,
+                   int ret) {
+    struct pi_i2c_presence *presence = bus->presence;
+
+    if ((presence == NULL) || !watched_address(presence, device_address)) {
+        return;
+    }
+
+    if (ret == 0) {
+        set_presence(presence, device_address, 1);
+    } else if (ret == -ENACK) {
+        set_presence(presence, device_address, 0);
+    }
+}
+
+// Probe the next few watched addresses if the bus is free
+static void refresh_presence(struct pi_i2c_presence *presence) {
+    struct pi_i2c_bus *bus = presence->bus;
+
+    unsigned long long mask[I2C_ADDRESS_MAP_WORDS] = {0};
+    unsigned long long found[I2C_ADDRESS_MAP_WORDS];
+    long long last_scan_ns;
+
+    unsigned int address = presence->next_address;
+    unsigned int n = 0;
+    unsigned int i;
+
+    // Leave the bus to the application while it is using it:
+    if (pthread_mutex_trylock(&bus->lock) != 0) {
+        atomic_fetch_add(&presence->num_busy, 1);
+        return;
+    }
+
+    for (i = 0; (i < 128) && (n < presence->n_per_refresh); i++) {
+        address = (presence->next_address + i) & 0x7F;
+
+        if (watched_address(presence, address)) {
+            mask[address >> 6] |= 1ULL << (address & 0x3F);
+            n++;
+        }
+    }
+
+    presence->next_address = (address + 1) & 0x7F;
+
+    // Background probes are not the caller's scans:
+    last_scan_ns = bus->statistics.last_scan_ns;
+
+    if (scan_addresses(bus, 0x00, 0x7F, mask, I2C_SCAN_RESERVED,
+                       found) >= 0) {
+        for (address = 0; address < 128; address++) {
+            if (I2C_ADDRESS_PRESENT(mask, address)) {
+                set_presence(presence, address,
+                             I2C_ADDRESS_PRESENT(found, address));
+            }
+        }
+
+        // Keep track of statistics for any caller interested in those
+        // kind of numbers:
+        pthread_mutex_lock(&presence->lock);
+        presence->statistics.num_refreshes++;
+        presence->statistics.num_probes += n;
+        presence->statistics.last_refresh_ns = bus->statistics.last_scan_ns;
+        pthread_mutex_unlock(&presence->lock);
+    }
+
+    bus->statistics.last_scan_ns = last_scan_ns;
+
+    pthread_mutex_unlock(&bus->lock);
+}
+
+// Hand queued events to the callback
+static void deliver_events(struct pi_i2c_presence *presence) {
+    unsigned int event;
+
+    while (pop_ring(&presence->events, &event) == 0) {
+        presence->callback(event & 0x7F, (event & PRESENCE_ARRIVED) != 0,
+                           presence->callback_arg);
+    }
+}
+
+static long long presence_clock_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Refresh every interval_us until asked to stop, handing events to the
+// callback in between
+static void *run_worker(void *arg) {
+    struct pi_i2c_presence *presence = arg;
+
+    struct timespec deadline;
+
+    long long next_ns = presence_clock_ns() +
+                        presence->interval_us * 1000LL;
+
+    pthread_mutex_lock(&presence->lock);
+
+    while (!presence->stop) {
+        deadline.tv_sec = next_ns / 1000000000LL;
+        deadline.tv_nsec = next_ns % 1000000000LL;
+
+        while (!presence->stop && !presence->pending &&
+               (pthread_cond_timedwait(&presence->wake, &presence->lock,
+                                       &deadline) == 0)) {
+        }
+
+        presence->pending = 0;
+
+        if (presence->stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&presence->lock);
+
+        if (presence_clock_ns() >= next_ns) {
+            refresh_presence(presence);
+            next_ns = presence_clock_ns() + presence->interval_us * 1000LL;
+        }
+
+        if (presence->callback != NULL) {
+            deliver_events(presence);
+        }
+
+        pthread_mutex_lock(&presence->lock);
+    }
+
+    pthread_mutex_unlock(&presence->lock);
+
+    return NULL;
+}
+
+static void free_presence(struct pi_i2c_presence *presence) {
+    if (presence->event_fd >= 0) {
+        close(presence->event_fd);
+    }
+
+    pthread_cond_destroy(&presence->wake);
+    pthread_mutex_destroy(&presence->lock);
+    free_ring(&presence->events);
+    free(presence);
+}
+
+// Keep track of which of the addresses in mask (the unreserved addresses
+// 0x08 to 0x77 if NULL) have a device on them. The bus is scanned once,
+// then n_per_refresh addresses are probed every interval_us (defaults for
+// 0) by a worker thread. Arrive and depart events go to callback if given.
+// Returns NULL and sets errno on error
+struct pi_i2c_presence *watch_presence_i2c_bus(
+    struct pi_i2c_bus *bus, const unsigned long long *mask,
+    unsigned int n_per_refresh, unsigned int interval_us,
+    void (*callback)(unsigned int device_address, int present, void *arg),
+    void *callback_arg) {
+    struct pi_i2c_presence *presence;
+
+    pthread_condattr_t attr;
+
+    unsigned int address;
+    int ret;
+
+    if (bus == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((presence = calloc(1, sizeof(*presence))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    presence->bus = bus;
+    presence->event_fd = -1;
+    presence->n_per_refresh = (n_per_refresh != 0) ? n_per_refresh :
+                              PRESENCE_N_PER_REFRESH;
+    presence->interval_us = (interval_us != 0) ? interval_us :
+                            PRESENCE_INTERVAL_US;
+    presence->callback = callback;
+    presence->callback_arg = callback_arg;
+
+    for (address = 0x08; address < 0x78; address++) {
+        if ((mask == NULL) || I2C_ADDRESS_PRESENT(mask, address)) {
+            presence->watched[address >> 6] |= 1ULL << (address & 0x3F);
+        }
+    }
+
+    // Reserved addresses only when asked for:
+    if (mask != NULL) {
+        presence->watched[0] |= mask[0] & 0xFFULL;
+        presence->watched[1] |= mask[1] & (0xFFULL << 56);
+    }
+
+    pthread_mutex_init(&presence->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&presence->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if ((init_ring(&presence->events, PRESENCE_EVENTS) < 0) ||
+        ((presence->event_fd = eventfd(0, EFD_CLOEXEC |
+                                          EFD_NONBLOCK)) < 0)) {
+        ret = (presence->event_fd < 0) ? errno : ENOMEM;
+        free_presence(presence);
+        errno = ret;
+        return NULL;
+    }
+
+    // Fill the map with a scan of every watched address:
+    pthread_mutex_lock(&bus->lock);
+
+    if (bus->presence != NULL) {
+        ret = -EBUSY;
+    } else if ((ret = scan_addresses(bus, 0x00, 0x7F, presence->watched,
+                                     I2C_SCAN_RESERVED,
+                                     presence->present)) >= 0) {
+        bus->presence = presence;
+    }
+
+    pthread_mutex_unlock(&bus->lock);
+
+    if (ret < 0) {
+        free_presence(presence);
+        errno = -ret;
+        return NULL;
+    }
+
+    if ((ret = pthread_create(&presence->worker, NULL, run_worker,
+                              presence)) != 0) {
+        pthread_mutex_lock(&bus->lock);
+        bus->presence = NULL;
+        pthread_mutex_unlock(&bus->lock);
+
+        free_presence(presence);
+        errno = ret;
+        return NULL;
+    }
+
+    return presence;
+}
+
+// Watch the default bus
+struct pi_i2c_presence *watch_presence_i2c(
+    const unsigned long long *mask, unsigned int n_per_refresh,
+    unsigned int interval_us,
+    void (*callback)(unsigned int device_address, int present, void *arg),
+    void *callback_arg) {
+    return watch_presence_i2c_bus(&default_bus, mask, n_per_refresh,
+                                  interval_us, callback, callback_arg);
+}
+
+// Stop watching: transactions go to the bus again whatever the map says,
+// and events not yet taken are dropped. Returns -EDEADLK if called from the
+// worker (the event callback), which cannot wait for itself to finish
+int unwatch_presence_i2c(struct pi_i2c_presence *presence) {
+    if (presence == NULL) {
+        return 0;
+    }
+
+    if (pthread_equal(pthread_self(), presence->worker)) {
+        return -EDEADLK;
+    }
+
+    pthread_mutex_lock(&presence->bus->lock);
+    presence->bus->presence = NULL;
+    pthread_mutex_unlock(&presence->bus->lock);
+
+    pthread_mutex_lock(&presence->lock);
+    presence->stop = 1;
+    pthread_cond_signal(&presence->wake);
+    pthread_mutex_unlock(&presence->lock);
+
+    pthread_join(presence->worker, NULL);
+
+    free_presence(presence);
+
+    return 0;
+}
+
+// Copy the map of watched addresses with a device on them. Returns the
+// number of devices present
+int get_map_presence_i2c(struct pi_i2c_presence *presence,
+                         unsigned long long *address_map) {
+    unsigned int address;
+    int n_present = 0;
+
+    if ((presence == NULL) || (address_map == NULL)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&presence->lock);
+
+    for (address = 0; address < 128; address++) {
+        n_present += I2C_ADDRESS_PRESENT(presence->present, address);
+    }
+
+    address_map[0] = presence->present[0];
+    address_map[1] = presence->present[1];
+
+    pthread_mutex_unlock(&presence->lock);
+
+    return n_present;
+}
+
+// Take the oldest arrive or depart event. Returns -EAGAIN if there is none
+// (events go to the callback instead when one was given)
+int poll_presence_i2c(struct pi_i2c_presence *presence,
+                      unsigned int *device_address, int *present) {
+    unsigned int event;
+    uint64_t count;
+
+    if ((presence == NULL) || (device_address == NULL) ||
+        (present == NULL)) {
+        return -EINVAL;
+    }
+
+    // Clear the eventfd once the queue runs dry, then look again for an
+    // event queued in between:
+    if (pop_ring(&presence->events, &event) < 0) {
+        if (read(presence->event_fd, &count, sizeof(count)) < 0) {
+            // Nothing signalled; nothing to clear
+        }
+
+        if (pop_ring(&presence->events, &event) < 0) {
+            return -EAGAIN;
+        }
+    }
+
+    *device_address = event & 0x7F;
+    *present = (event & PRESENCE_ARRIVED) != 0;
+
+    return 0;
+}
+
+// File descriptor readable while events are queued (for poll() or epoll)
+int get_fd_presence_i2c(struct pi_i2c_presence *presence) {
+    if (presence == NULL) {
+        return -EINVAL;
+    }
+
+    return presence->event_fd;
+}
+
+// Return the statistics of the background rescan
+struct pi_i2c_presence_statistics get_statistics_presence_i2c(
+    struct pi_i2c_presence *presence) {
+    struct pi_i2c_presence_statistics statistics;
+
+    pthread_mutex_lock(&presence->lock);
+    statistics = presence->statistics;
+    pthread_mutex_unlock(&presence->lock);
+
+    statistics.num_busy = atomic_load(&presence->num_busy);
+
+    return statistics;
+}
@@ -0,0 +1,332 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Continuous sampling
+//
+// A sampler reads the same registers of a device at a fixed rate from a
+// thread of its own and writes each sample, with the time its read started,
+// into a ring the caller allocated. Nothing is allocated and no lock is
+// shared with the caller once sampling starts: the caller finds out how far
+// the sampler has got from the producer index, a count of the samples
+// written so far (sample i is in slot i % capacity), and tells it how far
+// it has taken samples so that samples written over before being taken are
+// counted.
+//
+// Reads are timed against absolute deadlines of the monotonic clock so that
+// a late read does not push every later one back. A read running past the
+// next deadline skips the sample times it ran over, counting them as
+// missed, rather than bunching samples up to catch up.
+
+// GNU extensions (CPU affinity):
+#define _GNU_SOURCE
+
+// Include C standard libraries:
+#include <stdlib.h>    // C Standard library (sampler allocation)
+#include <stdint.h>    // C Standard integer types (byte buffers)
+#include <time.h>      // C Standard get and manipulate time library
+#include <errno.h>     // C Standard for error conditions
+#include <stdatomic.h> // C Standard atomic operations
+
+// Include C POSIX libraries:
+#include <pthread.h> // POSIX threads (sampling thread)
+#include <sched.h>   // CPU sets (sampling thread pinning)
+
+// Include header files:
+#include "pi_i2c.h" // Speed grade, macros, and outward function prototypes
+#include "config.h" // I2C timing and variable defs
+
+struct pi_i2c_sampler {
+    struct pi_i2c_bus *bus;
+
+    unsigned int device_address;
+    unsigned int register_address;
+    unsigned int n_bytes;
+    long long period_ns;
+
+    // Caller's ring of capacity samples of n_bytes each and their times:
+    uint8_t *samples;
+    long long *timestamps_ns;
+    unsigned int capacity;
+
+    atomic_ullong index; // Samples written (producer index)
+    atomic_ullong taken; // Samples taken by the caller
+
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // Stop asked for
+    int stop;
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers (guarded by lock):
+    struct pi_i2c_sampler_statistics statistics;
+    long long start_ns;
+};
+
+static long long sampler_clock_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Read one sample into the next slot of the ring and publish it. Returns
+// the error number of the read
+static int take_sample(struct pi_i2c_sampler *sampler, long long now_ns) {
+    unsigned long long index = atomic_load_explicit(&sampler->index,
+                                                    memory_order_relaxed);
+    unsigned int slot = index % sampler->capacity;
+
+    int ret;
+
+    if ((ret = read_bytes_i2c_bus(sampler->bus, sampler->device_address,
+                                  sampler->register_address,
+                                  sampler->samples + slot * sampler->n_bytes,
+                                  sampler->n_bytes)) < 0) {
+        return ret;
+    }
+
+    if (sampler->timestamps_ns != NULL) {
+        sampler->timestamps_ns[slot] = now_ns;
+    }
+
+    // The slot is only the caller's to read once the index has moved past
+    // it:
+    atomic_store_explicit(&sampler->index, index + 1, memory_order_release);
+
+    return (index - atomic_load(&sampler->taken) >= sampler->capacity) ?
+           1 : 0;
+}
+
+// Sample every period_ns until asked to stop
+static void *run_worker(void *arg) {
+    struct pi_i2c_sampler *sampler = arg;
+
+    struct timespec deadline;
+
+    long long next_ns = sampler->start_ns;
+    long long now_ns;
+    long long lateness_ns;
+    long long n_missed;
+
+    int ret;
+
+    pthread_mutex_lock(&sampler->lock);
+
+    while (!sampler->stop) {
+        deadline.tv_sec = next_ns / 1000000000LL;
+        deadline.tv_nsec = next_ns % 1000000000LL;
+
+        while (!sampler->stop &&
+               (pthread_cond_timedwait(&sampler->wake, &sampler->lock,
+                                       &deadline) == 0)) {
+        }
+
+        if (sampler->stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&sampler->lock);
+
+        now_ns = sampler_clock_ns();
+        lateness_ns = now_ns - next_ns;
+        ret = take_sample(sampler, now_ns);
+
+        // Skip the sample times the read ran over:
+        next_ns += sampler->period_ns;
+        n_missed = (sampler_clock_ns() - next_ns) / sampler->period_ns;
+
+        if (n_missed > 0) {
+            next_ns += n_missed * sampler->period_ns;
+        } else {
+            n_missed = 0;
+        }
+
+        pthread_mutex_lock(&sampler->lock);
+
+        // Keep track of statistics for any caller interested in those kind
+        // of numbers:
+        if (ret < 0) {
+            sampler->statistics.num_errors++;
+            sampler->statistics.last_error = ret;
+        } else {
+            sampler->statistics.num_samples++;
+            sampler->statistics.num_overwritten += ret;
+        }
+
+        sampler->statistics.num_missed += n_missed;
+
+        if (lateness_ns > sampler->statistics.max_lateness_ns) {
+            sampler->statistics.max_lateness_ns = lateness_ns;
+        }
+    }
+
+    pthread_mutex_unlock(&sampler->lock);
+
+    return NULL;
+}
+
+// Start reading n_bytes from a device's register address rate_hz times a
+// second into a ring of capacity samples: samples holds capacity * n_bytes
+// bytes and timestamps_ns (if not NULL) capacity times. The sampling thread
+// is pinned to a CPU unless cpu is negative. Returns NULL and sets errno
+// on error
+struct pi_i2c_sampler *start_sampler_i2c_bus(struct pi_i2c_bus *bus,
+                                             unsigned int device_address,
+                                             unsigned int register_address,
+                                             unsigned int n_bytes,
+                                             float rate_hz, uint8_t *samples,
+                                             long long *timestamps_ns,
+                                             unsigned int capacity,
+                                             int cpu) {
+    struct pi_i2c_sampler *sampler;
+
+    pthread_condattr_t condattr;
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+
+    int ret;
+
+    // Only 7-bit addressing and 8-bit register addresses are supported.
+    // A sample time must fall at least a nano second after the last:
+    if ((bus == NULL) || (device_address > 0x7F) ||
+        (register_address > 0xFF) || (n_bytes == 0) || !(rate_hz > 0) ||
+        (rate_hz > 1e9) || (samples == NULL) || (capacity == 0) ||
+        (cpu >= CPU_SETSIZE)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((sampler = calloc(1, sizeof(*sampler))) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sampler->bus = bus;
+    sampler->device_address = device_address;
+    sampler->register_address = register_address;
+    sampler->n_bytes = n_bytes;
+    sampler->period_ns = (long long) (1e9 / rate_hz + 0.5);
+    sampler->samples = samples;
+    sampler->timestamps_ns = timestamps_ns;
+    sampler->capacity = capacity;
+    atomic_init(&sampler->index, 0);
+    atomic_init(&sampler->taken, 0);
+
+    pthread_mutex_init(&sampler->lock, NULL);
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sampler->wake, &condattr);
+    pthread_condattr_destroy(&condattr);
+
+    pthread_attr_init(&attr);
+
+    if (cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    sampler->start_ns = sampler_clock_ns();
+
+    ret = pthread_create(&sampler->worker, &attr, run_worker, sampler);
+
+    pthread_attr_destroy(&attr);
+
+    if (ret != 0) {
+        pthread_cond_destroy(&sampler->wake);
+        pthread_mutex_destroy(&sampler->lock);
+        free(sampler);
+        errno = ret;
+        return NULL;
+    }
+
+    return sampler;
+}
+
+// Sample the default bus
+struct pi_i2c_sampler *start_sampler_i2c(unsigned int device_address,
+                                         unsigned int register_address,
+                                         unsigned int n_bytes, float rate_hz,
+                                         uint8_t *samples,
+                                         long long *timestamps_ns,
+                                         unsigned int capacity, int cpu) {
+    return start_sampler_i2c_bus(&default_bus, device_address,
+                                 register_address, n_bytes, rate_hz,
+                                 samples, timestamps_ns, capacity, cpu);
+}
+
+// Stop sampling once the read under way (if any) is written. The ring is
+// the caller's to free afterwards. Returns the number of samples written
+unsigned long long stop_sampler_i2c(struct pi_i2c_sampler *sampler) {
+    unsigned long long index;
+
+    if (sampler == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&sampler->lock);
+    sampler->stop = 1;
+    pthread_cond_signal(&sampler->wake);
+    pthread_mutex_unlock(&sampler->lock);
+
+    pthread_join(sampler->worker, NULL);
+
+    index = atomic_load(&sampler->index);
+
+    pthread_cond_destroy(&sampler->wake);
+    pthread_mutex_destroy(&sampler->lock);
+    free(sampler);
+
+    return index;
+}
+
+// Return the number of samples written so far. Samples index - capacity + 1
+// to index - 1 may be read from the ring: the slot of sample
+// index - capacity is the one the read under way is written into
+unsigned long long get_index_sampler_i2c(struct pi_i2c_sampler *sampler) {
+    return atomic_load_explicit(&sampler->index, memory_order_acquire);
+}
+
+// Tell the sampler that samples before index have been taken. Samples
+// written over before being taken are counted as overwritten
+void set_taken_sampler_i2c(struct pi_i2c_sampler *sampler,
+                           unsigned long long index) {
+    atomic_store(&sampler->taken, index);
+}
+
+// Return the statistics of a sampler
+struct pi_i2c_sampler_statistics get_statistics_sampler_i2c(
+    struct pi_i2c_sampler *sampler) {
+    struct pi_i2c_sampler_statistics statistics;
+
+    pthread_mutex_lock(&sampler->lock);
+    statistics = sampler->statistics;
+    pthread_mutex_unlock(&sampler->lock);
+
+    statistics.elapsed_ns = sampler_clock_ns() - sampler->start_ns;
+    statistics.achieved_rate_hz = statistics.num_samples * 1e9 /
+                                  statistics.elapsed_ns;
+
+    return statistics;
+}
@@ -0,0 +1,218 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Bus scans
+//
+// Addresses are probed with an address frame each and the ACKs collected
+// into a map holding a bit per 7-bit address. All of the probes of a scan
+// are compiled into one program before the bus is touched and, unless the
+// caller asks for a STOP condition after each, chained with repeated
+// STARTs so that the bus is only released once the last probe is done.
+// Every probe ends a message of the program so that run_waveform() hands
+// its ACK back on its own.
+
+// Include C standard libraries:
+#include <time.h>  // C Standard get and manipulate time library
+#include <errno.h> // C Standard for error conditions
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "write_conditions_to_bus.h"  // I2C START and STOP function protos
+#include "config.h"                   // I2C timing and variable defs
+#include "gpio_line.h"                // Open-drain line control
+#include "i2c_dev_backend.h"          // Kernel i2c-dev function protos
+#include "waveform.h"                 // Compiled message waveforms
+#include "scan.h"                     // Bus scan function protos
+
+// Whether a 7-bit address is one UM10204 reserves (general call, START
+// byte, CBUS, 10-bit addressing and future purposes)
+static inline int reserved_address(unsigned int address) {
+    return (address < 0x08) || (address > 0x77);
+}
+
+// Time on the backend's clock (the host's for kernel adapters) to report
+// how long a scan took
+static long long scan_clock_ns(struct pi_i2c_bus *bus) {
+    struct timespec now;
+
+    if ((bus->backend != NULL) && (bus->backend->now_ns != NULL)) {
+        return now_ns(bus);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Probe the listed addresses one message each on a kernel adapter
+static int probe_addresses_i2c_dev(struct pi_i2c_bus *bus,
+                                   const unsigned int *addresses,
+                                   unsigned int n_addresses, int flags,
+                                   unsigned long long *address_map) {
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < n_addresses; i++) {
+        if ((ret = probe_i2c_dev(bus, addresses[i],
+                                 flags & I2C_SCAN_READ)) < 0) {
+            return ret;
+        } else if (ret) {
+            address_map[addresses[i] >> 6] |= 1ULL << (addresses[i] & 0x3F);
+        }
+    }
+
+    return 0;
+}
+
+// Probe the listed addresses as one compiled program. Probes are chained
+// with repeated STARTs (a single STOP at the end) unless I2C_SCAN_STOP is
+// given, and each ends the program's message so that its ACK is returned
+// on its own
+static int probe_addresses(struct pi_i2c_bus *bus,
+                           const unsigned int *addresses,
+                           unsigned int n_addresses, int flags,
+                           unsigned long long *address_map) {
+    int read_flag = (flags & I2C_SCAN_READ) ? READ_FLAG : WRITE_FLAG;
+    uint8_t byte;
+
+    unsigned int i;
+    int ret;
+
+    // Get bus into known state by using STOP condition:
+    if ((ret = write_stop_condition_to_bus(bus)) < 0) {
+        return ret;
+    }
+
+    bus->device_address = addresses[0];
+
+    begin_waveform(bus);
+
+    for (i = 0; i < n_addresses; i++) {
+        if ((i == 0) || (flags & I2C_SCAN_STOP)) {
+            add_start_to_waveform(bus);
+        } else {
+            add_repeated_start_to_waveform(bus);
+        }
+
+        add_device_to_waveform(bus, addresses[i]);
+        add_write_byte_to_waveform(bus, (addresses[i] << 1) | read_flag,
+                                   WAVEFORM_ACK_PROBE);
+
+        // A device answering a read probe goes on to send a byte; take it
+        // and NACK it so that the device lets go of SDA:
+        if (flags & I2C_SCAN_READ) {
+            add_read_byte_to_waveform(bus, 0, 0);
+        }
+
+        if (flags & I2C_SCAN_STOP) {
+            add_stop_to_waveform(bus);
+        }
+
+        add_end_message_to_waveform(bus);
+    }
+
+    if (!(flags & I2C_SCAN_STOP)) {
+        add_stop_to_waveform(bus);
+    }
+
+    for (i = 0; i < n_addresses; i++) {
+        if ((ret = run_waveform(bus, &byte)) < 0) {
+            return ret;
+        }
+
+        // If device responded, update the address map to say if a device
+        // was detected:
+        if (ret == ACK) {
+            address_map[addresses[i] >> 6] |= 1ULL << (addresses[i] & 0x3F);
+        }
+    }
+
+    // STOP condition ending chained probes:
+    if (!(flags & I2C_SCAN_STOP)) {
+        return run_waveform(bus, NULL);
+    }
+
+    return 0;
+}
+
+// Scan the addresses first_address to last_address (and in mask unless
+// NULL) for devices, leaving out reserved addresses unless asked for.
+// Returns the number of devices found (caller holds bus->lock)
+int scan_addresses(struct pi_i2c_bus *bus, unsigned int first_address,
+                   unsigned int last_address, const unsigned long long *mask,
+                   int flags, unsigned long long *address_map) {
+    // Definitions:
+    unsigned int addresses[128];
+    unsigned int n_addresses = 0;
+    unsigned int address;
+
+    long long start_ns;
+
+    int n_found = 0;
+    int ret;
+
+    // Check if I2C has been configured for use; otherwise bail as important
+    // timings are not yet defined:
+    if (!bus->config_i2c_flag) {
+        return -EI2CNOTCFG;
+    }
+
+    address_map[0] = 0;
+    address_map[1] = 0;
+
+    for (address = first_address; address <= last_address; address++) {
+        if (((mask == NULL) || I2C_ADDRESS_PRESENT(mask, address)) &&
+            ((flags & I2C_SCAN_RESERVED) || !reserved_address(address))) {
+            addresses[n_addresses++] = address;
+        }
+    }
+
+    if (n_addresses == 0) {
+        return 0;
+    }
+
+    start_ns = scan_clock_ns(bus);
+
+    if (bus->i2c_dev_fd >= 0) {
+        ret = probe_addresses_i2c_dev(bus, addresses, n_addresses, flags,
+                                      address_map);
+    } else {
+        ret = probe_addresses(bus, addresses, n_addresses, flags,
+                              address_map);
+    }
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    bus->statistics.last_scan_ns = scan_clock_ns(bus) - start_ns;
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (address = 0; address < 128; address++) {
+        n_found += I2C_ADDRESS_PRESENT(address_map, address);
+    }
+
+    return n_found;
+}
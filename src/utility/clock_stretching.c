@@ -22,54 +22,320 @@
 // ============================================================================
 
 // Include C standard libraries:
-#include <time.h>  // C Standard get and manipulate time library
+#include <stdio.h>  // C Standard I/O library (profile export)
+#include <time.h>   // C Standard get and manipulate time library
+#include <limits.h> // C Standard sizes of integer types
+#include <errno.h>  // C Standard for error conditions
 
 // Include header files:
 #include "pi_i2c.h"                   // Speed grade, macros, and outward
                                       // function prototypes.
 #include "config.h"                   // I2C timing and variable defs
+#include "gpio_line.h"                // Open-drain line control
 #include "detect_recover_bus.h"       // Detect and recover I2C bus
-#include <pi_lw_gpio.h>               // GPIO library for the Pi
-#include <pi_microsleep_hard.h>       // Hard microsleep function for the Pi
+#include "clock_stretching.h"         // Support clock stretching
 
-// Support UM10204 I2C-bus specification 3.1.9 before breaking another device
-int support_clock_stretching(void) {
-    // Elapsed time in micro seconds:
-    int clock_stretching_elapsed_us = 0;
-    int clock_stretching_sleep_us = CLOCK_STRETCHING_TIMEOUT_US / 10;
+// Names of I2C_PHASE_* in exported profiles:
+static const char *phase_names[I2C_N_PHASES] = {
+    "bit", "address", "register", "read_address", "write_data", "read_data"
+};
 
-    // Implement a wait to avoid a false positive SCL stuck low:
-    microsleep_hard(scl_response_time_us);
+// Time waited out since a stretch began: the backend clock where there is one,
+// otherwise the sum of the waits asked for
+static inline long long stretch_elapsed_ns(struct pi_i2c_bus *bus,
+                                           long long start_ns,
+                                           long long waited_ns) {
+    if (bus->backend->now_ns != NULL) {
+        return now_ns(bus) - start_ns;
+    }
+
+    return waited_ns;
+}
+
+static inline int clamp_ns(long long ns) {
+    return (ns > INT_MAX) ? INT_MAX : (int) ns;
+}
+
+// Wait for ns, yielding the CPU if that is long enough. Returns 1 if slept
+static int wait_or_sleep_ns(struct pi_i2c_bus *bus, long long ns) {
+    if (ns >= CLOCK_STRETCHING_SLEEP_NS) {
+        sleep_us(bus, (ns + 999) / 1000);
+        return 1;
+    }
+
+    wait_ns(bus, ns);
+
+    return 0;
+}
+
+// Keep track of statistics for any caller interested in those kind of
+// numbers:
+static void record_stretch(struct pi_i2c_bus *bus, long long stretch_ns,
+                           int slept) {
+    bus->statistics.num_clock_stretch_sleeps += slept;
+    bus->statistics.total_clock_stretch_ns += stretch_ns;
+    bus->statistics.last_clock_stretch_ns = clamp_ns(stretch_ns);
+
+    if (bus->statistics.last_clock_stretch_ns >
+        bus->statistics.max_clock_stretch_ns) {
+        bus->statistics.max_clock_stretch_ns =
+            bus->statistics.last_clock_stretch_ns;
+    }
+}
+
+// Poll SCL until a device stretching the clock lets go of it, waited_ns
+// after the stretch was first seen. Stores how long the device stretched
+// for in stretch_ns and returns 0, or -ECLKTIMEOUT.
+//
+// SCL is polled finely for the first CLOCK_STRETCHING_SPIN_NS as most
+// stretches are short. After that the interval between polls doubles up to
+// CLOCK_STRETCHING_MAX_STEP_NS so that a device releasing SCL is seen within
+// about twice the time it stretched for, and intervals of at least
+// CLOCK_STRETCHING_SLEEP_NS yield the CPU instead of spinning. A precise
+// poll keeps every interval within an eighth of the time stretched so far
+// so that the stretch measured is close to the real one.
+static int poll_clock_stretching(struct pi_i2c_bus *bus, long long waited_ns,
+                                 int slept, int precise,
+                                 long long *stretch_ns) {
+    // Definitions:
+    unsigned int timeout_us = bus->stretch_timeout_us[bus->device_address];
+
+    long long timeout_ns;
+    long long start_ns = 0;
+    long long elapsed_ns = 0;
+    long long step_ns = CLOCK_STRETCHING_POLL_NS;
+
+    if (timeout_us == 0) {
+        timeout_us = CLOCK_STRETCHING_TIMEOUT_US;
+    }
+
+    timeout_ns = timeout_us * 1000LL;
+
+    if (bus->backend->now_ns != NULL) {
+        start_ns = now_ns(bus) - waited_ns;
+    }
+
+    // Wait for SCL to go high within the timeout period; if it goes high,
+    // then device is ready for controller to continue:
+    while (!read_scl(bus)) {
+        elapsed_ns = stretch_elapsed_ns(bus, start_ns, waited_ns);
+
+        if (elapsed_ns >= timeout_ns) {
+            // Device has not responded within the timeout!
+
+            // Keep track of statistics for any caller interested in those
+            // kind of numbers:
+            bus->statistics.num_clock_stretching_timeouts++;
+
+            return -ECLKTIMEOUT;
+        }
+
+        // Back off once the device has stretched for a while:
+        if ((elapsed_ns >= CLOCK_STRETCHING_SPIN_NS) &&
+            (step_ns < CLOCK_STRETCHING_MAX_STEP_NS)) {
+            step_ns *= 2;
+        }
+
+        if (precise && (step_ns > elapsed_ns / 8)) {
+            step_ns = (elapsed_ns / 8 > CLOCK_STRETCHING_POLL_NS) ?
+                      elapsed_ns / 8 : CLOCK_STRETCHING_POLL_NS;
+        }
+
+        if (step_ns > timeout_ns - elapsed_ns) {
+            step_ns = timeout_ns - elapsed_ns;
+        }
+
+        slept |= wait_or_sleep_ns(bus, step_ns);
+        waited_ns += step_ns;
+    }
+
+    *stretch_ns = stretch_elapsed_ns(bus, start_ns, waited_ns);
+
+    record_stretch(bus, *stretch_ns, slept);
+
+    return 0;
+}
+
+// Add a check of a clock pulse (stretch_ns 0 if it was not stretched) to a
+// profile. The wait predicted is the shortest stretch seen; longer stretches
+// only raise it gradually so that waiting up front rarely overshoots
+static void record_profile(struct stretch_profile *profile,
+                           long long stretch_ns) {
+    struct pi_i2c_stretch_profile *stats = &profile->stats;
+
+    int ns = clamp_ns(stretch_ns);
+
+    stats->num_samples++;
+    stats->last_stretch_ns = ns;
+
+    if (ns > 0) {
+        stats->num_stretched++;
+        stats->total_stretch_ns += ns;
+
+        if ((stats->num_stretched == 1) || (ns < stats->min_stretch_ns)) {
+            stats->min_stretch_ns = ns;
+        }
+
+        if (ns > stats->max_stretch_ns) {
+            stats->max_stretch_ns = ns;
+        }
+    }
+
+    if ((stats->num_samples == 1) || (ns < stats->predicted_ns)) {
+        stats->predicted_ns = ns;
+    } else {
+        stats->predicted_ns += (ns - stats->predicted_ns) / 8;
+    }
+
+    profile->n_predicted = 0;
+}
+
+// Wait for a device holding SCL low after it was released (and had time to
+// rise). Returns 1 if the device stretched the clock, 0 if it did not, or
+// -ECLKTIMEOUT.
+int wait_out_clock_stretching(struct pi_i2c_bus *bus) {
+    long long stretch_ns;
+
+    int ret;
 
     // Check if SCL line has actually gone high after it was released; if not,
     // device has requested clock stretching:
-    if (!(gpio_read_level(scl_gpio_pin))) {
+    if (read_scl(bus)) {
+        return 0;
+    }
+
+    // Keep track of statistics for any caller interested in those
+    // kind of numbers:
+    bus->statistics.num_clock_stretch++;
+
+    if ((ret = poll_clock_stretching(bus, 0, 0, 0, &stretch_ns)) < 0) {
+        return ret;
+    }
+
+    return 1;
+}
+
+// Wait out clock stretching at a point of a message (I2C_PHASE_*) and add
+// it to the profile of the device addressed. Returns 1 if the device
+// stretched the clock (or was waited for up front), 0 if it did not, or
+// -ECLKTIMEOUT.
+//
+// Once learned (I2C_STRETCH_LEARNED), a device known to stretch the clock
+// at this point is waited for up front for the predicted time and SCL is
+// read once to confirm the device let go of it; only longer stretches fall
+// back to polling. Every CLOCK_STRETCHING_REFRESH predicted waits the device
+// is polled instead so that the profile keeps up with the device.
+int wait_out_profiled_stretching(struct pi_i2c_bus *bus, unsigned int phase,
+                                 int learned) {
+    // Definitions:
+    struct stretch_profile *profile =
+        &bus->stretch_profiles[bus->device_address][phase];
+
+    long long predicted_ns = profile->stats.predicted_ns;
+    long long stretch_ns;
+
+    int slept;
+    int ret;
+
+    if (learned && (predicted_ns > 0) &&
+        (profile->stats.num_samples >= CLOCK_STRETCHING_LEARN_SAMPLES) &&
+        (profile->n_predicted < CLOCK_STRETCHING_REFRESH)) {
+        profile->n_predicted++;
+
+        slept = wait_or_sleep_ns(bus, predicted_ns);
+
         // Keep track of statistics for any caller interested in those
         // kind of numbers:
-        statistics.num_clock_stretch++;
+        bus->statistics.num_clock_stretch++;
 
-        // Wait for SCL to go high within the timeout period; if it goes
-        // high, then device is ready for controller to continue.
-        while ((clock_stretching_elapsed_us < CLOCK_STRETCHING_TIMEOUT_US)) {
-            // Wait for device to release SCL line:
-            microsleep_hard(clock_stretching_sleep_us);
+        if (read_scl(bus)) {
+            bus->statistics.num_predicted_stretches++;
+            record_stretch(bus, predicted_ns, slept);
 
-            // If SCL line has been released then controller can continue:
-            if (gpio_read_level(scl_gpio_pin)) {
-                return 0;
-            }
+            return 1;
+        }
+
+        bus->statistics.num_mispredicted_stretches++;
 
-            // Continue clock stretching:
-            clock_stretching_elapsed_us += (clock_stretching_sleep_us);
+        if ((ret = poll_clock_stretching(bus, predicted_ns, slept, 1,
+                                         &stretch_ns)) < 0) {
+            return ret;
         }
 
-        // Device has not responded within the timeout!
+        record_profile(profile, stretch_ns);
 
-        // Keep track of statistics for any caller interested in those
-        // kind of numbers:
-        statistics.num_clock_stretching_timeouts++;
+        return 1;
+    }
+
+    if (read_scl(bus)) {
+        record_profile(profile, 0);
+
+        return 0;
+    }
+
+    // Keep track of statistics for any caller interested in those
+    // kind of numbers:
+    bus->statistics.num_clock_stretch++;
+
+    if ((ret = poll_clock_stretching(bus, 0, 0, learned, &stretch_ns)) < 0) {
+        return ret;
+    }
+
+    record_profile(profile, stretch_ns);
+
+    return 1;
+}
+
+// Support UM10204 I2C-bus specification 3.1.9 before breaking another device
+int support_clock_stretching(struct pi_i2c_bus *bus) {
+    int ret;
+
+    // Implement a wait to avoid a false positive SCL stuck low:
+    wait_ns(bus, bus->scl_response_time_ns);
+
+    if ((ret = wait_out_clock_stretching(bus)) < 0) {
+        return ret;
+    }
+
+    return 0;
+}
+
+// Write every profile with at least one check to a text file, one line per
+// device and phase
+int export_stretch_profiles(struct pi_i2c_bus *bus, const char *path) {
+    // Definitions:
+    const struct pi_i2c_stretch_profile *stats;
+
+    FILE *file;
+
+    int address;
+    int phase;
+
+    if ((file = fopen(path, "w")) == NULL) {
+        return -errno;
+    }
+
+    fprintf(file, "# pi_i2c stretch profiles: address phase samples "
+                  "stretched min_ns max_ns last_ns predicted_ns total_ns\n");
+
+    for (address = 0; address < 128; address++) {
+        for (phase = 0; phase < I2C_N_PHASES; phase++) {
+            stats = &bus->stretch_profiles[address][phase].stats;
+
+            if (stats->num_samples == 0) {
+                continue;
+            }
+
+            fprintf(file, "0x%02X %s %lld %lld %d %d %d %d %lld\n", address,
+                    phase_names[phase], stats->num_samples,
+                    stats->num_stretched, stats->min_stretch_ns,
+                    stats->max_stretch_ns, stats->last_stretch_ns,
+                    stats->predicted_ns, stats->total_stretch_ns);
+        }
+    }
 
-        return -ECLKTIMEOUT;
+    if (fclose(file) != 0) {
+        return -errno;
     }
 
     return 0;
@@ -21,5 +21,9 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 // ============================================================================
 
-// Support clock stretching function prototype:
-int support_clock_stretching(void);
\ No newline at end of file
+// Support clock stretching function prototypes:
+int support_clock_stretching(struct pi_i2c_bus *bus);
+int wait_out_clock_stretching(struct pi_i2c_bus *bus);
+int wait_out_profiled_stretching(struct pi_i2c_bus *bus, unsigned int phase,
+                                 int learned);
+int export_stretch_profiles(struct pi_i2c_bus *bus, const char *path);
\ No newline at end of file
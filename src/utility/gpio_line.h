@@ -0,0 +1,161 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+
+// Open-drain line control through the GPIO backend chosen at config time.
+// Clearing a line pulls it low; releasing it lets the pull-up take it high.
+// Kept inline as these sit on the per-bit hot path (requires config.h).
+//
+// The bus keeps a shadow of what the controller drove onto the lines so
+// that reading back a state the controller itself just set up can be left
+// out (see skip_read_lines()).
+
+// Line levels as returned by read_lines():
+#define SDA_LEVEL 0x1
+#define SCL_LEVEL 0x2
+#define BUS_IDLE (SDA_LEVEL | SCL_LEVEL)
+
+static inline void clear_sda(struct pi_i2c_bus *bus) {
+    bus->backend->clear_line(bus->backend_ctx, bus->sda_gpio_pin);
+    bus->driven_lines &= ~SDA_LEVEL;
+    bus->idle_verified = 0;
+}
+
+static inline void clear_scl(struct pi_i2c_bus *bus) {
+    bus->backend->clear_line(bus->backend_ctx, bus->scl_gpio_pin);
+    bus->driven_lines &= ~SCL_LEVEL;
+    bus->idle_verified = 0;
+}
+
+static inline void release_sda(struct pi_i2c_bus *bus) {
+    bus->backend->release_line(bus->backend_ctx, bus->sda_gpio_pin);
+    bus->driven_lines |= SDA_LEVEL;
+}
+
+static inline void release_scl(struct pi_i2c_bus *bus) {
+    bus->backend->release_line(bus->backend_ctx, bus->scl_gpio_pin);
+    bus->driven_lines |= SCL_LEVEL;
+}
+
+// A line the backend fails to read is taken as released so that nothing
+// waits on it, and the error is kept for take_line_error() to return in
+// place of whatever that level would otherwise have meant:
+static inline int line_read_failed(struct pi_i2c_bus *bus, int ret,
+                                   int released) {
+    bus->line_error = ret;
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    bus->statistics.num_line_errors++;
+    bus->statistics.last_line_error = ret;
+
+    return released;
+}
+
+// Return and clear the error of a failed line read (0 if none):
+static inline int take_line_error(struct pi_i2c_bus *bus) {
+    int ret = bus->line_error;
+
+    bus->line_error = 0;
+
+    return ret;
+}
+
+static inline int read_sda(struct pi_i2c_bus *bus) {
+    int level = bus->backend->read_line(bus->backend_ctx,
+                                        bus->sda_gpio_pin);
+
+    return (level < 0) ? line_read_failed(bus, level, 1) : level;
+}
+
+static inline int read_scl(struct pi_i2c_bus *bus) {
+    int level = bus->backend->read_line(bus->backend_ctx,
+                                        bus->scl_gpio_pin);
+
+    return (level < 0) ? line_read_failed(bus, level, 1) : level;
+}
+
+static inline void wait_us(struct pi_i2c_bus *bus, unsigned int us) {
+    bus->backend->delay_us(bus->backend_ctx, us);
+}
+
+// Wait yielding the CPU, where the backend supports it:
+static inline void sleep_us(struct pi_i2c_bus *bus, unsigned int us) {
+    if (bus->backend->sleep_us != NULL) {
+        bus->backend->sleep_us(bus->backend_ctx, us);
+    } else {
+        bus->backend->delay_us(bus->backend_ctx, us);
+    }
+}
+
+// Backends without nano second delays round up to whole micro seconds:
+static inline void wait_ns(struct pi_i2c_bus *bus, unsigned int ns) {
+    if (bus->backend->delay_ns != NULL) {
+        bus->backend->delay_ns(bus->backend_ctx, ns);
+    } else {
+        bus->backend->delay_us(bus->backend_ctx, (ns + 999) / 1000);
+    }
+}
+
+// Backend clock used for deadline timing (requires now_ns()):
+static inline long long now_ns(struct pi_i2c_bus *bus) {
+    return bus->backend->now_ns(bus->backend_ctx);
+}
+
+// Wait for an absolute deadline on the backend clock (requires
+// delay_until_ns()). Returns how late the deadline was reached:
+static inline long long wait_until_ns(struct pi_i2c_bus *bus,
+                                      long long deadline_ns) {
+    return bus->backend->delay_until_ns(bus->backend_ctx, deadline_ns);
+}
+
+// Read both lines, in a single backend access where supported. Seeing both
+// high while the controller has released them verifies the bus IDLE:
+static inline int read_lines(struct pi_i2c_bus *bus) {
+    int lines;
+
+    if (bus->backend->read_lines != NULL) {
+        lines = bus->backend->read_lines(bus->backend_ctx);
+
+        if (lines < 0) {
+            lines = line_read_failed(bus, lines, BUS_IDLE);
+        }
+    } else {
+        lines = read_sda(bus) | (read_scl(bus) << 1);
+    }
+
+    // Lines that could not be read verify nothing:
+    if ((lines == BUS_IDLE) && (bus->driven_lines == BUS_IDLE) &&
+        (bus->line_error == 0)) {
+        bus->idle_verified = 1;
+    }
+
+    return lines;
+}
+
+// Count a read_lines() left out as the shadow already tells the result:
+static inline void skip_read_lines(struct pi_i2c_bus *bus) {
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    bus->statistics.num_line_reads_avoided +=
+        (bus->backend->read_lines != NULL) ? 1 : 2;
+}
@@ -0,0 +1,162 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+
+// Bounded lock-free ring of request indices (D. Vyukov's bounded MPMC
+// queue). Any number of threads may push and pop at the same time. Each
+// slot carries a sequence number saying whether it is ready to be written
+// (sequence == position) or read (sequence == position + 1), so a push or
+// pop is a single compare-and-swap on the ring position once the slot is
+// ready. Kept inline as these sit on the submission and completion paths.
+
+// Include C standard libraries:
+#include <stdlib.h>    // C Standard library (slot allocation)
+#include <errno.h>     // C Standard for error conditions
+#include <stdatomic.h> // C Standard atomic operations
+
+struct ring_slot {
+    atomic_uint sequence;
+    unsigned int value;
+};
+
+struct ring {
+    struct ring_slot *slots;
+    unsigned int mask; // Capacity - 1 (capacity is a power of two)
+
+    // Positions kept on cache lines of their own so that producers and
+    // consumers do not keep stealing them from each other:
+    _Alignas(64) atomic_uint push_position;
+    _Alignas(64) atomic_uint pop_position;
+};
+
+// Allocate an empty ring holding at least capacity values. Returns -ENOMEM
+// on error
+static inline int init_ring(struct ring *ring, unsigned int capacity) {
+    unsigned int size = 1;
+    unsigned int i;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    if ((ring->slots = malloc(size * sizeof(*ring->slots))) == NULL) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < size; i++) {
+        atomic_init(&ring->slots[i].sequence, i);
+    }
+
+    ring->mask = size - 1;
+
+    atomic_init(&ring->push_position, 0);
+    atomic_init(&ring->pop_position, 0);
+
+    return 0;
+}
+
+static inline void free_ring(struct ring *ring) {
+    free(ring->slots);
+}
+
+// Append a value. Returns 0, or -EAGAIN if the ring is full
+static inline int push_ring(struct ring *ring, unsigned int value) {
+    struct ring_slot *slot;
+
+    unsigned int position;
+    unsigned int sequence;
+
+    position = atomic_load_explicit(&ring->push_position,
+                                    memory_order_relaxed);
+
+    while (1) {
+        slot = &ring->slots[position & ring->mask];
+        sequence = atomic_load_explicit(&slot->sequence,
+                                        memory_order_acquire);
+
+        if (sequence == position) {
+            // Slot is free; claim it (position is reloaded on failure):
+            if (atomic_compare_exchange_weak_explicit(
+                    &ring->push_position, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if ((int) (sequence - position) < 0) {
+            // Slot still holds a value from a lap ago:
+            return -EAGAIN;
+        } else {
+            position = atomic_load_explicit(&ring->push_position,
+                                            memory_order_relaxed);
+        }
+    }
+
+    slot->value = value;
+    atomic_store_explicit(&slot->sequence, position + 1,
+                          memory_order_release);
+
+    return 0;
+}
+
+// Take the oldest value. Returns 0, or -EAGAIN if the ring is empty
+static inline int pop_ring(struct ring *ring, unsigned int *value) {
+    struct ring_slot *slot;
+
+    unsigned int position;
+    unsigned int sequence;
+
+    position = atomic_load_explicit(&ring->pop_position,
+                                    memory_order_relaxed);
+
+    while (1) {
+        slot = &ring->slots[position & ring->mask];
+        sequence = atomic_load_explicit(&slot->sequence,
+                                        memory_order_acquire);
+
+        if (sequence == position + 1) {
+            // Slot holds a value; claim it:
+            if (atomic_compare_exchange_weak_explicit(
+                    &ring->pop_position, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if ((int) (sequence - (position + 1)) < 0) {
+            // Nothing pushed into the slot yet:
+            return -EAGAIN;
+        } else {
+            position = atomic_load_explicit(&ring->pop_position,
+                                            memory_order_relaxed);
+        }
+    }
+
+    *value = slot->value;
+    atomic_store_explicit(&slot->sequence, position + ring->mask + 1,
+                          memory_order_release);
+
+    return 0;
+}
+
+// Whether a value has been pushed that is not popped yet. Only a snapshot
+// while other threads use the ring
+static inline int ring_empty(struct ring *ring) {
+    return atomic_load(&ring->push_position) ==
+           atomic_load(&ring->pop_position);
+}
@@ -0,0 +1,158 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Calibrated nano second spin delays
+//
+// I2C phases at 400 kHz and above last a few hundred nano seconds, well below
+// the 1 us resolution of a hard microsleep. Delays are instead spent busy
+// waiting on CLOCK_MONOTONIC, ending one clock read early since the last read
+// lands after the deadline. Delays too short to measure with the clock
+// (a couple of clock reads) are counted out with a spin loop instead. The
+// cost of a clock read and the speed of the spin loop are calibrated once per
+// process when the first bus is configured.
+
+// Include C standard libraries:
+#include <time.h>   // C Standard get and manipulate time library
+#include <limits.h> // C Standard sizes of integer types
+
+// Include C POSIX libraries:
+#include <pthread.h> // POSIX threads (one-time calibration)
+
+// Include header files:
+#include "spin_delay.h"               // Spin delay function protos
+
+#define CALIBRATION_RUNS 5        // Keep the best run (least preempted)
+#define CALIBRATION_CLOCK_READS 1000
+#define CALIBRATION_LOOPS 100000
+
+// Delays shorter than this many clock reads are spun out in loops:
+#define SHORT_DELAY_CLOCK_READS 2
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+
+static long long clock_read_ns = 0;             // Cost of one clock read
+static unsigned long long loops_per_ns_q16 = 0; // Spin loops per nano second
+                                                // (16.16 fixed point)
+
+static inline long long monotonic_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static inline void spin_loops(unsigned long long loops) {
+    volatile unsigned long long i;
+
+    for (i = 0; i < loops; i++) {
+    }
+}
+
+static void calibrate(void) {
+    long long start;
+    long long elapsed;
+    long long best;
+
+    int run;
+    int i;
+
+    // Cost of reading the clock:
+    best = LLONG_MAX;
+
+    for (run = 0; run < CALIBRATION_RUNS; run++) {
+        start = monotonic_ns();
+
+        for (i = 0; i < CALIBRATION_CLOCK_READS; i++) {
+            monotonic_ns();
+        }
+
+        if ((elapsed = monotonic_ns() - start) < best) {
+            best = elapsed;
+        }
+    }
+
+    clock_read_ns = best / CALIBRATION_CLOCK_READS;
+
+    // Speed of the spin loop:
+    best = LLONG_MAX;
+
+    for (run = 0; run < CALIBRATION_RUNS; run++) {
+        start = monotonic_ns();
+
+        spin_loops(CALIBRATION_LOOPS);
+
+        if ((elapsed = monotonic_ns() - start) < best) {
+            best = elapsed;
+        }
+    }
+
+    if (best < 1) {
+        best = 1;
+    }
+
+    loops_per_ns_q16 = ((unsigned long long) CALIBRATION_LOOPS << 16) / best;
+}
+
+// Calibrate spin delays (only done the first time this is called)
+void calibrate_spin_delay(void) {
+    pthread_once(&calibrate_once, calibrate);
+}
+
+// Busy wait for the given number of nano seconds
+void spin_delay_ns(unsigned int ns) {
+    long long deadline;
+
+    if (ns < SHORT_DELAY_CLOCK_READS * clock_read_ns) {
+        spin_loops((ns * loops_per_ns_q16) >> 16);
+        return;
+    }
+
+    deadline = monotonic_ns() + ns - clock_read_ns;
+
+    while (monotonic_ns() < deadline) {
+    }
+}
+
+// Current time on the monotonic clock spin delays run on [nano seconds]
+long long spin_clock_ns(void) {
+    return monotonic_ns();
+}
+
+// Busy wait until the monotonic clock reaches deadline_ns. Returns how late
+// the caller already was (0 if the deadline had not yet passed)
+long long spin_until_ns(long long deadline_ns) {
+    long long now = monotonic_ns();
+
+    if (now >= deadline_ns) {
+        return now - deadline_ns;
+    }
+
+    // The last read lands after the deadline:
+    deadline_ns -= clock_read_ns;
+
+    while (monotonic_ns() < deadline_ns) {
+    }
+
+    return 0;
+}
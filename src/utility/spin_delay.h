@@ -21,7 +21,8 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 // ============================================================================
 
-// Write function prototypes:
-int write_byte_to_bus(int byte);
-int write_address_frame_to_bus(int device_address, int write_flag);
-int write_data_frame_to_bus(int data);
\ No newline at end of file
+// Spin delay function prototypes:
+void calibrate_spin_delay(void);
+void spin_delay_ns(unsigned int ns);
+long long spin_clock_ns(void);
+long long spin_until_ns(long long deadline_ns);
@@ -0,0 +1,695 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+//
+// Transaction waveform compiler
+//
+// Rather than working out every bit while driving the bus, a whole message
+// (START, address frame, register, data, repeated START and STOP including
+// the ACK sample points) is first compiled into a flat array of line
+// changes, delays and sample points. Everything known up front is settled
+// at compile time: bit values of written bytes, delays, which frame a NACK
+// refers to, and writes that would not change a line (e.g. SDA staying low
+// across consecutive 0 bits) are left out. run_waveform() then executes the
+// array in one tight loop.
+//
+// Every step carries the delay that follows it so waits cost no extra
+// dispatch. Example: writing bit 1 then bit 1 compiles to
+//
+//     RELEASE_SDA + t_low,  RELEASE_SCL_STRETCH + t_high,  CLEAR_SCL + t_low,
+//                           RELEASE_SCL_STRETCH + t_high,  CLEAR_SCL
+
+// Include C standard libraries:
+#include <stdlib.h> // C Standard library (program allocation)
+#include <limits.h> // C Standard sizes of integer types
+#include <errno.h>  // C Standard for error conditions
+
+// Include header files:
+#include "pi_i2c.h"                   // Speed grade, macros, and outward
+                                      // function prototypes.
+#include "config.h"                   // I2C timing and variable defs
+#include "detect_recover_bus.h"       // Detect and recover I2C bus
+#include "clock_stretching.h"         // Support clock stretching
+#include "gpio_line.h"                // Open-drain line control
+#include "waveform.h"                 // Waveform compiler function protos
+
+// Step operations:
+#define WAVEFORM_CLEAR_SDA 0
+#define WAVEFORM_RELEASE_SDA 1
+#define WAVEFORM_CLEAR_SCL 2
+#define WAVEFORM_RELEASE_SCL 3
+#define WAVEFORM_RELEASE_SCL_STRETCH 4 // Release SCL, wait out stretching
+#define WAVEFORM_NOP 5                 // Nothing but the delay
+#define WAVEFORM_READ_BIT 6            // Shift SDA into the byte being read
+#define WAVEFORM_READ_DONE 7           // Store byte read at data[arg]
+#define WAVEFORM_ACK 8                 // Sample ACK of written byte
+#define WAVEFORM_ABORT_ON_NACK 9       // Jump to STOP if that ACK failed
+#define WAVEFORM_CHECK_START 10        // Verify START (arg 1 if repeated)
+#define WAVEFORM_CHECK_STOP 11         // Verify STOP and recover bus
+#define WAVEFORM_SET_DEVICE 12         // Device addressed from here on
+#define WAVEFORM_END_MESSAGE 13        // Return; batches run on from here
+
+// More steps than a single byte or condition compiles to:
+#define WAVEFORM_MAX_BYTE_STEPS 64
+
+// Make room for another n steps; failures are reported by run_waveform()
+static int reserve_steps(struct waveform *program, unsigned int n) {
+    struct waveform_step *steps;
+    unsigned int capacity;
+
+    if (program->n_steps + n <= program->capacity) {
+        return 0;
+    }
+
+    capacity = (program->capacity != 0) ? program->capacity * 2 : 256;
+
+    while (capacity < program->n_steps + n) {
+        capacity *= 2;
+    }
+
+    if ((steps = realloc(program->steps,
+                         capacity * sizeof(*steps))) == NULL) {
+        program->error = 1;
+        return -ENOMEM;
+    }
+
+    program->steps = steps;
+    program->capacity = capacity;
+
+    return 0;
+}
+
+static inline void add_step(struct waveform *program, unsigned int op,
+                            unsigned int arg) {
+    struct waveform_step *step = &program->steps[program->n_steps++];
+
+    step->op = op;
+    step->arg = arg;
+    step->delay_ns = 0;
+}
+
+// Waits are folded into the step before them. Only a wait heading a program
+// or the STOP condition (a NACK jump target) needs a step of its own:
+static void add_wait(struct waveform *program, int ns) {
+    if (ns <= 0) {
+        return;
+    }
+
+    if ((program->n_steps == 0) ||
+        (program->n_steps == program->stop_step)) {
+        add_step(program, WAVEFORM_NOP, 0);
+    }
+
+    program->steps[program->n_steps - 1].delay_ns += ns;
+}
+
+// Line writes that would leave a line where it already is are dropped:
+static void add_sda(struct waveform *program, int level) {
+    if (program->sda_level == level) {
+        return;
+    }
+
+    add_step(program, level ? WAVEFORM_RELEASE_SDA : WAVEFORM_CLEAR_SDA, 0);
+    program->sda_level = level;
+}
+
+static void add_scl(struct waveform *program, int level) {
+    if (program->scl_level == level) {
+        return;
+    }
+
+    add_step(program, level ? WAVEFORM_RELEASE_SCL : WAVEFORM_CLEAR_SCL, 0);
+    program->scl_level = level;
+}
+
+// Release SCL and wait out any device stretching the clock. The phase
+// (I2C_PHASE_*) says which profile the stretch is recorded in:
+static void add_scl_release_stretch(struct waveform *program,
+                                    unsigned int phase) {
+    if (program->scl_level == 1) {
+        return;
+    }
+
+    // Adhere to UM10204 I2C-bus specification 3.1.9:
+    add_step(program, WAVEFORM_RELEASE_SCL_STRETCH, phase);
+    program->scl_level = 1;
+}
+
+// Release SCL for a clock pulse (ack_phase is the I2C_PHASE_* of the byte
+// for its ACK/NACK pulse, I2C_PHASE_BIT otherwise). The stretch policy of
+// the device decides whether clock stretching is waited out: on every pulse,
+// only on the ACK pulse and whatever follows it (the next byte, repeated
+// START or STOP), or never. Pulses not checked still give SCL its rise time
+// but skip reading the line back:
+static void add_scl_release(struct pi_i2c_bus *bus, unsigned int ack_phase) {
+    struct waveform *program = &bus->waveform;
+
+    // Stretching is profiled on the release after an ACK (by the byte it
+    // follows); any other pulse counts as I2C_PHASE_BIT:
+    unsigned int phase = program->stretch_phase;
+    int stretch;
+
+    switch (program->stretch_policy) {
+    case I2C_STRETCH_NEVER:
+        stretch = 0;
+        break;
+    case I2C_STRETCH_ACK_ONLY:
+        stretch = (ack_phase != I2C_PHASE_BIT) || (phase != I2C_PHASE_BIT);
+        break;
+    default:
+        stretch = 1;
+        break;
+    }
+
+    program->stretch_phase = ack_phase;
+
+    if (stretch) {
+        add_scl_release_stretch(program, phase);
+    } else if (program->scl_level == 0) {
+        add_scl(program, 1);
+        add_wait(program, bus->scl_response_time_ns);
+    }
+}
+
+// One SCL pulse during which SDA is held (or sampled):
+static void add_clock_pulse(struct pi_i2c_bus *bus, unsigned int ack_phase) {
+    add_scl_release(bus, ack_phase);
+    add_wait(&bus->waveform, bus->scl_t_high_sleep_ns);
+}
+
+// Phase of the ACK pulse of a written byte
+static unsigned int phase_of_ack(unsigned int ack_kind) {
+    switch (ack_kind) {
+    case WAVEFORM_ACK_REGISTER:
+        return I2C_PHASE_REGISTER;
+    case WAVEFORM_ACK_READ_ADDRESS:
+        return I2C_PHASE_READ_ADDRESS;
+    case WAVEFORM_ACK_DATA:
+    case WAVEFORM_ACK_DATA_LAST:
+        return I2C_PHASE_WRITE_DATA;
+    default:
+        return I2C_PHASE_ADDRESS;
+    }
+}
+
+// Stretch policy of a device
+static int stretch_policy(struct pi_i2c_bus *bus,
+                          unsigned int device_address) {
+    int policy = bus->device_stretch_policy[device_address];
+
+    if (policy == I2C_STRETCH_DEFAULT) {
+        policy = bus->stretch_policy;
+    }
+
+    return (policy == I2C_STRETCH_DEFAULT) ? I2C_STRETCH_EVERY_BIT : policy;
+}
+
+// Start a new program. Messages always begin from an IDLE bus (both lines
+// released) as the caller first writes a STOP condition
+void begin_waveform(struct pi_i2c_bus *bus) {
+    struct waveform *program = &bus->waveform;
+
+    program->n_steps = 0;
+    program->stop_step = UINT_MAX;
+    program->message_step = 0;
+    program->run_step = 0;
+    program->sda_level = 1;
+    program->scl_level = 1;
+    program->stretch_policy = stretch_policy(bus, bus->device_address);
+    program->stretch_phase = I2C_PHASE_BIT;
+    program->error = 0;
+}
+
+// Address another device from here on (messages combining segments to
+// several devices). Its stretch policy applies to the clock pulses that
+// follow and clock stretching is handled as its own once running
+void add_device_to_waveform(struct pi_i2c_bus *bus,
+                            unsigned int device_address) {
+    struct waveform *program = &bus->waveform;
+
+    if (reserve_steps(program, WAVEFORM_MAX_BYTE_STEPS) < 0) {
+        return;
+    }
+
+    program->stretch_policy = stretch_policy(bus, device_address);
+
+    add_step(program, WAVEFORM_SET_DEVICE, device_address);
+}
+
+// START condition: SDA falls while SCL is high (bus busy)
+void add_start_to_waveform(struct pi_i2c_bus *bus) {
+    struct waveform *program = &bus->waveform;
+
+    if (reserve_steps(program, WAVEFORM_MAX_BYTE_STEPS) < 0) {
+        return;
+    }
+
+    program->message_step = program->n_steps;
+
+    add_sda(program, 0);
+    add_wait(program, bus->min_t_hdsta_sleep_ns);
+    add_scl(program, 0);
+    add_wait(program, bus->scl_t_low_sleep_ns);
+
+    add_step(program, WAVEFORM_CHECK_START, 0);
+}
+
+// Repeated START: release both lines without producing a STOP, then START
+void add_repeated_start_to_waveform(struct pi_i2c_bus *bus) {
+    struct waveform *program = &bus->waveform;
+
+    if (reserve_steps(program, WAVEFORM_MAX_BYTE_STEPS) < 0) {
+        return;
+    }
+
+    // Set SDA line first as to not produce a STOP condition accidentally. A
+    // device may still be stretching the clock after the last ACK:
+    add_sda(program, 1);
+    add_scl_release(bus, I2C_PHASE_BIT);
+    add_wait(program, bus->min_t_susta_sleep_ns);
+
+    add_sda(program, 0);
+    add_wait(program, bus->min_t_hdsta_sleep_ns);
+    add_scl(program, 0);
+    add_wait(program, bus->scl_t_low_sleep_ns);
+
+    add_step(program, WAVEFORM_CHECK_START, 1);
+}
+
+// Write a byte MSB first and sample the device's ACK. A NACK ends the
+// message with a STOP condition and the error matching ack_kind
+void add_write_byte_to_waveform(struct pi_i2c_bus *bus, int byte,
+                                unsigned int ack_kind) {
+    struct waveform *program = &bus->waveform;
+
+    int i;
+
+    if (reserve_steps(program, WAVEFORM_MAX_BYTE_STEPS) < 0) {
+        return;
+    }
+
+    for (i = 7; i >= 0; i--) {
+        // Change SDA right after the previous clock pulse:
+        add_sda(program, (byte >> i) & 0x1);
+        add_wait(program, bus->scl_t_low_sleep_ns);
+
+        add_clock_pulse(bus, I2C_PHASE_BIT);
+        add_scl(program, 0);
+    }
+
+    // Release SDA line so that device can ACK or NACK data transfer:
+    add_sda(program, 1);
+    add_wait(program, bus->scl_t_low_sleep_ns);
+
+    add_scl_release(bus, phase_of_ack(ack_kind));
+    add_step(program, WAVEFORM_ACK, ack_kind);
+    add_wait(program, bus->scl_t_high_sleep_ns);
+    add_scl(program, 0);
+
+    // Reclaim SDA line as device is done using it:
+    add_sda(program, 0);
+
+    if (ack_kind != WAVEFORM_ACK_PROBE) {
+        add_step(program, WAVEFORM_ABORT_ON_NACK, 0);
+    }
+}
+
+// Read a byte MSB first into data[index] then ACK (more to come) or NACK
+// (last byte)
+void add_read_byte_to_waveform(struct pi_i2c_bus *bus, unsigned int index,
+                               int ack_flag) {
+    struct waveform *program = &bus->waveform;
+
+    int i;
+
+    if (reserve_steps(program, WAVEFORM_MAX_BYTE_STEPS) < 0) {
+        return;
+    }
+
+    // Release SDA line for the device to use:
+    add_sda(program, 1);
+
+    for (i = 7; i >= 0; i--) {
+        add_clock_pulse(bus, I2C_PHASE_BIT);
+        add_step(program, WAVEFORM_READ_BIT, 0);
+        add_scl(program, 0);
+        add_wait(program, bus->scl_t_low_sleep_ns);
+    }
+
+    // Device must have released SDA by now:
+    add_step(program, WAVEFORM_READ_DONE, index);
+
+    // ACK by clearing SDA line; NACK by leaving it released:
+    if (ack_flag) {
+        add_sda(program, 0);
+    }
+
+    add_clock_pulse(bus, I2C_PHASE_READ_DATA);
+    add_scl(program, 0);
+    add_wait(program, bus->scl_t_low_sleep_ns);
+
+    // After a NACK clear SDA so that a STOP condition can be generated:
+    add_sda(program, 0);
+}
+
+// STOP condition: SDA rises while SCL is high (bus idle). NACKs of the
+// message jump here
+void add_stop_to_waveform(struct pi_i2c_bus *bus) {
+    struct waveform *program = &bus->waveform;
+
+    unsigned int i;
+
+    if (reserve_steps(program, WAVEFORM_MAX_BYTE_STEPS) < 0) {
+        return;
+    }
+
+    program->stop_step = program->n_steps;
+
+    for (i = program->message_step; i < program->n_steps; i++) {
+        if (program->steps[i].op == WAVEFORM_ABORT_ON_NACK) {
+            program->steps[i].arg = program->stop_step;
+        }
+    }
+
+    // A device may still be stretching the clock after the last ACK:
+    add_scl_release(bus, I2C_PHASE_BIT);
+    add_wait(program, bus->min_t_susto_sleep_ns);
+    add_sda(program, 1);
+    add_wait(program, bus->min_t_buf_sleep_ns);
+
+    add_step(program, WAVEFORM_CHECK_STOP, 0);
+}
+
+// Whole register read (START to STOP): address frame, register address,
+// repeated START (required prior to reading off data), address frame again
+// and the data read into data[0] to data[n_bytes - 1]. Only NACK if it is
+// the last byte to be read
+void add_read_message_to_waveform(struct pi_i2c_bus *bus,
+                                  unsigned int device_address,
+                                  unsigned int register_address,
+                                  unsigned int n_bytes) {
+    unsigned int i;
+
+    add_start_to_waveform(bus);
+    add_write_byte_to_waveform(bus, (device_address << 1) | WRITE_FLAG,
+                               WAVEFORM_ACK_ADDRESS);
+    add_write_byte_to_waveform(bus, register_address, WAVEFORM_ACK_REGISTER);
+    add_repeated_start_to_waveform(bus);
+    add_write_byte_to_waveform(bus, (device_address << 1) | READ_FLAG,
+                               WAVEFORM_ACK_READ_ADDRESS);
+
+    for (i = 0; i < n_bytes; i++) {
+        add_read_byte_to_waveform(bus, i, i != (n_bytes - 1));
+    }
+
+    // Complete message by transition the bus to IDLE:
+    add_stop_to_waveform(bus);
+}
+
+// Whole register write (START to STOP): address frame, register address and
+// data. A NACK anywhere ends the message early with the STOP condition
+void add_write_message_to_waveform(struct pi_i2c_bus *bus,
+                                   unsigned int device_address,
+                                   unsigned int register_address,
+                                   const uint8_t *data, unsigned int n_bytes) {
+    unsigned int i;
+
+    add_start_to_waveform(bus);
+    add_write_byte_to_waveform(bus, (device_address << 1) | WRITE_FLAG,
+                               WAVEFORM_ACK_ADDRESS);
+    add_write_byte_to_waveform(bus, register_address, WAVEFORM_ACK_REGISTER);
+
+    for (i = 0; i < n_bytes; i++) {
+        add_write_byte_to_waveform(bus, data[i], WAVEFORM_ACK_DATA);
+    }
+
+    add_stop_to_waveform(bus);
+}
+
+// End one message of a batch: run_waveform() returns its status here and
+// is called again to run the next message
+void add_end_message_to_waveform(struct pi_i2c_bus *bus) {
+    struct waveform *program = &bus->waveform;
+
+    if (reserve_steps(program, 1) < 0) {
+        return;
+    }
+
+    add_step(program, WAVEFORM_END_MESSAGE, 0);
+}
+
+// Record a NACK of a written byte and return the error it stands for
+static int nack_error(struct pi_i2c_bus *bus, unsigned int ack_kind) {
+    // Keep track of statistics for any caller interested in those
+    // kind of numbers:
+    switch (ack_kind) {
+    case WAVEFORM_ACK_ADDRESS:
+        bus->statistics.num_nack++;
+        return -ENACK;
+    case WAVEFORM_ACK_REGISTER:
+        bus->statistics.num_bad_reg++;
+        return -EBADREGADDR;
+    case WAVEFORM_ACK_READ_ADDRESS:
+        bus->statistics.num_nack_rst++;
+        return -ENACKRST;
+    case WAVEFORM_ACK_DATA:
+        bus->statistics.num_badxfr++;
+        return -EBADXFR;
+    default:
+        return NACK;
+    }
+}
+
+// Wait for the deadline of the next edge and record how late the host got
+// there (deadline timing)
+static inline void wait_for_deadline(struct pi_i2c_bus *bus,
+                                     long long deadline_ns) {
+    long long lateness_ns;
+
+    int ns;
+
+    if ((lateness_ns = wait_until_ns(bus, deadline_ns)) <= 0) {
+        return;
+    }
+
+    ns = (lateness_ns > INT_MAX) ? INT_MAX : (int) lateness_ns;
+
+    // Keep track of statistics for any caller interested in those kind of
+    // numbers:
+    bus->statistics.num_late_edges++;
+
+    if (ns > bus->statistics.max_edge_lateness_ns) {
+        bus->statistics.max_edge_lateness_ns = ns;
+    }
+
+    if (ns > bus->statistics.last_edge_lateness_ns) {
+        bus->statistics.last_edge_lateness_ns = ns;
+    }
+}
+
+// Execute the compiled program, storing bytes read into data. Returns 0,
+// NACK for a scan probe nobody answered, or a negative error number.
+//
+// Programs run from bus->waveform.run_step (0 unless set by the caller) up
+// to their end or the end of the message there (batches).
+//
+// With relative timing each step's delay is slept after the step, so the time
+// spent in backend calls adds to every clock period. With deadline timing
+// every edge is instead given a deadline counted from the start of the
+// transaction; time spent in backend calls comes out of the delays and only
+// edges the host could not reach in time are late.
+static int run_steps(struct pi_i2c_bus *bus, uint8_t *data) {
+    // Definitions:
+    const struct waveform_step *steps = bus->waveform.steps;
+    const struct waveform_step *step;
+    const struct waveform_step *end;
+
+    int deadline_timing = (bus->timing_mode == I2C_TIMING_DEADLINE);
+    int learned = (stretch_policy(bus, bus->device_address) ==
+                   I2C_STRETCH_LEARNED);
+    int idle_verified = bus->idle_verified;
+    long long deadline_ns = 0;
+
+    int byte = 0;
+    int status = 0;
+    int ret;
+
+    if (bus->waveform.error) {
+        return -ENOMEM;
+    }
+
+    end = steps + bus->waveform.n_steps;
+    step = steps + bus->waveform.run_step;
+
+    if (deadline_timing) {
+        bus->statistics.last_edge_lateness_ns = 0;
+        deadline_ns = now_ns(bus);
+    }
+
+    for (; step < end; step++) {
+        switch (step->op) {
+        case WAVEFORM_CLEAR_SDA:
+            clear_sda(bus);
+            break;
+        case WAVEFORM_RELEASE_SDA:
+            release_sda(bus);
+            break;
+        case WAVEFORM_CLEAR_SCL:
+            clear_scl(bus);
+            break;
+        case WAVEFORM_RELEASE_SCL:
+            release_scl(bus);
+            break;
+        case WAVEFORM_RELEASE_SCL_STRETCH:
+            release_scl(bus);
+
+            // Adhere to UM10204 I2C-bus specification 3.1.9. SCL has until
+            // its own deadline to rise with deadline timing:
+            if (deadline_timing) {
+                deadline_ns += bus->scl_response_time_ns;
+                wait_for_deadline(bus, deadline_ns);
+            } else {
+                wait_ns(bus, bus->scl_response_time_ns);
+            }
+
+            // A clock stretching time out ends the message right away as
+            // the device needs to be power cycled:
+            if ((ret = wait_out_profiled_stretching(bus, step->arg,
+                                                    learned)) < 0) {
+                return ret;
+            }
+
+            // A device stretching the clock pushes back every edge after
+            // it:
+            if (deadline_timing && (ret > 0)) {
+                deadline_ns = now_ns(bus);
+            }
+            break;
+        case WAVEFORM_NOP:
+            break;
+        case WAVEFORM_READ_BIT:
+            byte = (byte << 1) | read_sda(bus);
+            break;
+        case WAVEFORM_READ_DONE:
+            // If the SDA line has not yet been released then we assume
+            // that the device is unresponsive; consider it a bad transfer:
+            if (!(read_sda(bus))) {
+                return -EBADXFR;
+            }
+
+            data[step->arg] = byte;
+            byte = 0;
+
+            // Keep track of statistics for any caller interested in those
+            // kind of numbers:
+            bus->statistics.num_bytes_read++;
+            break;
+        case WAVEFORM_ACK:
+            // Determine if device ACK'd data transfer by reading pin value
+            //     ACK = 1: NACK
+            //     ACK = 0: ACK
+            if (read_sda(bus) && (step->arg != WAVEFORM_ACK_DATA_LAST)) {
+                status = nack_error(bus, step->arg);
+            } else if ((step->arg == WAVEFORM_ACK_DATA) ||
+                       (step->arg == WAVEFORM_ACK_DATA_LAST)) {
+                // Keep track of statistics for any caller interested in
+                // those kind of numbers:
+                bus->statistics.num_bytes_written++;
+            }
+            break;
+        case WAVEFORM_ABORT_ON_NACK:
+            // Continue at the message's STOP condition (the loop steps
+            // onto it):
+            if (status < 0) {
+                step = steps + step->arg - 1;
+                continue;
+            }
+            break;
+        case WAVEFORM_CHECK_START:
+            // The controller drives both lines low for a START so reading
+            // them back only tells something new on a bus that was not
+            // verified IDLE right before. A repeated START always follows
+            // a START that was checked:
+            if (step->arg || idle_verified) {
+                skip_read_lines(bus);
+            } else if (read_lines(bus) == BUS_IDLE) {
+                // START condition was not actually written to the bus!
+
+                // Keep track of statistics for any caller interested in
+                // those kind of numbers:
+                bus->statistics.num_failed_start_cond++;
+
+                return -EFAILSTCOND;
+            }
+
+            // Keep track of statistics for any caller interested in those
+            // kind of numbers:
+            bus->statistics.num_start_cond++;
+            bus->statistics.num_repeated_start_cond += step->arg;
+            break;
+        case WAVEFORM_SET_DEVICE:
+            bus->device_address = step->arg;
+            learned = (stretch_policy(bus, step->arg) ==
+                       I2C_STRETCH_LEARNED);
+            break;
+        case WAVEFORM_END_MESSAGE:
+            bus->waveform.run_step = step - steps + 1;
+            return status;
+        case WAVEFORM_CHECK_STOP:
+            // Detect if bus is not IDLE and attempt to recover the bus:
+            if ((ret = detect_recover_bus(bus)) < 0) {
+                // Keep track of statistics for any caller interested in
+                // those kind of numbers:
+                bus->statistics.num_failed_stop_cond++;
+
+                return ret;
+            }
+
+            // Keep track of statistics for any caller interested in those
+            // kind of numbers:
+            bus->statistics.num_stop_cond++;
+            break;
+        }
+
+        if (step->delay_ns == 0) {
+            continue;
+        }
+
+        if (deadline_timing) {
+            deadline_ns += step->delay_ns;
+            wait_for_deadline(bus, deadline_ns);
+        } else {
+            wait_ns(bus, step->delay_ns);
+        }
+    }
+
+    return status;
+}
+
+// Execute the compiled program (see run_steps()). A line the backend failed
+// to read fails the program with the backend's error rather than whatever
+// the level taken in its place led to
+int run_waveform(struct pi_i2c_bus *bus, uint8_t *data) {
+    int ret = run_steps(bus, data);
+
+    return (bus->line_error != 0) ? take_line_error(bus) : ret;
+}
@@ -0,0 +1,52 @@
+// Inter-Integrated Circuit (I2C) Library for the Raspberry Pi
+//
+// Copyright (c) 2021 Benjamin Spencer
+// ============================================================================
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+// ============================================================================
+
+// Waveform compiler function prototypes (caller holds bus->lock):
+void begin_waveform(struct pi_i2c_bus *bus);
+void add_start_to_waveform(struct pi_i2c_bus *bus);
+void add_device_to_waveform(struct pi_i2c_bus *bus,
+                            unsigned int device_address);
+void add_repeated_start_to_waveform(struct pi_i2c_bus *bus);
+void add_write_byte_to_waveform(struct pi_i2c_bus *bus, int byte,
+                                unsigned int ack_kind);
+void add_read_byte_to_waveform(struct pi_i2c_bus *bus, unsigned int index,
+                               int ack_flag);
+void add_stop_to_waveform(struct pi_i2c_bus *bus);
+void add_read_message_to_waveform(struct pi_i2c_bus *bus,
+                                  unsigned int device_address,
+                                  unsigned int register_address,
+                                  unsigned int n_bytes);
+void add_write_message_to_waveform(struct pi_i2c_bus *bus,
+                                   unsigned int device_address,
+                                   unsigned int register_address,
+                                   const uint8_t *data, unsigned int n_bytes);
+void add_end_message_to_waveform(struct pi_i2c_bus *bus);
+int run_waveform(struct pi_i2c_bus *bus, uint8_t *data);
+
+// What a NACK of a written byte means (see add_write_byte_to_waveform()):
+#define WAVEFORM_ACK_ADDRESS 0      // Device address (ENACK)
+#define WAVEFORM_ACK_REGISTER 1     // Register address (EBADREGADDR)
+#define WAVEFORM_ACK_READ_ADDRESS 2 // Address after repeated START (ENACKRST)
+#define WAVEFORM_ACK_DATA 3         // Data byte (EBADXFR)
+#define WAVEFORM_ACK_PROBE 4        // Scan probe; recorded, not an error
+#define WAVEFORM_ACK_DATA_LAST 5    // Last data byte; NACK is not an error
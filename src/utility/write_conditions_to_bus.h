@@ -22,6 +22,4 @@
 // ============================================================================
 
 // Condition write function prototypes:
-int write_start_condition_to_bus(void);
-int write_stop_condition_to_bus(void);
-int write_repeated_start_condition_to_bus(void);
\ No newline at end of file
+int write_stop_condition_to_bus(struct pi_i2c_bus *bus);
\ No newline at end of file
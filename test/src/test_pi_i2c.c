@@ -25,6 +25,10 @@
 #include <stdlib.h> // C Standard library
 #include <stdio.h>  // C Standard I/O libary
 #include <time.h>   // C Standard date and time manipulation
+#include <errno.h>  // C Standard errors
+
+#include <pthread.h> // POSIX threads (concurrent reads)
+#include <unistd.h>  // POSIX usleep
 
 #include <pi_i2c.h> // Pi I2C library!
 
@@ -57,6 +61,36 @@ void test_scan_bus_i2c(void) {
     printf("Test complete\n");
 }
 
+// Test scanning the unreserved addresses with chained probes
+void test_scan_range_i2c(void) {
+    int ret;
+    unsigned int address;
+
+    // Address map returned by function:
+    unsigned long long address_map[I2C_ADDRESS_MAP_WORDS];
+
+    printf("Testing scan_range_i2c()\n");
+
+    if ((ret = scan_range_i2c(0x00, 0x7F, NULL, I2C_SCAN_WRITE,
+                              address_map)) < 0) {
+        printf("Error! scan_range_i2c() returned %d\n\n", ret);
+        return;
+    }
+
+    printf("scan_range_i2c() has returned %d in %lld ns\n", ret,
+           get_statistics_i2c().last_scan_ns);
+
+    printf("Following address have been detected: \n");
+
+    for (address = 0; address < 128; address++) {
+        if (I2C_ADDRESS_PRESENT(address_map, address)) {
+            printf("0x%X\n", address);
+        }
+    }
+
+    printf("Test complete\n");
+}
+
 // Test I2C write capability
 void test_write_i2c_one_byte(int device_address, int register_address,
                              int *data, int n_bytes) {
@@ -118,6 +152,31 @@ void test_read_i2c_one_byte(int device_address, int register_address,
     printf("Test complete\n");
 }
 
+// Test I2C read capability into a byte buffer
+void test_read_bytes_i2c(int device_address, int register_address,
+                         int n_bytes) {
+    uint8_t data[n_bytes];
+
+    int i;
+    int ret;
+
+    printf("Testing read_bytes_i2c()\n");
+    printf("device_address = 0x%X\n", device_address);
+    printf("register_address = 0x%X\n", register_address);
+    printf("n_bytes = %d\n", n_bytes);
+
+    // Read the bytes straight into the byte buffer:
+    ret = read_bytes_i2c(device_address, register_address, data, n_bytes);
+
+    printf("read_bytes_i2c() has returned %d\n", ret);
+
+    for (i = 0; i < n_bytes; i++) {
+        printf("Byte %d read = 0x%X\n", i, data[i]);
+    }
+
+    printf("Test complete\n");
+}
+
 // Test I2C read capability over a number of iterations
 // to calculate success rate:
 void test_read_i2c_iterative(int device_address, int register_address,
@@ -167,6 +226,289 @@ void test_read_i2c_multiple_bytes(int device_address, int register_address,
     printf("Test complete\n");
 }
 
+// Test reading several registers in one transaction joined by repeated
+// STARTs:
+void test_transfer_i2c(int device_address, int *register_addresses,
+                       int n_registers) {
+    struct pi_i2c_msg msgs[I2C_MAX_MSGS];
+
+    int data[I2C_MAX_MSGS];
+
+    int i;
+    int ret;
+
+    printf("Testing transfer_i2c()\n");
+    printf("device_address = 0x%X\n", device_address);
+    printf("n_registers = %d\n", n_registers);
+
+    for (i = 0; i < n_registers; i++) {
+        msgs[i].device_address = device_address;
+        msgs[i].register_address = register_addresses[i];
+        msgs[i].flags = I2C_MSG_READ;
+        msgs[i].data = &data[i];
+        msgs[i].n_bytes = 1;
+    }
+
+    // Read one byte from every register with a single STOP:
+    ret = transfer_i2c(msgs, n_registers);
+
+    printf("transfer_i2c() has returned %d\n", ret);
+
+    for (i = 0; i < n_registers; i++) {
+        printf("Register 0x%X = 0x%X\n", register_addresses[i], data[i]);
+    }
+
+    printf("Test complete\n");
+}
+
+// Test running reads of several registers as a batch:
+void test_run_batch_i2c(int device_address, int *register_addresses,
+                        int n_registers) {
+    struct pi_i2c_batch *batch;
+    struct pi_i2c_batch_timing timing;
+
+    int data[16];
+
+    int i;
+    int ret;
+
+    printf("Testing run_batch_i2c()\n");
+    printf("device_address = 0x%X\n", device_address);
+    printf("n_registers = %d\n", n_registers);
+
+    if ((batch = create_batch_i2c()) == NULL) {
+        printf("create_batch_i2c() has failed\n");
+        return;
+    }
+
+    for (i = 0; i < n_registers; i++) {
+        add_read_batch_i2c(batch, device_address, register_addresses[i],
+                           &data[i], 1);
+    }
+
+    ret = run_batch_i2c(batch);
+    timing = get_timing_batch_i2c(batch);
+
+    printf("run_batch_i2c() has returned %d\n", ret);
+
+    for (i = 0; i < n_registers; i++) {
+        printf("Register 0x%X = 0x%X (status %d)\n", register_addresses[i],
+               data[i], get_status_batch_i2c(batch, i));
+    }
+
+    printf("elapsed_ns = %lld\n", timing.elapsed_ns);
+    printf("compile_ns = %lld\n", timing.compile_ns);
+    printf("num_transfers = %d\n", timing.num_transfers);
+    printf("num_failed = %d\n", timing.num_failed);
+    printf("num_bytes = %d\n", timing.num_bytes);
+
+    free_batch_i2c(batch);
+
+    printf("Test complete\n");
+}
+
+// Test reading several registers asynchronously on the default bus:
+void test_submit_async_i2c(int device_address, int *register_addresses,
+                           int n_registers) {
+    struct pi_i2c_async *async;
+    struct pi_i2c_async_statistics statistics;
+    struct pi_i2c_request *request;
+
+    int i;
+    int ret;
+
+    printf("Testing submit_async_i2c()\n");
+    printf("device_address = 0x%X\n", device_address);
+    printf("n_registers = %d\n", n_registers);
+
+    if ((async = create_async_i2c(n_registers, -1)) == NULL) {
+        printf("create_async_i2c() has failed\n");
+        return;
+    }
+
+    for (i = 0; i < n_registers; i++) {
+        request = get_request_async_i2c(async);
+        request->kind = I2C_ASYNC_READ;
+        request->device_address = device_address;
+        request->register_address = register_addresses[i];
+        request->n_bytes = 1;
+
+        if ((ret = submit_async_i2c(async, request)) < 0) {
+            printf("Error! submit_async_i2c() returned %d\n", ret);
+        }
+    }
+
+    for (i = 0; i < n_registers; i++) {
+        if ((request = wait_async_i2c(async, 1000)) == NULL) {
+            printf("Error! wait_async_i2c() timed out\n");
+            break;
+        }
+
+        printf("Register 0x%X = 0x%X (status %d, %lld ns)\n",
+               request->register_address, request->data[0],
+               request->status, request->complete_ns - request->submit_ns);
+
+        put_request_async_i2c(async, request);
+    }
+
+    statistics = get_statistics_async_i2c(async);
+
+    printf("num_submitted = %lld\n", statistics.num_submitted);
+    printf("num_completed = %lld\n", statistics.num_completed);
+    printf("max_queue_depth = %d\n", statistics.max_queue_depth);
+    printf("max_latency_ns = %lld\n", statistics.max_latency_ns);
+    printf("busy_ns = %lld\n", statistics.busy_ns);
+
+    free_async_i2c(async);
+
+    printf("Test complete\n");
+}
+
+// Test sampling a register at a fixed rate into a ring on the default bus:
+void test_start_sampler_i2c(int device_address, int register_address) {
+    struct pi_i2c_sampler *sampler;
+    struct pi_i2c_sampler_statistics statistics;
+
+    uint8_t samples[16];
+    long long timestamps_ns[16];
+
+    unsigned long long index;
+    unsigned long long i;
+
+    printf("Testing start_sampler_i2c()\n");
+    printf("device_address = 0x%X\n", device_address);
+    printf("register_address = 0x%X\n", register_address);
+
+    if ((sampler = start_sampler_i2c(device_address, register_address, 1,
+                                     100, samples, timestamps_ns, 16,
+                                     -1)) == NULL) {
+        printf("start_sampler_i2c() has failed\n");
+        return;
+    }
+
+    // A tenth of a second at 100 Hz:
+    usleep(100000);
+
+    index = get_index_sampler_i2c(sampler);
+
+    // The slot of sample index - 16 is being written into:
+    for (i = (index > 15) ? index - 15 : 0; i < index; i++) {
+        printf("Sample %llu = 0x%X at %lld ns\n", i, samples[i % 16],
+               timestamps_ns[i % 16]);
+    }
+
+    set_taken_sampler_i2c(sampler, index);
+
+    statistics = get_statistics_sampler_i2c(sampler);
+
+    printf("num_samples = %lld\n", statistics.num_samples);
+    printf("num_missed = %lld\n", statistics.num_missed);
+    printf("num_overwritten = %lld\n", statistics.num_overwritten);
+    printf("num_errors = %lld\n", statistics.num_errors);
+    printf("max_lateness_ns = %lld\n", statistics.max_lateness_ns);
+    printf("achieved_rate_hz = %f\n", statistics.achieved_rate_hz);
+
+    stop_sampler_i2c(sampler);
+
+    printf("Test complete\n");
+}
+
+// Register polled by both threads of test_read_coalescing_i2c():
+struct coalesce_poll {
+    int device_address;
+    int register_address;
+    int data;
+    int ret;
+};
+
+static void *poll_register(void *arg) {
+    struct coalesce_poll *poll = arg;
+
+    poll->ret = read_i2c(poll->device_address, poll->register_address,
+                         &poll->data, 1);
+
+    return NULL;
+}
+
+// Test two threads reading the same register with reads coalesced:
+void test_read_coalescing_i2c(int device_address, int register_address) {
+    struct coalesce_poll polls[2];
+    pthread_t threads[2];
+
+    int i;
+    int ret;
+
+    printf("Testing set_read_coalescing_i2c()\n");
+    printf("device_address = 0x%X\n", device_address);
+    printf("register_address = 0x%X\n", register_address);
+
+    if ((ret = set_read_coalescing_i2c(1)) < 0) {
+        printf("Error! set_read_coalescing_i2c() returned %d\n", ret);
+        return;
+    }
+
+    for (i = 0; i < 2; i++) {
+        polls[i].device_address = device_address;
+        polls[i].register_address = register_address;
+
+        pthread_create(&threads[i], NULL, poll_register, &polls[i]);
+    }
+
+    for (i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+
+        printf("Thread %d read 0x%X (returned %d)\n", i, polls[i].data,
+               polls[i].ret);
+    }
+
+    printf("get_coalesced_reads_i2c() has returned %d\n",
+           get_coalesced_reads_i2c(device_address, register_address, 1));
+
+    set_read_coalescing_i2c(0);
+
+    printf("Test complete\n");
+}
+
+// Test watching the default bus for devices coming and going:
+void test_watch_presence_i2c(int device_address) {
+    struct pi_i2c_presence_statistics statistics;
+    struct pi_i2c_presence *presence;
+
+    // Address map returned by function:
+    unsigned long long address_map[I2C_ADDRESS_MAP_WORDS];
+
+    int ret;
+
+    printf("Testing watch_presence_i2c()\n");
+    printf("device_address = 0x%X\n", device_address);
+
+    if ((presence = watch_presence_i2c(NULL, 4, 10000, NULL,
+                                       NULL)) == NULL) {
+        printf("Error! watch_presence_i2c() failed (errno %d)\n", errno);
+        return;
+    }
+
+    ret = get_map_presence_i2c(presence, address_map);
+
+    printf("get_map_presence_i2c() has returned %d\n", ret);
+    printf("Device 0x%X is %s\n", device_address,
+           I2C_ADDRESS_PRESENT(address_map, device_address) ?
+           "present" : "absent");
+
+    // Give the background refresh a full sweep of the bus:
+    usleep(500000);
+
+    statistics = get_statistics_presence_i2c(presence);
+
+    printf("%lld refreshes probed %lld addresses (%lld put off)\n",
+           statistics.num_refreshes, statistics.num_probes,
+           statistics.num_busy);
+
+    unwatch_presence_i2c(presence);
+
+    printf("Test complete\n");
+}
+
 void test_get_statistics_i2c(void) {
     printf("Testing get_statistics_i2c()\n");
 
@@ -193,6 +535,22 @@ void test_get_statistics_i2c(void) {
     printf("num_clock_stretching_timeouts = %d\n",
            statistics.num_clock_stretching_timeouts);
     printf("num_clock_stretch = %d\n", statistics.num_clock_stretch);
+    printf("num_late_edges = %d\n", statistics.num_late_edges);
+    printf("max_edge_lateness_ns = %d\n", statistics.max_edge_lateness_ns);
+    printf("last_edge_lateness_ns = %d\n",
+           statistics.last_edge_lateness_ns);
+    printf("num_clock_stretch_sleeps = %d\n",
+           statistics.num_clock_stretch_sleeps);
+    printf("last_clock_stretch_ns = %d\n", statistics.last_clock_stretch_ns);
+    printf("max_clock_stretch_ns = %d\n", statistics.max_clock_stretch_ns);
+    printf("total_clock_stretch_ns = %lld\n",
+           statistics.total_clock_stretch_ns);
+    printf("num_predicted_stretches = %d\n",
+           statistics.num_predicted_stretches);
+    printf("num_mispredicted_stretches = %d\n",
+           statistics.num_mispredicted_stretches);
+    printf("num_line_reads_avoided = %d\n",
+           statistics.num_line_reads_avoided);
     printf("Test complete\n");
 }
 
@@ -323,6 +681,165 @@ void test_get_configs_i2c(void) {
     printf("min_t_susta_sleep_us = %d\n", configs.min_t_susta_sleep_us);
     printf("min_t_susto_sleep_us = %d\n", configs.min_t_susto_sleep_us);
     printf("min_t_buf_sleep_us = %d\n", configs.min_t_buf_sleep_us);
+    printf("scl_t_low_sleep_ns = %d\n", configs.scl_t_low_sleep_ns);
+    printf("scl_t_high_sleep_ns = %d\n", configs.scl_t_high_sleep_ns);
+    printf("scl_response_time_ns = %d\n", configs.scl_response_time_ns);
+    printf("min_t_hdsta_sleep_ns = %d\n", configs.min_t_hdsta_sleep_ns);
+    printf("min_t_susta_sleep_ns = %d\n", configs.min_t_susta_sleep_ns);
+    printf("min_t_susto_sleep_ns = %d\n", configs.min_t_susto_sleep_ns);
+    printf("min_t_buf_sleep_ns = %d\n", configs.min_t_buf_sleep_ns);
+    printf("timing_mode = %d\n", configs.timing_mode);
+    printf("stretch_policy = %d\n", configs.stretch_policy);
+    printf("calibrated = %d\n", configs.calibrated);
+    printf("line_call_ns = %d\n", configs.line_call_ns);
+    printf("Test complete\n");
+}
+
+// Calibrate the default bus twice: the second run should come from the cache
+void test_calibrate_i2c(const char *cache_path) {
+    int i;
+    int ret;
+
+    struct timespec start;
+    struct timespec end;
+
+    double run_time;
+
+    printf("Testing calibrate_i2c()\n");
+
+    for (i = 0; i < 2; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = calibrate_i2c(cache_path);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        run_time = (((double) end.tv_sec + 1.0e-9 * end.tv_nsec) -
+                    ((double) start.tv_sec + 1.0e-9 * start.tv_nsec));
+
+        printf("calibrate_i2c() has returned %d in %4.3e seconds\n", ret,
+               run_time);
+    }
+
+    printf("Test complete\n");
+}
+
+// Test I2C read through a bus handle configured on the given pins
+void test_read_i2c_bus(int sda_pin, int scl_pin, int speed_grade,
+                       int device_address, int register_address,
+                       int *data, int n_bytes) {
+    int ret;
+
+    struct pi_i2c_bus *bus;
+
+    printf("Testing read_i2c_bus()\n");
+    printf("device_address = 0x%X\n", device_address);
+    printf("register_address = 0x%X\n", register_address);
+    printf("n_bytes = %d\n", n_bytes);
+
+    // Configure a bus handle separate from the default bus:
+    if ((bus = config_i2c_bus(sda_pin, scl_pin, speed_grade)) == NULL) {
+        printf("Error! config_i2c_bus() failed\n\n");
+        return;
+    }
+
+    // Read a byte from the device:
+    ret = read_i2c_bus(bus, device_address, register_address, data, n_bytes);
+
+    printf("read_i2c_bus() has returned %d\n", ret);
+    printf("Byte read = 0x%X\n", data[0]);
+    printf("num_bytes_read on bus = %d\n",
+           get_statistics_i2c_bus(bus).num_bytes_read);
+
+    free_i2c_bus(bus);
+
+    printf("Test complete\n");
+}
+
+// Test I2C read on a bus group of the one bus on the given pins, clocked
+// through the GPIO registers
+void test_read_bus_group_i2c(unsigned int sda_pin, unsigned int scl_pin,
+                             int speed_grade, int device_address,
+                             int register_address, int *data, int n_bytes) {
+    int ret;
+    int status;
+
+    struct pi_i2c_bus_group *group;
+    struct pi_i2c_bus_group_statistics statistics;
+
+    printf("Testing read_bus_group_i2c()\n");
+    printf("device_address = 0x%X\n", device_address);
+    printf("register_address = 0x%X\n", register_address);
+    printf("n_bytes = %d\n", n_bytes);
+
+    if ((group = create_bus_group_i2c(&sda_pin, &scl_pin, 1, speed_grade,
+                                      NULL)) == NULL) {
+        printf("Error! create_bus_group_i2c() failed\n\n");
+        return;
+    }
+
+    ret = read_bus_group_i2c(group, device_address, register_address, data,
+                             n_bytes, &status);
+
+    printf("read_bus_group_i2c() has returned %d (bus status %d)\n", ret,
+           status);
+    printf("Byte read = 0x%X\n", data[0]);
+
+    statistics = get_statistics_bus_group_i2c(group);
+
+    printf("num_register_stores = %lld\n", statistics.num_register_stores);
+    printf("num_level_reads = %lld\n", statistics.num_level_reads);
+
+    free_bus_group_i2c(group);
+
+    printf("Test complete\n");
+}
+
+// Test I2C write and read back through a kernel I2C adapter (/dev/i2c-N).
+// Without hardware load i2c-stub with a device at the given address:
+// modprobe i2c-stub chip_addr=0x1C
+void test_write_read_i2c_dev_bus(int adapter, int device_address,
+                                 int register_address) {
+    int ret;
+    int i;
+
+    int write_data[4] = {0xDE, 0xAD, 0xBE, 0xEF};
+    int read_data[4] = {0};
+
+    struct pi_i2c_bus *bus;
+    struct pi_i2c_statistics statistics;
+
+    printf("Testing config_i2c_dev_bus()\n");
+    printf("adapter = /dev/i2c-%d\n", adapter);
+    printf("device_address = 0x%X\n", device_address);
+    printf("register_address = 0x%X\n", register_address);
+
+    if ((bus = config_i2c_dev_bus(adapter)) == NULL) {
+        printf("Error! config_i2c_dev_bus() failed\n\n");
+        return;
+    }
+
+    ret = write_i2c_bus(bus, device_address, register_address, write_data, 4);
+    printf("write_i2c_bus() has returned %d\n", ret);
+
+    ret = read_i2c_bus(bus, device_address, register_address, read_data, 4);
+    printf("read_i2c_bus() has returned %d\n", ret);
+
+    for (i = 0; i < 4; i++) {
+        if (read_data[i] != write_data[i]) {
+            printf("Error! Byte %d read back as 0x%X (wrote 0x%X)\n", i,
+                   read_data[i], write_data[i]);
+        }
+    }
+
+    statistics = get_statistics_i2c_bus(bus);
+
+    printf("num_start_cond = %d\n", statistics.num_start_cond);
+    printf("num_repeated_start_cond = %d\n",
+           statistics.num_repeated_start_cond);
+    printf("num_bytes_written = %d\n", statistics.num_bytes_written);
+    printf("num_bytes_read = %d\n", statistics.num_bytes_read);
+
+    free_i2c_bus(bus);
+
     printf("Test complete\n");
 }
 
@@ -358,6 +875,15 @@ void main(void) {
     int read_bytes_multiple = 2;                 // UPDATE
     int read_data_multiple[read_bytes_multiple]; // UPDATE
 
+    int transfer_device_address = 0x1C;                      // UPDATE
+    int transfer_register_addresses[3] = {0x0F, 0x28, 0x29}; // UPDATE
+
+    int i2c_dev_adapter = 1;            // UPDATE
+    int i2c_dev_device_address = 0x1C;  // UPDATE
+    int i2c_dev_register_address = 0x0; // UPDATE
+
+    char *calibration_cache_path = "/tmp/pi_i2c_calibration"; // UPDATE
+
     printf("Begin pi_i2c_test.c\n");
 
     printf("Configuring pi_i2c:\n");
@@ -371,9 +897,16 @@ void main(void) {
     // Return back useful numbers to know:
     test_get_configs_i2c();
 
+    // Measure the lines and derive timings from them:
+    test_calibrate_i2c(calibration_cache_path);
+    test_get_configs_i2c();
+
     // Scan I2C bus and identify present devices:
     test_scan_bus_i2c();
 
+    // Scan again chaining the probes with repeated STARTs:
+    test_scan_range_i2c();
+
     // Test I2C write one-shot:
     test_write_i2c_one_byte(write_device_address, write_register_address,
                             write_data, write_bytes);
@@ -382,6 +915,10 @@ void main(void) {
     test_read_i2c_one_byte(read_device_address, read_register_address,
                            read_data, read_bytes);
 
+    // Test I2C read into a byte buffer:
+    test_read_bytes_i2c(read_device_address_multiple,
+                        read_register_address_multiple, read_bytes_multiple);
+
     // Test iterations of write to see success of consecutive writes:
     test_write_i2c_iterative(write_device_address,
                              write_register_address,
@@ -399,6 +936,26 @@ void main(void) {
                                  read_register_address_multiple,
                                  read_data_multiple, read_bytes_multiple);
 
+    // Test reading unrelated registers in one transaction:
+    test_transfer_i2c(transfer_device_address, transfer_register_addresses,
+                      3);
+
+    // Test reading the same registers as a batch:
+    test_run_batch_i2c(transfer_device_address, transfer_register_addresses,
+                       3);
+
+    // Test reading the same registers asynchronously:
+    test_submit_async_i2c(transfer_device_address,
+                          transfer_register_addresses, 3);
+
+    // Test sampling a register at a fixed rate:
+    test_start_sampler_i2c(read_device_address, read_register_address);
+
+    // Test two threads reading the same register at once:
+    test_read_coalescing_i2c(read_device_address, read_register_address);
+
+    // Test watching the bus for devices coming and going:
+    test_watch_presence_i2c(read_device_address);
 
     // Test reading multiple bytes to find useful data rate:
     speed_test_read_i2c(read_device_address_multiple,
@@ -415,4 +972,17 @@ void main(void) {
     // Test get statistics following all of the test calls:
     test_get_statistics_i2c();
 
+    // Test reading through a bus handle instead of the default bus:
+    test_read_i2c_bus(sda_pin, scl_pin, speed_grade, read_device_address,
+                      read_register_address, read_data, read_bytes);
+
+    // Test reading through the GPIO registers as a group of one bus:
+    test_read_bus_group_i2c(sda_pin, scl_pin, speed_grade,
+                            read_device_address, read_register_address,
+                            read_data, read_bytes);
+
+    // Test write and read back through a kernel I2C adapter:
+    test_write_read_i2c_dev_bus(i2c_dev_adapter, i2c_dev_device_address,
+                                i2c_dev_register_address);
+
 }